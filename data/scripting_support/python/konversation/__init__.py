@@ -8,5 +8,6 @@ public, stable scripting interface.
 Modules:
 dbus -- Interact with Konveration's D-Bus API.
 i18n -- Translation support.
+host -- Long-lived process running scripts on Konversation's behalf.
 
 """
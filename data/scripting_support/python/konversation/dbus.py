@@ -82,9 +82,16 @@ def _prefix(message, prefix):
 
 def _dispatch(*args):
 
-    """Dispatch to Konversation's D-Bus API."""
+    """
+    Dispatch to Konversation's D-Bus API, or queue the call when running
+    inside the script host (see the host module).
+
+    """
 
-    subprocess.call(_dbus_command + args)
+    if _host_commands is not None:
+        _host_commands.append(args)
+    else:
+        subprocess.call(_dbus_command + args)
 
 
 # Attributes
@@ -99,3 +106,6 @@ except IndexError:
 default_message_prefix = ''
 
 _dbus_command = ('qdbus', 'org.kde.konversation', '/irc')
+
+# Set to a list by the script host; calls are collected there instead.
+_host_commands = None
@@ -0,0 +1,133 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License as
+# published by the Free Software Foundation; either version 2 of
+# the License or (at your option) version 3 or any later version
+# accepted by the membership of KDE e.V. (or its successor appro-
+# ved by the membership of KDE e.V.), which shall act as a proxy
+# defined in Section 14 of version 3 of the license.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see http://www.gnu.org/licenses/.
+
+
+"""
+Runs Konversation scripts written in Python inside one long-lived process,
+instead of starting a new interpreter for each invocation.
+
+Konversation starts this module as 'python -m konversation.host <socket>' and
+sends script invocations over the local socket. Every message in either
+direction is a frame: a 32-bit big-endian payload length followed by the
+payload, UTF-8 encoded fields separated by NUL characters, the first field
+naming the frame type.
+
+Konversation -> host:
+run <connection> <target> <script path> [<argument> ...]
+
+Host -> Konversation, one frame per call made through the dbus module:
+say <connection> <target> <message>
+info <message>
+error <message>
+
+The calls a script makes are collected while it runs and sent together once
+it finished. Scripts run one at a time, in the order they were requested.
+
+This module is considered EXPERIMENTAL at this time and not part of the public,
+stable scripting interface.
+
+"""
+
+import os
+import runpy
+import socket
+import struct
+import sys
+import traceback
+from . import dbus
+
+
+def main():
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(sys.argv[1])
+    stream = sock.makefile('rb')
+
+    while True:
+        fields = _read_frame(stream)
+
+        if fields is None:
+            break
+
+        if fields[0] == 'run' and len(fields) >= 4:
+            sock.sendall(_run(*fields[1:]))
+
+def _run(connection, target, path, *args):
+
+    """Run one script and return the frames for the calls it made."""
+
+    commands = []
+
+    # A script may change the module's attributes, e.g. default_message_prefix,
+    # which must not carry over to the next one
+    saved_dbus = dict(vars(dbus))
+
+    dbus.connection = connection
+    dbus.target = target
+    dbus._host_commands = commands
+
+    saved_argv = sys.argv
+    saved_cwd = os.getcwd()
+
+    sys.argv = [path, connection, target] + list(args)
+
+    try:
+        os.chdir(os.path.dirname(path))
+        runpy.run_path(path, run_name='__main__')
+    except SystemExit:
+        pass
+    except Exception:
+        commands.append(('error', traceback.format_exc().splitlines()[-1]))
+    finally:
+        sys.argv = saved_argv
+        os.chdir(saved_cwd)
+        vars(dbus).clear()
+        vars(dbus).update(saved_dbus)
+
+    return b''.join(_frame(command) for command in commands)
+
+def _read_frame(stream):
+    header = stream.read(4)
+
+    if len(header) < 4:
+        return None
+
+    length, = struct.unpack('>I', header)
+    payload = stream.read(length)
+
+    if len(payload) < length:
+        return None
+
+    return payload.decode('utf-8').split('\0')
+
+def _frame(fields):
+    encoded = []
+
+    for field in fields:
+        if not isinstance(field, bytes):
+            field = field.encode('utf-8')
+
+        encoded.append(field)
+
+    payload = b'\0'.join(encoded)
+
+    return struct.pack('>I', len(payload)) + payload
+
+
+if __name__ == '__main__':
+    main()
@@ -19,6 +19,7 @@
 #include "transfermanager.h"
 #include "viewcontainer.h"
 #include "urlcatcher.h"
+#include "logindex.h"
 #include "highlight.h"
 #include "server.h"
 #include "sound.h"
@@ -31,6 +32,7 @@
 #include "images.h"
 #include "notificationhandler.h"
 #include "awaymanager.h"
+#include "autoreplacer.h"
 
 #include <QTextCodec>
 #include <QRegExp>
@@ -40,6 +42,7 @@
 #include <QStandardItemModel>
 #include <QFileInfo>
 #include <QTextCursor>
+#include <QTimer>
 
 #include <KRun>
 #include <KCmdLineArgs>
@@ -69,9 +72,28 @@ Application::Application()
     m_sound = 0;
     m_dccTransferManager = 0;
     m_notificationHandler = 0;
+    m_autoreplacer = 0;
     m_urlModel = 0;
+    m_logIndex = 0;
+
+    m_saveAllOptions = false;
+    m_saveUpdatesGUI = false;
+    m_nextServerIndex = 0;
+    m_nextChannelIndex = 0;
+
+    // Dialogs and D-Bus calls tend to change several things in a row
+    m_saveOptionsTimer = new QTimer(this);
+    m_saveOptionsTimer->setSingleShot(true);
+    m_saveOptionsTimer->setInterval(1000);
+    connect(m_saveOptionsTimer, SIGNAL(timeout()), this, SLOT(flushOptions()));
+
+    m_nextMultiServerSendId = 1;
+    m_multiServerSendTimer = new QTimer(this);
+    m_multiServerSendTimer->setInterval(500);
+    connect(m_multiServerSendTimer, SIGNAL(timeout()), this, SLOT(updateMultiServerSends()));
     dbusObject = 0;
     identDBus = 0;
+    m_eventDBus = 0;
 }
 
 Application::~Application()
@@ -164,7 +186,13 @@ int Application::newInstance()
         connect(Solid::Networking::notifier(), SIGNAL(shouldDisconnect()), m_connectionManager, SLOT(involuntaryQuitServers()));
         connect(Solid::Networking::notifier(), SIGNAL(shouldConnect()), m_connectionManager, SLOT(reconnectInvoluntary()));
 
+        // before any connection exists, events are posted from the start
+        m_eventDBus = new Konversation::EventDBus(this);
+
         m_scriptLauncher = new ScriptLauncher(this);
+        connect(m_scriptLauncher, SIGNAL(scriptSay(QString,QString,QString)),
+            this, SLOT(dbusSay(QString,QString,QString)));
+        connect(m_scriptLauncher, SIGNAL(scriptInfo(QString)), this, SLOT(dbusInfo(QString)));
 
         // an instance of DccTransferManager needs to be created before GUI class instances' creation.
         m_dccTransferManager = new DCC::TransferManager(this);
@@ -179,6 +207,10 @@ int Application::newInstance()
         osd = new OSDWidget( "Konversation" );
 
         Preferences::self();
+
+        // compiled autoreplace rules, rebuilt whenever the list in Preferences changes
+        m_autoreplacer = new Konversation::Autoreplacer(this);
+
         readOptions();
 
         // Images object providing LEDs, NickIcons
@@ -186,6 +218,9 @@ int Application::newInstance()
 
         m_urlModel = new QStandardItemModel(0, 3, this);
 
+        // built on first use by the log search panel
+        m_logIndex = new LogIndex(this);
+
         // Auto-alias scripts.  This adds any missing aliases
         QStringList aliasList(Preferences::self()->aliasList());
         const QStringList scripts(Preferences::defaultAliasList());
@@ -244,19 +279,20 @@ int Application::newInstance()
 
         if (openServerList) mainWindow->openServerList();
 
-        connect(this, SIGNAL(serverGroupsChanged(Konversation::ServerGroupSettingsPtr)), this, SLOT(saveOptions()));
+        connect(this, SIGNAL(serverGroupsChanged(Konversation::ServerGroupSettingsPtr)),
+            this, SLOT(serverGroupChanged(Konversation::ServerGroupSettingsPtr)));
 
         // prepare dbus interface
         dbusObject = new Konversation::DBus(this);
-        QDBusConnection::sessionBus().registerObject("/irc", dbusObject, QDBusConnection::ExportNonScriptableSlots);
+        QDBusConnection::sessionBus().registerObject("/irc", dbusObject,
+            QDBusConnection::ExportNonScriptableSlots | QDBusConnection::ExportScriptableSignals);
         identDBus = new Konversation::IdentDBus(this);
         QDBusConnection::sessionBus().registerObject("/identity", identDBus, QDBusConnection::ExportNonScriptableSlots);
+        QDBusConnection::sessionBus().registerObject("/events", m_eventDBus, QDBusConnection::ExportNonScriptableSlots);
         QDBusConnection::sessionBus().registerObject("/KIMIface", Konversation::Addressbook::self(), QDBusConnection::ExportNonScriptableSlots | QDBusConnection::ExportNonScriptableSignals);
 
         if (dbusObject)
         {
-            connect(dbusObject,SIGNAL (dbusMultiServerRaw(QString)),
-                this,SLOT (dbusMultiServerRaw(QString)) );
             connect(dbusObject,SIGNAL (dbusRaw(QString,QString)),
                 this,SLOT (dbusRaw(QString,QString)) );
             connect(dbusObject,SIGNAL (dbusSay(QString,QString,QString)),
@@ -334,11 +370,6 @@ void Application::showQueueTuner(bool p)
     getMainWindow()->getViewContainer()->showQueueTuner(p);
 }
 
-void Application::dbusMultiServerRaw(const QString &command)
-{
-    sendMultiServerCommand(command.section(' ', 0,0), command.section(' ', 1));
-}
-
 void Application::dbusRaw(const QString& connection, const QString &command)
 {
     Server* server = getConnectionManager()->getServerByName(connection, ConnectionManager::MatchByIdThenName);
@@ -377,6 +408,7 @@ void Application::readOptions()
 
     // Identity list
     QStringList identityList=KGlobal::config()->groupList().filter(QRegExp("Identity [0-9]+"));
+    m_identityGroups.clear();
     if (!identityList.isEmpty())
     {
         Preferences::clearIdentityList();
@@ -420,6 +452,7 @@ void Application::readOptions()
             newIdentity->setAwayNickname(cgIdentity.readEntry("AwayNick"));
 
             Preferences::addIdentity(newIdentity);
+            m_identityGroups.insert(newIdentity->id(), identityList[index]);
 
         }
 
@@ -453,6 +486,10 @@ void Application::readOptions()
     QMap<int,QStringList> notifyList;
     QList<int> sgKeys;
 
+    m_serverGroupGroups.clear();
+    m_nextServerIndex = nextFreeIndex("Server");
+    m_nextChannelIndex = nextFreeIndex("Channel");
+
     if(!groups.isEmpty())
     {
         Konversation::ServerGroupHash serverGroups;
@@ -525,6 +562,7 @@ void Application::readOptions()
 
             serverGroups.insert(serverGroup->id(), serverGroup);
             sgKeys.append(serverGroup->id());
+            m_serverGroupGroups.insert(serverGroup->id(), *it);
 
             index++;
         }
@@ -749,35 +787,14 @@ void Application::saveOptions(bool updateGUI)
     IdentityList identityList = Preferences::identityList();
     int index = 0;
 
+    m_identityGroups.clear();
+
     for (IdentityList::ConstIterator it = identityList.constBegin(); it != identityList.constEnd(); ++it)
     {
-        IdentityPtr identity = (*it);
-        KConfigGroup cgIdentity(KGlobal::config()->group(QString("Identity %1").arg(index)));
-
-        cgIdentity.writeEntry("Name",identity->getName());
-        cgIdentity.writeEntry("Ident",identity->getIdent());
-        cgIdentity.writeEntry("Realname",identity->getRealName());
-        cgIdentity.writeEntry("Nicknames",identity->getNicknameList());
-        cgIdentity.writeEntry("AuthType",identity->getAuthType());
-        cgIdentity.writeEntry("Password",identity->getAuthPassword());
-        cgIdentity.writeEntry("Bot",identity->getNickservNickname());
-        cgIdentity.writeEntry("NickservCommand",identity->getNickservCommand());
-        cgIdentity.writeEntry("SaslAccount",identity->getSaslAccount());
-        cgIdentity.writeEntry("PemClientCertFile", identity->getPemClientCertFile());
-        cgIdentity.writeEntry("InsertRememberLineOnAway", identity->getInsertRememberLineOnAway());
-        cgIdentity.writeEntry("ShowAwayMessage",identity->getRunAwayCommands());
-        cgIdentity.writeEntry("AwayMessage",identity->getAwayCommand());
-        cgIdentity.writeEntry("ReturnMessage",identity->getReturnCommand());
-        cgIdentity.writeEntry("AutomaticAway", identity->getAutomaticAway());
-        cgIdentity.writeEntry("AwayInactivity", identity->getAwayInactivity());
-        cgIdentity.writeEntry("AutomaticUnaway", identity->getAutomaticUnaway());
-        cgIdentity.writeEntry("QuitReason",identity->getQuitReason());
-        cgIdentity.writeEntry("PartReason",identity->getPartReason());
-        cgIdentity.writeEntry("KickReason",identity->getKickReason());
-        cgIdentity.writeEntry("PreShellCommand",identity->getShellCommand());
-        cgIdentity.writeEntry("Codec",identity->getCodecName());
-        cgIdentity.writeEntry("AwayReason",identity->getAwayMessage());
-        cgIdentity.writeEntry("AwayNick", identity->getAwayNickname());
+        QString groupName = QString("Identity %1").arg(index);
+        KConfigGroup cgIdentity(KGlobal::config()->group(groupName));
+        writeIdentity(cgIdentity, *it);
+        m_identityGroups.insert((*it)->id(), groupName);
         index++;
     } // endfor
 
@@ -838,78 +855,25 @@ void Application::saveOptions(bool updateGUI)
     for(int i=0; i<keys.count(); i++)
         if(width < keys.at(i)) width = keys.at(i);
     width = QString(width).length();
-    QString groupName;
-    QStringList servers;
-    Konversation::ServerList::iterator it2;
-    Konversation::ServerList serverlist;
-    Konversation::ChannelList channelList;
-    Konversation::ChannelList::iterator it3;
-    QStringList channels;
-    QStringList channelHistory;
     QList<int> sgKeys;
 
+    m_serverGroupGroups.clear();
+
     while(it.hasNext())
     {
         it.next();
-        serverlist = (it.value())->serverList();
-        servers.clear();
 
         sgKeys.append(it.value()->id());
 
-        for(it2 = serverlist.begin(); it2 != serverlist.end(); ++it2)
-        {
-            groupName = QString("Server %1").arg(index2);
-            servers.append(groupName);
-            KConfigGroup cgServer(KGlobal::config()->group(groupName));
-            cgServer.writeEntry("Server", (*it2).host());
-            cgServer.writeEntry("Port", (*it2).port());
-            cgServer.writeEntry("Password", (*it2).password());
-            cgServer.writeEntry("SSLEnabled", (*it2).SSLEnabled());
-            index2++;
-        }
-
-        channelList = it.value()->channelList();
-        channels.clear();
-
-        for(it3 = channelList.begin(); it3 != channelList.end(); ++it3)
-        {
-            groupName = QString("Channel %1").arg(index3);
-            channels.append(groupName);
-            KConfigGroup cgChannel(KGlobal::config()->group(groupName));
-            cgChannel.writeEntry("Name", (*it3).name());
-            cgChannel.writeEntry("Password", (*it3).password());
-            index3++;
-        }
-
-        channelList = it.value()->channelHistory();
-        channelHistory.clear();
-
-        for(it3 = channelList.begin(); it3 != channelList.end(); ++it3)
-        {   // TODO FIXME: is it just me or is this broken?
-            groupName = QString("Channel %1").arg(index3);
-            channelHistory.append(groupName);
-            KConfigGroup cgChannelHistory(KGlobal::config()->group(groupName));
-            cgChannelHistory.writeEntry("Name", (*it3).name());
-            cgChannelHistory.writeEntry("Password", (*it3).password());
-            cgChannelHistory.writeEntry("EnableNotifications", (*it3).enableNotifications());
-            index3++;
-        }
-
         QString sgn = QString("ServerGroup %1").arg(QString::number(index).rightJustified(width,'0'));
-        KConfigGroup cgServerGroup(KGlobal::config()->group(sgn));
-        cgServerGroup.writeEntry("Name", it.value()->name());
-        cgServerGroup.writeEntry("Identity", it.value()->identity()->getName());
-        cgServerGroup.writeEntry("ServerList", servers);
-        cgServerGroup.writeEntry("AutoJoinChannels", channels);
-        cgServerGroup.writeEntry("ConnectCommands", it.value()->connectCommands());
-        cgServerGroup.writeEntry("AutoConnect", it.value()->autoConnectEnabled());
-        cgServerGroup.writeEntry("ChannelHistory", channelHistory);
-        cgServerGroup.writeEntry("EnableNotifications", it.value()->enableNotifications());
-        cgServerGroup.writeEntry("Expanded", it.value()->expanded());
-        cgServerGroup.writeEntry("NotifyList",Preferences::notifyStringByGroupId(it.value()->id()));
+        writeServerGroup(sgn, it.value(), index2, index3);
+        m_serverGroupGroups.insert(it.value()->id(), sgn);
         index++;
     }
 
+    m_nextServerIndex = index2;
+    m_nextChannelIndex = index3;
+
     KGlobal::config()->deleteGroup("Server List");
 
     // Ignore List
@@ -991,10 +955,210 @@ void Application::saveOptions(bool updateGUI)
 
     KGlobal::config()->sync();
 
+    // Everything pending is written now
+    m_saveOptionsTimer->stop();
+    m_saveAllOptions = false;
+    m_saveUpdatesGUI = false;
+    m_dirtyIdentities.clear();
+    m_dirtyServerGroups.clear();
+
     if(updateGUI)
         emit appearanceChanged();
 }
 
+void Application::scheduleSaveOptions(bool updateGUI)
+{
+    m_saveAllOptions = true;
+    m_saveUpdatesGUI |= updateGUI;
+    m_saveOptionsTimer->start();
+}
+
+void Application::saveIdentity(int identityId, bool updateGUI)
+{
+    m_dirtyIdentities.insert(identityId);
+    m_saveUpdatesGUI |= updateGUI;
+    m_saveOptionsTimer->start();
+}
+
+void Application::saveServerGroup(int serverGroupId, bool updateGUI)
+{
+    m_dirtyServerGroups.insert(serverGroupId);
+    m_saveUpdatesGUI |= updateGUI;
+    m_saveOptionsTimer->start();
+}
+
+void Application::serverGroupChanged(const Konversation::ServerGroupSettingsPtr serverGroup)
+{
+    // Groups that were added, removed or reordered change the numbering
+    if (serverGroup && m_serverGroupGroups.contains(serverGroup->id()))
+        saveServerGroup(serverGroup->id());
+    else
+        scheduleSaveOptions();
+}
+
+void Application::flushOptions()
+{
+    // Preferences::identityById() falls back to the first identity, look
+    // them up here so a removed one is noticed.
+    QHash<int, IdentityPtr> identities;
+
+    foreach (const IdentityPtr& identity, Preferences::identityList())
+        identities.insert(identity->id(), identity);
+
+    // An identity or server group that isn't in the config yet needs the
+    // numbering of the full save.
+    foreach (int id, m_dirtyIdentities)
+    {
+        if (!m_identityGroups.contains(id) || !identities.contains(id))
+            m_saveAllOptions = true;
+    }
+
+    foreach (int id, m_dirtyServerGroups)
+    {
+        if (!m_serverGroupGroups.contains(id) || !Preferences::serverGroupById(id))
+            m_saveAllOptions = true;
+    }
+
+    if (m_saveAllOptions)
+    {
+        saveOptions(m_saveUpdatesGUI);
+
+        return;
+    }
+
+    foreach (int id, m_dirtyIdentities)
+    {
+        KConfigGroup cgIdentity(KGlobal::config()->group(m_identityGroups.value(id)));
+        writeIdentity(cgIdentity, identities.value(id));
+    }
+
+    foreach (int id, m_dirtyServerGroups)
+    {
+        const QString groupName = m_serverGroupGroups.value(id);
+
+        // The server and channel groups are renumbered, drop the old ones
+        KConfigGroup cgServerGroup(KGlobal::config()->group(groupName));
+        QStringList oldGroups = cgServerGroup.readEntry("ServerList", QStringList());
+        oldGroups += cgServerGroup.readEntry("AutoJoinChannels", QStringList());
+        oldGroups += cgServerGroup.readEntry("ChannelHistory", QStringList());
+
+        foreach (const QString& oldGroup, oldGroups)
+            KGlobal::config()->deleteGroup(oldGroup);
+
+        writeServerGroup(groupName, Preferences::serverGroupById(id), m_nextServerIndex, m_nextChannelIndex);
+    }
+
+    KGlobal::config()->sync();
+
+    bool updateGUI = m_saveUpdatesGUI;
+
+    m_saveUpdatesGUI = false;
+    m_dirtyIdentities.clear();
+    m_dirtyServerGroups.clear();
+
+    if (updateGUI)
+        emit appearanceChanged();
+}
+
+void Application::writeIdentity(KConfigGroup& cgIdentity, IdentityPtr identity)
+{
+    cgIdentity.writeEntry("Name",identity->getName());
+    cgIdentity.writeEntry("Ident",identity->getIdent());
+    cgIdentity.writeEntry("Realname",identity->getRealName());
+    cgIdentity.writeEntry("Nicknames",identity->getNicknameList());
+    cgIdentity.writeEntry("AuthType",identity->getAuthType());
+    cgIdentity.writeEntry("Password",identity->getAuthPassword());
+    cgIdentity.writeEntry("Bot",identity->getNickservNickname());
+    cgIdentity.writeEntry("NickservCommand",identity->getNickservCommand());
+    cgIdentity.writeEntry("SaslAccount",identity->getSaslAccount());
+    cgIdentity.writeEntry("PemClientCertFile", identity->getPemClientCertFile());
+    cgIdentity.writeEntry("InsertRememberLineOnAway", identity->getInsertRememberLineOnAway());
+    cgIdentity.writeEntry("ShowAwayMessage",identity->getRunAwayCommands());
+    cgIdentity.writeEntry("AwayMessage",identity->getAwayCommand());
+    cgIdentity.writeEntry("ReturnMessage",identity->getReturnCommand());
+    cgIdentity.writeEntry("AutomaticAway", identity->getAutomaticAway());
+    cgIdentity.writeEntry("AwayInactivity", identity->getAwayInactivity());
+    cgIdentity.writeEntry("AutomaticUnaway", identity->getAutomaticUnaway());
+    cgIdentity.writeEntry("QuitReason",identity->getQuitReason());
+    cgIdentity.writeEntry("PartReason",identity->getPartReason());
+    cgIdentity.writeEntry("KickReason",identity->getKickReason());
+    cgIdentity.writeEntry("PreShellCommand",identity->getShellCommand());
+    cgIdentity.writeEntry("Codec",identity->getCodecName());
+    cgIdentity.writeEntry("AwayReason",identity->getAwayMessage());
+    cgIdentity.writeEntry("AwayNick", identity->getAwayNickname());
+}
+
+void Application::writeServerGroup(const QString& groupName, Konversation::ServerGroupSettingsPtr serverGroup,
+    int& serverIndex, int& channelIndex)
+{
+    QString subGroupName;
+    QStringList servers;
+    QStringList channels;
+    QStringList channelHistory;
+
+    Konversation::ServerList serverList = serverGroup->serverList();
+
+    for (Konversation::ServerList::iterator it = serverList.begin(); it != serverList.end(); ++it)
+    {
+        subGroupName = QString("Server %1").arg(serverIndex);
+        servers.append(subGroupName);
+        KConfigGroup cgServer(KGlobal::config()->group(subGroupName));
+        cgServer.writeEntry("Server", (*it).host());
+        cgServer.writeEntry("Port", (*it).port());
+        cgServer.writeEntry("Password", (*it).password());
+        cgServer.writeEntry("SSLEnabled", (*it).SSLEnabled());
+        serverIndex++;
+    }
+
+    Konversation::ChannelList channelList = serverGroup->channelList();
+
+    for (Konversation::ChannelList::iterator it = channelList.begin(); it != channelList.end(); ++it)
+    {
+        subGroupName = QString("Channel %1").arg(channelIndex);
+        channels.append(subGroupName);
+        KConfigGroup cgChannel(KGlobal::config()->group(subGroupName));
+        cgChannel.writeEntry("Name", (*it).name());
+        cgChannel.writeEntry("Password", (*it).password());
+        channelIndex++;
+    }
+
+    channelList = serverGroup->channelHistory();
+
+    for (Konversation::ChannelList::iterator it = channelList.begin(); it != channelList.end(); ++it)
+    {   // TODO FIXME: is it just me or is this broken?
+        subGroupName = QString("Channel %1").arg(channelIndex);
+        channelHistory.append(subGroupName);
+        KConfigGroup cgChannelHistory(KGlobal::config()->group(subGroupName));
+        cgChannelHistory.writeEntry("Name", (*it).name());
+        cgChannelHistory.writeEntry("Password", (*it).password());
+        cgChannelHistory.writeEntry("EnableNotifications", (*it).enableNotifications());
+        channelIndex++;
+    }
+
+    KConfigGroup cgServerGroup(KGlobal::config()->group(groupName));
+    cgServerGroup.writeEntry("Name", serverGroup->name());
+    cgServerGroup.writeEntry("Identity", serverGroup->identity()->getName());
+    cgServerGroup.writeEntry("ServerList", servers);
+    cgServerGroup.writeEntry("AutoJoinChannels", channels);
+    cgServerGroup.writeEntry("ConnectCommands", serverGroup->connectCommands());
+    cgServerGroup.writeEntry("AutoConnect", serverGroup->autoConnectEnabled());
+    cgServerGroup.writeEntry("ChannelHistory", channelHistory);
+    cgServerGroup.writeEntry("EnableNotifications", serverGroup->enableNotifications());
+    cgServerGroup.writeEntry("Expanded", serverGroup->expanded());
+    cgServerGroup.writeEntry("NotifyList",Preferences::notifyStringByGroupId(serverGroup->id()));
+}
+
+/// One past the highest number used by "<prefix> N" config groups.
+int Application::nextFreeIndex(const QString& prefix)
+{
+    int next = 0;
+
+    foreach (const QString& group, KGlobal::config()->groupList().filter(QRegExp('^' + prefix + " [0-9]+$")))
+        next = qMax(next, group.section(' ', 1).toInt() + 1);
+
+    return next;
+}
+
 void Application::fetchQueueRates()
 {
     //The following rate was found in the rc for all queues, which were deliberately bad numbers chosen for debugging.
@@ -1066,12 +1230,86 @@ void Application::openQuickConnectDialog()
     quickConnectDialog->show();
 }
 
-void Application::sendMultiServerCommand(const QString& command, const QString& parameter)
+int Application::sendMultiServerCommand(const QString& command, const QString& parameter)
 {
     const QList<Server*> serverList = getConnectionManager()->getServerList();
+    MultiServerSend send;
+    send.total = 0;
+    send.sent = 0;
 
     foreach (Server* server, serverList)
+    {
+        const int start = server->queueMark();
+
         server->executeMultiServerCommand(command, parameter);
+
+        MultiServerSend::Part part;
+        part.server = server;
+        part.start = start;
+        part.count = server->queueMark() - start;
+
+        if (part.count > 0)
+        {
+            send.parts.append(part);
+            send.total += part.count;
+        }
+    }
+
+    if (!send.total)
+        return 0;
+
+    const int id = m_nextMultiServerSendId++;
+    m_multiServerSends.insert(id, send);
+
+    if (!m_multiServerSendTimer->isActive())
+        m_multiServerSendTimer->start();
+
+    return id;
+}
+
+void Application::updateMultiServerSends()
+{
+    QMutableHashIterator<int, MultiServerSend> it(m_multiServerSends);
+
+    while (it.hasNext())
+    {
+        MultiServerSend& send = it.next().value();
+        int sent = 0;
+        bool done = true;
+
+        foreach (const MultiServerSend::Part& part, send.parts)
+        {
+            // A connection that went away won't send the rest, count it as done
+            if (!part.server || !part.server->isConnected())
+            {
+                sent += part.count;
+
+                continue;
+            }
+
+            const int partSent = qBound(0, part.server->queueLinesSent() - part.start, part.count);
+
+            sent += partSent;
+
+            if (partSent < part.count)
+                done = false;
+        }
+
+        if (sent != send.sent)
+        {
+            send.sent = sent;
+            emit multiServerSendProgress(it.key(), sent, send.total);
+        }
+
+        if (done)
+        {
+            emit multiServerSendFinished(it.key());
+            it.remove();
+        }
+    }
+
+    if (m_multiServerSends.isEmpty())
+        m_multiServerSendTimer->stop();
 }
 
 void Application::splitNick_Server(const QString& nick_server, QString &ircnick, QString &serverOrGroup)
@@ -1105,135 +1343,7 @@ NickInfoPtr Application::getNickInfo(const QString &ircnick, const QString &serv
 // auto replace on input/output
 QPair<QString, int> Application::doAutoreplace(const QString& text, bool output, int cursorPos)
 {
-    // get autoreplace list
-    QList<QStringList> autoreplaceList=Preferences::autoreplaceList();
-    // working copy
-    QString line=text;
-
-    // loop through the list of replacement patterns
-    for (int index=0;index<autoreplaceList.count();index++)
-    {
-        // get autoreplace definition
-        QStringList definition=autoreplaceList[index];
-        // split definition in parts
-        QString regex=definition.at(0);
-        QString direction=definition.at(1);
-        QString pattern=definition.at(2);
-        QString replacement=definition.at(3);
-
-        QString isDirection=output ? "o" : "i";
-
-        // only replace if this pattern is for the specific direction or both directions
-        if (direction==isDirection || direction=="io")
-        {
-            // regular expression pattern?
-            if (regex=="1")
-            {
-                // create regex from pattern
-                QRegExp needleReg(pattern);
-                // set pattern case insensitive
-                needleReg.setCaseSensitivity(Qt::CaseSensitive);
-                int index = 0;
-                int newIndex = index;
-
-                do {
-                    // find matches
-                    index = line.indexOf(needleReg, index);
-
-                    if (index != -1)
-                    {
-                        // remember captured patterns
-                        QStringList captures = needleReg.capturedTexts();
-                        QString replaceWith = replacement;
-
-                        replaceWith.replace("%%","%\x01"); // escape double %
-                        // replace %0-9 in regex groups
-                        for (int capture=0;capture<captures.count();capture++)
-                        {
-                            QString search = QString("%%1").arg(capture);
-                            replaceWith.replace(search, captures[capture]);
-                        }
-                        //Explanation why this is important so we don't forget:
-                        //If somebody has a regex that say has a replacement of url.com/%1/%2 and the
-                        //regex can either match one or two patterns, if the 2nd pattern match is left,
-                        //the url is invalid (url.com/match/%2). This is expected regex behavior I'd assume.
-                        replaceWith.remove(QRegExp("%[0-9]"));
-
-                        replaceWith.replace("%\x01","%"); // return escaped % to normal
-                        // allow for var expansion in autoreplace
-                        replaceWith = Konversation::doVarExpansion(replaceWith);
-                        // replace input with replacement
-                        line.replace(index, captures[0].length(), replaceWith);
-
-                        newIndex = index + replaceWith.length();
-
-                        if (cursorPos > -1 && cursorPos >= index)
-                        {
-                            if (cursorPos < index + captures[0].length())
-                                cursorPos = newIndex;
-                            else
-                            {
-                                if (captures[0].length() > replaceWith.length())
-                                    cursorPos -= captures[0].length() - replaceWith.length();
-                                else
-                                    cursorPos += replaceWith.length() - captures[0].length();
-                            }
-                        }
-
-                        index = newIndex;
-                    }
-                } while (index >= 0 && index < line.length());
-            }
-            else
-            {
-                QRegExp needleReg(pattern);
-                needleReg.setPatternSyntax(QRegExp::FixedString);
-                int index=line.indexOf(needleReg);
-                while (index>=0)
-                {
-                    int length,nextLength,patLen,repLen;
-                    patLen=pattern.length();
-
-                    repLen=replacement.length();
-                    length=index;
-                    length+=patLen;
-                    nextLength=length;
-                    //nextlength is used to account for the replacement taking up less space
-                    QChar before,after;
-                    if (index!=0) before = line.at(index-1);
-                    if (line.length() > length) after = line.at(length);
-
-                    if (index==0 || before.isSpace() || before.isPunct())
-                    {
-                        if (line.length() == length || after.isSpace() || after.isPunct())
-                        {
-                            // allow for var expansion in autoreplace
-                            replacement = Konversation::doVarExpansion(replacement);
-                            line.replace(index,patLen,replacement);
-                            nextLength = index+repLen;
-                        }
-                    }
-
-                    if (cursorPos > -1 && cursorPos >= index)
-                    {
-                        if (cursorPos < length)
-                            cursorPos = nextLength;
-                        else
-                        {
-                            if (patLen > repLen)
-                                cursorPos -= patLen - repLen;
-                            else
-                                cursorPos += repLen - patLen;
-                        }
-                    }
-
-                    index=line.indexOf(needleReg,nextLength);
-                }
-            }
-        }
-    }
-
-    return QPair<QString, int>(line, cursorPos);
+    return m_autoreplacer->replace(text, output, cursorPos);
 }
 
 void Application::doInlineAutoreplace(KTextEdit* textEdit)
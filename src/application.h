@@ -25,9 +25,18 @@
 
 #include <KUniqueApplication>
 
+#include <QHash>
+#include <QSet>
+
+
+class QTimer;
+
+class KConfigGroup;
+
 class ConnectionManager;
 class AwayManager;
 class ScriptLauncher;
+class LogIndex;
 class Server;
 class QuickConnectDialog;
 class Images;
@@ -40,6 +49,8 @@ namespace Konversation
 {
     class DBus;
     class IdentDBus;
+    class EventDBus;
+    class Autoreplacer;
     class Sound;
     class NotificationHandler;
 
@@ -81,6 +92,9 @@ class Application : public KUniqueApplication
         // URL-Catcher
         QStandardItemModel* getUrlModel() { return m_urlModel; }
 
+        // Log search
+        LogIndex* getLogIndex() { return m_logIndex; }
+
         Application();
         ~Application();
 
@@ -115,6 +129,7 @@ class Application : public KUniqueApplication
         Images* images() { return m_images; }
 
         Konversation::NotificationHandler* notificationHandler() const { return m_notificationHandler; }
+        Konversation::EventDBus* eventDBus() const { return m_eventDBus; }
 
         // auto replacement for input or output lines
         QPair<QString, int> doAutoreplace(const QString& text, bool output, int cursorPos = -1);
@@ -135,11 +150,27 @@ class Application : public KUniqueApplication
         void serverGroupsChanged(const Konversation::ServerGroupSettingsPtr serverGroup);
         void appearanceChanged();
 
+        /// Lines of a multi-server send that went out so far, see sendMultiServerCommand().
+        void multiServerSendProgress(int id, int sent, int total);
+        void multiServerSendFinished(int id);
+
     public slots:
         void restart();
 
         void readOptions();
+        /// Rewrite the whole configuration right away, e.g. on shutdown.
         void saveOptions(bool updateGUI=true);
+        /// Schedule a full save, coalesced with other changes made shortly after.
+        void scheduleSaveOptions(bool updateGUI=true);
+        /// Schedule writing just this identity's config group.
+        void saveIdentity(int identityId, bool updateGUI=true);
+        /// Schedule writing just this server group's config groups.
+        void saveServerGroup(int serverGroupId, bool updateGUI=true);
+
+        /** Run command on all connections. Returns an id to follow the lines it
+         *  queued with the multiServerSend signals, or 0 if nothing was queued.
+         */
+        int sendMultiServerCommand(const QString& command, const QString& parameter);
 
         void fetchQueueRates(); ///< on Application::readOptions()
         void stashQueueRates(); ///< on application exit
@@ -153,26 +184,35 @@ class Application : public KUniqueApplication
     protected slots:
         void openQuickConnectDialog();
 
-        void dbusMultiServerRaw(const QString &command);
         void dbusRaw(const QString& connection, const QString &command);
         void dbusSay(const QString& connection, const QString& target, const QString& command);
         void dbusInfo(const QString& string);
-        void sendMultiServerCommand(const QString& command, const QString& parameter);
+        void updateMultiServerSends();
 
         void updateProxySettings();
 
         void closeWallet();
 
+        void serverGroupChanged(const Konversation::ServerGroupSettingsPtr serverGroup);
+        void flushOptions();
+
     private:
         void implementRestart();
 
+        void writeIdentity(KConfigGroup& cgIdentity, IdentityPtr identity);
+        void writeServerGroup(const QString& groupName, Konversation::ServerGroupSettingsPtr serverGroup,
+            int& serverIndex, int& channelIndex);
+        static int nextFreeIndex(const QString& prefix);
+
         ConnectionManager* m_connectionManager;
         AwayManager* m_awayManager;
         Konversation::DCC::TransferManager* m_dccTransferManager;
         ScriptLauncher* m_scriptLauncher;
         QStandardItemModel* m_urlModel;
+        LogIndex* m_logIndex;
         Konversation::DBus* dbusObject;
         Konversation::IdentDBus* identDBus;
+        Konversation::EventDBus* m_eventDBus;
         QPointer<MainWindow> mainWindow;
         Konversation::Sound* m_sound;
         QuickConnectDialog* quickConnectDialog;
@@ -181,7 +221,41 @@ class Application : public KUniqueApplication
 
         Konversation::NotificationHandler* m_notificationHandler;
 
+        Konversation::Autoreplacer* m_autoreplacer;
+
         KWallet::Wallet* m_wallet;
+
+        /// Coalesces saves requested in quick succession
+        QTimer* m_saveOptionsTimer;
+        bool m_saveAllOptions;
+        bool m_saveUpdatesGUI;
+        QSet<int> m_dirtyIdentities;
+        QSet<int> m_dirtyServerGroups;
+        /// Config group names as of the last full read or save, by id
+        QHash<int, QString> m_identityGroups;
+        QHash<int, QString> m_serverGroupGroups;
+        /// First unused "Server N" and "Channel N" numbers
+        int m_nextServerIndex;
+        int m_nextChannelIndex;
+
+        /// Lines queued on each connection by one sendMultiServerCommand()
+        struct MultiServerSend
+        {
+            struct Part
+            {
+                QPointer<Server> server;
+                int start; ///< the server's queue mark before
+                int count;
+            };
+
+            QList<Part> parts;
+            int total;
+            int sent;
+        };
+
+        QHash<int, MultiServerSend> m_multiServerSends;
+        QTimer* m_multiServerSendTimer;
+        int m_nextMultiServerSendId;
 };
 
 #endif
@@ -0,0 +1,312 @@
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+*/
+
+#include "autoreplacer.h"
+#include "common.h"
+#include "preferences.h"
+
+#include <string.h>
+
+
+namespace Konversation
+{
+
+Autoreplacer::Autoreplacer(QObject* parent) : QObject(parent)
+{
+    m_dirty = true;
+
+    connect(Preferences::self(), SIGNAL(autoreplaceListChanged()), this, SLOT(invalidate()));
+}
+
+Autoreplacer::~Autoreplacer()
+{
+}
+
+void Autoreplacer::invalidate()
+{
+    m_dirty = true;
+}
+
+void Autoreplacer::rebuild()
+{
+    m_incoming.clear();
+    m_outgoing.clear();
+
+    const QList<QStringList> autoreplaceList = Preferences::autoreplaceList();
+
+    foreach (const QStringList& definition, autoreplaceList)
+    {
+        // regex, direction, pattern, replacement
+        if (definition.count() < 4 || definition.at(2).isEmpty())
+            continue;
+
+        const QString& direction = definition.at(1);
+
+        if (direction == "i" || direction == "io")
+            m_incoming.addRule(definition);
+
+        if (direction == "o" || direction == "io")
+            m_outgoing.addRule(definition);
+    }
+
+    m_dirty = false;
+}
+
+void Autoreplacer::RuleSet::clear()
+{
+    rules.clear();
+    fixedBuckets.clear();
+    fixedCount = 0;
+}
+
+void Autoreplacer::RuleSet::addRule(const QStringList& definition)
+{
+    Rule rule;
+
+    rule.isRegExp = (definition.at(0) == "1");
+    rule.pattern = definition.at(2);
+    rule.replacement = definition.at(3);
+
+    if (rule.isRegExp)
+    {
+        rule.regExp = QRegExp(rule.pattern, Qt::CaseSensitive);
+        rule.segments = parseReplacement(rule.replacement);
+    }
+    else
+    {
+        if (fixedBuckets.isEmpty())
+            fixedBuckets.resize(256);
+
+        fixedBuckets[rule.pattern.at(0).unicode() & 0xFF].append(rules.count());
+        ++fixedCount;
+    }
+
+    rules.append(rule);
+}
+
+/// Find all fixed-string rules whose pattern occurs somewhere in line.
+QBitArray Autoreplacer::RuleSet::fixedCandidates(const QString& line) const
+{
+    QBitArray found(rules.count());
+
+    if (!fixedCount)
+        return found;
+
+    const QChar* data = line.unicode();
+    const int length = line.length();
+    int remaining = fixedCount;
+
+    for (int pos = 0; pos < length; ++pos)
+    {
+        const QVector<int>& bucket = fixedBuckets.at(data[pos].unicode() & 0xFF);
+
+        for (int i = 0; i < bucket.count(); ++i)
+        {
+            const int index = bucket.at(i);
+
+            if (found.testBit(index))
+                continue;
+
+            const QString& pattern = rules.at(index).pattern;
+
+            if (pattern.length() <= length - pos
+                && memcmp(data + pos, pattern.unicode(), pattern.length() * sizeof(QChar)) == 0)
+            {
+                found.setBit(index);
+
+                if (--remaining == 0)
+                    return found;
+            }
+        }
+    }
+
+    return found;
+}
+
+/// Split a replacement template into literal text and %0-%9 capture references.
+/// "%%" stands for a literal percent sign.
+QList<Autoreplacer::Segment> Autoreplacer::parseReplacement(const QString& replacement)
+{
+    QList<Segment> segments;
+    Segment literal;
+    literal.capture = -1;
+
+    for (int i = 0; i < replacement.length(); ++i)
+    {
+        const QChar c = replacement.at(i);
+
+        if (c == '%' && i + 1 < replacement.length())
+        {
+            const QChar next = replacement.at(i + 1);
+
+            if (next == '%')
+            {
+                literal.text += '%';
+                ++i;
+                continue;
+            }
+            else if (next >= '0' && next <= '9')
+            {
+                if (!literal.text.isEmpty())
+                {
+                    segments.append(literal);
+                    literal.text.clear();
+                }
+
+                Segment capture;
+                capture.capture = next.digitValue();
+                segments.append(capture);
+                ++i;
+                continue;
+            }
+        }
+
+        literal.text += c;
+    }
+
+    if (!literal.text.isEmpty())
+        segments.append(literal);
+
+    return segments;
+}
+
+bool Autoreplacer::applyRegExp(Rule& rule, QString& line, int& cursorPos)
+{
+    QRegExp& needleReg = rule.regExp;
+    bool changed = false;
+    int index = 0;
+
+    do {
+        // find matches
+        index = line.indexOf(needleReg, index);
+
+        if (index != -1)
+        {
+            const int matchLength = needleReg.matchedLength();
+            const int captureCount = needleReg.captureCount() + 1;
+            QString replaceWith;
+
+            // Capture references beyond the groups in the regex expand to nothing,
+            // so a replacement like url.com/%1/%2 stays valid if %2 didn't match.
+            foreach (const Segment& segment, rule.segments)
+            {
+                if (segment.capture < 0)
+                    replaceWith += segment.text;
+                else if (segment.capture < captureCount)
+                    replaceWith += needleReg.cap(segment.capture);
+            }
+
+            // allow for var expansion in autoreplace
+            replaceWith = Konversation::doVarExpansion(replaceWith);
+            // replace input with replacement
+            line.replace(index, matchLength, replaceWith);
+            changed = true;
+
+            int newIndex = index + replaceWith.length();
+
+            if (cursorPos > -1 && cursorPos >= index)
+            {
+                if (cursorPos < index + matchLength)
+                    cursorPos = newIndex;
+                else
+                    cursorPos += replaceWith.length() - matchLength;
+            }
+
+            // an empty match replaced by nothing would match again right here
+            if (matchLength == 0 && replaceWith.isEmpty())
+                ++newIndex;
+
+            index = newIndex;
+        }
+    } while (index >= 0 && index < line.length());
+
+    return changed;
+}
+
+bool Autoreplacer::applyFixed(const Rule& rule, QString& line, int& cursorPos)
+{
+    const QString& pattern = rule.pattern;
+    const int patLen = pattern.length();
+    bool changed = false;
+
+    int index = line.indexOf(pattern);
+
+    while (index >= 0)
+    {
+        int length = index + patLen;
+        int nextLength = length;
+
+        // only replace whole words
+        QChar before, after;
+        if (index != 0) before = line.at(index - 1);
+        if (line.length() > length) after = line.at(length);
+
+        if ((index == 0 || before.isSpace() || before.isPunct())
+            && (line.length() == length || after.isSpace() || after.isPunct()))
+        {
+            // allow for var expansion in autoreplace
+            const QString replacement = Konversation::doVarExpansion(rule.replacement);
+            const int repLen = replacement.length();
+
+            line.replace(index, patLen, replacement);
+            changed = true;
+            nextLength = index + repLen;
+
+            if (cursorPos > -1 && cursorPos >= index)
+            {
+                if (cursorPos < length)
+                    cursorPos = nextLength;
+                else
+                    cursorPos += repLen - patLen;
+            }
+        }
+
+        index = line.indexOf(pattern, nextLength);
+    }
+
+    return changed;
+}
+
+QPair<QString, int> Autoreplacer::replace(const QString& text, bool output, int cursorPos)
+{
+    if (m_dirty)
+        rebuild();
+
+    RuleSet& ruleSet = output ? m_outgoing : m_incoming;
+
+    if (ruleSet.rules.isEmpty())
+        return QPair<QString, int>(text, cursorPos);
+
+    // working copy
+    QString line = text;
+
+    QBitArray candidates = ruleSet.fixedCandidates(line);
+
+    // Rules apply one after another, each to the result of the previous ones
+    for (int index = 0; index < ruleSet.rules.count(); ++index)
+    {
+        Rule& rule = ruleSet.rules[index];
+        bool changed;
+
+        if (rule.isRegExp)
+            changed = applyRegExp(rule, line, cursorPos);
+        else if (candidates.testBit(index))
+            changed = applyFixed(rule, line, cursorPos);
+        else
+            continue;
+
+        // a replacement may have created matches for later fixed-string rules
+        if (changed)
+            candidates = ruleSet.fixedCandidates(line);
+    }
+
+    return QPair<QString, int>(line, cursorPos);
+}
+
+}
+
+#include "autoreplacer.moc"
@@ -0,0 +1,91 @@
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+*/
+
+#ifndef AUTOREPLACER_H
+#define AUTOREPLACER_H
+
+#include <QObject>
+#include <QBitArray>
+#include <QList>
+#include <QPair>
+#include <QRegExp>
+#include <QStringList>
+#include <QVector>
+
+namespace Konversation
+{
+    /**
+     * Applies the autoreplace definitions from Preferences::autoreplaceList().
+     *
+     * The definitions are compiled once into a rule set per direction and only
+     * rebuilt after the list in Preferences changed. Regular expressions are
+     * compiled up front, replacement templates are split into literal and
+     * capture segments, and fixed-string patterns are located with a single
+     * scan of the line, so rules that cannot match cost nothing.
+     */
+    class Autoreplacer : public QObject
+    {
+        Q_OBJECT
+
+        public:
+            explicit Autoreplacer(QObject* parent = 0);
+            ~Autoreplacer();
+
+            /** Apply the rules for one direction to text.
+             *  @param output true for outgoing lines, false for incoming ones
+             *  @param cursorPos cursor position to keep in sync, or -1
+             *  @return the new text and cursor position
+             */
+            QPair<QString, int> replace(const QString& text, bool output, int cursorPos = -1);
+
+        public slots:
+            /// Mark the compiled rules as stale, they are rebuilt on next use.
+            void invalidate();
+
+        private:
+            struct Segment
+            {
+                int capture; ///< capture group to insert, or -1 for literal text
+                QString text;
+            };
+
+            struct Rule
+            {
+                bool isRegExp;
+                QString pattern;
+                QRegExp regExp;
+                QString replacement;
+                QList<Segment> segments;
+            };
+
+            struct RuleSet
+            {
+                RuleSet() : fixedCount(0) {}
+
+                QList<Rule> rules;
+                /// fixed-string rule indexes, bucketed by the low byte of the pattern's first character
+                QVector<QVector<int> > fixedBuckets;
+                int fixedCount;
+
+                void clear();
+                void addRule(const QStringList& definition);
+                QBitArray fixedCandidates(const QString& line) const;
+            };
+
+            void rebuild();
+
+            static QList<Segment> parseReplacement(const QString& replacement);
+            static bool applyRegExp(Rule& rule, QString& line, int& cursorPos);
+            static bool applyFixed(const Rule& rule, QString& line, int& cursorPos);
+
+            RuleSet m_incoming;
+            RuleSet m_outgoing;
+            bool m_dirty;
+    };
+}
+
+#endif
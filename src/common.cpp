@@ -20,6 +20,10 @@
 #include <QPixmap>
 #include <QBitmap>
 #include <QPainter>
+#include <QDateTime>
+
+#include <KGlobal>
+#include <KLocale>
 
 #include "guess_ja.cpp"
 #include "unicode.cpp"
@@ -54,6 +58,16 @@ namespace Konversation
 
     QString removeIrcMarkup(const QString& text)
     {
+        // all markup starts with a control character, most text has none
+        const QChar* data = text.unicode();
+        int i = 0;
+
+        while (i < text.length() && data[i].unicode() >= 0x20)
+            ++i;
+
+        if (i == text.length())
+            return text;
+
         QString escaped(text);
         // Escape text decoration
         escaped.remove(colorRegExp);
@@ -290,36 +304,41 @@ namespace Konversation
     QString& sterilizeUnicode(QString& s)
     {
         // HACK work around undocumented requirement to vet Unicode text sent over DBUS.
-        // strips noncharacters, the private use characters are presumably safe
-        for (int i = 0; i < s.length(); ++i)
+        // strips noncharacters and unpaired surrogates, the private use characters are presumably safe
+        const int len = s.length();
+        int i = findUnicodeFixupCandidate(s.utf16(), 0, len);
+
+        // Nearly every line has nothing to fix, don't detach those
+        if (i == len)
+            return s;
+
+        ushort* data = reinterpret_cast<ushort*>(s.data());
+
+        while (i < len)
         {
-            QChar c(s.at(i));
-            if (c.category() == QChar::Other_Surrogate)
-            {
-                if (!c.isHighSurrogate() || (!(i+1 < s.length()) && !s.at(i+1).isLowSurrogate()))
-                {
-                    //stomp on this bad char now, next trip through the loop (if there is one) eats the other
-                    s.replace(i, 1, QChar(0xFFFD));
-                    continue;
-                }
+            ushort c = data[i];
 
-                QChar next = s.at(i+1);
-                if ((next.unicode()&0x3FE) == 0x3FE && (c.unicode()&0x3F) == 0x3F)
+            if ((c & 0xFC00) == 0xD800 && i + 1 < len && (data[i+1] & 0xFC00) == 0xDC00)
+            {
+                // U+xFFFE and U+xFFFF are noncharacters on every plane
+                if ((data[i+1] & 0x3FE) == 0x3FE && (c & 0x3F) == 0x3F)
                 {
-                    s.replace(i, 1, QChar(0xFFFD)); //its one of the last two of the plane, replace them
-                    s.replace(i+1, 1, QChar(0xFFFD));
+                    data[i] = 0xFFFD;
+                    data[i+1] = 0xFFFD;
                 }
 
-                ++i; // skip the high surrogate now, the loop takes care of the low
+                i += 2;
             }
-            else if ((c.category() == QChar::Other_NotAssigned) //perhaps Qt will use QChar::Other_NotAssigned some day
-                || (c.unicode() >= 0xFDD0 && c.unicode() <= 0xFDEF) //Unicode class Cn on BMP only
-                || (c.unicode() == 0xFFFE || (c.unicode() == 0xFFFF)) //Unicode class Cn on all planes
-                )
+            else
             {
-                s.replace(i, 1, QChar(0xFFFD));
+                // an unpaired surrogate or a BMP noncharacter
+                data[i] = 0xFFFD;
+                ++i;
             }
+
+            i = findUnicodeFixupCandidate(data, i, len);
         }
+
         return s;
     }
 
@@ -329,7 +348,13 @@ namespace Konversation
     QStringList& sterilizeUnicode(QStringList& list)
     {
         for (int i = 0; i < list.count(); ++i)
-            sterilizeUnicode(list[i]);
+        {
+            const QString& item = list.at(i);
+
+            // only detach the list and the string when there is something to fix
+            if (findUnicodeFixupCandidate(item.utf16(), 0, item.length()) != item.length())
+                sterilizeUnicode(list[i]);
+        }
 
         return list;
     }
@@ -341,4 +366,67 @@ namespace Konversation
         return sterilizeUnicode(out);
     }
 
+    /// A string depending only on the current second
+    struct TimeStampCache
+    {
+        TimeStampCache() : second(-1) {}
+
+        qint64 second;
+        QString text;
+    };
+
+    static TimeStampCache s_timeStamp;
+    static TimeStampCache s_logTimeStamp;
+
+    static qint64 secondOf(const QDateTime& dateTime)
+    {
+        const QTime time = dateTime.time();
+
+        return qint64(dateTime.date().toJulianDay()) * 86400
+            + time.hour() * 3600 + time.minute() * 60 + time.second();
+    }
+
+    QString timeStamp()
+    {
+        const QDateTime now = QDateTime::currentDateTime();
+        const qint64 second = secondOf(now);
+
+        if (second != s_timeStamp.second)
+        {
+            const QString time = now.time().toString(Preferences::self()->timestampFormat());
+
+            if (Preferences::self()->showDate())
+                s_timeStamp.text = QString(QLatin1String("[%1 %2]"))
+                    .arg(KGlobal::locale()->formatDate(now.date(), KLocale::ShortDate), time);
+            else
+                s_timeStamp.text = QString(QLatin1String("[%1]")).arg(time);
+
+            s_timeStamp.second = second;
+        }
+
+        return s_timeStamp.text;
+    }
+
+    QString logTimeStamp()
+    {
+        const QDateTime now = QDateTime::currentDateTime();
+        const qint64 second = secondOf(now);
+
+        if (second != s_logTimeStamp.second)
+        {
+            s_logTimeStamp.text = QString(QLatin1String("[%1] [%2]"))
+                .arg(KGlobal::locale()->formatDate(now.date(), KLocale::LongDate),
+                     KGlobal::locale()->formatTime(now.time(), true));
+            s_logTimeStamp.second = second;
+        }
+
+        return s_logTimeStamp.text;
+    }
+
+    void resetTimeStamps()
+    {
+        s_timeStamp.second = -1;
+        s_logTimeStamp.second = -1;
+    }
+
 }
@@ -95,5 +95,13 @@ namespace Konversation
     QString& sterilizeUnicode(QString& s);
     QStringList& sterilizeUnicode(QStringList& list);
     QStringList sterilizeUnicode(const QStringList& inVal);
+
+    /// The time stamp of chat lines as configured, "[time]" or "[date time]".
+    /// Formatted once per second, other calls share that string.
+    QString timeStamp();
+    /// The "[date] [time]" prefix of log file lines, cached like timeStamp().
+    QString logTimeStamp();
+    /// Format the time stamps again, e.g. after the settings changed.
+    void resetTimeStamps();
 }
 #endif
@@ -72,6 +72,7 @@ Preferences::Preferences()
     serverGroup->addChannel(channel);
     serverGroup->setExpanded(false);
     mServerGroupHash.insert(0, serverGroup);
+    indexServerGroup(0);
     mQuickButtonList = defaultQuickButtonList();
     mAutoreplaceList = defaultAutoreplaceList();
 }
@@ -132,11 +133,13 @@ const QList<QStringList> Preferences::autoreplaceList()
 void Preferences::setAutoreplaceList(const QList<QStringList> newList)
 {
   self()->mAutoreplaceList=newList;
+  emit self()->autoreplaceListChanged();
 }
 
 void Preferences::clearAutoreplaceList()
 {
   self()->mAutoreplaceList.clear();
+  emit self()->autoreplaceListChanged();
 }
 
 // --------------------------- AutoReplace ---------------------------
@@ -145,6 +148,7 @@ void Preferences::setServerGroupHash(const Konversation::ServerGroupHash& hash)
 {
     self()->mServerGroupHash.clear();
     self()->mServerGroupHash = hash;
+    self()->rebuildServerGroupIndex();
 }
 
 void Preferences::addServerGroup(Konversation::ServerGroupSettingsPtr serverGroup)
@@ -152,6 +156,7 @@ void Preferences::addServerGroup(Konversation::ServerGroupSettingsPtr serverGrou
     Konversation::ServerGroupHash hash = self()->mServerGroupHash;
     hash.insert(serverGroup->id(), serverGroup);
     self()->mServerGroupHash = hash;
+    self()->indexServerGroup(serverGroup->id());
 }
 
 const Konversation::ServerGroupSettingsPtr Preferences::serverGroupById(int id)
@@ -177,13 +182,8 @@ const QList<Konversation::ServerGroupSettingsPtr> Preferences::serverGroupsBySer
 
 QList<int> Preferences::serverGroupIdsByName(const QString& serverGroup)
 {
-    QList<int> serverIds;
-    QHashIterator<int, Konversation::ServerGroupSettingsPtr> it(self()->mServerGroupHash);
-    while(it.hasNext())
-    {
-        if(it.next().value()->name().toLower() == serverGroup.toLower())
-            serverIds.append(it.key());
-    }
+    QList<int> serverIds = self()->mServerGroupIdsByName.value(serverGroup.toLower());
+
     if (serverIds.isEmpty())
         serverIds.append(-1);
 
@@ -192,18 +192,58 @@ QList<int> Preferences::serverGroupIdsByName(const QString& serverGroup)
 
 bool Preferences::isServerGroup(const QString& server)
 {
-    QHashIterator<int, Konversation::ServerGroupSettingsPtr> it(self()->mServerGroupHash);
-    while(it.hasNext())
-    {
-        if(it.next().value()->name().toLower() == server.toLower())
-            return true;
-    }
-    return false;
+    return self()->mServerGroupIdsByName.contains(server.toLower());
 }
 
 void Preferences::removeServerGroup(int id)
 {
     self()->mServerGroupHash.remove(id);
+    self()->unindexServerGroup(id);
+}
+
+void Preferences::serverGroupRenamed(int id)
+{
+    self()->indexServerGroup(id);
+}
+
+void Preferences::indexServerGroup(int id)
+{
+    unindexServerGroup(id);
+
+    Konversation::ServerGroupSettingsPtr serverGroup = mServerGroupHash.value(id);
+
+    if (!serverGroup)
+        return;
+
+    const QString name = serverGroup->name().toLower();
+
+    mServerGroupIdsByName[name].append(id);
+    mServerGroupIndexedNames.insert(id, name);
+}
+
+void Preferences::unindexServerGroup(int id)
+{
+    if (!mServerGroupIndexedNames.contains(id))
+        return;
+
+    const QString name = mServerGroupIndexedNames.take(id);
+    QList<int>& ids = mServerGroupIdsByName[name];
+
+    ids.removeOne(id);
+
+    if (ids.isEmpty())
+        mServerGroupIdsByName.remove(name);
+}
+
+void Preferences::rebuildServerGroupIndex()
+{
+    mServerGroupIdsByName.clear();
+    mServerGroupIndexedNames.clear();
+
+    QHashIterator<int, Konversation::ServerGroupSettingsPtr> it(mServerGroupHash);
+
+    while (it.hasNext())
+        indexServerGroup(it.next().key());
 }
 
 
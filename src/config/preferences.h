@@ -62,6 +62,8 @@ class Preferences : public PreferencesBase
         static QList<int> serverGroupIdsByName(const QString& serverGroup);
         static bool isServerGroup(const QString& server);
         static void removeServerGroup(int id);
+        /// Call after the name of a server group in the list was changed.
+        static void serverGroupRenamed(int id);
 
         /** Returns a list of alias set up by default.  This is a set of aliases for the scripts found. */
         static QStringList defaultAliasList();
@@ -140,10 +142,17 @@ class Preferences : public PreferencesBase
     signals:
         void notifyListStarted(int serverGroupId);
         void updateTrayIcon();
+        void autoreplaceListChanged();
 
     protected:
+        void indexServerGroup(int id);
+        void unindexServerGroup(int id);
+        void rebuildServerGroupIndex();
+
         IdentityPtr mIdentity;
         Konversation::ServerGroupHash mServerGroupHash;
+        QHash<QString, QList<int> > mServerGroupIdsByName;  // lowercase name, server group ids
+        QHash<int, QString> mServerGroupIndexedNames;  // server group id, lowercase name it's indexed under
         QList<Ignore*> mIgnoreList;
         QList<IdentityPtr> mIdentityList;
         QList<Highlight*> mHighlightList;
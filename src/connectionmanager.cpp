@@ -233,14 +233,17 @@ void ConnectionManager::handleReconnect(Server* server)
 
     uint reconnectCount = Preferences::self()->reconnectCount();
 
+    // Racing tries all servers of a group in every attempt.
+    const bool rotateServers = settings.serverGroup() && !Preferences::self()->parallelConnect();
+
     // For server groups, one iteration over their server list shall count as one
     // connection attempt.
-    if (settings.serverGroup())
+    if (rotateServers)
         reconnectCount = reconnectCount * settings.serverGroup()->serverList().size();
 
     if (reconnectCount == 0 || settings.reconnectCount() < reconnectCount)
     {
-        if (settings.serverGroup() && settings.serverGroup()->serverList().size() > 1)
+        if (rotateServers && settings.serverGroup()->serverList().size() > 1)
         {
             Konversation::ServerList serverList = settings.serverGroup()->serverList();
 
@@ -17,18 +17,35 @@
 #include "connectionmanager.h"
 #include "awaymanager.h"
 #include "channel.h"
+#include "connectburst.h"
+#include "keepalive.h"
 #include "identity.h"
 #include "server.h"
 
+#include <QDateTime>
 #include <QDBusConnection>
+#include <QDBusServiceWatcher>
+#include <QTimer>
 
 using namespace Konversation;
 
 
+// how long events are collected before a batch goes out
+static const int EventFlushInterval = 250;
+
+// a subscriber that can't keep up loses the oldest events beyond this
+static const int MaxPendingEvents = 1000;
+
+
 DBus::DBus(QObject *parent) : QObject(parent)
 {
     QDBusConnection bus = QDBusConnection::sessionBus();
     bus.connect("org.freedesktop.ScreenSaver", "/ScreenSaver", "org.freedesktop.ScreenSaver", "ActiveChanged", this, SLOT(changeAwayStatus(bool)));
+
+    connect(Application::instance(), SIGNAL(multiServerSendProgress(int,int,int)),
+        this, SIGNAL(multiServerSendProgress(int,int,int)));
+    connect(Application::instance(), SIGNAL(multiServerSendFinished(int)),
+        this, SIGNAL(multiServerSendFinished(int)));
 }
 
 void DBus::raw(const QString& server,const QString& command)
@@ -88,6 +105,53 @@ QStringList DBus::listJoinedChannels(const QString& serverName)
     return joinedChannels;
 }
 
+QVariantMap DBus::getConnectTimes(const QString& serverName)
+{
+    QVariantMap times;
+
+    ConnectionManager* connectionManager = Application::instance()->getConnectionManager();
+
+    Server* server = connectionManager->getServerByName(serverName, ConnectionManager::MatchByIdThenName);
+
+    if (server)
+    {
+        ConnectBurst* connectBurst = server->getConnectBurst();
+
+        times.insert("registered", connectBurst->registeredAfter());
+        times.insert("usable", connectBurst->usableAfter());
+        times.insert("channels", connectBurst->channelCount());
+    }
+
+    return times;
+}
+
+QVariantMap DBus::getLagStatistics(const QString& serverName)
+{
+    QVariantMap statistics;
+
+    ConnectionManager* connectionManager = Application::instance()->getConnectionManager();
+
+    Server* server = connectionManager->getServerByName(serverName, ConnectionManager::MatchByIdThenName);
+
+    if (server)
+    {
+        QVariantList bounds;
+        QVariantList histogram;
+
+        foreach (int bound, KeepAlive::histogramBounds())
+            bounds << bound;
+
+        foreach (int count, server->getKeepAlive()->histogram())
+            histogram << count;
+
+        statistics.insert("lag", server->getLag());
+        statistics.insert("bounds", bounds);
+        statistics.insert("histogram", histogram);
+    }
+
+    return statistics;
+}
+
 void DBus::setAway(const QString& awaymessage)
 {
     static_cast<Application*>(kapp)->getAwayManager()->requestAllAway(sterilizeUnicode(awaymessage));
@@ -98,14 +162,14 @@ void DBus::setBack()
     static_cast<Application*>(kapp)->getAwayManager()->requestAllUnaway();
 }
 
-void DBus::sayToAll(const QString &message)
+int DBus::sayToAll(const QString &message)
 {
-    emit dbusMultiServerRaw("msg " + sterilizeUnicode(message));
+    return Application::instance()->sendMultiServerCommand("msg", sterilizeUnicode(message));
 }
 
-void DBus::actionToAll(const QString &message)
+int DBus::actionToAll(const QString &message)
 {
-    emit dbusMultiServerRaw("me " + sterilizeUnicode(message));
+    return Application::instance()->sendMultiServerCommand("me", sterilizeUnicode(message));
 }
 
 void DBus::say(const QString& _server,const QString& _target,const QString& _command)
@@ -267,7 +331,7 @@ void IdentDBus::setNickname(const QString &identity, int index,const QString& ni
 {
     const Identity *i = Preferences::identityByName(sterilizeUnicode(identity)).data();
     const_cast<Identity *>(i)->setNickname(index, sterilizeUnicode(nick));
-    static_cast<Application *>(kapp)->saveOptions(true);
+    static_cast<Application *>(kapp)->saveIdentity(i->id());
 }
 
 QString IdentDBus::getNickname(const QString &identity, int index)
@@ -279,7 +343,7 @@ void IdentDBus::setBot(const QString &identity, const QString& bot)
 {
     const Identity *i = Preferences::identityByName(sterilizeUnicode(identity)).data();
     const_cast<Identity *>(i)->setNickservNickname(sterilizeUnicode(bot));
-    static_cast<Application *>(kapp)->saveOptions(true);
+    static_cast<Application *>(kapp)->saveIdentity(i->id());
 }
 
 QString IdentDBus::getBot(const QString &identity)
@@ -291,7 +355,7 @@ void IdentDBus::setPassword(const QString &identity, const QString& password)
 {
     const Identity *i = Preferences::identityByName(sterilizeUnicode(identity)).data();
     const_cast<Identity *>(i)->setAuthPassword(sterilizeUnicode(password));
-    static_cast<Application *>(kapp)->saveOptions(true);
+    static_cast<Application *>(kapp)->saveIdentity(i->id());
 }
 
 QString IdentDBus::getPassword(const QString &identity)
@@ -303,7 +367,7 @@ void IdentDBus::setNicknameList(const QString &identity, const QStringList& newL
 {
     const Identity *i = Preferences::identityByName(sterilizeUnicode(identity)).data();
     const_cast<Identity *>(i)->setNicknameList(sterilizeUnicode(newList));
-    static_cast<Application *>(kapp)->saveOptions(true);
+    static_cast<Application *>(kapp)->saveIdentity(i->id());
 }
 
 QStringList IdentDBus::getNicknameList(const QString &identity)
@@ -315,7 +379,7 @@ void IdentDBus::setQuitReason(const QString &identity, const QString& reason)
 {
     const Identity *i = Preferences::identityByName(sterilizeUnicode(identity)).data();
     const_cast<Identity *>(i)->setQuitReason(sterilizeUnicode(reason));
-    static_cast<Application *>(kapp)->saveOptions(true);
+    static_cast<Application *>(kapp)->saveIdentity(i->id());
 }
 
 QString IdentDBus::getQuitReason(const QString &identity)
@@ -328,7 +392,7 @@ void IdentDBus::setPartReason(const QString &identity, const QString& reason)
 {
     const Identity *i = Preferences::identityByName(sterilizeUnicode(identity)).data();
     const_cast<Identity *>(i)->setPartReason(sterilizeUnicode(reason));
-    static_cast<Application *>(kapp)->saveOptions(true);
+    static_cast<Application *>(kapp)->saveIdentity(i->id());
 }
 
 QString IdentDBus::getPartReason(const QString &identity)
@@ -340,7 +404,7 @@ void IdentDBus::setKickReason(const QString &identity, const QString& reason)
 {
     const Identity *i = Preferences::identityByName(sterilizeUnicode(identity)).data();
     const_cast<Identity *>(i)->setKickReason(sterilizeUnicode(reason));
-    static_cast<Application *>(kapp)->saveOptions(true);
+    static_cast<Application *>(kapp)->saveIdentity(i->id());
 }
 
 QString IdentDBus::getKickReason(const QString &identity)
@@ -352,7 +416,7 @@ void IdentDBus::setRunAwayCommands(const QString &identity, bool run)
 {
     const Identity *i = Preferences::identityByName(sterilizeUnicode(identity)).data();
     const_cast<Identity *>(i)->setRunAwayCommands(run);
-    static_cast<Application *>(kapp)->saveOptions(true);
+    static_cast<Application *>(kapp)->saveIdentity(i->id());
 }
 
 bool IdentDBus::getRunAwayCommands(const QString &identity)
@@ -364,7 +428,7 @@ void IdentDBus::setAwayCommand(const QString &identity, const QString& command)
 {
     const Identity *i = Preferences::identityByName(sterilizeUnicode(identity)).data();
     const_cast<Identity *>(i)->setAwayCommand(sterilizeUnicode(command));
-    static_cast<Application *>(kapp)->saveOptions(true);
+    static_cast<Application *>(kapp)->saveIdentity(i->id());
 }
 
 QString IdentDBus::getAwayCommand(const QString &identity)
@@ -376,7 +440,7 @@ void IdentDBus::setReturnCommand(const QString &identity, const QString& command
 {
     const Identity *i = Preferences::identityByName(sterilizeUnicode(identity)).data();
     const_cast<Identity *>(i)->setReturnCommand(sterilizeUnicode(command));
-    static_cast<Application *>(kapp)->saveOptions(true);
+    static_cast<Application *>(kapp)->saveIdentity(i->id());
 }
 
 QString IdentDBus::getReturnCommand(const QString &identity)
@@ -388,7 +452,7 @@ void IdentDBus::setAwayMessage(const QString &identity, const QString& message)
 {
     const Identity *i = Preferences::identityByName(sterilizeUnicode(identity)).data();
     const_cast<Identity *>(i)->setAwayMessage(sterilizeUnicode(message));
-    static_cast<Application *>(kapp)->saveOptions(true);
+    static_cast<Application *>(kapp)->saveIdentity(i->id());
 }
 
 QString IdentDBus::getAwayMessage(const QString &identity)
@@ -400,7 +464,7 @@ void IdentDBus::setAwayNickname(const QString &identity, const QString& nickname
 {
     const Identity *i = Preferences::identityByName(sterilizeUnicode(identity)).data();
     const_cast<Identity *>(i)->setAwayNickname(sterilizeUnicode(nickname));
-    static_cast<Application *>(kapp)->saveOptions(true);
+    static_cast<Application *>(kapp)->saveIdentity(i->id());
 }
 
 QString IdentDBus::getAwayNickname(const QString &identity)
@@ -408,4 +472,218 @@ QString IdentDBus::getAwayNickname(const QString &identity)
     return sterilizeUnicode(Preferences::identityByName(sterilizeUnicode(identity))->getAwayNickname());
 }
 
+EventSubscription::EventSubscription(QObject* parent) : QObject(parent)
+{
+    m_dropped = 0;
+}
+
+EventDBus::EventDBus(QObject* parent) : QObject(parent)
+{
+    m_nextId = 1;
+
+    m_serviceWatcher = new QDBusServiceWatcher(this);
+    m_serviceWatcher->setConnection(QDBusConnection::sessionBus());
+    m_serviceWatcher->setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
+    connect(m_serviceWatcher, SIGNAL(serviceUnregistered(QString)), this, SLOT(serviceUnregistered(QString)));
+
+    m_flushTimer = new QTimer(this);
+    m_flushTimer->setSingleShot(true);
+    m_flushTimer->setInterval(EventFlushInterval);
+    connect(m_flushTimer, SIGNAL(timeout()), this, SLOT(flush()));
+
+    connect(Application::instance()->getConnectionManager(),
+        SIGNAL(connectionChangedState(Server*,Konversation::ConnectionState)),
+        this, SLOT(connectionChangedState(Server*,Konversation::ConnectionState)));
+}
+
+EventDBus::~EventDBus()
+{
+}
+
+QString EventDBus::subscribe(const QStringList& types, const QString& server, const QString& target)
+{
+    static const QStringList knownTypes = QStringList() << "message" << "action" << "join" << "part"
+        << "quit" << "kick" << "nick" << "highlight" << "connection";
+
+    EventSubscription* subscription = new EventSubscription(this);
+
+    foreach (const QString& type, types)
+    {
+        const QString lcType = sterilizeUnicode(type).toLower();
+
+        if (!knownTypes.contains(lcType))
+        {
+            delete subscription;
+
+            if (calledFromDBus())
+                sendErrorReply(QDBusError::InvalidArgs, QString("Unknown event type: %1").arg(type));
+
+            return QString();
+        }
+
+        subscription->m_types.insert(lcType);
+    }
+
+    subscription->m_server = sterilizeUnicode(server).toLower();
+    subscription->m_target = sterilizeUnicode(target).toLower();
+
+    const QString path = QString("/events/%1").arg(m_nextId++);
+
+    if (calledFromDBus())
+    {
+        subscription->m_service = message().service();
+        m_serviceWatcher->addWatchedService(subscription->m_service);
+    }
+
+    QDBusConnection::sessionBus().registerObject(path, subscription, QDBusConnection::ExportAllSignals);
+    m_subscriptions.insert(path, subscription);
+
+    return path;
+}
+
+void EventDBus::unsubscribe(const QString& path)
+{
+    EventSubscription* subscription = m_subscriptions.value(path);
+
+    if (subscription)
+        removeSubscription(subscription);
+}
+
+void EventDBus::removeSubscription(EventSubscription* subscription)
+{
+    const QString path = m_subscriptions.key(subscription);
+
+    QDBusConnection::sessionBus().unregisterObject(path);
+    m_subscriptions.remove(path);
+
+    if (!subscription->m_service.isEmpty())
+    {
+        bool watched = false;
+
+        foreach (EventSubscription* other, m_subscriptions)
+        {
+            if (other->m_service == subscription->m_service)
+            {
+                watched = true;
+                break;
+            }
+        }
+
+        if (!watched)
+            m_serviceWatcher->removeWatchedService(subscription->m_service);
+    }
+
+    delete subscription;
+}
+
+void EventDBus::serviceUnregistered(const QString& service)
+{
+    foreach (EventSubscription* subscription, m_subscriptions)
+    {
+        if (subscription->m_service == service)
+            removeSubscription(subscription);
+    }
+}
+
+void EventDBus::post(const QString& type, Server* server, const QString& target,
+    const QString& nick, const QString& text, const QString& source)
+{
+    if (m_subscriptions.isEmpty() || !server)
+        return;
+
+    const QString lcTarget = target.toLower();
+    QString connectionId;
+    QVariantMap event;
+
+    foreach (EventSubscription* subscription, m_subscriptions)
+    {
+        if (!subscription->m_types.isEmpty() && !subscription->m_types.contains(type))
+            continue;
+
+        if (!subscription->m_target.isEmpty() && subscription->m_target != lcTarget)
+            continue;
+
+        if (!subscription->m_server.isEmpty())
+        {
+            if (connectionId.isEmpty())
+                connectionId = QString::number(server->connectionId());
+
+            if (subscription->m_server != connectionId
+                && subscription->m_server != server->getServerName().toLower()
+                && subscription->m_server != server->getDisplayName().toLower())
+                continue;
+        }
+
+        // only built once something wants it
+        if (event.isEmpty())
+        {
+            event.insert("type", type);
+            event.insert("connection", server->connectionId());
+            event.insert("server", server->getDisplayName());
+            event.insert("target", target);
+            event.insert("nick", nick);
+            event.insert("text", text);
+            event.insert("source", source);
+            event.insert("time", QDateTime::currentDateTime().toTime_t());
+        }
+
+        if (subscription->m_pending.count() == MaxPendingEvents)
+        {
+            subscription->m_pending.removeFirst();
+            ++subscription->m_dropped;
+        }
+
+        subscription->m_pending.append(event);
+
+        if (!m_flushTimer->isActive())
+            m_flushTimer->start();
+    }
+}
+
+void EventDBus::connectionChangedState(Server* server, Konversation::ConnectionState state)
+{
+    QString text;
+
+    switch (state)
+    {
+        case Konversation::SSConnecting:
+            text = "connecting";
+            break;
+        case Konversation::SSConnected:
+            text = "connected";
+            break;
+        case Konversation::SSDeliberatelyDisconnected:
+        case Konversation::SSInvoluntarilyDisconnected:
+            text = "disconnected";
+            break;
+        default:
+            return;
+    }
+
+    post("connection", server, QString(), server->getNickname(), text);
+}
+
+void EventDBus::flush()
+{
+    foreach (EventSubscription* subscription, m_subscriptions)
+    {
+        if (subscription->m_pending.isEmpty())
+            continue;
+
+        if (subscription->m_dropped)
+        {
+            // let the subscriber know it missed some
+            QVariantMap overflow;
+            overflow.insert("type", "overflow");
+            overflow.insert("text", QString::number(subscription->m_dropped));
+            overflow.insert("time", QDateTime::currentDateTime().toTime_t());
+            subscription->m_pending.prepend(overflow);
+            subscription->m_dropped = 0;
+        }
+
+        emit subscription->events(subscription->m_pending);
+        subscription->m_pending.clear();
+    }
+}
+
 #include "dbus.moc"
@@ -18,6 +18,17 @@
 #include "common.h"
 
 #include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QVariant>
+#include <QDBusContext>
+
+
+class QTimer;
+class QDBusServiceWatcher;
+
+class Server;
 
 namespace Konversation
 {
@@ -38,7 +49,10 @@ class DBus : public QObject
         void dbusInfo(const QString& string);
         void dbusInsertMarkerLine();
         void dbusRaw(const QString& server, const QString& command);
-        void dbusMultiServerRaw(const QString& command);
+
+        /// Lines of a sayToAll() or actionToAll() call sent so far.
+        Q_SCRIPTABLE void multiServerSendProgress(int id, int sent, int total);
+        Q_SCRIPTABLE void multiServerSendFinished(int id);
 
         void connectTo(Konversation::ConnectionFlag flag,
                        const QString& hostName,
@@ -51,8 +65,9 @@ class DBus : public QObject
     public slots:
         void setAway(const QString &awaymessage);
         void setBack();
-        void sayToAll(const QString &message);
-        void actionToAll(const QString &message);
+        /// Returns the id used by the multiServerSend signals, 0 if nothing was sent.
+        int sayToAll(const QString &message);
+        int actionToAll(const QString &message);
         void raw(const QString& server,const QString& command);
         void say(const QString& server,const QString& target,const QString& command);
         void info(const QString& string);
@@ -63,6 +78,12 @@ class DBus : public QObject
         QStringList listServers();
         QStringList listConnectedServers();
         QStringList listJoinedChannels(const QString& server);
+        /// Milliseconds from connecting until "registered" and until the
+        /// "channels" joined after registering were "usable", -1 if not yet.
+        QVariantMap getConnectTimes(const QString& server);
+        /// The last "lag" in ms and how many lags fell into each "histogram"
+        /// bucket, split at the "bounds" in ms.
+        QVariantMap getLagStatistics(const QString& server);
 
     private slots:
         void changeAwayStatus(bool away);
@@ -116,6 +137,85 @@ class IdentDBus : public QObject
         QStringList listIdentities();
 };
 
+/**
+ * One subscriber's view of the event stream, exported at the path returned by
+ * EventDBus::subscribe(). Events come in batches, each one a map with the keys
+ * "type", "connection", "server", "target", "nick", "text", "source" and
+ * "time". "source" is only set when someone else than "nick" caused the event.
+ */
+class EventSubscription : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.kde.konversation.Events")
+
+    friend class EventDBus;
+
+    public:
+        explicit EventSubscription(QObject* parent = 0);
+
+    signals:
+        void events(const QVariantList& batch);
+
+    private:
+        /// The bus name of the subscriber.
+        QString m_service;
+
+        /// Lowercase filters, empty ones match everything.
+        QSet<QString> m_types;
+        QString m_server;
+        QString m_target;
+
+        QVariantList m_pending;
+        int m_dropped;
+};
+
+/**
+ * Lets external tools subscribe to what happens on IRC instead of polling.
+ *
+ * Event types are "message", "action", "join", "part", "quit", "kick", "nick",
+ * "highlight" and "connection". Quits and nick changes are posted once for
+ * every channel the nick shared with us. Filtering happens here, so a subscriber only
+ * receives the events it asked for, and events are delivered in batches so a
+ * busy channel costs a few signals per second rather than one per line.
+ */
+class EventDBus : public QObject, protected QDBusContext
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.kde.konversation")
+
+    public:
+        explicit EventDBus(QObject* parent = 0);
+        ~EventDBus();
+
+        /// Queue an event for the subscriptions it matches. Cheap if there are none.
+        /// source is who caused it if that is not nick, like the kicker of a kick.
+        void post(const QString& type, Server* server, const QString& target,
+            const QString& nick, const QString& text = QString(), const QString& source = QString());
+
+    public slots:
+        /**
+         * Subscribe to events. Empty filters match everything; server is a
+         * connection id, server name or network name like in the other calls.
+         * Returns the object path the events() signal will be emitted on. The
+         * subscription ends with unsubscribe() or when the caller leaves the bus.
+         */
+        QString subscribe(const QStringList& types, const QString& server, const QString& target);
+        void unsubscribe(const QString& path);
+
+    private slots:
+        void connectionChangedState(Server* server, Konversation::ConnectionState state);
+        void serviceUnregistered(const QString& service);
+        void flush();
+
+    private:
+        void removeSubscription(EventSubscription* subscription);
+
+        QHash<QString, EventSubscription*> m_subscriptions;
+        QDBusServiceWatcher* m_serviceWatcher;
+        QTimer* m_flushTimer;
+        int m_nextId;
+};
+
 }
 
 #endif
@@ -18,6 +18,7 @@
 
 #include <cmath>
 
+#include <QImage>
 #include <QPainter>
 #include <QPixmap>
 #include <QResizeEvent>
@@ -31,6 +32,8 @@ namespace Konversation
     namespace DCC
     {
         static const int InvalidLastPos = -32546;
+        // length of the lines forming an arrow head
+        static const int ArrowLength = 9;
 
         WhiteBoardPaintArea::WhiteBoardPaintArea(QWidget* parent)
             : QWidget(parent),
@@ -41,6 +44,8 @@ namespace Konversation
               m_backgroundColor(Qt::white),
               m_penWidth(1)
         {
+            m_image = new QImage(width(), height(), QImage::Format_RGB32);
+            m_image->fill(QColor(Qt::white).rgb());
             m_imagePixmap = new QPixmap(width(), height());
             m_imagePixmap->fill(Qt::white);
             m_overlayPixmap = new QPixmap(width(), height());
@@ -54,6 +59,7 @@ namespace Konversation
 
         WhiteBoardPaintArea::~WhiteBoardPaintArea()
         {
+            delete m_image;
             delete m_imagePixmap;
             delete m_overlayPixmap;
         }
@@ -77,7 +83,7 @@ namespace Konversation
             {
                 if (isLastPosValid())
                 {
-                    m_overlayPixmap->fill(Qt::transparent);
+                    clearOverlay();
                     text(m_overlayPixmap, m_font, m_foregroundColor, m_backgroundColor, m_lastPos.x(), m_lastPos.y(), m_writtenText, true, m_tool);
                     update();
                 }
@@ -97,7 +103,7 @@ namespace Konversation
             {
                 if (isLastPosValid())
                 {
-                    m_overlayPixmap->fill(Qt::transparent);
+                    clearOverlay();
                     text(m_overlayPixmap, m_font, m_foregroundColor, m_backgroundColor, m_lastPos.x(), m_lastPos.y(), m_writtenText, true, m_tool);
                     update();
                 }
@@ -114,7 +120,7 @@ namespace Konversation
             m_font = font;
             if (isLastPosValid() && m_tool == WhiteBoardGlobals::TextExtended)
             {
-                m_overlayPixmap->fill(Qt::transparent);
+                clearOverlay();
                 text(m_overlayPixmap, m_font, m_foregroundColor, m_backgroundColor, m_lastPos.x(), m_lastPos.y(), m_writtenText, true, m_tool);
                 update();
             }
@@ -122,8 +128,10 @@ namespace Konversation
 
         void WhiteBoardPaintArea::clear()
         {
+            m_image->fill(QColor(Qt::white).rgb());
+            m_dirtyRegion = QRegion();
             m_imagePixmap->fill(Qt::white);
-            m_overlayPixmap->fill(Qt::transparent);
+            clearOverlay();
             m_mousePressed = false;
             makeLastPosInvalid();
             update();
@@ -133,7 +141,7 @@ namespace Konversation
                                            int xFrom, int yFrom, int xTo, int yTo)
         {
             checkImageSize(xFrom, yFrom, xTo, yTo, lineWidth);
-            QPainter tPaint(m_imagePixmap);
+            QPainter tPaint(m_image);
             tPaint.setPen(getPen(penColor, lineWidth, WhiteBoardGlobals::Line));
             tPaint.setBrush(brushColor);
 
@@ -149,113 +157,121 @@ namespace Konversation
                 tPaint.drawLine(xFrom, yFrom, xTo, yTo);
             }
             tPaint.end();
-            update();
+            imageChanged(strokeRect(xFrom, yFrom, xTo, yTo, lineWidth));
         }
 
         void WhiteBoardPaintArea::drawRectangle(int lineWidth, const QColor& penColor,
                                                 int xFrom, int yFrom, int xTo, int yTo)
         {
             checkImageSize(xFrom, yFrom, xTo, yTo, lineWidth);
-            QPainter tPaint(m_imagePixmap);
+            QPainter tPaint(m_image);
             tPaint.setPen(getPen(penColor, lineWidth, WhiteBoardGlobals::Rectangle));
             tPaint.drawRect(xFrom, yFrom, xTo-xFrom, yTo-yFrom);
             tPaint.end();
-            update();
+            imageChanged(strokeRect(xFrom, yFrom, xTo, yTo, lineWidth));
         }
 
         void WhiteBoardPaintArea::drawFilledRectangle(int lineWidth, const QColor& penColor, const QColor& brushColor,
                                                       int xFrom, int yFrom, int xTo, int yTo)
         {
             checkImageSize(xFrom, yFrom, xTo, yTo, lineWidth);
-            QPainter tPaint(m_imagePixmap);
+            QPainter tPaint(m_image);
             tPaint.setPen(getPen(penColor, lineWidth, WhiteBoardGlobals::FilledRectangle));
             tPaint.setBrush(brushColor);
             drawRect(&tPaint, xFrom, yFrom, xTo, yTo);
             tPaint.end();
-            update();
+            imageChanged(strokeRect(xFrom, yFrom, xTo, yTo, lineWidth));
         }
 
         void WhiteBoardPaintArea::drawEllipse(int lineWidth, const QColor& penColor,
                                               int xFrom, int yFrom, int xTo, int yTo)
         {
             checkImageSize(xFrom, yFrom, xTo, yTo, lineWidth);
-            QPainter tPaint(m_imagePixmap);
+            QPainter tPaint(m_image);
             tPaint.setPen(getPen(penColor, lineWidth, WhiteBoardGlobals::Ellipse));
             tPaint.drawEllipse(xFrom, yFrom, xTo-xFrom, yTo-yFrom);
             tPaint.end();
-            update();
+            imageChanged(strokeRect(xFrom, yFrom, xTo, yTo, lineWidth));
         }
 
         void WhiteBoardPaintArea::drawFilledEllipse(int lineWidth, const QColor& penColor, const QColor& brushColor,
                                                     int xFrom, int yFrom, int xTo, int yTo)
         {
             checkImageSize(xFrom, yFrom, xTo, yTo, lineWidth);
-            QPainter tPaint(m_imagePixmap);
+            QPainter tPaint(m_image);
             tPaint.setPen(getPen(penColor, lineWidth, WhiteBoardGlobals::FilledEllipse));
             tPaint.setBrush(brushColor);
             tPaint.drawEllipse(xFrom, yFrom, xTo-xFrom, yTo-yFrom);
             tPaint.end();
-            update();
+            imageChanged(strokeRect(xFrom, yFrom, xTo, yTo, lineWidth));
         }
 
         void WhiteBoardPaintArea::drawArrow(int lineWidth, const QColor& penColor, int xFrom, int yFrom, int xTo, int yTo)
         {
             checkImageSize(xFrom, yFrom, xTo, yTo, lineWidth);
-            QPainter tPaint(m_imagePixmap);
+            QPainter tPaint(m_image);
             tPaint.setPen(getPen(penColor, lineWidth, WhiteBoardGlobals::Arrow));
             arrow(&tPaint, xFrom, yFrom, xTo, yTo);
             tPaint.end();
-            update();
+            imageChanged(strokeRect(xFrom, yFrom, xTo, yTo, lineWidth + ArrowLength));
         }
 
         void WhiteBoardPaintArea::useEraser(int lineWidth, int xFrom, int yFrom, int xTo, int yTo)
         {
             checkImageSize(xFrom, yFrom, xTo, yTo, lineWidth);
-            QPainter tPaint(m_imagePixmap);
+            QPainter tPaint(m_image);
             tPaint.setPen(getPen(Qt::white, lineWidth, WhiteBoardGlobals::Eraser));
             tPaint.drawLine(xFrom, yFrom, xTo, yTo);
             tPaint.end();
-            update();
+            imageChanged(strokeRect(xFrom, yFrom, xTo, yTo, lineWidth));
         }
 
         void WhiteBoardPaintArea::useFloodFill (int x, int y, const QColor& color)
         {
             checkImageSize(x, y, 0, 0, 1);
             floodfill(x, y, color);
-            update();
         }
 
         void WhiteBoardPaintArea::useBlt(int x1src, int y1src, int x2src, int y2src, int xdest, int ydest)
         {
-            //TODO optimize me
             checkImageSize(x2src, y2src, xdest, ydest, 1);
-            QPixmap copyPix(m_imagePixmap->copy(x1src, y1src, x2src-x1src, y2src-y1src));
-            QPainter tPaint(m_imagePixmap);
-            tPaint.drawPixmap(xdest, ydest, copyPix);
+            const QImage copyImage(m_image->copy(x1src, y1src, x2src-x1src, y2src-y1src));
+            QPainter tPaint(m_image);
+            tPaint.drawImage(xdest, ydest, copyImage);
             tPaint.end();
-            update();
+            imageChanged(QRect(QPoint(xdest, ydest), copyImage.size()));
         }
 
         void WhiteBoardPaintArea::useText(int x1, int y1, const QString& textString)
         {
-            text(m_imagePixmap, QFont(), Qt::black, Qt::white, x1, y1, textString, false, WhiteBoardGlobals::Text);
-            update();
+            text(m_image, QFont(), Qt::black, Qt::white, x1, y1, textString, false, WhiteBoardGlobals::Text);
         }
 
         void WhiteBoardPaintArea::useTextExtended(int x1, int y1, const QFont& font, const QColor& foreGround, const QColor& backGround, const QString& textString)
         {
-            text(m_imagePixmap, font, foreGround, backGround, x1, y1, textString, false, WhiteBoardGlobals::TextExtended);
-            update();
+            text(m_image, font, foreGround, backGround, x1, y1, textString, false, WhiteBoardGlobals::TextExtended);
         }
 
         void WhiteBoardPaintArea::save(const QString& fileName)
         {
-            m_imagePixmap->save(fileName);
+            m_image->save(fileName);
         }
 
         void WhiteBoardPaintArea::paintEvent(QPaintEvent *event)
         {
             //kDebug();
+            // bring the on screen copy up to date with what the tools painted
+            if (!m_dirtyRegion.isEmpty())
+            {
+                QPainter tUpload(m_imagePixmap);
+                foreach (const QRect& rect, m_dirtyRegion.rects())
+                {
+                    tUpload.drawImage(rect.topLeft(), *m_image, rect);
+                }
+                tUpload.end();
+                m_dirtyRegion = QRegion();
+            }
+
             QPainter tPaint;
             tPaint.begin(this);
 
@@ -307,7 +323,7 @@ namespace Konversation
             if (event->buttons() & Qt::RightButton && m_tool != WhiteBoardGlobals::Pencil)
             {
                 m_mousePressed = false;
-                m_overlayPixmap->fill(Qt::transparent);
+                clearOverlay();
                 m_writtenText.clear();
                 makeLastPosInvalid();
                 update();
@@ -323,12 +339,11 @@ namespace Konversation
                     floodfill(event->pos().x(), event->pos().y(), m_foregroundColor);
                     setCursor(oldCur);
                     emit usedFloodFill(event->pos().x(), event->pos().y(), m_foregroundColor);
-                    update();
                 }
                 else if (m_tool == WhiteBoardGlobals::TextExtended || m_tool == WhiteBoardGlobals::Text)
                 {
                     m_mousePressed = false;
-                    m_overlayPixmap->fill(Qt::transparent);
+                    clearOverlay();
                     if (isLastPosValid())
                     {
                         finishText();
@@ -401,12 +416,8 @@ namespace Konversation
                     return;
                 }
 
-                QPainter tPainter(m_imagePixmap);
-                tPainter.drawPixmap(0,0, *m_overlayPixmap);
-                tPainter.end();
-                m_overlayPixmap->fill(Qt::transparent);
+                mergeOverlay();
                 makeLastPosInvalid();
-                update();
             }
         }
 
@@ -423,6 +434,8 @@ namespace Konversation
                     checkImageSize(event->pos().x(), event->pos().y(), 0, 0, m_penWidth);
                 }
 
+                const QPoint tFrom = isLastPosValid() ? m_lastPos : event->pos();
+
                 QPainter tPainter(m_overlayPixmap);
                 tPainter.setPen(getPen(m_foregroundColor, m_penWidth, m_tool));
 
@@ -454,7 +467,7 @@ namespace Konversation
                     {
                         if (isLastPosValid())
                         {
-                            m_overlayPixmap->fill(Qt::transparent);
+                            clearOverlay();
                             const int xStart = m_lastPos.x();
                             const int yStart = m_lastPos.y();
                             const int xTo = event->pos().x() - xStart;
@@ -477,7 +490,7 @@ namespace Konversation
                     {
                         if (isLastPosValid())
                         {
-                            m_overlayPixmap->fill(Qt::transparent);
+                            clearOverlay();
                             drawRect(&tPainter, m_lastPos.x(), m_lastPos.y(), event->pos().x(), event->pos().y());
                         }
                         else
@@ -492,7 +505,7 @@ namespace Konversation
                     {
                         if (isLastPosValid())
                         {
-                            m_overlayPixmap->fill(Qt::transparent);
+                            clearOverlay();
                             tPainter.drawLine(m_lastPos, event->pos());
                         }
                         else
@@ -529,7 +542,7 @@ namespace Konversation
                     {
                         if (isLastPosValid())
                         {
-                            m_overlayPixmap->fill(Qt::transparent);
+                            clearOverlay();
                             arrow(&tPainter, m_lastPos.x(), m_lastPos.y(), event->pos().x(), event->pos().y());
                         }
                         else
@@ -546,8 +559,7 @@ namespace Konversation
 
                 case WhiteBoardGlobals::ColorPicker:
                     {
-                        QImage image = m_imagePixmap->toImage();
-                        QColor fgColor(image.pixel(event->pos().x(), event->pos().y()));
+                        QColor fgColor(m_image->pixel(event->pos().x(), event->pos().y()));
                         m_foregroundColor = fgColor;
                         emit colorPicked(fgColor);
                     }
@@ -559,6 +571,9 @@ namespace Konversation
                 }
                 tPainter.end();
 
+                // the arrow head is the widest any tool gets beyond its end points
+                m_overlayRect |= strokeRect(tFrom.x(), tFrom.y(), event->pos().x(), event->pos().y(), m_penWidth + ArrowLength);
+
                 update();
             }
         }
@@ -590,7 +605,7 @@ namespace Konversation
                 {
                     m_writtenText.chop(1);
                 }
-                m_overlayPixmap->fill(Qt::transparent);
+                clearOverlay();
                 text(m_overlayPixmap, m_font, m_foregroundColor, m_backgroundColor, m_lastPos.x(), m_lastPos.y(), m_writtenText, true, m_tool);
                 update();
             }
@@ -633,8 +648,17 @@ namespace Konversation
 
         void WhiteBoardPaintArea::resizeImage(int width, int height)
         {
-            if (m_imagePixmap->height() < height || m_imagePixmap->width() < width)
+            if (m_image->height() < height || m_image->width() < width)
             {
+                QImage* oldImage = m_image;
+                m_image = new QImage(width, height, QImage::Format_RGB32);
+                m_image->fill(QColor(Qt::white).rgb());
+                QPainter tPaintImage(m_image);
+                tPaintImage.drawImage(0, 0, *oldImage);
+                tPaintImage.end();
+                delete oldImage;
+
+                // pending uploads stay valid, the old content is kept at the same place
                 QPixmap* oldImg = m_imagePixmap;
                 m_imagePixmap = new QPixmap(width, height);
                 m_imagePixmap->fill(Qt::white);
@@ -657,6 +681,42 @@ namespace Konversation
             }
         }
 
+        QRect WhiteBoardPaintArea::strokeRect(int x1, int y1, int x2, int y2, int penWidth) const
+        {
+            // generous enough for square caps, miter joins and antialiasing
+            const int margin = penWidth + 2;
+            return QRect(QPoint(qMin(x1, x2), qMin(y1, y2)), QPoint(qMax(x1, x2), qMax(y1, y2)))
+                   .adjusted(-margin, -margin, margin, margin);
+        }
+
+        void WhiteBoardPaintArea::imageChanged(const QRect& rect)
+        {
+            const QRect tRect = rect & m_image->rect();
+            m_dirtyRegion += tRect;
+            update(tRect);
+        }
+
+        void WhiteBoardPaintArea::clearOverlay()
+        {
+            m_overlayPixmap->fill(Qt::transparent);
+            m_overlayRect = QRect();
+        }
+
+        void WhiteBoardPaintArea::mergeOverlay()
+        {
+            const QRect tRect = m_overlayRect & m_image->rect();
+            if (!tRect.isEmpty())
+            {
+                // only convert the part of the overlay that was painted on
+                const QImage tOverlay = m_overlayPixmap->copy(tRect).toImage();
+                QPainter tPainter(m_image);
+                tPainter.drawImage(tRect.topLeft(), tOverlay);
+                tPainter.end();
+                imageChanged(tRect);
+            }
+            clearOverlay();
+        }
+
         QPen WhiteBoardPaintArea::getPen(const QColor& color, int lineWidth, WhiteBoardGlobals::WhiteBoardTool tool)
         {
             switch (tool)
@@ -681,17 +741,18 @@ namespace Konversation
         void WhiteBoardPaintArea::floodfill(int x, int y, const QColor& fillColor)
         {
             // A recursiv "fast" floodfill *can* cause a stackoverflow
-            // so we use a "slow" stack + extra data.
-            // TODO optimize me, mass QImage::pixel use is slow
-            QImage image = m_imagePixmap->toImage();
-            const int width = image.width();
-            const int height = image.height();
+            // so we fill whole spans of a line at once and only keep
+            // one seed per span of the lines above and below on a stack.
+            const int width = m_image->width();
+            const int height = m_image->height();
             if (x < 0 || y < 0 || x >= width || y >= height)
             {
                 return;
             }
-            QRgb originalColor = image.pixel(x,y);
-            QRgb color = fillColor.rgb();
+
+            // Format_RGB32 always stores 0xffRRGGBB
+            const QRgb originalColor = reinterpret_cast<const QRgb*>(m_image->scanLine(y))[x];
+            const QRgb color = fillColor.rgb() | 0xff000000;
 
             if (color == originalColor)
             {
@@ -699,6 +760,11 @@ namespace Konversation
                 return;
             }
 
+            int minX = x;
+            int maxX = x;
+            int minY = y;
+            int maxY = y;
+
             QStack<StackCoords> tStack;
             StackCoords t;
             t.x = x;
@@ -707,43 +773,68 @@ namespace Konversation
             tStack.push(t);
             while (!tStack.isEmpty())
             {
-                StackCoords co = tStack.pop();
-                image.setPixel(co.x, co.y, color);
+                const StackCoords co = tStack.pop();
+                QRgb* line = reinterpret_cast<QRgb*>(m_image->scanLine(co.y));
 
-                StackCoords tLeft;
-                tLeft.x = co.x-1;
-                tLeft.y = co.y;
-                if (tLeft.x >= 0 && image.pixel(tLeft.x, tLeft.y) == originalColor)
+                if (line[co.x] != originalColor)
                 {
-                    tStack.push(tLeft);
+                    // filled by an earlier span
+                    continue;
                 }
 
-                StackCoords tRight;
-                tRight.x = co.x+1;
-                tRight.y = co.y;
-                if (tRight.x < width && image.pixel(tRight.x, tRight.y) == originalColor)
+                int left = co.x;
+                while (left > 0 && line[left-1] == originalColor)
+                {
+                    --left;
+                }
+                int right = co.x;
+                while (right < width-1 && line[right+1] == originalColor)
                 {
-                    tStack.push(tRight);
+                    ++right;
                 }
 
-                StackCoords tUp;
-                tUp.x = co.x;
-                tUp.y = co.y-1;
-                if (tUp.y >= 0 && image.pixel(tUp.x, tUp.y) == originalColor)
+                for (int i = left; i <= right; ++i)
                 {
-                    tStack.push(tUp);
+                    line[i] = color;
                 }
 
-                StackCoords tDown;
-                tDown.x = co.x;
-                tDown.y = co.y+1;
-                if (tDown.y < height && image.pixel(tDown.x, tDown.y) == originalColor)
+                minX = qMin(minX, left);
+                maxX = qMax(maxX, right);
+                minY = qMin(minY, co.y);
+                maxY = qMax(maxY, co.y);
+
+                // one seed for every run of originalColor next to the span
+                for (int ny = co.y-1; ny <= co.y+1; ny += 2)
                 {
-                    tStack.push(tDown);
+                    if (ny < 0 || ny >= height)
+                    {
+                        continue;
+                    }
+
+                    const QRgb* nextLine = reinterpret_cast<const QRgb*>(m_image->scanLine(ny));
+                    bool inRun = false;
+                    for (int i = left; i <= right; ++i)
+                    {
+                        if (nextLine[i] == originalColor)
+                        {
+                            if (!inRun)
+                            {
+                                StackCoords seed;
+                                seed.x = i;
+                                seed.y = ny;
+                                tStack.push(seed);
+                                inRun = true;
+                            }
+                        }
+                        else
+                        {
+                            inRun = false;
+                        }
+                    }
                 }
             }
-            delete m_imagePixmap;
-            m_imagePixmap = new QPixmap(QPixmap::fromImage(image));
+
+            imageChanged(QRect(QPoint(minX, minY), QPoint(maxX, maxY)));
         }
 
         void WhiteBoardPaintArea::arrow(QPainter* painter, int x1, int y1, int x2, int y2)
@@ -791,17 +882,15 @@ namespace Konversation
                 }
             }
 
-            static const int arrowLength = 9;
-
             angle -= M_PI;
             static const qreal radDiff = qreal(2)* M_PI / qreal(360) * 22;
             qreal tRightAngle = angle + radDiff;
-            const int x1Arrow = sin(tRightAngle) * arrowLength + x2;
-            const int y1Arrow = cos(tRightAngle) * arrowLength + y2;
+            const int x1Arrow = sin(tRightAngle) * ArrowLength + x2;
+            const int y1Arrow = cos(tRightAngle) * ArrowLength + y2;
 
             qreal tLeftAngle = angle - radDiff;
-            const int x2Arrow = sin(tLeftAngle) * arrowLength + x2;
-            const int y2Arrow = cos(tLeftAngle) * arrowLength + y2;
+            const int x2Arrow = sin(tLeftAngle) * ArrowLength + x2;
+            const int y2Arrow = cos(tLeftAngle) * ArrowLength + y2;
 
             painter->drawLine(x1, y1, x2, y2);
             painter->drawLine(x1Arrow, y1Arrow, x2, y2);
@@ -825,7 +914,7 @@ namespace Konversation
             }
             else
             {
-                device = m_imagePixmap;
+                device = m_image;
             }
 
             QPainter tPaint(device);
@@ -864,17 +953,29 @@ namespace Konversation
                 tPaint.drawRect(x1-1,y1-1, tSize.width()+1, tSize.height()+1);
             }
             tPaint.end();
+
+            // leave room for descenders, italic overhang and the selection frame
+            const int margin = tMetrics.height();
+            const QRect tTextRect = QRect(x1, y1, tSize.width(), tSize.height()).adjusted(-margin, -margin, margin, margin);
+            if (isOverlay)
+            {
+                m_overlayRect |= tTextRect;
+            }
+            else
+            {
+                imageChanged(tTextRect);
+            }
         }
 
         void WhiteBoardPaintArea::finishText()
         {
-            m_overlayPixmap->fill(Qt::transparent);
+            clearOverlay();
             if (m_writtenText.isEmpty())
             {
                 return;
             }
 
-            text(m_imagePixmap, m_font, m_foregroundColor, m_backgroundColor, m_lastPos.x(), m_lastPos.y(), m_writtenText, false, m_tool);
+            text(m_image, m_font, m_foregroundColor, m_backgroundColor, m_lastPos.x(), m_lastPos.y(), m_writtenText, false, m_tool);
             if (m_tool == WhiteBoardGlobals::TextExtended)
             {
                 emit usedTextExtended(m_lastPos.x(), m_lastPos.y(), m_font, m_foregroundColor, m_backgroundColor, m_writtenText);
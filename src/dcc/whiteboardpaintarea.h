@@ -16,6 +16,8 @@
 #include <QPoint>
 #include <QColor>
 #include <QPen>
+#include <QRect>
+#include <QRegion>
 
 #include "whiteboardglobals.h"
 
@@ -24,6 +26,7 @@ class QPaintEvent;
 class QResizeEvent;
 class QMouseEvent;
 class QPixmap;
+class QImage;
 class QKeyEvent;
 
 namespace Konversation
@@ -103,6 +106,11 @@ namespace Konversation
             inline void checkImageSize(int x1, int y1, int x2, int y2, int penWidth = 1);
             inline void resizeImage(int width, int height);
 
+            inline QRect strokeRect(int x1, int y1, int x2, int y2, int penWidth) const;
+            inline void imageChanged(const QRect& rect);
+            inline void clearOverlay();
+            inline void mergeOverlay();
+
             inline QPen getPen(const QColor& color, int lineWidth, WhiteBoardGlobals::WhiteBoardTool tool);
 
             inline void floodfill(int x, int y, const QColor& fillColor);
@@ -116,8 +124,15 @@ namespace Konversation
 
             inline void drawRect(QPainter* painter, int xFrom, int yFrom, int xTo, int yTo);
 
+            // the board itself, all tools paint here
+            QImage* m_image;
+            // on screen copy of m_image, only m_dirtyRegion gets uploaded again
             QPixmap* m_imagePixmap;
+            QRegion m_dirtyRegion;
+
             QPixmap* m_overlayPixmap;
+            // part of m_overlayPixmap that may hold something
+            QRect m_overlayRect;
 
             bool m_mousePressed;
             QPoint m_lastPos;
@@ -76,25 +76,34 @@ class JapaneseCode
   enum Type {K_ASCII, K_JIS, K_EUC, K_SJIS, K_UNICODE, K_UTF8 };
   enum Type guess_jp(const char* buf, int buflen);
   
-  JapaneseCode () {
-    eucj = new guess_dfa(guess_eucj_st, guess_eucj_ar);
-    sjis = new guess_dfa(guess_sjis_st, guess_sjis_ar);
-    utf8 = new guess_dfa(guess_utf8_st, guess_utf8_ar);
+  JapaneseCode () :
+    eucj_dfa(guess_eucj_st, guess_eucj_ar),
+    sjis_dfa(guess_sjis_st, guess_sjis_ar),
+    utf8_dfa(guess_utf8_st, guess_utf8_ar)
+  {
+    eucj = &eucj_dfa;
+    sjis = &sjis_dfa;
+    utf8 = &utf8_dfa;
     last_JIS_escape = false;
   }
   
-  ~JapaneseCode () {
-    delete eucj;
-    delete sjis;
-    delete utf8;
-  }
-  
  protected:
+  /* The DFAs live inside the object so a guesser can be put on the
+     stack without any heap allocation. */
+  guess_dfa eucj_dfa;
+  guess_dfa sjis_dfa;
+  guess_dfa utf8_dfa;
+
   guess_dfa *eucj;
   guess_dfa *sjis;
   guess_dfa *utf8;
   
   bool last_JIS_escape;
+
+ private:
+  /* eucj/sjis/utf8 point into this object */
+  JapaneseCode (const JapaneseCode&);
+  JapaneseCode& operator= (const JapaneseCode&);
 };
 
 #define DFA_NEXT(dfa, ch)                               \
@@ -17,6 +17,7 @@
 #include "server.h"
 #include "nick.h"
 #include "nicklistview.h"
+#include "nicklistmodel.h"
 #include "quickbutton.h"
 #include "modebutton.h"
 #include "ircinput.h"
@@ -80,6 +81,8 @@ Channel::Channel(QWidget* parent, const QString& _name) : ChatWindow(parent)
     m_processedNicksCount = 0;
     m_processedOpsCount = 0;
     m_initialNamesReceived = false;
+    m_nicksKept = false;
+    m_modeRequestsDeferred = false;
     nicks = 0;
     ops = 0;
     completionPosition = 0;
@@ -202,7 +205,8 @@ Channel::Channel(QWidget* parent, const QString& _name) : ChatWindow(parent)
     m_horizSplitter->setStretchFactor(m_horizSplitter->indexOf(nickListButtons), 0);
     nickListButtons->setSpacing(spacing());
 
-    nicknameListView=new NickListView(nickListButtons, this);
+    m_nickListModel = new NickListModel(this);
+    nicknameListView=new NickListView(nickListButtons, this, m_nickListModel);
     nicknameListView->installEventFilter(this);
 
     // initialize buttons grid, will be set up in updateQuickButtons
@@ -270,23 +274,14 @@ Channel::Channel(QWidget* parent, const QString& _name) : ChatWindow(parent)
     connect(getTextView(),SIGNAL (sendFile()),this,SLOT (sendFileMenu()) );
     connect(getTextView(),SIGNAL (autoText(QString)),this,SLOT (sendText(QString)) );
 
-    connect(nicknameListView,SIGNAL (itemDoubleClicked(QTreeWidgetItem*,int)),this,SLOT (doubleClickCommand(QTreeWidgetItem*,int)) );
+    connect(nicknameListView,SIGNAL (doubleClicked(QModelIndex)),this,SLOT (doubleClickCommand(QModelIndex)) );
     connect(nicknameCombobox,SIGNAL (activated(int)),this,SLOT(nicknameComboboxChanged()));
 
     if(nicknameCombobox->lineEdit())
         connect(nicknameCombobox->lineEdit(), SIGNAL (editingFinished()),this,SLOT(nicknameComboboxChanged()));
 
 
-    connect(&userhostTimer,SIGNAL (timeout()),this,SLOT (autoUserhost()));
-
-    m_whoTimer.setSingleShot(true);
-    connect(&m_whoTimer, SIGNAL(timeout()), this, SLOT(autoWho()));
-    connect(Application::instance(), SIGNAL(appearanceChanged()), this, SLOT(updateAutoWho()));
-
-    // every 5 minutes decrease everyone's activity by 1 unit
-    m_fadeActivityTimer.start(5*60*1000);
-
-    connect(&m_fadeActivityTimer, SIGNAL(timeout()), this, SLOT(fadeActivity()));
+    connect(&m_columnResizeTimer,SIGNAL (timeout()),this,SLOT (resizeNicknameListViewColumns()));
 
     updateAppearance();
 
@@ -427,17 +422,30 @@ void Channel::purgeNicks()
     m_ownChannelNick = 0;
 
     // Purge nickname list
+    m_nickListModel->clear();
     qDeleteAll(nicknameList);
     nicknameList.clear();
     m_nicknameNickHash.clear();
 
-    // Execute this otherwise it may crash trying to access
-    // deleted nicks
-    nicknameListView->executeDelayedItemsLayout();
-
     // clear stats counter
     nicks=0;
     ops=0;
+
+    m_unconfirmedNicks.clear();
+}
+
+void Channel::keepNicksForRejoin()
+{
+    m_nicksKept = true;
+}
+
+void Channel::purgeKeptNicks()
+{
+    if (!m_nicksKept)
+        return;
+
+    m_nicksKept = false;
+    purgeNicks();
 }
 
 void Channel::showOptionsDialog()
@@ -465,13 +473,12 @@ void Channel::textPasted(const QString& text)
 }
 
 // Will be connected to NickListView::doubleClicked()
-void Channel::doubleClickCommand(QTreeWidgetItem *item, int column)
+void Channel::doubleClickCommand(const QModelIndex& index)
 {
-    Q_UNUSED(column)
-    if(item)
+    if(index.isValid())
     {
         nicknameListView->clearSelection();
-        item->setSelected(true);
+        nicknameListView->selectionModel()->select(index, QItemSelectionModel::Select | QItemSelectionModel::Rows);
         // TODO: put the quick button code in another function to make reusal more legitimate
         quickButtonClicked(Preferences::self()->channelDoubleClickAction());
     }
@@ -848,11 +855,8 @@ QStringList Channel::getSelectedNickList()
 {
     QStringList selectedNicks;
 
-    foreach (Nick* nick, nicknameList)
-    {
-        if (nick->isSelected())
-            selectedNicks << nick->getChannelNick()->getNickname();
-    }
+    foreach (Nick* nick, nicknameListView->selectedNicks())
+        selectedNicks << nick->getChannelNick()->getNickname();
 
     return selectedNicks;
 }
@@ -956,34 +960,13 @@ void Channel::fastAddNickname(ChannelNickPtr channelnick, Nick *nick)
     Q_ASSERT(channelnick);
     if(!channelnick) return;
 
-    if (!nick || !nick->treeWidget())
+    if (!nick)
     {
-        // Deal with nicknameListView now (creating nick if necessary)
-        NickListView::NoSorting noSorting(nicknameListView);
-        int index = nicknameListView->topLevelItemCount();
-
-        // Append nick to the lists
-        if (nick)
-        {
-            nicknameListView->addTopLevelItem(nick);
-        }
-        else
-        {
-            nick = new Nick(nicknameListView, this, channelnick);
-            m_nicknameListViewTextChanged |= 0xFF; // new nick, text changed.
-        }
-
-        if (!m_delayedSortTimer->isActive()) {
-            // Find its right place and insert where it belongs
-            int newindex = nicknameListView->findLowerBound(*nick);
-            if (newindex != index) {
-                if (newindex >= index)
-                    newindex--;
-                nicknameListView->takeTopLevelItem(index);
-                nicknameListView->insertTopLevelItem(newindex, nick);
-            }
-        }
-        // Otherwise it will be sorted by delayed sort.
+        // Deal with the nick list model now. It inserts the nick at its
+        // place, or appends it if sorting is delayed.
+        nick = new Nick(m_nickListModel, this, channelnick);
+        m_nicknameListViewTextChanged |= 0xFF; // new nick, text changed.
+        m_nickListModel->insertNick(nick);
     }
 
     // Now deal with nicknameList
@@ -1062,6 +1045,9 @@ void Channel::nickRenamed(const QString &oldNick, const NickInfo& nickInfo)
         m_nicknameNickHash.remove(oldNick.toLower());
         m_nicknameNickHash.insert(newNick.toLower(), nick);
 
+        if (m_unconfirmedNicks.remove(oldNick.toLower()))
+            m_unconfirmedNicks.insert(newNick.toLower());
+
         repositionNick(nick);
     }
 }
@@ -1079,8 +1065,17 @@ void Channel::joinNickname(ChannelNickPtr channelNick)
                                  "You (%1) have joined the channel %2.", channelNick->getHostmask(), getName()), false, true);
 
         // Prepare for impending NAMES.
-        purgeNicks();
-        nicknameListView->setUpdatesEnabled(false);
+        if (m_nicksKept)
+        {
+            // Whoever the NAMES reply doesn't list left while we were gone
+            m_nicksKept = false;
+            m_unconfirmedNicks = QSet<QString>::fromList(m_nicknameNickHash.keys());
+        }
+        else
+        {
+            purgeNicks();
+            nicknameListView->setUpdatesEnabled(false);
+        }
 
         m_ownChannelNick = channelNick;
         refreshModeButtons();
@@ -1105,6 +1100,7 @@ void Channel::joinNickname(ChannelNickPtr channelNick)
         if (displayCommandMessage)
             appendCommandMessage(i18nc("Message type", "Join"), i18nc("%1 is the nick joining and %2 the hostmask of that nick",
                                  "%1 (%2) has joined this channel.", nick, hostname), false);
+        m_unconfirmedNicks.remove(channelNick->loweredNickname());
         addNickname(channelNick);
     }
 }
@@ -1181,11 +1177,10 @@ void Channel::removeNick(ChannelNickPtr channelNick, const QString &reason, bool
 
         if(nick)
         {
+            m_nickListModel->removeNick(nick);
             nicknameList.removeOne(nick);
             m_nicknameNickHash.remove(channelNick->loweredNickname());
             delete nick;
-            // Execute this otherwise it may crash trying to access deleted nick
-            nicknameListView->executeDelayedItemsLayout();
         }
         else
         {
@@ -1281,6 +1276,7 @@ void Channel::kickNick(ChannelNickPtr channelNick, const QString &kicker, const
         }
         else
         {
+            m_nickListModel->removeNick(nick);
             nicknameList.removeOne(nick);
             m_nicknameNickHash.remove(channelNick->loweredNickname());
             delete nick;
@@ -1818,6 +1814,15 @@ void Channel::updateMode(const QString& sourceNick, char mode, bool plus, const
     updateModeWidgets(mode, plus, parameter);
 }
 
+void Channel::requestModes(Server::QueuePriority priority)
+{
+    m_server->queue("MODE " + getName(), priority);
+
+    clearBanList();
+    m_server->getInputFilter()->setAutomaticRequest("BANLIST", getName(), true);
+    m_server->queue("MODE " + getName() + " +b", priority);
+}
+
 void Channel::clearModeList()
 {
     QString k;
@@ -2035,6 +2040,15 @@ void Channel::showEvent(QShowEvent*)
         indicateAway(awayState);
     }
 
+    if (m_modeRequestsDeferred)
+    {
+        m_modeRequestsDeferred = false;
+
+        // The user is looking at the channel, so don't let it wait behind the others
+        if (m_joined)
+            requestModes(Server::StandardPriority);
+    }
+
     syncSplitters();
 }
 
@@ -2093,7 +2107,7 @@ void Channel::updateAppearance()
         limit->setFont(KGlobalSettings::generalFont());
     }
 
-    nicknameListView->resort();
+    m_nickListModel->resort();
     nicknameListView->setPalette(palette);
     nicknameListView->setAlternatingRowColors(Preferences::self()->inputFieldsBackgroundColor());
 
@@ -2157,7 +2171,9 @@ void Channel::endOfNames()
     {
         m_initialNamesReceived = true;
 
-        scheduleAutoWho();
+        // Otherwise the last queued invocation takes care of it
+        if (m_nickQueue.isEmpty())
+            removeUnconfirmedNicks();
     }
 }
 
@@ -2208,32 +2224,6 @@ void Channel::nicknameListViewTextChanged(int textChangedFlags)
     m_nicknameListViewTextChanged |= textChangedFlags;
 }
 
-void Channel::autoUserhost()
-{
-    if(Preferences::self()->autoUserhost() && !Preferences::self()->autoWhoContinuousEnabled())
-    {
-        int limit = 5;
-
-        QString nickString;
-
-        foreach (Nick* nick, getNickList())
-        {
-            if(nick->getChannelNick()->getHostmask().isEmpty())
-            {
-                if(limit--) nickString = nickString + nick->getChannelNick()->getNickname() + ' ';
-                else break;
-            }
-        }
-
-        if(!nickString.isEmpty()) m_server->requestUserhost(nickString);
-    }
-
-    if(!nicknameList.isEmpty())
-    {
-        resizeNicknameListViewColumns();
-    }
-}
-
 void Channel::setAutoUserhost(bool state)
 {
     nicknameListView->setColumnHidden(Nick::HostmaskColumn, !state);
@@ -2242,118 +2232,18 @@ void Channel::setAutoUserhost(bool state)
         nicknameListView->setHorizontalScrollBarPolicy(Qt::ScrollBarAsNeeded);
         // Cannot use QHeaderView::ResizeToContents here because it is slow
         // and it gets triggered by setSortingEnabled(). Using timed resize
-        // instead, see Channel::autoUserhost() above.
+        // instead, see Channel::resizeNicknameListViewColumns() below.
         nicknameListView->header()->setResizeMode(Nick::NicknameColumn, QHeaderView::Fixed);
         nicknameListView->header()->setResizeMode(Nick::HostmaskColumn, QHeaderView::Fixed);
-        userhostTimer.start(10000);
+        m_columnResizeTimer.start(10000);
         m_nicknameListViewTextChanged |= 0xFF; // ResizeColumnsToContents
-        QTimer::singleShot(0, this, SLOT(autoUserhost())); // resize columns ASAP
+        QTimer::singleShot(0, this, SLOT(resizeNicknameListViewColumns())); // resize columns ASAP
     }
     else
     {
         nicknameListView->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
         nicknameListView->header()->setResizeMode(Nick::NicknameColumn, QHeaderView::Stretch);
-        userhostTimer.stop();
-    }
-}
-
-void Channel::scheduleAutoWho(int msec)
-{
-    // The first auto-who is scheduled by ENDOFNAMES in InputFilter, which means
-    // the first auto-who occurs one interval after it. This has two desirable
-    // consequences specifically related to the startup phase: auto-who dispatch
-    // doesn't occur at the same time for all channels that are auto-joined, and
-    // it gives some breathing room to process the NAMES replies for all channels
-    // first before getting started on WHO.
-    // Subsequent auto-whos are scheduled by ENDOFWHO in InputFilter. However,
-    // autoWho() might refuse to actually do the request if the number of nicks
-    // in the channel exceeds the threshold, and will instead schedule another
-    // attempt later. Thus scheduling an auto-who does not guarantee it will be
-    // performed.
-    // If this is called mid-interval (e.g. due to the ENDOFWHO from a manual WHO)
-    // it will reset the interval to avoid cutting it short.
-
-    if (m_whoTimer.isActive())
-        m_whoTimer.stop();
-
-    if (Preferences::self()->autoWhoContinuousEnabled())
-    {
-        if (msec > 0)
-            m_whoTimer.start(msec);
-        else
-            m_whoTimer.start(Preferences::self()->autoWhoContinuousInterval() * 1000);
-    }
-}
-
-void Channel::autoWho()
-{
-    // Try again later if there are too many nicks or we're already processing a WHO request.
-    if ((nicks > Preferences::self()->autoWhoNicksLimit()) ||
-       m_server->getInputFilter()->isWhoRequestUnderProcess(getName()))
-    {
-        scheduleAutoWho();
-
-        return;
-    }
-
-    m_server->requestWho(getName());
-}
-
-void Channel::updateAutoWho()
-{
-    if (!Preferences::self()->autoWhoContinuousEnabled())
-        m_whoTimer.stop();
-    else if (Preferences::self()->autoWhoContinuousEnabled() && !m_whoTimer.isActive())
-        autoWho();
-    else if (m_whoTimer.isActive())
-    {
-        // The below tries to meet user expectations on an interval settings change,
-        // making two assumptions:
-        // - If the new interval is lower than the old one, the user may be impatient
-        //   and desires an information update.
-        // - If the new interval is longer than the old one, the user may be trying to
-        //   avoid Konversation producing too much traffic in a given timeframe, and
-        //   wants it to stop doing so sooner rather than later.
-        // Both require rescheduling the next auto-who request.
-
-        int interval = Preferences::self()->autoWhoContinuousInterval() * 1000;
-
-        if (interval != m_whoTimer.interval())
-        {
-            if (m_whoTimerStarted.elapsed() >= interval)
-            {
-                // If the time since the last auto-who request is longer than (or
-                // equal to) the new interval setting, it follows that the new
-                // setting is lower than the old setting. In this case issue a new
-                // request immediately, which is the closest we can come to acting
-                // as if the new setting had been active all along, short of tra-
-                // velling back in time to change history. This handles the impa-
-                // tient user.
-                // FIXME: Adjust algorithm when time machine becomes available.
-
-                m_whoTimer.stop();
-                autoWho();
-            }
-            else
-            {
-                // If on the other hand the elapsed time is shorter than the new
-                // interval setting, the new setting could be either shorter or
-                // _longer_ than the old setting. Happily, this time we can actually
-                // behave as if the new setting had been active all along, by sched-
-                // uling the next request to happen in the new interval time minus
-                // the already elapsed time, meeting user expecations for both cases
-                // originally laid out.
-
-                scheduleAutoWho(interval - m_whoTimerStarted.elapsed());
-            }
-        }
-    }
-}
-
-void Channel::fadeActivity()
-{
-    foreach (Nick *nick,  nicknameList) {
-        nick->getChannelNick()->lessActive();
+        m_columnResizeTimer.stop();
     }
 }
 
@@ -2407,12 +2297,14 @@ void Channel::setActive(bool active)
     else
     {
         m_initialNamesReceived = false;
-        purgeNicks();
+
+        if (!m_nicksKept)
+            purgeNicks();
+
         nicknameCombobox->setEnabled(false);
         topicLine->clear();
         clearModeList();
         clearBanList();
-        m_whoTimer.stop();
     }
 }
 
@@ -2467,6 +2359,9 @@ void Channel::processQueuedNicks(bool flush)
             if (Preferences::self()->autoUserhost())
                 resizeNicknameListViewColumns();
         }
+
+        if (m_initialNamesReceived)
+            removeUnconfirmedNicks();
     }
     else
     {
@@ -2484,6 +2379,16 @@ void Channel::processQueuedNicks(bool flush)
         // Remove possible mode characters from nickname and store the resulting mode.
         m_server->mangleNicknameWithModes(nickname, admin, owner, op, halfop, voice);
 
+        // With userhost-in-names the entries are full nick!user@host masks
+        QString hostmask;
+        const int bang = nickname.indexOf('!');
+
+        if (bang > 0)
+        {
+            hostmask = nickname.mid(bang + 1);
+            nickname.truncate(bang);
+        }
+
         // TODO: Make these an enumeration in KApplication or somewhere, we can use them as well.
         unsigned int mode = (admin  ? 16 : 0) +
                             (owner  ?  8 : 0) +
@@ -2494,10 +2399,17 @@ void Channel::processQueuedNicks(bool flush)
         // Check if nick is already in the nicklist.
         if (!nickname.isEmpty() && !getNickByName(nickname))
         {
+            // Append the whole batch and sort once at the end
+            if (!m_processedNicksCount)
+                m_nickListModel->setSortingEnabled(false);
+
             ChannelNickPtr nick = m_server->addNickToJoinedChannelsList(getName(), nickname);
             Q_ASSERT(nick);
             nick->setMode(mode);
 
+            if (!hostmask.isEmpty())
+                nick->getNickInfo()->setHostmask(hostmask);
+
             fastAddNickname(nick);
 
             ++m_processedNicksCount;
@@ -2505,12 +2417,61 @@ void Channel::processQueuedNicks(bool flush)
             if (nick->isAdmin() || nick->isOwner() || nick->isOp() || nick->isHalfOp())
                 ++m_processedOpsCount;
         }
+        else if (!nickname.isEmpty() && m_unconfirmedNicks.remove(nickname.toLower()))
+        {
+            // Kept over a reconnect, only its modes may have changed
+            Nick* nick = getNickByName(nickname);
+
+            if (nick)
+            {
+                ChannelNickPtr channelNick = nick->getChannelNick();
+                const bool wasAnyOp = channelNick->isAnyTypeOfOp();
+
+                if (!hostmask.isEmpty())
+                    channelNick->getNickInfo()->setHostmask(hostmask);
+
+                if (channelNick->setMode(mode))
+                {
+                    if (wasAnyOp != channelNick->isAnyTypeOfOp())
+                        adjustOps(wasAnyOp ? -1 : 1);
+
+                    repositionNick(nick);
+                }
+            }
+        }
 
         QMetaObject::invokeMethod(this, "processQueuedNicks",
             flush ? Qt::DirectConnection : Qt::QueuedConnection, Q_ARG(bool, flush));
     }
 }
 
+void Channel::removeUnconfirmedNicks()
+{
+    if (m_unconfirmedNicks.isEmpty())
+        return;
+
+    foreach (const QString& lcNickname, m_unconfirmedNicks)
+    {
+        Nick* nick = m_nicknameNickHash.take(lcNickname);
+
+        if (!nick)
+            continue;
+
+        if (nick->getChannelNick()->isAnyTypeOfOp())
+            adjustOps(-1);
+
+        adjustNicks(-1);
+
+        m_nickListModel->removeNick(nick);
+        nicknameList.removeOne(nick);
+        delete nick;
+
+        m_server->removeStaleNickFromChannel(getName(), lcNickname);
+    }
+
+    m_unconfirmedNicks.clear();
+}
+
 void Channel::setChannelEncoding(const QString& encoding) // virtual
 {
     if(m_server->getServerGroup())
@@ -2563,7 +2524,7 @@ void Channel::requestNickListSort()
     if (m_delayedSortTrigger == DELAYED_SORT_TRIGGER &&
         !m_delayedSortTimer->isActive())
     {
-        nicknameListView->fastSetSortingEnabled(false);
+        m_nickListModel->setSortingEnabled(false);
         m_delayedSortTimer->start(1000);
     }
 }
@@ -2577,10 +2538,9 @@ void Channel::sortNickList(bool delayed)
 {
     if (!delayed || m_delayedSortTrigger > DELAYED_SORT_TRIGGER) {
         qSort(nicknameList.begin(), nicknameList.end(), nickLessThan);
-        nicknameListView->resort();
+        m_nickListModel->resort();
     }
-    if (!nicknameListView->isSortingEnabled())
-        nicknameListView->fastSetSortingEnabled(true);
+    m_nickListModel->setSortingEnabled(true);
     m_delayedSortTrigger = 0;
     m_delayedSortTimer->stop();
 }
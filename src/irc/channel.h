@@ -24,13 +24,14 @@
 #include "cipher.h"
 #endif
 
+#include <QSet>
 #include <QTimer>
 #include <QString>
 
 
 class QLabel;
 class QTimer;
-class QTreeWidgetItem;
+class QModelIndex;
 class QStringList;
 class QSplitter;
 class QToolButton;
@@ -42,6 +43,7 @@ class KComboBox;
 
 class AwayLabel;
 class NickListView;
+class NickListModel;
 class Nick;
 class QuickButton;
 class ModeButton;
@@ -119,15 +121,10 @@ class Channel : public ChatWindow
 
     public slots:
         void setNickname(const QString& newNickname);
-        void scheduleAutoWho(int msec = -1);
         void setAutoUserhost(bool state);
         void rejoin();
 
     protected slots:
-        void autoUserhost();
-        void autoWho();
-        void updateAutoWho();
-        void fadeActivity();
         virtual void serverOnline(bool online);
         void delayedSortNickList();
 
@@ -146,18 +143,28 @@ class Channel : public ChatWindow
         void nickRenamed(const QString &oldNick, const NickInfo& channelnick);
         void queueNicks(const QStringList& nicknameList);
         void endOfNames();
+        /// Whether the NAMES reply that follows our JOIN is complete.
+        bool initialNamesReceived() const { return m_initialNamesReceived; }
         Nick *getNickByName(const QString& lookname) const;
         NickList getNickList() const { return nicknameList; }
 
+        /// Keeps the nicklist when the connection breaks, the NAMES reply
+        /// after rejoining only adds and removes what changed meanwhile.
+        void keepNicksForRejoin();
+        /// The kept nicklist is not going to be rejoined after all.
+        void purgeKeptNicks();
+
         void adjustNicks(int value);
         void adjustOps(int value);
         virtual void emitUpdateInfo();
 
+    public slots:
         void resizeNicknameListViewColumns();
 
     protected slots:
         void purgeNicks();
         void processQueuedNicks(bool flush = false);
+        void removeUnconfirmedNicks();
 
         void updateNickInfos();
         void updateChannelNicks(const QString& channel);
@@ -180,6 +187,11 @@ class Channel : public ChatWindow
     public:
         /// Internal - Empty the modelist
         void clearModeList();
+        /// Asks the server for the modes and the ban list of the channel.
+        void requestModes(Server::QueuePriority priority = Server::LowPriority);
+        /// Leaves requestModes() to when the channel is first shown, for
+        /// channels joined in the connect burst.
+        void deferModeRequests() { m_modeRequestsDeferred = true; }
         /// Get the list of modes that this channel has - e.g. {+l,+s,-m}
         //TODO: does this method return a list of all modes, all modes that have been changed, or all modes that are +?
         QStringList getModeList() const { return m_modeList; }
@@ -257,7 +269,7 @@ class Channel : public ChatWindow
         void modeButtonClicked(int id,bool on);
         void channelLimitChanged();
 
-        void doubleClickCommand(QTreeWidgetItem *item,int column);  ///< Connected to NickListView::itemDoubleClicked()
+        void doubleClickCommand(const QModelIndex& index);  ///< Connected to NickListView::doubleClicked()
         // Dialogs
         void changeNickname(const QString& newNickname);
 
@@ -314,6 +326,7 @@ class Channel : public ChatWindow
         KLineEdit* limit; //TODO: this GUI element is the only storage for the mode
 
         NickListView* nicknameListView;
+        NickListModel* m_nickListModel;
         KHBox* commandLineBox;
         KVBox* nickListButtons;
         QWidget* m_buttonsGrid;
@@ -328,27 +341,26 @@ class Channel : public ChatWindow
 //Members from here to end are not GUI
         bool m_joined;
         NickList nicknameList;
-        QTimer userhostTimer;
+        QTimer m_columnResizeTimer;
         int m_nicknameListViewTextChanged;
         QHash<QString, Nick*> m_nicknameNickHash;
 
         TopicHistoryModel* m_topicHistory;
         QStringList m_BanList;
 
-        QTimer m_whoTimer; ///< For continuous auto /WHO
-        QTime  m_whoTimerStarted;
-
-        QTimer m_fadeActivityTimer; ///< For the smoothing function used in activity sorting
-
         QStringList m_nickQueue;
         int m_processedNicksCount;
         int m_processedOpsCount;
         bool m_initialNamesReceived;
+        bool m_nicksKept; ///< nicklist kept over a reconnect, not yet rejoined
+        /// Lowered nicks of the kept nicklist the NAMES reply did not list yet
+        QSet<QString> m_unconfirmedNicks;
 
         QTimer* m_delayedSortTimer;
         int m_delayedSortTrigger;
 
         QStringList m_modeList;
+        bool m_modeRequestsDeferred;
         ChannelNickPtr m_ownChannelNick;
 
         bool pendingNicks; ///< are there still nicks to be added by /names reply?
@@ -19,8 +19,12 @@
 #include "common.h"
 #include "application.h"
 
+#include <QBitArray>
 #include <QHeaderView>
 #include <QTextDocument>
+#include <QtConcurrentRun>
+
+#include <algorithm>
 
 #include <KRun>
 #include <KFileDialog>
@@ -28,14 +32,461 @@
 #include <KToolBar>
 
 
+void ChannelListData::clear()
+{
+    names.clear();
+    foldedNames.clear();
+    nameOffsets.clear();
+    topics.clear();
+    foldedTopics.clear();
+    topicOffsets.clear();
+    users.clear();
+}
+
+void ChannelListData::append(const QString& name, int userCount, const QString& topic)
+{
+    QString foldedName = name.toLower();
+    QString foldedTopic = topic.toLower();
+
+    // the folded buffers share the offsets, keep the lengths in step
+    if (foldedName.length() != name.length())
+        foldedName = name;
+    if (foldedTopic.length() != topic.length())
+        foldedTopic = topic;
+
+    nameOffsets.append(names.length());
+    names += name;
+    names += '\n';
+    foldedNames += foldedName;
+    foldedNames += '\n';
+
+    topicOffsets.append(topics.length());
+    topics += topic;
+    topics += '\n';
+    foldedTopics += foldedTopic;
+    foldedTopics += '\n';
+
+    users.append(userCount);
+}
+
+QString ChannelListData::name(int row) const
+{
+    int end = (row + 1 < count()) ? nameOffsets.at(row + 1) : names.length();
+
+    return names.mid(nameOffsets.at(row), end - nameOffsets.at(row) - 1);
+}
+
+QString ChannelListData::topic(int row) const
+{
+    int end = (row + 1 < count()) ? topicOffsets.at(row + 1) : topics.length();
+
+    return topics.mid(topicOffsets.at(row), end - topicOffsets.at(row) - 1);
+}
+
+ChannelListFilter::ChannelListFilter()
+{
+    regExp = false;
+    channel = true;
+    topic = false;
+    minUsers = 0;
+    maxUsers = 0;
+}
+
+bool ChannelListFilter::operator==(const ChannelListFilter& other) const
+{
+    return text == other.text && regExp == other.regExp
+        && channel == other.channel && topic == other.topic
+        && minUsers == other.minUsers && maxUsers == other.maxUsers;
+}
+
+namespace
+{
+    // how many rows the worker handles between checks for cancellation
+    const int CancelCheckInterval = 4096;
+
+    struct FilterJob
+    {
+        ChannelListData data;
+        ChannelListFilter filter;
+        int sortColumn;
+        Qt::SortOrder sortOrder;
+        int generation;
+        QAtomicInt* currentGeneration;
+
+        bool cancelled() const { return *currentGeneration != generation; }
+    };
+
+    /// Matches one column of a ChannelListData against the filter text.
+    class ColumnMatcher
+    {
+        public:
+            ColumnMatcher(const ChannelListFilter& filter, const QString& buffer,
+                const QString& foldedBuffer, const QVector<int>& offsets)
+            : m_buffer(buffer), m_foldedBuffer(foldedBuffer), m_offsets(offsets)
+            {
+                m_plain = !filter.regExp && !filter.text.contains(QRegExp("[*?\\[]"));
+
+                if (m_plain)
+                    m_needle = filter.text.toLower();
+                else
+                    m_regExp = QRegExp(filter.text, Qt::CaseInsensitive,
+                        filter.regExp ? QRegExp::RegExp : QRegExp::Wildcard);
+            }
+
+            /// Mark every row from first to count that matches. Returns false if cancelled.
+            bool match(QBitArray& hits, int first, int count, const FilterJob& job)
+            {
+                hits.resize(count);
+
+                if (m_plain)
+                    return matchPlain(hits, first, count, job);
+
+                for (int row = first; row < count; ++row)
+                {
+                    if (row % CancelCheckInterval == 0 && job.cancelled())
+                        return false;
+
+                    int start = m_offsets.at(row);
+                    int end = (row + 1 < m_offsets.count()) ? m_offsets.at(row + 1) : m_buffer.length();
+                    const QString text = QString::fromRawData(m_buffer.unicode() + start, end - start - 1);
+
+                    if (m_regExp.indexIn(text) != -1)
+                        hits.setBit(row);
+                }
+
+                return true;
+            }
+
+        private:
+            /// One linear scan over the folded buffer, skipping to the next row on each hit.
+            bool matchPlain(QBitArray& hits, int first, int count, const FilterJob& job)
+            {
+                if (m_needle.isEmpty())
+                {
+                    hits.fill(true);
+                    return true;
+                }
+
+                if (first >= count)
+                    return true;
+
+                const int limit = (count < m_offsets.count()) ? m_offsets.at(count) : m_foldedBuffer.length();
+                int pos = m_offsets.at(first);
+                int scanned = 0;
+
+                while ((pos = m_foldedBuffer.indexOf(m_needle, pos)) != -1 && pos < limit)
+                {
+                    // the row whose text contains pos
+                    int row = qUpperBound(m_offsets.constBegin(), m_offsets.constBegin() + count, pos)
+                        - m_offsets.constBegin() - 1;
+
+                    hits.setBit(row);
+
+                    if (row + 1 >= count)
+                        break;
+
+                    pos = m_offsets.at(row + 1);
+
+                    if (++scanned % CancelCheckInterval == 0 && job.cancelled())
+                        return false;
+                }
+
+                return true;
+            }
+
+            const QString& m_buffer;
+            const QString& m_foldedBuffer;
+            const QVector<int>& m_offsets;
+            bool m_plain;
+            QString m_needle;
+            QRegExp m_regExp;
+    };
+
+    class RowLessThan
+    {
+        public:
+            RowLessThan(const ChannelListData& data, int column, Qt::SortOrder order = Qt::AscendingOrder)
+            : m_data(data), m_column(column), m_order(order) {}
+
+            bool operator()(int left, int right) const
+            {
+                if (m_order == Qt::DescendingOrder)
+                    return lessThan(right, left);
+
+                return lessThan(left, right);
+            }
+
+        private:
+            bool lessThan(int left, int right) const
+            {
+                if (m_column == 1)
+                    return m_data.users.at(left) < m_data.users.at(right);
+
+                if (m_column == 2)
+                    return compare(m_data.foldedTopics, m_data.topicOffsets, left, right) < 0;
+
+                return compare(m_data.foldedNames, m_data.nameOffsets, left, right) < 0;
+            }
+
+            int compare(const QString& buffer, const QVector<int>& offsets, int left, int right) const
+            {
+                return QStringRef::compare(ref(buffer, offsets, left), ref(buffer, offsets, right));
+            }
+
+            QStringRef ref(const QString& buffer, const QVector<int>& offsets, int row) const
+            {
+                int end = (row + 1 < offsets.count()) ? offsets.at(row + 1) : buffer.length();
+
+                return QStringRef(&buffer, offsets.at(row), end - offsets.at(row) - 1);
+            }
+
+            const ChannelListData& m_data;
+            int m_column;
+            Qt::SortOrder m_order;
+    };
+
+    bool usersInRange(const ChannelListFilter& filter, int users)
+    {
+        return (!filter.minUsers || users >= filter.minUsers)
+            && (!filter.maxUsers || users <= filter.maxUsers);
+    }
+
+    /// Filter rows from first up to the end of data. Returns false if cancelled.
+    bool filterRows(const FilterJob& job, int first, QVector<int>& rows, int& users)
+    {
+        const ChannelListData& data = job.data;
+        const ChannelListFilter& filter = job.filter;
+        const int count = data.count();
+
+        // checking the text only makes sense if there's a column to check it against
+        bool checkText = !filter.text.isEmpty() && (filter.channel || filter.topic);
+
+        QBitArray channelHits;
+        QBitArray topicHits;
+
+        if (checkText && filter.channel)
+        {
+            ColumnMatcher matcher(filter, data.names, data.foldedNames, data.nameOffsets);
+
+            if (!matcher.match(channelHits, first, count, job))
+                return false;
+        }
+
+        if (checkText && filter.topic)
+        {
+            ColumnMatcher matcher(filter, data.topics, data.foldedTopics, data.topicOffsets);
+
+            if (!matcher.match(topicHits, first, count, job))
+                return false;
+        }
+
+        for (int row = first; row < count; ++row)
+        {
+            if (!usersInRange(filter, data.users.at(row)))
+                continue;
+
+            if (checkText && !(filter.channel && channelHits.testBit(row))
+                && !(filter.topic && topicHits.testBit(row)))
+                continue;
+
+            rows.append(row);
+            users += data.users.at(row);
+        }
+
+        return true;
+    }
+
+    ChannelListFilterResult runFilterJob(const FilterJob& job)
+    {
+        ChannelListFilterResult result;
+        result.generation = job.generation;
+        result.sourceCount = job.data.count();
+        result.users = 0;
+
+        if (!filterRows(job, 0, result.rows, result.users))
+            return result;
+
+        if (job.sortColumn >= 0 && !job.cancelled())
+        {
+            qStableSort(result.rows.begin(), result.rows.end(), RowLessThan(job.data, job.sortColumn));
+
+            if (job.sortOrder == Qt::DescendingOrder)
+                std::reverse(result.rows.begin(), result.rows.end());
+        }
+
+        return result;
+    }
+}
+
 ChannelListModel::ChannelListModel(QObject* parent) : QAbstractListModel(parent)
 {
+    m_sortColumn = -1;
+    m_sortOrder = Qt::AscendingOrder;
+    m_visibleUsers = 0;
+    m_flushedCount = 0;
+
+    // new rows are shown in batches instead of one by one
+    m_batchTimer.setSingleShot(true);
+    m_batchTimer.setInterval(250);
+    connect(&m_batchTimer, SIGNAL(timeout()), this, SLOT(flush()));
+
+    connect(&m_filterWatcher, SIGNAL(finished()), this, SLOT(filterFinished()));
+}
+
+ChannelListModel::~ChannelListModel()
+{
+    cancelFilter();
+    m_filterWatcher.waitForFinished();
 }
 
-void ChannelListModel::append(const ChannelItem& item)
+void ChannelListModel::append(const QString& name, int users, const QString& topic)
 {
-    m_channelList.append(item);
-    reset();
+    m_data.append(name, users, topic);
+
+    if (!m_batchTimer.isActive())
+        m_batchTimer.start();
+}
+
+void ChannelListModel::clear()
+{
+    cancelFilter();
+    m_batchTimer.stop();
+
+    beginResetModel();
+    m_data.clear();
+    m_visibleRows.clear();
+    m_visibleUsers = 0;
+    m_flushedCount = 0;
+    endResetModel();
+}
+
+void ChannelListModel::flush()
+{
+    m_batchTimer.stop();
+
+    if (m_flushedCount == m_data.count())
+        return;
+
+    // a filter run covering these rows is still going, let it add them
+    if (m_filterWatcher.isRunning())
+        return;
+
+    FilterJob job;
+    job.data = m_data;
+    job.filter = m_filter;
+    job.generation = m_generation;
+    job.currentGeneration = &m_generation;
+
+    QVector<int> rows;
+    int users = 0;
+
+    filterRows(job, m_flushedCount, rows, users);
+    m_flushedCount = m_data.count();
+
+    if (rows.isEmpty())
+        return;
+
+    m_visibleUsers += users;
+
+    if (m_sortColumn < 0)
+    {
+        beginInsertRows(QModelIndex(), m_visibleRows.count(), m_visibleRows.count() + rows.count() - 1);
+        m_visibleRows += rows;
+        endInsertRows();
+
+        return;
+    }
+
+    // Merge the new rows into the sorted ones, inserting each run of them
+    // that lands between the same two shown rows at once
+    RowLessThan lessThan(m_data, m_sortColumn, m_sortOrder);
+    qStableSort(rows.begin(), rows.end(), lessThan);
+
+    int first = 0;
+    int searchFrom = 0;
+
+    while (first < rows.count())
+    {
+        const int pos = qUpperBound(m_visibleRows.constBegin() + searchFrom, m_visibleRows.constEnd(),
+            rows.at(first), lessThan) - m_visibleRows.constBegin();
+
+        int last = first + 1;
+
+        while (last < rows.count() && (pos == m_visibleRows.count() || lessThan(rows.at(last), m_visibleRows.at(pos))))
+            ++last;
+
+        beginInsertRows(QModelIndex(), pos, pos + last - first - 1);
+        m_visibleRows.insert(pos, last - first, 0);
+        qCopy(rows.constBegin() + first, rows.constBegin() + last, m_visibleRows.begin() + pos);
+        endInsertRows();
+
+        searchFrom = pos + last - first;
+        first = last;
+    }
+}
+
+void ChannelListModel::setFilter(const ChannelListFilter& filter)
+{
+    if (filter == m_filter)
+        return;
+
+    m_filter = filter;
+    refilter();
+}
+
+void ChannelListModel::sort(int column, Qt::SortOrder order)
+{
+    if (column == m_sortColumn && order == m_sortOrder)
+        return;
+
+    m_sortColumn = column;
+    m_sortOrder = order;
+    refilter();
+}
+
+void ChannelListModel::cancelFilter()
+{
+    // a running job notices the new generation and gives up
+    m_generation.fetchAndAddOrdered(1);
+}
+
+void ChannelListModel::refilter()
+{
+    cancelFilter();
+
+    FilterJob job;
+    job.data = m_data;
+    job.filter = m_filter;
+    job.sortColumn = m_sortColumn;
+    job.sortOrder = m_sortOrder;
+    job.generation = m_generation;
+    job.currentGeneration = &m_generation;
+
+    m_flushedCount = m_data.count();
+    m_filterWatcher.setFuture(QtConcurrent::run(runFilterJob, job));
+}
+
+void ChannelListModel::filterFinished()
+{
+    const ChannelListFilterResult result = m_filterWatcher.result();
+
+    // Superseded by a newer filter or sort order, or the list was cleared.
+    // Rows that came in meanwhile were held back for this run, show them.
+    if (result.generation != m_generation)
+    {
+        flush();
+
+        return;
+    }
+
+    beginResetModel();
+    m_visibleRows = result.rows;
+    m_visibleUsers = result.users;
+    m_flushedCount = result.sourceCount;
+    endResetModel();
+
+    // rows that came in while the filter was running
+    flush();
 }
 
 int ChannelListModel::columnCount(const QModelIndex& /*parent*/) const
@@ -43,35 +494,38 @@ int ChannelListModel::columnCount(const QModelIndex& /*parent*/) const
     return 3;
 }
 
-int ChannelListModel::rowCount(const QModelIndex& /*parent*/) const
+int ChannelListModel::rowCount(const QModelIndex& parent) const
 {
-    return m_channelList.count();
+    if (parent.isValid())
+        return 0;
+
+    return m_visibleRows.count();
 }
 
 QVariant ChannelListModel::data(const QModelIndex& index, int role) const
 {
-    if(!index.isValid() || index.row() >= m_channelList.count ())
+    if(!index.isValid() || index.row() >= m_visibleRows.count())
         return QVariant();
 
-    const ChannelItem& item = m_channelList[index.row()];
+    int row = m_visibleRows.at(index.row());
 
     if(role == Qt::DisplayRole)
     {
         switch(index.column())
         {
             case 0:
-                return item.name;
+                return m_data.name(row);
             case 1:
-                return item.users;
+                return m_data.users.at(row);
             case 2:
-                return item.topic;
+                return m_data.topic(row);
             default:
                 return QVariant();
         }
     }
     else if(role == Qt::ToolTipRole)
     {
-        return QString(QLatin1String("<qt>") + Qt::escape(item.topic) + QLatin1String("</qt>"));
+        return QString(QLatin1String("<qt>") + Qt::escape(m_data.topic(row)) + QLatin1String("</qt>"));
     }
     return QVariant();
 }
@@ -94,59 +548,12 @@ QVariant ChannelListModel::headerData (int section, Qt::Orientation orientation,
     }
 }
 
-ChannelListProxyModel::ChannelListProxyModel(QObject* parent) : QSortFilterProxyModel(parent)
-{
-    m_minUsers = 0;
-    m_maxUsers = 0;
-    m_filterChannel = true;
-    m_filterTopic = false;
-}
-
-bool ChannelListProxyModel::filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const
-{
-    QModelIndex index0 = sourceModel()->index(sourceRow, 0, sourceParent);
-    QModelIndex index1 = sourceModel()->index(sourceRow, 1, sourceParent);
-    QModelIndex index2 = sourceModel()->index(sourceRow, 2, sourceParent);
-
-    return (((m_filterChannel && sourceModel()->data(index0).toString().contains(filterRegExp()))
-        || (m_filterTopic && sourceModel()->data(index2).toString().contains(filterRegExp()))
-        || (!m_filterChannel && !m_filterTopic))
-        && usersInRange(sourceModel()->data(index1).toInt()));
-}
-
-bool ChannelListProxyModel::usersInRange(int users) const
-{
-    return (!m_minUsers || users >= m_minUsers)
-    && (!m_maxUsers || users <= m_maxUsers);
-}
-
-void ChannelListProxyModel::setFilterMinimumUsers(int users)
-{
-    m_minUsers = users;
-}
-
-void ChannelListProxyModel::setFilterMaximumUsers(int users)
-{
-    m_maxUsers = users;
-}
-
-void ChannelListProxyModel::setFilterTopic(bool filter)
-{
-    m_filterTopic = filter;
-}
-
-void ChannelListProxyModel::setFilterChannel(bool filter)
-{
-    m_filterChannel = filter;
-}
-
 ChannelListPanel::ChannelListPanel(QWidget* parent) : ChatWindow(parent)
 {
     setType(ChatWindow::ChannelList);
     setName(i18n("Channel List"));
 
     m_firstRun = true;
-    m_regexState = false;
     m_numUsers = 0;
     m_numChannels = 0;
     m_visibleUsers = 0;
@@ -171,10 +578,7 @@ ChannelListPanel::ChannelListPanel(QWidget* parent) : ChatWindow(parent)
     setupUi(this);
 
     m_channelListModel = new ChannelListModel(this);
-
-    m_proxyModel = new ChannelListProxyModel(this);
-    m_proxyModel->setSourceModel(m_channelListModel);
-    m_channelListView->setModel(m_proxyModel);
+    m_channelListView->setModel(m_channelListModel);
     m_channelListView->header()->resizeSection(1,75); // resize users section to be smaller
 
     Preferences::restoreColumnState(m_channelListView, "ChannelList ViewSettings");
@@ -200,6 +604,9 @@ ChannelListPanel::ChannelListPanel(QWidget* parent) : ChatWindow(parent)
     connect(m_progressTimer, SIGNAL(timeout()), this, SLOT(setProgress()));
     connect(m_tempTimer, SIGNAL(timeout()), this, SLOT(endOfChannelList()));
 
+    connect(m_channelListModel, SIGNAL(modelReset()), this, SLOT(updateUsersChannels()));
+    connect(m_channelListModel, SIGNAL(rowsInserted(QModelIndex,int,int)), this, SLOT(updateUsersChannels()));
+
     updateUsersChannels();
 }
 
@@ -236,18 +643,15 @@ void ChannelListPanel::addToChannelList(const QString& channel,int users,const Q
 
         m_refreshList->setEnabled(false);
 
+        m_channelListModel->clear();
+
         m_statsLabel->setText(i18n("Refreshing."));
         m_progressTimer->start(500);
 
         m_firstRun = false;
-        m_channelListModel = new ChannelListModel(this);
     }
 
-    ChannelItem item;
-    item.name = channel;
-    item.users = users;
-    item.topic = Konversation::removeIrcMarkup(topic);
-    m_channelListModel->append(item);
+    m_channelListModel->append(channel, users, Konversation::removeIrcMarkup(topic));
 
     ++m_numChannels;
     m_numUsers += users;
@@ -257,8 +661,8 @@ void ChannelListPanel::endOfChannelList()
 {
     m_progressTimer->stop();
 
-    m_proxyModel->setSourceModel(m_channelListModel);
-    m_proxyModel->invalidate();
+    // the last batch, already in sort order
+    m_channelListModel->flush();
     m_refreshList->setEnabled(true);
     m_firstRun = true;
     updateUsersChannels();
@@ -271,54 +675,16 @@ void ChannelListPanel::filterChanged()
 
 void ChannelListPanel::updateFilter()
 {
-    QString text = m_filterLine->text();
-    int max = m_maxUser->value();
-    int min = m_minUser->value();
-    bool topic = m_topicBox->isChecked();
-    bool channel = m_channelBox->isChecked();
-    bool regex = m_regexBox->isChecked();
-    bool regexChanged = (regex != m_regexState);
-    if (regexChanged) m_regexState = regex;
-
-    bool change = false;
-
-    if (m_proxyModel->filterRegExp().pattern() != text || regexChanged)
-    {
-        change = true;
-        if(m_regexState)
-            m_proxyModel->setFilterRegExp(text);
-        else
-            m_proxyModel->setFilterWildcard(text);
-    }
+    ChannelListFilter filter;
+    filter.text = m_filterLine->text();
+    filter.regExp = m_regexBox->isChecked();
+    filter.channel = m_channelBox->isChecked();
+    filter.topic = m_topicBox->isChecked();
+    filter.minUsers = m_minUser->value();
+    filter.maxUsers = m_maxUser->value();
 
-    if (m_proxyModel->filterMinimumUsers() != min)
-    {
-        change = true;
-        m_proxyModel->setFilterMinimumUsers(min);
-    }
-
-    if (m_proxyModel->filterMaximumUsers() != max)
-    {
-        change = true;
-        m_proxyModel->setFilterMaximumUsers(max);
-    }
-
-    if (m_proxyModel->filterTopic() != topic)
-    {
-        change = true;
-        m_proxyModel->setFilterTopic(topic);
-    }
-
-    if (m_proxyModel->filterChannel() != channel)
-    {
-        change = true;
-        m_proxyModel->setFilterChannel(channel);
-    }
-
-    if (change)
-        m_proxyModel->invalidate();
-
-    updateUsersChannels();
+    // filtering runs in the background, the stats follow once it's done
+    m_channelListModel->setFilter(filter);
 }
 
 void ChannelListPanel::currentChanged(QModelIndex current,QModelIndex previous)
@@ -337,19 +703,14 @@ void ChannelListPanel::setProgress()
 }
 
 
-void ChannelListPanel::countUsers(const QModelIndex& index, int pos)
-{
-    m_visibleUsers += index.data().toInt();
-    ++pos;
-    if (pos < m_proxyModel->rowCount())
-        countUsers(index.sibling(pos,1), pos);
-}
-
 void ChannelListPanel::updateUsersChannels()
 {
-    m_visibleUsers = 0;
-    countUsers(m_proxyModel->index(0,1,QModelIndex()),0);
-    m_visibleChannels = m_proxyModel->rowCount();
+    // don't overwrite the progress indicator while the list is coming in
+    if (m_progressTimer->isActive())
+        return;
+
+    m_visibleUsers = m_channelListModel->visibleUsers();
+    m_visibleChannels = m_channelListModel->rowCount();
     m_statsLabel->setText(i18n("Channels: %1 (%2 shown)", m_numChannels, m_visibleChannels) +
                           i18n(" Non-unique users: %1 (%2 shown)", m_numUsers, m_visibleUsers));
 }
@@ -369,8 +730,8 @@ void ChannelListPanel::saveList()
         int maxChannelWidth=0;
         int maxUsersWidth=0;
 
-        int rows = m_proxyModel->rowCount();
-        QModelIndex index = m_proxyModel->index(0,0,QModelIndex());
+        int rows = m_channelListModel->rowCount();
+        QModelIndex index = m_channelListModel->index(0,0,QModelIndex());
         for (int r = 0; r < rows; r++)
         {
             QString channel = index.sibling(r,0).data().toString();
@@ -19,45 +19,55 @@
 #include "ui_channellistpanelui.h"
 
 #include <QAbstractListModel>
-#include <QSortFilterProxyModel>
+#include <QAtomicInt>
+#include <QFutureWatcher>
+#include <QTimer>
 
 class KToolBar;
 
-struct ChannelItem
+/// Columnar storage for a channel list. Each text column is one buffer with a
+/// '\n' after every row, the lowercase copies are what substring filters scan.
+struct ChannelListData
 {
-    QString name;
-    int users;
-    QString topic;
-};
+    QString names;
+    QString foldedNames;
+    QVector<int> nameOffsets;
 
-class ChannelListProxyModel : public QSortFilterProxyModel
-{
-    Q_OBJECT
+    QString topics;
+    QString foldedTopics;
+    QVector<int> topicOffsets;
 
-    public:
-        explicit ChannelListProxyModel(QObject *parent = 0);
+    QVector<int> users;
 
-        int filterMinimumUsers() { return m_minUsers; }
-        int filterMaximumUsers() { return m_maxUsers; }
-        bool filterTopic() { return m_filterTopic; }
-        bool filterChannel() { return m_filterChannel; }
+    int count() const { return users.count(); }
+    void clear();
+    void append(const QString& name, int userCount, const QString& topic);
 
-    public slots:
-        void setFilterMinimumUsers(int users);
-        void setFilterMaximumUsers(int users);
+    QString name(int row) const;
+    QString topic(int row) const;
+};
 
-        void setFilterTopic(bool filter);
-        void setFilterChannel(bool filter);
+struct ChannelListFilter
+{
+    ChannelListFilter();
 
-    protected:
-        bool filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const;
+    QString text;
+    bool regExp;
+    bool channel;
+    bool topic;
+    int minUsers;
+    int maxUsers;
 
-    private:
-        bool usersInRange(int users) const;
-        int m_minUsers;
-        int m_maxUsers;
-        bool m_filterTopic;
-        bool m_filterChannel;
+    bool operator==(const ChannelListFilter& other) const;
+    bool operator!=(const ChannelListFilter& other) const { return !(*this == other); }
+};
+
+struct ChannelListFilterResult
+{
+    int generation;
+    int sourceCount; ///< number of source rows the result covers
+    QVector<int> rows;
+    int users;
 };
 
 class ChannelListModel : public QAbstractListModel
@@ -66,8 +76,19 @@ class ChannelListModel : public QAbstractListModel
 
     public:
         explicit ChannelListModel(QObject* parent);
+        ~ChannelListModel();
+
+        /// Add a channel. Rows show up in batches, call flush() to show them right away.
+        void append(const QString& name, int users, const QString& topic);
+        void clear();
+
+        void setFilter(const ChannelListFilter& filter);
+        ChannelListFilter filter() const { return m_filter; }
+
+        /// Filter and sort all rows again on a worker thread.
+        void refilter();
 
-        void append(const ChannelItem& item);
+        int visibleUsers() const { return m_visibleUsers; }
 
         int columnCount(const QModelIndex& parent = QModelIndex()) const;
         int rowCount(const QModelIndex& parent = QModelIndex()) const;
@@ -75,8 +96,31 @@ class ChannelListModel : public QAbstractListModel
         QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
         QVariant headerData (int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const;
 
+        void sort(int column, Qt::SortOrder order = Qt::AscendingOrder);
+
+    public slots:
+        void flush();
+
+    private slots:
+        void filterFinished();
+
     private:
-        QList<ChannelItem> m_channelList;
+        void cancelFilter();
+
+        ChannelListData m_data;
+        ChannelListFilter m_filter;
+        int m_sortColumn;
+        Qt::SortOrder m_sortOrder;
+
+        /// source rows currently shown, in display order
+        QVector<int> m_visibleRows;
+        int m_visibleUsers;
+        /// source rows below this have been run through the filter
+        int m_flushedCount;
+
+        QTimer m_batchTimer;
+        QFutureWatcher<ChannelListFilterResult> m_filterWatcher;
+        QAtomicInt m_generation;
 };
 
 class ChannelListPanel : public ChatWindow, private Ui::ChannelListWidgetUI
@@ -128,22 +172,18 @@ class ChannelListPanel : public ChatWindow, private Ui::ChannelListWidgetUI
         /** Called from ChatWindow adjustFocus */
         virtual void childAdjustFocus(){}
 
-        void countUsers(const QModelIndex& index, int pos);
-
         int m_numChannels;
         int m_numUsers;
         int m_visibleChannels;
         int m_visibleUsers;
         bool m_online;
         bool m_firstRun;
-        bool m_regexState;
 
         QTimer* m_progressTimer;
         QTimer* m_filterTimer;
         QTimer* m_tempTimer;
 
         ChannelListModel* m_channelListModel;
-        ChannelListProxyModel* m_proxyModel;
 
         KToolBar *m_toolBar;
         QAction *m_saveList;
@@ -20,6 +20,13 @@
 #include "channel.h"
 #include "server.h"
 
+#include <QDateTime>
+
+#include <math.h>
+
+
+// recent activity halves every ten minutes
+static const double ActivityHalfLife = 600.0;
 
 ChannelNick::ChannelNick(const NickInfoPtr& nickInfo, const QString& channel)
 : KShared()
@@ -31,7 +38,7 @@ ChannelNick::ChannelNick(const NickInfoPtr& nickInfo, const QString& channel)
     m_ishalfop = false;
     m_hasvoice = false;
     m_timeStamp = 0;
-    m_recentActivity = 0;
+    m_activityKey = 0;
     m_channel = channel;
     m_isChanged = false;
 }
@@ -223,19 +230,22 @@ uint ChannelNick::timeStamp() const
   return m_timeStamp;
 }
 
-uint ChannelNick::recentActivity() const
+double ChannelNick::recentActivity() const
 {
-    return m_recentActivity;
+    if (!m_activityKey)
+        return 0;
+
+    return pow(2.0, m_activityKey - QDateTime::currentDateTime().toTime_t() / ActivityHalfLife);
 }
 
 void ChannelNick::moreActive()
 {
-    m_recentActivity++;
-}
+    // The key is log2(activity) plus the time in half-lives, so decay is
+    // only ever computed here, when the nick speaks.
+    const double now = QDateTime::currentDateTime().toTime_t() / ActivityHalfLife;
+    const double activity = m_activityKey ? pow(2.0, m_activityKey - now) : 0.0;
 
-void ChannelNick::lessActive()
-{
-    m_recentActivity--;
+    m_activityKey = now + log(activity + 1.0) / log(2.0);
 }
 
 void ChannelNick::setTimeStamp(uint stamp)
@@ -36,9 +36,13 @@ class ChannelNick : public KShared
         bool isAnyTypeOfOp() const;
         bool hasVoice() const;
         uint timeStamp() const;
-        uint recentActivity() const;
+        /// Lines said recently, decaying exponentially over time.
+        double recentActivity() const;
+        /** Sort key for recentActivity(). Decay affects all nicks alike, so
+         *  the order by key never changes on its own, only when a nick speaks.
+         */
+        double activityKey() const { return m_activityKey; }
         void moreActive();
-        void lessActive();
 
         bool setVoice(bool state);
         bool setOp(bool state);
@@ -72,7 +76,7 @@ class ChannelNick : public KShared
         bool m_ishalfop;
         bool m_hasvoice;
         uint m_timeStamp;
-        uint m_recentActivity;
+        double m_activityKey;
         QString m_channel;
 
         bool m_isChanged;
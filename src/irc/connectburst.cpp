@@ -0,0 +1,162 @@
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+*/
+
+#include "connectburst.h"
+#include "server.h"
+
+#include <QVector>
+
+#include <KGlobal>
+#include <KLocale>
+
+
+ConnectBurst::ConnectBurst(Server* server) : QObject(server), m_server(server)
+{
+    reset();
+}
+
+ConnectBurst::~ConnectBurst()
+{
+}
+
+void ConnectBurst::reset()
+{
+    m_joinTargetLimit = 0;
+    m_channelLimits.clear();
+    m_channelLimitsFromChanLimit = false;
+    m_maxChannels = -1;
+
+    m_started = false;
+    m_connectTime.start();
+    m_registeredAfter = -1;
+    m_usableAfter = -1;
+    m_channelCount = 0;
+
+    m_pendingChannels.clear();
+}
+
+void ConnectBurst::registered()
+{
+    m_registeredAfter = m_connectTime.elapsed();
+}
+
+bool ConnectBurst::start()
+{
+    if (m_started)
+        return false;
+
+    m_started = true;
+
+    return true;
+}
+
+void ConnectBurst::setChannelLimits(const QString& value)
+{
+    m_channelLimits.clear();
+    m_channelLimitsFromChanLimit = true;
+
+    foreach (const QString& limit, value.split(',', QString::SkipEmptyParts))
+    {
+        const QString prefixes = limit.section(':', 0, 0);
+        bool ok = false;
+        const int count = limit.section(':', 1).toInt(&ok);
+
+        // an empty count means no limit
+        if (ok && !prefixes.isEmpty())
+            m_channelLimits << qMakePair(prefixes, count);
+    }
+}
+
+void ConnectBurst::setMaxChannels(int limit)
+{
+    m_maxChannels = limit;
+}
+
+Konversation::ChannelList ConnectBurst::plan(const Konversation::ChannelList& channels)
+{
+    // CHANTYPES may come after MAXCHANNELS, so only now are the prefixes known
+    if (!m_channelLimitsFromChanLimit && m_maxChannels >= 0)
+    {
+        m_channelLimits.clear();
+        m_channelLimits << qMakePair(m_server->getChannelTypes(), m_maxChannels);
+    }
+
+    Konversation::ChannelList planned;
+    QVector<int> joinedCounts(m_channelLimits.count(), 0);
+    QStringList skipped;
+
+    foreach (const Konversation::ChannelSettings& channel, channels)
+    {
+        const QString name = channel.name();
+        const QString lcName = name.toLower();
+
+        // The same channel might be autojoined and passed on the command line
+        if (!m_server->isAChannel(name) || m_pendingChannels.contains(lcName))
+            continue;
+
+        int limitIndex = 0;
+
+        while (limitIndex < m_channelLimits.count() && !m_channelLimits.at(limitIndex).first.contains(name.at(0)))
+            ++limitIndex;
+
+        if (limitIndex < m_channelLimits.count())
+        {
+            // the server would refuse it with ERR_TOOMANYCHANNELS anyway
+            if (joinedCounts.at(limitIndex) >= m_channelLimits.at(limitIndex).second)
+            {
+                skipped << name;
+                continue;
+            }
+
+            ++joinedCounts[limitIndex];
+        }
+
+        m_pendingChannels.insert(lcName);
+        planned << channel;
+    }
+
+    if (!skipped.isEmpty())
+    {
+        m_server->getStatusView()->appendServerMessage(i18n("Info"),
+            i18np("Not joining %2, the server allows no more channels.",
+                  "Not joining %1 channels (%2), the server allows no more channels.",
+                  skipped.count(), skipped.join(", ")));
+    }
+
+    m_channelCount = planned.count();
+
+    if (m_pendingChannels.isEmpty())
+        finish();
+
+    return planned;
+}
+
+bool ConnectBurst::isBurstChannel(const QString& channelName) const
+{
+    return m_pendingChannels.contains(channelName.toLower());
+}
+
+void ConnectBurst::channelDone(const QString& channelName)
+{
+    if (m_pendingChannels.remove(channelName.toLower()) && m_pendingChannels.isEmpty())
+        finish();
+}
+
+void ConnectBurst::finish()
+{
+    m_usableAfter = m_connectTime.elapsed();
+
+    if (m_channelCount)
+    {
+        m_server->getStatusView()->appendServerMessage(i18n("Info"),
+            i18np("The channel was usable %2 seconds after connecting.",
+                  "All %1 channels were usable %2 seconds after connecting.",
+                  m_channelCount, KGlobal::locale()->formatNumber(m_usableAfter / 1000.0, 1)));
+    }
+}
+
+#include "connectburst.moc"
@@ -0,0 +1,91 @@
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+*/
+
+#ifndef CONNECTBURST_H
+#define CONNECTBURST_H
+
+#include "servergroupsettings.h"
+
+#include <QObject>
+#include <QPair>
+#include <QSet>
+#include <QTime>
+
+
+class Server;
+
+/**
+ * Plans the channels joined once registration is done, within the limits the
+ * server advertised in RPL_ISUPPORT, and times how long the connection took
+ * to become usable. There is one instance of this class for each Server
+ * object.
+ *
+ * The burst is sent as soon as RPL_ISUPPORT is complete instead of after the
+ * MOTD. Channels joined in it ask for their modes and ban list only once they
+ * are shown, see Channel::requestModes().
+ */
+class ConnectBurst : public QObject
+{
+    Q_OBJECT
+
+    public:
+        explicit ConnectBurst(Server* server);
+        ~ConnectBurst();
+
+        /// A connection attempt begins, forgets the limits and times of the last one.
+        void reset();
+        /// RPL_WELCOME arrived.
+        void registered();
+        /// Returns false if the burst was already sent on this connection.
+        bool start();
+
+        /// From TARGMAX, 0 if there is no limit.
+        void setJoinTargetLimit(int limit) { m_joinTargetLimit = limit; }
+        int joinTargetLimit() const { return m_joinTargetLimit; }
+        /// From CHANLIMIT, as in "#&:100,+:10".
+        void setChannelLimits(const QString& value);
+        /// From MAXCHANNELS, which older servers send instead of CHANLIMIT.
+        void setMaxChannels(int limit);
+
+        /// The channels to join within the server's channel limits. The
+        /// ones left out are reported in the status view.
+        Konversation::ChannelList plan(const Konversation::ChannelList& channels);
+        /// Whether the channel was joined in the burst and its NAMES are not complete yet.
+        bool isBurstChannel(const QString& channelName) const;
+        /// The NAMES of a channel of the burst are complete, or joining it failed.
+        void channelDone(const QString& channelName);
+
+        /// Milliseconds from connecting until registration, -1 if not yet.
+        int registeredAfter() const { return m_registeredAfter; }
+        /// Milliseconds from connecting until all channels of the burst were usable, -1 if not yet.
+        int usableAfter() const { return m_usableAfter; }
+        int channelCount() const { return m_channelCount; }
+
+    private:
+        void finish();
+
+        /// A pointer to the server we are a member of.
+        Server* m_server;
+
+        int m_joinTargetLimit;
+        /// Channel prefixes -> how many channels with them may be joined
+        QList<QPair<QString, int> > m_channelLimits;
+        bool m_channelLimitsFromChanLimit;
+        /// From MAXCHANNELS, -1 if not sent
+        int m_maxChannels;
+
+        bool m_started;
+        QTime m_connectTime;
+        int m_registeredAfter;
+        int m_usableAfter;
+        int m_channelCount;
+
+        /// Lowercase names of the channels of the burst that are not usable yet
+        QSet<QString> m_pendingChannels;
+};
+
+#endif
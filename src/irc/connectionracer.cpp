@@ -0,0 +1,362 @@
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+*/
+
+#include "connectionracer.h"
+
+#include <QHostInfo>
+#include <QTimer>
+
+#include <KDebug>
+#include <ktcpsocket.h>
+
+#include <algorithm>
+#include <limits.h>
+
+
+// how long an attempt gets before the next one is started beside it
+static const int AttemptDelay = 250;
+
+struct ServerRecord
+{
+    ServerRecord() : failures(0), latency(-1) {}
+
+    int failures; ///< in a row
+    int latency; ///< smoothed connect time in ms, -1 if unknown
+};
+
+// shared by all connections, a network's servers are usually the same for all
+static QHash<QString, ServerRecord> s_serverRecords;
+
+static QString recordKey(const Konversation::ServerSettings& server)
+{
+    return server.host().toLower() + ':' + QString::number(server.port());
+}
+
+static bool recordLessThan(const Konversation::ServerSettings& a, const Konversation::ServerSettings& b)
+{
+    const ServerRecord recordA = s_serverRecords.value(recordKey(a));
+    const ServerRecord recordB = s_serverRecords.value(recordKey(b));
+
+    if (recordA.failures != recordB.failures)
+        return recordA.failures < recordB.failures;
+
+    // servers not connected to yet keep their place after the known ones
+    const int latencyA = (recordA.latency < 0) ? INT_MAX : recordA.latency;
+    const int latencyB = (recordB.latency < 0) ? INT_MAX : recordB.latency;
+
+    return latencyA < latencyB;
+}
+
+ConnectionRacer::ConnectionRacer(QObject* parent) : QObject(parent)
+{
+    m_lastSocket = 0;
+    m_lastRank = 0;
+    m_doubtfulSocket = 0;
+    m_doubtfulRank = 0;
+
+    m_attemptTimer = new QTimer(this);
+    m_attemptTimer->setSingleShot(true);
+    m_attemptTimer->setInterval(AttemptDelay);
+    connect(m_attemptTimer, SIGNAL(timeout()), this, SLOT(startNextAttempt()));
+}
+
+ConnectionRacer::~ConnectionRacer()
+{
+    abort();
+}
+
+Konversation::ServerList ConnectionRacer::orderedServers(const Konversation::ServerList& servers)
+{
+    Konversation::ServerList ordered = servers;
+
+    std::stable_sort(ordered.begin(), ordered.end(), recordLessThan);
+
+    return ordered;
+}
+
+void ConnectionRacer::start(const Konversation::ServerList& servers, bool resolve)
+{
+    abort();
+
+    m_servers = orderedServers(servers);
+
+    for (int rank = 0; rank < m_servers.count(); ++rank)
+    {
+        const Konversation::ServerSettings& server = m_servers.at(rank);
+
+        if (resolve && !server.SSLEnabled())
+            m_lookups.insert(QHostInfo::lookupHost(server.host(), this, SLOT(hostLookedUp(QHostInfo))), rank);
+        else
+            queueTarget(rank, 0, server.host());
+    }
+
+    startNextAttempt();
+}
+
+void ConnectionRacer::abort()
+{
+    m_attemptTimer->stop();
+
+    foreach (int lookupId, m_lookups.keys())
+        QHostInfo::abortHostLookup(lookupId);
+
+    m_lookups.clear();
+    m_queue.clear();
+
+    foreach (KTcpSocket* socket, m_attempts.keys())
+    {
+        socket->disconnect(this);
+        socket->abort();
+        socket->deleteLater();
+    }
+
+    m_attempts.clear();
+
+    if (m_lastSocket)
+    {
+        m_lastSocket->deleteLater();
+        m_lastSocket = 0;
+    }
+
+    if (m_doubtfulSocket)
+    {
+        m_doubtfulSocket->disconnect(this);
+        m_doubtfulSocket->abort();
+        m_doubtfulSocket->deleteLater();
+        m_doubtfulSocket = 0;
+    }
+}
+
+bool ConnectionRacer::isRacing() const
+{
+    return !m_lookups.isEmpty() || !m_queue.isEmpty() || !m_attempts.isEmpty();
+}
+
+void ConnectionRacer::queueTarget(int rank, int order, const QString& address)
+{
+    Target target;
+    target.rank = rank;
+    target.order = order;
+    target.address = address;
+
+    int index = 0;
+
+    while (index < m_queue.count() && (m_queue.at(index).rank < rank
+        || (m_queue.at(index).rank == rank && m_queue.at(index).order <= order)))
+    {
+        ++index;
+    }
+
+    m_queue.insert(index, target);
+}
+
+void ConnectionRacer::hostLookedUp(const QHostInfo& info)
+{
+    if (!m_lookups.contains(info.lookupId()))
+        return;
+
+    const int rank = m_lookups.take(info.lookupId());
+
+    if (info.error() != QHostInfo::NoError || info.addresses().isEmpty())
+    {
+        // the socket fails with the same error, for the usual message
+        queueTarget(rank, 0, m_servers.at(rank).host());
+    }
+    else
+    {
+        QList<QHostAddress> ipv6;
+        QList<QHostAddress> ipv4;
+
+        foreach (const QHostAddress& address, info.addresses())
+        {
+            if (address.protocol() == QAbstractSocket::IPv6Protocol)
+                ipv6 << address;
+            else
+                ipv4 << address;
+        }
+
+        for (int i = 0; i < qMax(ipv6.count(), ipv4.count()); ++i)
+        {
+            if (i < ipv6.count())
+                queueTarget(rank, 2 * i, ipv6.at(i).toString());
+
+            if (i < ipv4.count())
+                queueTarget(rank, 2 * i + 1, ipv4.at(i).toString());
+        }
+    }
+
+    if (!m_attemptTimer->isActive())
+        startNextAttempt();
+}
+
+void ConnectionRacer::startNextAttempt()
+{
+    if (m_queue.isEmpty())
+        return;
+
+    const Target target = m_queue.takeFirst();
+    const Konversation::ServerSettings& server = m_servers.at(target.rank);
+
+    KTcpSocket* socket = new KTcpSocket(this);
+    connect(socket, SIGNAL(error(KTcpSocket::Error)), this, SLOT(attemptError()));
+
+    if (server.SSLEnabled())
+    {
+        // a server that accepts connections but stalls the handshake must not win
+        connect(socket, SIGNAL(encrypted()), this, SLOT(attemptConnected()));
+        connect(socket, SIGNAL(sslErrors(QList<KSslError>)), this, SLOT(attemptSslErrors()));
+
+        if (!m_clientCertificate.isEmpty())
+        {
+            socket->setLocalCertificate(m_clientCertificate);
+            socket->setPrivateKey(m_clientCertificate);
+        }
+
+        socket->setAdvertisedSslVersion(KTcpSocket::TlsV1);
+    }
+    else
+        connect(socket, SIGNAL(connected()), this, SLOT(attemptConnected()));
+
+    Attempt attempt;
+    attempt.rank = target.rank;
+    attempt.started.start();
+    m_attempts.insert(socket, attempt);
+
+    emit attemptStarted(server, target.address);
+
+    if (server.SSLEnabled())
+        socket->connectToHostEncrypted(target.address, server.port());
+    else
+        socket->connectToHost(target.address, server.port());
+
+    m_attemptTimer->start();
+}
+
+void ConnectionRacer::attemptConnected()
+{
+    KTcpSocket* socket = qobject_cast<KTcpSocket*>(sender());
+
+    if (!socket || !m_attempts.contains(socket))
+        return;
+
+    const Attempt attempt = m_attempts.take(socket);
+    const Konversation::ServerSettings server = m_servers.at(attempt.rank);
+
+    ServerRecord& record = s_serverRecords[recordKey(server)];
+    const int latency = attempt.started.elapsed();
+
+    record.failures = 0;
+    record.latency = (record.latency < 0) ? latency : (3 * record.latency + latency) / 4;
+
+    if (!socket->sslErrors().isEmpty())
+    {
+        // Only wins if no server without certificate errors can be had
+        if (!m_doubtfulSocket)
+        {
+            m_doubtfulSocket = socket;
+            m_doubtfulRank = attempt.rank;
+        }
+        else
+        {
+            socket->disconnect(this);
+            socket->abort();
+            socket->deleteLater();
+        }
+
+        if (m_queue.isEmpty())
+            settle();
+        else
+            startNextAttempt();
+
+        return;
+    }
+
+    win(socket, attempt.rank);
+}
+
+void ConnectionRacer::attemptSslErrors()
+{
+    KTcpSocket* socket = qobject_cast<KTcpSocket*>(sender());
+
+    // The errors are looked at once the handshake is done, nothing is sent before
+    if (socket && m_attempts.contains(socket))
+        socket->ignoreSslErrors();
+}
+
+void ConnectionRacer::win(KTcpSocket* socket, int rank)
+{
+    const Konversation::ServerSettings server = m_servers.at(rank);
+
+    socket->disconnect(this);
+    socket->setParent(0);
+
+    if (socket == m_doubtfulSocket)
+        m_doubtfulSocket = 0;
+
+    // the other attempts lost, which says nothing about their servers
+    abort();
+
+    emit won(socket, server);
+}
+
+bool ConnectionRacer::settle()
+{
+    if (!m_queue.isEmpty() || !m_attempts.isEmpty() || !m_lookups.isEmpty())
+        return false;
+
+    m_attemptTimer->stop();
+
+    if (m_doubtfulSocket)
+    {
+        win(m_doubtfulSocket, m_doubtfulRank);
+
+        return true;
+    }
+
+    if (!m_lastSocket)
+        return false;
+
+    KTcpSocket* lastSocket = m_lastSocket;
+    m_lastSocket = 0;
+    lastSocket->setParent(0);
+
+    emit lost(lastSocket, m_servers.at(m_lastRank));
+
+    return true;
+}
+
+void ConnectionRacer::attemptError()
+{
+    KTcpSocket* socket = qobject_cast<KTcpSocket*>(sender());
+
+    if (!socket || !m_attempts.contains(socket))
+        return;
+
+    const Attempt attempt = m_attempts.take(socket);
+    const Konversation::ServerSettings server = m_servers.at(attempt.rank);
+
+    ++s_serverRecords[recordKey(server)].failures;
+
+    kDebug() << "connecting to" << server.host() << "failed:" << socket->errorString();
+
+    socket->disconnect(this);
+    emit attemptFailed(server, socket->errorString());
+
+    if (m_lastSocket)
+        m_lastSocket->deleteLater();
+
+    m_lastSocket = socket;
+    m_lastRank = attempt.rank;
+
+    // no need to wait for an attempt that already failed
+    if (!m_queue.isEmpty())
+        startNextAttempt();
+    else
+        settle();
+}
+
+#include "connectionracer.moc"
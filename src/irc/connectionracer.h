@@ -0,0 +1,111 @@
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+*/
+
+#ifndef CONNECTIONRACER_H
+#define CONNECTIONRACER_H
+
+#include "serversettings.h"
+#include "servergroupsettings.h"
+
+#include <QObject>
+#include <QHash>
+#include <QTime>
+
+
+class QHostInfo;
+class QTimer;
+
+class KTcpSocket;
+
+/**
+ * Connects to all servers of a network at once and hands the first connected
+ * socket to its Server, in the manner of Happy Eyeballs (RFC 8305).
+ *
+ * Attempts are started one after the other, each AttemptDelay after the
+ * previous one or right away when the previous one failed, so a server that
+ * answers quickly wins without any extra connections. Plain connections are
+ * raced per address, alternating IPv6 and IPv4 addresses. Encrypted ones are
+ * raced per server, as the certificate has to be checked against the host
+ * name, and only win once their handshake is done. Certificate errors are
+ * ignored for the handshake to finish, a server with them only wins when no
+ * other one could be connected to, and the receiver has to ask the user about
+ * them before sending anything.
+ *
+ * How long connecting to a server took and how often it failed in a row is
+ * remembered for the rest of the session and decides the order servers are
+ * tried in the next time.
+ */
+class ConnectionRacer : public QObject
+{
+    Q_OBJECT
+
+    public:
+        explicit ConnectionRacer(QObject* parent = 0);
+        ~ConnectionRacer();
+
+        /// Starts connecting to servers, any earlier race is aborted.
+        /// Without resolve host names are left to the sockets, e.g. for a proxy.
+        void start(const Konversation::ServerList& servers, bool resolve);
+        /// The PEM file with the client certificate and key for encrypted connections.
+        void setClientCertificate(const QString& fileName) { m_clientCertificate = fileName; }
+        void abort();
+        bool isRacing() const;
+
+    signals:
+        void attemptStarted(const Konversation::ServerSettings& server, const QString& address);
+        void attemptFailed(const Konversation::ServerSettings& server, const QString& error);
+        /// The socket is connected, and encrypted if the server uses SSL, and
+        /// belongs to the receiver now.
+        void won(KTcpSocket* socket, const Konversation::ServerSettings& server);
+        /// All attempts failed, the receiver gets the socket of the last one.
+        void lost(KTcpSocket* socket, const Konversation::ServerSettings& server);
+
+    private slots:
+        void hostLookedUp(const QHostInfo& info);
+        void startNextAttempt();
+        void attemptConnected();
+        void attemptSslErrors();
+        void attemptError();
+
+    private:
+        struct Target
+        {
+            int rank; ///< of the server in m_servers
+            int order; ///< of the address among those of the server
+            QString address;
+        };
+
+        struct Attempt
+        {
+            int rank;
+            QTime started;
+        };
+
+        static Konversation::ServerList orderedServers(const Konversation::ServerList& servers);
+        void queueTarget(int rank, int order, const QString& address);
+        /// Hands a socket over after all attempts ended, false if there is none.
+        bool settle();
+        void win(KTcpSocket* socket, int rank);
+
+        Konversation::ServerList m_servers;
+        /// Host lookup id -> rank of the server looked up
+        QHash<int, int> m_lookups;
+        /// Sorted by rank and order
+        QList<Target> m_queue;
+        QHash<KTcpSocket*, Attempt> m_attempts;
+        QTimer* m_attemptTimer;
+
+        KTcpSocket* m_lastSocket;
+        int m_lastRank;
+        /// Encrypted despite certificate errors, kept in case nothing else works
+        KTcpSocket* m_doubtfulSocket;
+        int m_doubtfulRank;
+
+        QString m_clientCertificate;
+};
+
+#endif
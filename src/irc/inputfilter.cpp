@@ -22,6 +22,9 @@
 #include "statuspanel.h"
 #include "common.h"
 #include "notificationhandler.h"
+#include "whoscheduler.h"
+#include "connectburst.h"
+#include "dbus.h"
 #include <config-konversation.h>
 
 #include <QStringList>
@@ -31,11 +34,33 @@
 #include <KLocale>
 
 
+// The replies to a JOIN that did not succeed, with the channel as first parameter
+static bool isJoinFailure(int numeric)
+{
+    switch (numeric)
+    {
+        case ERR_NOSUCHCHANNEL:
+        case ERR_TOOMANYCHANNELS:
+        case ERR_UNAVAILRESOURCE:
+        case ERR_LINKCHANNEL:
+        case ERR_CHANNELISFULL:
+        case ERR_INVITEONLYCHAN:
+        case ERR_BANNEDFROMCHAN:
+        case ERR_BADCHANNELKEY:
+        case ERR_BADCHANMASK:
+        case ERR_NOCHANMODES:
+            return true;
+        default:
+            return false;
+    }
+}
+
 InputFilter::InputFilter()
     : m_server(0),
       m_lagMeasuring(false)
 {
     m_connecting = false;
+    m_isupportReceived = false;
 }
 
 InputFilter::~InputFilter()
@@ -223,6 +248,7 @@ void InputFilter::parseClientCommand(const QString &prefix, const QString &comma
                     }
 
                     channel->appendAction(sourceNick, ctcpArgument);
+                    konv_app->eventDBus()->post("action", m_server, channel->getName(), sourceNick, ctcpArgument);
 
                     if (sourceNick != m_server->getNickname())
                     {
@@ -253,6 +279,7 @@ void InputFilter::parseClientCommand(const QString &prefix, const QString &comma
 
                     // send action to query
                     query->appendAction(sourceNick, ctcpArgument);
+                    konv_app->eventDBus()->post("action", m_server, sourceNick, sourceNick, ctcpArgument);
 
                     if (sourceNick != m_server->getNickname() && query)
                         konv_app->notificationHandler()->queryMessage(query, sourceNick, ctcpArgument);
@@ -590,8 +617,9 @@ void InputFilter::parseClientCommand(const QString &prefix, const QString &comma
     }
     else if (command=="join" && plHas(1))
     {
-        QString channelName(trailing);
-        // Sometimes JOIN comes without ":" in front of the channel name
+        // Sometimes JOIN comes without ":" in front of the channel name, and
+        // with extended-join the trailing parameter is the real name
+        QString channelName(parameterList.value(0));
 
         // Did we join the channel, or was it someone else?
         if (m_server->isNickname(sourceNick))
@@ -617,23 +645,57 @@ void InputFilter::parseClientCommand(const QString &prefix, const QString &comma
 
             channel->clearModeList();
 
-            // Request modes for the channel
-            m_server->queue("MODE "+channelName, Server::LowPriority);
-
-            // Initiate channel ban list
-            channel->clearBanList();
-            setAutomaticRequest("BANLIST",channelName,true);
-            m_server->queue("MODE "+channelName+" +b", Server::LowPriority);
+            // Channels of the connect burst ask for their modes and bans once shown,
+            // keeping the queue free for the NAMES and WHO of all the others
+            if (m_server->getConnectBurst()->isBurstChannel(channelName) && !channel->isVisible())
+                channel->deferModeRequests();
+            else
+                channel->requestModes();
         }
         else
         {
             Channel* channel = m_server->nickJoinsChannel(channelName, sourceNick, sourceHostmask);
             konv_app->notificationHandler()->join(channel, sourceNick);
         }
+
+        konv_app->eventDBus()->post("join", m_server, channelName, sourceNick);
+
+        //:nick!user@host JOIN #channel account :Real Name
+        if (m_server->hasCapability(Server::ExtendedJoin) && parameterList.count() >= 3)
+        {
+            NickInfoPtr nickInfo = m_server->getNickInfo(sourceNick);
+            if (nickInfo)
+            {
+                nickInfo->setRealName(parameterList.value(2));
+                // "*" means not logged in to an account
+                nickInfo->setIdentified(parameterList.value(1) != "*");
+                // the away state follows with away-notify
+                nickInfo->setWhoTimeStamp(QDateTime::currentDateTime().toTime_t());
+            }
+        }
+    }
+    else if (command=="away")
+    {
+        // away-notify, an AWAY without message means back
+        NickInfoPtr nickInfo = m_server->getNickInfo(sourceNick);
+        if (nickInfo)
+        {
+            const QString awayMessage = parameterList.value(0);
+            nickInfo->setAway(!awayMessage.isEmpty());
+            nickInfo->setAwayMessage(awayMessage);
+        }
+    }
+    else if (command=="account" && plHas(1))
+    {
+        // account-notify, "*" means logged out
+        NickInfoPtr nickInfo = m_server->getNickInfo(sourceNick);
+        if (nickInfo)
+            nickInfo->setIdentified(parameterList.value(0) != "*");
     }
     else if (command=="kick" && plHas(2))
     {
         m_server->nickWasKickedFromChannel(parameterList.value(0), parameterList.value(1), sourceNick, trailing);
+        konv_app->eventDBus()->post("kick", m_server, parameterList.value(0), parameterList.value(1), trailing, sourceNick);
     }
     else if (command=="part" && plHas(1))
     {
@@ -643,6 +705,7 @@ void InputFilter::parseClientCommand(const QString &prefix, const QString &comma
         QString reason(parameterList.value(1));
 
         Channel* channelPtr = m_server->removeNickFromChannel(channel, sourceNick, reason);
+        konv_app->eventDBus()->post("part", m_server, channel, sourceNick, reason);
 
         if (sourceNick != m_server->getNickname())
         {
@@ -651,7 +714,11 @@ void InputFilter::parseClientCommand(const QString &prefix, const QString &comma
     }
     else if (command=="quit" && plHas(1))
     {
+        // The channels are gone once the nick is removed
+        const QStringList channels = m_server->getSharedChannels(sourceNick);
+
         m_server->removeNickFromServer(sourceNick, trailing);
+        postToChannels("quit", channels, sourceNick, trailing);
         if (sourceNick != m_server->getNickname())
         {
             konv_app->notificationHandler()->quit(m_server->getStatusView(), sourceNick);
@@ -662,6 +729,7 @@ void InputFilter::parseClientCommand(const QString &prefix, const QString &comma
         QString newNick(parameterList.value(0)); // Message may not include ":" in front of the new nickname
 
         m_server->renameNick(sourceNick, newNick);
+        postToChannels("nick", m_server->getSharedChannels(newNick), sourceNick, newNick);
 
         if (sourceNick != m_server->getNickname())
         {
@@ -738,7 +806,7 @@ void InputFilter::parseServerCommand(const QString &prefix, const QString &comma
             // the LAG cookie back in PONG
             if (trailing.startsWith(QLatin1String("LAG")) || getLagMeasuring())
             {
-                m_server->pongReceived();
+                m_server->pongReceived(trailing);
             }
         }
         else if (command == "mode")
@@ -752,6 +820,7 @@ void InputFilter::parseServerCommand(const QString &prefix, const QString &comma
         else if (command == "kick" && plHas(3))
         {
             m_server->nickWasKickedFromChannel(parameterList.value(1), parameterList.value(2), prefix, trailing);
+            Application::instance()->eventDBus()->post("kick", m_server, parameterList.value(1), parameterList.value(2), trailing, prefix);
         }
         else if (command == "privmsg")
         {
@@ -761,7 +830,23 @@ void InputFilter::parseServerCommand(const QString &prefix, const QString &comma
         {
             QString command = parameterList.value(1).toLower();
 
-            if (command == "ack" || command == "nak")
+            if (command == "ls")
+            {
+                // "CAP * LS * :..." announces more lines to follow
+                bool complete = !(parameterList.count() > 3 && parameterList.value(2) == "*");
+
+                m_server->capListed(parameterList.last().split(' ', QString::SkipEmptyParts), complete);
+            }
+            else if (command == "new")
+            {
+                m_server->capAdded(parameterList.last().split(' ', QString::SkipEmptyParts));
+            }
+            else if (command == "del")
+            {
+                foreach (const QString& name, parameterList.last().split(' ', QString::SkipEmptyParts))
+                    m_server->capRemoved(name);
+            }
+            else if (command == "ack" || command == "nak")
             {
                 m_server->capReply();
 
@@ -769,7 +854,7 @@ void InputFilter::parseServerCommand(const QString &prefix, const QString &comma
 
                 foreach(const QString& capability, capabilities)
                 {
-                    int nameStart = capability.indexOf(QRegExp("[a-z0-9", Qt::CaseInsensitive));
+                    int nameStart = capability.indexOf(QRegExp("[a-z0-9]", Qt::CaseInsensitive));
                     QString modifierString = capability.left(nameStart);
                     QString name = capability.mid(nameStart);
 
@@ -798,6 +883,8 @@ void InputFilter::parseServerCommand(const QString &prefix, const QString &comma
                     else
                         m_server->capDenied(name);
                 }
+
+                m_server->capRequestAnswered();
             }
         }
         else if (command == "authenticate" && plHas(1))
@@ -818,6 +905,14 @@ void InputFilter::parseServerCommand(const QString &prefix, const QString &comma
         //QString m_serverAssignedNick(parameterList.takeFirst());
         QString m_serverAssignedNick(parameterList.first());
 
+        // RPL_ISUPPORT is complete, the channel limits are known now
+        if (m_connecting && m_isupportReceived && numeric != RPL_ISUPPORT)
+            m_server->autoCommandsAndChannels();
+
+        // A channel of the connect burst that could not be joined is done too
+        if (isJoinFailure(numeric))
+            m_server->getConnectBurst()->channelDone(parameterList.value(1));
+
         switch (numeric)
         {
             case RPL_WELCOME:
@@ -842,6 +937,7 @@ void InputFilter::parseServerCommand(const QString &prefix, const QString &comma
                         // Send the welcome signal, so the server class knows we are connected properly
                         emit welcome(host);
                         m_connecting = true;
+                        m_isupportReceived = false;
                     }
                     m_server->appendStatusMessage(i18n("Welcome"), trailing);
                 }
@@ -879,6 +975,7 @@ void InputFilter::parseServerCommand(const QString &prefix, const QString &comma
                 if (plHas(0)) //make the script happy
                 {
                     m_server->appendStatusMessage(i18n("Support"), parameterList.join(" "));
+                    m_isupportReceived = true;
 
                 // The following behaviour is neither documented in RFC 1459 nor in 2810-2813
                     // Nowadays, most ircds send server capabilities out via 005 (BOUNCE).
@@ -964,6 +1061,31 @@ void InputFilter::parseServerCommand(const QString &prefix, const QString &comma
                                     m_server->setTopicLength(topicLength);
                             }
                         }
+                        else if (property == "WHOX")
+                        {
+                            m_server->setWhoxSupported(true);
+                        }
+                        else if (property == "TARGMAX")
+                        {
+                            foreach (const QString& target, value.split(',', QString::SkipEmptyParts))
+                            {
+                                // An empty limit means there is none
+                                if (target.section(':', 0, 0).toUpper() == "JOIN")
+                                    m_server->getConnectBurst()->setJoinTargetLimit(target.section(':', 1).toInt());
+                            }
+                        }
+                        else if (property == "CHANLIMIT")
+                        {
+                            m_server->getConnectBurst()->setChannelLimits(value);
+                        }
+                        else if (property == "MAXCHANNELS")
+                        {
+                            bool ok = false;
+                            int maxChannels = value.toInt(&ok);
+
+                            if (ok)
+                                m_server->getConnectBurst()->setMaxChannels(maxChannels);
+                        }
                         else
                         {
                             //kDebug() << "Ignored server-capability: " << property << " with value '" << value << "'";
@@ -1537,20 +1659,18 @@ void InputFilter::parseServerCommand(const QString &prefix, const QString &comma
             {
                 if (plHas(6))
                 {
-                    NickInfoPtr nickInfo = m_server->getNickInfo(parameterList.value(5));
-                                                    // G=away G@=away,op G+=away,voice
-                    bool bAway = parameterList.value(6).toUpper().startsWith('G');
-                    if (nickInfo)
-                    {
-                        nickInfo->setHostmask(i18n("%1@%2", parameterList.value(2), parameterList.value(3)));
+                    WhoReply reply;
+                    reply.nickname = parameterList.value(5);
+                    reply.hostmask = i18n("%1@%2", parameterList.value(2), parameterList.value(3));
                                                     //Strip off the "0 "
-                        nickInfo->setRealName(trailing.section(' ', 1));
-                        nickInfo->setAway(bAway);
-                        if(!bAway)
-                        {
-                            nickInfo->setAwayMessage(QString());
-                        }
-                    }
+                    reply.realName = trailing.section(' ', 1);
+                                                    // G=away G@=away,op G+=away,voice
+                    reply.away = parameterList.value(6).toUpper().startsWith('G');
+                    reply.identified = -1;
+
+                    bool bAway = reply.away;
+                    queueWhoReply(parameterList.value(1), reply);
+
                     // Display message only if this was not an automatic request.
                     if (!m_whoRequestList.isEmpty())     // for safe
                     {
@@ -1568,10 +1688,35 @@ void InputFilter::parseServerCommand(const QString &prefix, const QString &comma
                 }
                 break;
             }
+            // Sample WHOX response to our "WHO #lounge %tcuhnfar,152"
+            //[21:39] [354] 152 #lounge ~Nottingha worldforge.org SherwoodSpirit H sherwood :Arboreal Entity
+            case RPL_WHOSPCRPL:
+            {
+                // Replies to WHOX queries with other fields or tokens are the user's own
+                if (plHas(9) && parameterList.value(1) == QString::number(WhoScheduler::WhoxQueryToken))
+                {
+                    WhoReply reply;
+                    reply.nickname = parameterList.value(5);
+                    reply.hostmask = i18n("%1@%2", parameterList.value(3), parameterList.value(4));
+                    reply.realName = trailing;
+                    reply.away = parameterList.value(6).toUpper().startsWith('G');
+                    // "0" means not logged in to an account
+                    reply.identified = (parameterList.value(7) != "0") ? 1 : 0;
+
+                    queueWhoReply(parameterList.value(2), reply);
+                }
+                else if (plHas(2))
+                {
+                    m_server->appendMessageToFrontmost(i18n("Who"), parameterList.mid(1).join(" "), false);
+                }
+                break;
+            }
             case RPL_ENDOFWHO:
             {
                 if (plHas(2))
                 {
+                    applyWhoReplies(parameterList.value(1));
+
                     if (!m_whoRequestList.isEmpty())
                     {
                         const QString param = parameterList.value(1).toLower();
@@ -1598,6 +1743,10 @@ void InputFilter::parseServerCommand(const QString &prefix, const QString &comma
                             kDebug() << "RPL_ENDOFWHO: malformed ENDOFWHO. retrieved: "
                                 << parameterList.value(1) << " expected: " << m_whoRequestList.front();
                             m_whoRequestList.clear();
+
+                            // don't hold on to what arrived for the others
+                            foreach (const QString& pending, m_whoReplies.keys())
+                                applyWhoReplies(pending);
                         }
                     }
                     else
@@ -2055,7 +2204,7 @@ void InputFilter::parseServerCommand(const QString &prefix, const QString &comma
                     //Some servers don't know their name, so they return an error instead of the PING data
                     if (getLagMeasuring() && trailing.startsWith(prefix))
                     {
-                        m_server->pongReceived();
+                        m_server->pongReceived(parameterList.value(1));
                     }
                     else if (getAutomaticRequest("WHOIS", parameterList.value(1)) == 1) //Inhibit message if this was an automatic request
                     {
@@ -2285,6 +2434,22 @@ void InputFilter::parseModes(const QString &sourceNick, const QStringList &param
     }
 }
 
+void InputFilter::postToChannels(const QString& type, const QStringList& channels, const QString& nick, const QString& text)
+{
+    EventDBus* eventDBus = Application::instance()->eventDBus();
+
+    // Nobody shares a channel with the nick, only unfiltered subscribers get it
+    if (channels.isEmpty())
+        eventDBus->post(type, m_server, QString(), nick, text);
+
+    foreach (const QString& channelName, channels)
+    {
+        Channel* channel = m_server->getChannelByName(channelName);
+
+        eventDBus->post(type, m_server, channel ? channel->getName() : channelName, nick, text);
+    }
+}
+
 // # & + and ! are *often*, but not necessarily, Channel identifiers. + and ! are non-RFC,
 // so if a server doesn't offer 005 and supports + and ! channels, I think thats broken behaviour
 // on their part - not ours. --Argonel
@@ -2317,6 +2482,53 @@ void InputFilter::reset()
 {
     m_automaticRequest.clear();
     m_whoRequestList.clear();
+    m_whoReplies.clear();
+}
+
+/// Replies to a WHO we are waiting for are collected until its RPL_ENDOFWHO,
+/// unsolicited ones are applied right away.
+void InputFilter::queueWhoReply(const QString& target, const WhoReply& reply)
+{
+    const QString lcTarget = target.toLower();
+
+    if (m_whoRequestList.contains(lcTarget))
+        m_whoReplies[lcTarget].append(reply);
+    else
+        applyWhoReply(reply, QDateTime::currentDateTime().toTime_t());
+}
+
+void InputFilter::applyWhoReply(const WhoReply& reply, uint timeStamp)
+{
+    NickInfoPtr nickInfo = m_server->getNickInfo(reply.nickname);
+
+    if (!nickInfo)
+        return;
+
+    nickInfo->setHostmask(reply.hostmask);
+    nickInfo->setRealName(reply.realName);
+    nickInfo->setAway(reply.away);
+    if (!reply.away)
+        nickInfo->setAwayMessage(QString());
+    if (reply.identified == 1)
+        nickInfo->setIdentified(true);
+    nickInfo->setWhoTimeStamp(timeStamp);
+}
+
+/// Apply the collected replies to a WHO in one pass and pass the changes on
+/// right away, so the nick lists get a single coalesced update.
+void InputFilter::applyWhoReplies(const QString& target)
+{
+    const QList<WhoReply> replies = m_whoReplies.take(target.toLower());
+
+    if (replies.isEmpty())
+        return;
+
+    const uint timeStamp = QDateTime::currentDateTime().toTime_t();
+
+    foreach (const WhoReply& reply, replies)
+        applyWhoReply(reply, timeStamp);
+
+    m_server->flushNickInfoChanges();
 }
 
 void InputFilter::setAutomaticRequest(const QString& command, const QString& name, bool yes)
@@ -2371,6 +2583,7 @@ void InputFilter::parsePrivMsg(const QString& prefix, QStringList& parameterList
             if(channel)
             {
                 channel->append(source, message);
+                konv_app->eventDBus()->post("message", m_server, channel->getName(), source, message);
 
                 if(source != m_server->getNickname())
                 {
@@ -2404,6 +2617,7 @@ void InputFilter::parsePrivMsg(const QString& prefix, QStringList& parameterList
 
             // send action to query
             query->appendQuery(source, message);
+            konv_app->eventDBus()->post("message", m_server, source, source, message);
 
             if(source != m_server->getNickname() && query)
             {
@@ -19,6 +19,8 @@
 #include <QObject>
 #include <QStringList>
 #include <QMap>
+#include <QHash>
+#include <QList>
 
 class Server;
 class Query;
@@ -86,13 +88,33 @@ class InputFilter : public QObject
         bool isAChannel(const QString &check);
         bool isIgnore(const QString &pattern, Ignore::Type type);
 
+        /// The NickInfo relevant parts of a WHO (352) or WHOX (354) reply
+        struct WhoReply
+        {
+            QString nickname;
+            QString hostmask;
+            QString realName;
+            bool away;
+            int identified;                       ///< 1 logged in, 0 not, -1 unknown
+        };
+
+        void queueWhoReply(const QString& target, const WhoReply& reply);
+        void applyWhoReply(const WhoReply& reply, uint timeStamp);
+        void applyWhoReplies(const QString& target);
+        /// Posts a quit or nick change to D-Bus once for every channel it happened in.
+        void postToChannels(const QString& type, const QStringList& channels, const QString& nick, const QString& text);
+
         Server* m_server;
                                                   // automaticRequest[command][channel or nick]=count
         QMap< QString, QMap< QString, int > > m_automaticRequest;
         QStringList m_whoRequestList;
+        /// Replies to the WHO requests in m_whoRequestList, by lowercase target
+        QHash<QString, QList<WhoReply> > m_whoReplies;
         bool m_lagMeasuring;
 
         /// Used when handling MOTD
         bool m_connecting;
+        /// RPL_ISUPPORT arrived since RPL_WELCOME, the connect burst follows it
+        bool m_isupportReceived;
 };
 #endif
@@ -96,7 +96,10 @@ namespace Konversation
 
         // If the channel already exist in the history only the password will be updated.
         if (server && server->getServerGroup())
+        {
             server->getServerGroup()->appendChannelHistory(ChannelSettings(channel(), password()));
+            Application::instance()->saveServerGroup(server->getServerGroup()->id(), false);
+        }
 
         accept();
     }
@@ -0,0 +1,226 @@
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+*/
+
+#include "keepalive.h"
+#include "server.h"
+#include "preferences.h"
+
+#include <QTimer>
+
+#include <ktcpsocket.h>
+
+
+// between PINGs on an idle connection
+static const int IdleInterval = 60000;
+// after a lag well above the usual one
+static const int ShortInterval = 15000;
+// a connection busy with data is still pinged this often, for a current lag
+static const int BusyInterval = 300000;
+// how far above the usual lag counts as well above, at the least
+static const int SpikeMargin = 250;
+
+static const int HistogramBounds[] = { 50, 100, 200, 500, 1000, 2000, 5000 };
+static const int HistogramBoundCount = sizeof(HistogramBounds) / sizeof(HistogramBounds[0]);
+
+KeepAlive::KeepAlive(Server* server) : QObject(server), m_server(server)
+{
+    m_pingTimer = new QTimer(this);
+    m_pingTimer->setSingleShot(true);
+    connect(m_pingTimer, SIGNAL(timeout()), this, SLOT(sendPing()));
+
+    m_pongTimer = new QTimer(this);
+    m_pongTimer->setInterval(1000);
+    connect(m_pongTimer, SIGNAL(timeout()), this, SLOT(checkPendingPong()));
+
+    m_forcePing = false;
+    m_waitingForPong = false;
+    m_bytesBeforePing = 0;
+    m_lag = -1;
+    m_smoothedLag = -1;
+    m_lagDeviation = 0;
+    m_interval = IdleInterval;
+
+    m_histogram.fill(0, HistogramBoundCount + 1);
+}
+
+KeepAlive::~KeepAlive()
+{
+}
+
+void KeepAlive::start(KTcpSocket* socket)
+{
+    stop();
+
+    m_socket = socket;
+    connect(m_socket, SIGNAL(bytesWritten(qint64)), this, SLOT(pingBytesWritten(qint64)));
+
+    m_lastReceived.start();
+    m_forcePing = true;
+    m_smoothedLag = -1;
+    m_interval = IdleInterval;
+
+    // get the first lag early, whatever the traffic
+    m_pingTimer->start(1000);
+}
+
+void KeepAlive::stop()
+{
+    m_pingTimer->stop();
+    m_pongTimer->stop();
+
+    if (m_socket)
+        m_socket->disconnect(this);
+
+    m_socket = 0;
+
+    m_waitingForPong = false;
+    m_pingCookie.clear();
+    m_bytesBeforePing = 0;
+    m_server->getInputFilter()->setLagMeasuring(false);
+    m_lag = -1;
+}
+
+void KeepAlive::sendPing()
+{
+    if (!m_socket)
+        return;
+
+    const int sinceReceived = m_lastReceived.elapsed();
+
+    // Data arriving shows the connection is alive, no need to ask
+    if (!m_forcePing && sinceReceived < m_interval && m_lastPing.elapsed() < BusyInterval)
+    {
+        m_pingTimer->start(m_interval - sinceReceived);
+
+        return;
+    }
+
+    m_pingCookie = "LAG" + QTime::currentTime().toString("hhmmsszzz");
+    m_server->sendUnqueued("PING " + m_pingCookie);
+
+    // The lag starts once the socket wrote everything up to the PING
+    m_bytesBeforePing = m_socket->bytesToWrite();
+    m_lagTime.start();
+    m_lastPing.start();
+    m_forcePing = false;
+    m_waitingForPong = true;
+
+    m_server->getInputFilter()->setLagMeasuring(true);
+    m_pongTimer->start();
+
+    emit pingSent();
+}
+
+void KeepAlive::pingBytesWritten(qint64 bytes)
+{
+    if (m_bytesBeforePing <= 0)
+        return;
+
+    m_bytesBeforePing -= bytes;
+
+    if (m_bytesBeforePing <= 0)
+        m_lagTime.start();
+}
+
+void KeepAlive::pongReceived(const QString& cookie)
+{
+    // ignore unrequested PONGs, and late ones to a PING given up on. Some
+    // servers don't send the cookie back, those PONGs can't be told apart.
+    if (!m_waitingForPong || (cookie.startsWith(QLatin1String("LAG")) && cookie != m_pingCookie))
+        return;
+
+    m_waitingForPong = false;
+    m_pingCookie.clear();
+    m_bytesBeforePing = 0;
+    m_pongTimer->stop();
+    m_server->getInputFilter()->setLagMeasuring(false);
+
+    m_lag = m_lagTime.elapsed();
+    addToHistogram(m_lag);
+
+    if (m_smoothedLag < 0)
+    {
+        m_smoothedLag = m_lag;
+        m_lagDeviation = m_lag / 2;
+        m_interval = IdleInterval;
+    }
+    else
+    {
+        // A lag well above the usual may be the connection going bad, look again soon
+        if (m_lag > m_smoothedLag + qMax(4 * m_lagDeviation, SpikeMargin))
+            m_interval = ShortInterval;
+        else
+            m_interval = IdleInterval;
+
+        m_lagDeviation = (3 * m_lagDeviation + qAbs(m_smoothedLag - m_lag)) / 4;
+        m_smoothedLag = (7 * m_smoothedLag + m_lag) / 8;
+    }
+
+    emit lagMeasured(m_lag);
+
+    m_pingTimer->start(m_interval);
+}
+
+void KeepAlive::checkPendingPong()
+{
+    if (!m_waitingForPong)
+    {
+        m_pongTimer->stop();
+
+        return;
+    }
+
+    const int pending = m_lagTime.elapsed();
+    const int maximumLag = Preferences::self()->maximumLagTime() * 1000;
+
+    emit lagTooLong(pending);
+
+    if (pending <= maximumLag)
+        return;
+
+    m_pongTimer->stop();
+
+    if (m_lastReceived.elapsed() > maximumLag)
+    {
+        emit timedOut();
+
+        return;
+    }
+
+    // The server is slow to answer but still sending, give it another PING
+    // rather than reconnecting. The lag is not known, it was only waited for.
+    m_waitingForPong = false;
+    m_bytesBeforePing = 0;
+    m_server->getInputFilter()->setLagMeasuring(false);
+    m_lag = -1;
+
+    m_forcePing = true;
+    m_interval = ShortInterval;
+    m_pingTimer->start(m_interval);
+}
+
+QList<int> KeepAlive::histogramBounds()
+{
+    QList<int> bounds;
+
+    for (int i = 0; i < HistogramBoundCount; ++i)
+        bounds << HistogramBounds[i];
+
+    return bounds;
+}
+
+void KeepAlive::addToHistogram(int msec)
+{
+    int bucket = 0;
+
+    while (bucket < HistogramBoundCount && msec >= HistogramBounds[bucket])
+        ++bucket;
+
+    ++m_histogram[bucket];
+}
+
+#include "keepalive.moc"
@@ -0,0 +1,106 @@
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+*/
+
+#ifndef KEEPALIVE_H
+#define KEEPALIVE_H
+
+#include <QObject>
+#include <QPointer>
+#include <QTime>
+#include <QVector>
+
+
+class QTimer;
+
+class KTcpSocket;
+
+class Server;
+
+/**
+ * Pings the server to measure the lag and to notice a dead connection, for
+ * one Server object.
+ *
+ * PINGs bypass the rate limited queues and the lag is measured from the
+ * moment the socket actually wrote the PING, so neither a long paste nor
+ * a full send buffer count as lag. A connection that keeps receiving data
+ * is evidently alive and is pinged less, while one whose lag jumps above
+ * the usual is pinged more often.
+ *
+ * Every measured lag is counted in a histogram for the status bar and D-Bus.
+ */
+class KeepAlive : public QObject
+{
+    Q_OBJECT
+
+    public:
+        explicit KeepAlive(Server* server);
+        ~KeepAlive();
+
+        /// Registration is complete, starts pinging through the socket.
+        void start(KTcpSocket* socket);
+        void stop();
+
+        /// Called for any data read from the socket.
+        void dataReceived() { m_lastReceived.start(); }
+        /// Called when we received a PONG from the server, with what it echoed.
+        void pongReceived(const QString& cookie);
+
+        /// The last measured lag in ms, -1 if unknown.
+        int lag() const { return m_lag; }
+        /// Upper bounds in ms of all but the last histogram bucket.
+        static QList<int> histogramBounds();
+        /// How many lags fell into each bucket since the server was added.
+        QList<int> histogram() const { return m_histogram.toList(); }
+
+    signals:
+        void lagMeasured(int msec);
+        /// The PING was written msec ago and is not answered yet.
+        void lagTooLong(int msec);
+        /// Nothing arrived from the server for longer than the maximum lag time.
+        void timedOut();
+        /// A PING was sent, for things to refresh along with it.
+        void pingSent();
+
+    private slots:
+        void sendPing();
+        void pingBytesWritten(qint64 bytes);
+        void checkPendingPong();
+
+    private:
+        void scheduleNextPing();
+        void addToHistogram(int msec);
+
+        /// A pointer to the server we are a member of.
+        Server* m_server;
+        QPointer<KTcpSocket> m_socket;
+
+        QTimer* m_pingTimer;
+        /// Ticks while we wait for a PONG
+        QTimer* m_pongTimer;
+
+        QTime m_lastReceived;
+        QTime m_lastPing;
+        /// The next PING goes out whatever the traffic, e.g. the first one
+        bool m_forcePing;
+        /// Sent with the PING we wait for, to tell its PONG from late ones
+        QString m_pingCookie;
+        /// Measures the lag, restarted once the PING left the socket
+        QTime m_lagTime;
+        bool m_waitingForPong;
+        /// Bytes the socket has to write until the PING is out
+        qint64 m_bytesBeforePing;
+
+        int m_lag;
+        /// Smoothed lag and its mean deviation, as for TCP retransmissions
+        int m_smoothedLag;
+        int m_lagDeviation;
+        int m_interval;
+
+        QVector<int> m_histogram;
+};
+
+#endif
@@ -16,26 +16,25 @@
 #include "application.h"
 #include "images.h"
 #include "preferences.h"
-#include "nicklistview.h"
-
-#include <QHeaderView>
+#include "channel.h"
+#include "nicklistmodel.h"
 
 #include <kabc/phonenumber.h>
 
-Nick::Nick(NickListView *listView, Channel* channel, const ChannelNickPtr& channelnick)
-    : QTreeWidgetItem (listView)
+Nick::Nick(NickListModel *model, Channel* channel, const ChannelNickPtr& channelnick)
 {
     m_channelnickptr = channelnick;
     m_channel = channel;
+    m_model = model;
+
+    // the first refresh() always counts as a change
+    m_modes = -1;
+    m_away = false;
+    m_activityKey = 0;
 
     Q_ASSERT(channelnick);
     Q_ASSERT(m_channel);
-
-    m_flags = 0;
-
-    refresh();
-
-    setFlags((flags() & ~Qt::ItemIsDragEnabled) | Qt::ItemIsDropEnabled);
+    Q_ASSERT(m_model);
 }
 
 Nick::~Nick()
@@ -48,101 +47,90 @@ ChannelNickPtr Nick::getChannelNick() const
     return m_channelnickptr;
 }
 
-void Nick::refresh()
+QString Nick::text(int column) const
+{
+    if (column == NicknameColumn)
+        return calculateLabel1();
+    else if (column == HostmaskColumn)
+        return calculateLabel2();
+
+    return QString();
+}
+
+bool Nick::isAway() const
 {
-    int flags = 0;
     NickInfoPtr nickInfo(getChannelNick()->getNickInfo());
-    bool away = false;
-    int textChangedFlags = 0;
 
-    { // NOTE: this scoping is for NoSorting below. Do not remove it
-        // Disable auto-sorting while updating data
-        NickListView::NoSorting noSorting(qobject_cast<NickListView*>(treeWidget()));
-        if ( nickInfo )
-            away = nickInfo->isAway();
+    return nickInfo && nickInfo->isAway();
+}
 
-        if (away)
-        {
-            // Brush of the first column will be used for all columns
-            setForeground(NicknameColumn,
-                qApp->palette(treeWidget()).brush(QPalette::Disabled, QPalette::Text));
+QPixmap Nick::icon() const
+{
+    Images* images = Application::instance()->images();
+    bool away = isAway();
+
+    if ( getChannelNick()->isOwner() )
+        return images->getNickIcon( Images::Owner, away );
+    else if ( getChannelNick()->isAdmin() )
+        return images->getNickIcon( Images::Admin, away );
+    else if ( getChannelNick()->isOp() )
+        return images->getNickIcon( Images::Op, away );
+    else if ( getChannelNick()->isHalfOp() )
+        return images->getNickIcon( Images::HalfOp, away );
+    else if ( getChannelNick()->hasVoice() )
+        return images->getNickIcon( Images::Voice, away );
+
+    return images->getNickIcon( Images::Normal, away );
+}
 
-            flags = 1;
-        }
-        else
-        {
-            // Brush of the first column will be used for all columns
-            setForeground(NicknameColumn,
-                treeWidget()->palette().brush(QPalette::Normal, QPalette::Text));
-        }
+int Nick::modes() const
+{
+    const ChannelNickPtr channelNick = getChannelNick();
 
-        Images* images = Application::instance()->images();
-        QPixmap icon;
+    return (channelNick->isOwner() ? 16 : 0) | (channelNick->isAdmin() ? 8 : 0)
+        | (channelNick->isOp() ? 4 : 0) | (channelNick->isHalfOp() ? 2 : 0)
+        | (channelNick->hasVoice() ? 1 : 0);
+}
 
-        if ( getChannelNick()->isOwner() )
-        {
-            flags += 64;
-            icon = images->getNickIcon( Images::Owner, away );
-        }
-        else if ( getChannelNick()->isAdmin() )
-        {
-            flags += 128;
-            icon = images->getNickIcon( Images::Admin, away );
-        }
-        else if ( getChannelNick()->isOp() )
-        {
-            flags += 32;
-            icon = images->getNickIcon( Images::Op, away );
-        }
-        else if ( getChannelNick()->isHalfOp() )
-        {
-            flags += 16;
-            icon = images->getNickIcon( Images::HalfOp, away );
-        }
-        else if ( getChannelNick()->hasVoice() )
-        {
-            flags += 8;
-            icon = images->getNickIcon( Images::Voice, away );
-        }
-        else
-        {
-            flags += 4;
-            icon = images->getNickIcon( Images::Normal, away );
-        }
+void Nick::refresh()
+{
+    // Labels, icon and colour are computed by the model when the row gets
+    // painted, so all there is to do is to queue a row update. The model
+    // coalesces them and repositions the nick if needed. Nothing is queued
+    // if nothing shown changed, so the nick isn't resorted for nothing.
+    const QString label1 = calculateLabel1();
+    const QString label2 = calculateLabel2();
+    const int currentModes = modes();
+    const bool away = isAway();
+    const double activityKey = getChannelNick()->activityKey();
 
-        setIcon( NicknameColumn, icon );
+    int textChangedFlags = 0;
 
-        QString newtext = calculateLabel1();
-        if(newtext != text(NicknameColumn))
-        {
-            setText(NicknameColumn, newtext);
-            textChangedFlags |= 1 << NicknameColumn;
-        }
+    if (label1 != m_label1)
+        textChangedFlags |= 1 << NicknameColumn;
 
-        newtext = calculateLabel2();
-        if(newtext != text(HostmaskColumn))
-        {
-            setText(HostmaskColumn, newtext);
-            textChangedFlags |= 1 << HostmaskColumn;
-        }
-    }
+    if (label2 != m_label2)
+        textChangedFlags |= 1 << HostmaskColumn;
 
-    if(m_flags != flags || textChangedFlags)
-    {
-        m_flags = flags;
-        // Announce about nick update (and reposition the nick in the nick list as needed).
-        emitDataChanged();
+    if (!textChangedFlags && currentModes == m_modes && away == m_away && activityKey == m_activityKey)
+        return;
+
+    m_label1 = label1;
+    m_label2 = label2;
+    m_modes = currentModes;
+    m_away = away;
+    m_activityKey = activityKey;
+
+    if (textChangedFlags)
         m_channel->nicknameListViewTextChanged(textChangedFlags);
 
-        treeWidget()->repaint();
-    }
+    m_model->nickChanged(this);
 }
 
-// Triggers reposition of this nick (QTreeWidgetItem) in the nick list
+// Triggers reposition of this nick in the nick list
 void Nick::repositionMe()
 {
-    if (treeWidget()->isSortingEnabled())
-        emitDataChanged();
+    m_model->nickChanged(this);
 }
 
 QString Nick::calculateLabel1() const
@@ -169,14 +157,12 @@ QString Nick::calculateLabel2() const
     return getChannelNick()->getNickInfo()->getHostmask();
 }
 
-bool Nick::operator<(const QTreeWidgetItem& other) const
+bool Nick::lessThan(const Nick& otherNick, int col) const
 {
-    const Nick& otherNick = static_cast<const Nick&>(other);
-
     if(Preferences::self()->sortByActivity())
     {
-        uint thisRecentActivity = getChannelNick()->recentActivity();
-        uint otherRecentActivity = otherNick.getChannelNick()->recentActivity();
+        double thisRecentActivity = getChannelNick()->activityKey();
+        double otherRecentActivity = otherNick.getChannelNick()->activityKey();
         if(thisRecentActivity > otherRecentActivity)
         {
             return true;
@@ -212,47 +198,32 @@ bool Nick::operator<(const QTreeWidgetItem& other) const
         }
     }
 
-    QString thisKey;
-    QString otherKey;
-    int col = treeWidget()->sortColumn();
-
+    // Compare the raw nickname and hostmask rather than the built labels,
+    // this is called O(n log n) times per sort.
     if(col == NicknameColumn)
     {
         if(Preferences::self()->sortCaseInsensitive())
         {
-            thisKey = getChannelNick()->loweredNickname();
-            otherKey = otherNick.getChannelNick()->loweredNickname();
+            return getChannelNick()->loweredNickname() < otherNick.getChannelNick()->loweredNickname();
         }
         else
         {
-            thisKey = text(col);
-            otherKey = otherNick.text(col);
+            return getChannelNick()->getNickname() < otherNick.getChannelNick()->getNickname();
         }
     }
     else if (col > 0) //the reason we need this: enabling hostnames adds another column
     {
         if(Preferences::self()->sortCaseInsensitive())
         {
-            thisKey = text(col).toLower();
-            otherKey = otherNick.text(col).toLower();
+            return calculateLabel2().toLower() < otherNick.calculateLabel2().toLower();
         }
         else
         {
-            thisKey = text(col);
-            otherKey = otherNick.text(col);
+            return calculateLabel2() < otherNick.calculateLabel2();
         }
     }
 
-    return thisKey < otherKey;
-}
-
-QVariant Nick::data(int column, int role) const
-{
-    if (role == Qt::ForegroundRole && column > 0) {
-        // Use brush of the first column for all columns
-        return data(NicknameColumn, role);
-    }
-    return QTreeWidgetItem::data(column, role);
+    return false;
 }
 
 int Nick::getSortingValue() const
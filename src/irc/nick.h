@@ -17,22 +17,28 @@
 
 #include "channelnick.h"
 
-#include <QTreeWidgetItem>
+#include <QPixmap>
 
-class NickListView;
+class NickListModel;
 class Channel;
 
-class Nick : public QTreeWidgetItem
+class Nick
 {
     public:
-        Nick(NickListView *listView, Channel* channel,
+        Nick(NickListModel *model, Channel* channel,
             const ChannelNickPtr& channelnick);
         ~Nick();
 
         ChannelNickPtr getChannelNick() const;
 
-        virtual QVariant data(int column, int role) const;
-        virtual bool operator<(const QTreeWidgetItem& other) const;
+        /** The text shown in the given column of the nick list.
+         *  Computed on every call, so only use it for rows that are painted.
+         */
+        QString text(int column) const;
+        QPixmap icon() const;
+        bool isAway() const;
+
+        bool lessThan(const Nick& other, int column) const;
 
         void refresh();
         void repositionMe();
@@ -42,12 +48,20 @@ class Nick : public QTreeWidgetItem
         QString calculateLabel2() const;
 
         int getSortingValue() const;
+        /// The modes that decide the icon and the sorting, as bits.
+        int modes() const;
 
     protected:
         ChannelNickPtr m_channelnickptr;
         Channel* m_channel;
+        NickListModel* m_model;
 
-        int m_flags;
+        /// What was shown at the last refresh(), to tell if anything changed
+        QString m_label1;
+        QString m_label2;
+        int m_modes;
+        bool m_away;
+        double m_activityKey;
 
     public:
         enum Columns {
@@ -38,6 +38,7 @@ NickInfo::NickInfo(const QString& nick, Server* server): KShared()
     m_identified = false;
     m_printedOnline = false;
     m_changed = false;
+    m_whoTimeStamp = 0;
 
     if(!m_addressee.isEmpty())
         Konversation::Addressbook::self()->emitContactPresenceChanged(m_addressee.uid(), 4);
@@ -118,6 +118,12 @@ class NickInfo : public KShared
         bool isChanged() const { return m_changed; }
         void setChanged(bool c) { m_changed = c; }
 
+        /** When a WHO or USERHOST reply last brought this nick up to date, as time_t.
+         *  Used by WhoScheduler to skip nicks that are already fresh.
+         */
+        uint getWhoTimeStamp() const { return m_whoTimeStamp; }
+        void setWhoTimeStamp(uint timeStamp) { m_whoTimeStamp = timeStamp; }
+
     private:
         /** After calling, emitNickInfoChanged is guaranteed to be called _within_ 1 second.
          *  Used to consolidate changed signals.
@@ -146,6 +152,7 @@ class NickInfo : public KShared
         uint m_nickColor;
 
         bool m_changed;
+        uint m_whoTimeStamp;
 };
 
 /** A NickInfoPtr is a pointer to a NickInfo object.  Since it is a KSharedPtr, the NickInfo
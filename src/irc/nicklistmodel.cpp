@@ -0,0 +1,404 @@
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+*/
+
+#include "nicklistmodel.h"
+#include "nick.h"
+#include "common.h"
+
+#include <QHash>
+#include <QPair>
+#include <QTimer>
+
+#include <KUrl>
+
+
+// roughly one repaint worth of changes per update
+static const int UpdateInterval = 40;
+
+// past this many separate changed ranges a single spanning one is cheaper
+static const int MaxChangedRanges = 8;
+
+// past this many misplaced nicks a full sort is cheaper than moving each
+static const int MaxMovedNicks = 8;
+
+class NickLessThan
+{
+    public:
+        NickLessThan(int column, Qt::SortOrder order) : m_column(column), m_order(order) {}
+
+        bool operator()(const Nick* left, const Nick* right) const
+        {
+            if (m_order == Qt::AscendingOrder)
+                return left->lessThan(*right, m_column);
+            else
+                return right->lessThan(*left, m_column);
+        }
+
+    private:
+        int m_column;
+        Qt::SortOrder m_order;
+};
+
+NickListModel::NickListModel(QObject* parent) : QAbstractListModel(parent)
+{
+    m_sortingEnabled = true;
+    m_unsorted = false;
+    m_sortColumn = Nick::NicknameColumn;
+    m_sortOrder = Qt::AscendingOrder;
+
+    m_updateTimer = new QTimer(this);
+    m_updateTimer->setSingleShot(true);
+    m_updateTimer->setInterval(UpdateInterval);
+    connect(m_updateTimer, SIGNAL(timeout()), this, SLOT(processUpdates()));
+}
+
+NickListModel::~NickListModel()
+{
+}
+
+int NickListModel::columnCount(const QModelIndex& parent) const
+{
+    if (parent.isValid())
+        return 0;
+
+    return 2;
+}
+
+int NickListModel::rowCount(const QModelIndex& parent) const
+{
+    if (parent.isValid())
+        return 0;
+
+    return m_nicks.count();
+}
+
+QVariant NickListModel::data(const QModelIndex& index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_nicks.count())
+        return QVariant();
+
+    const Nick* nick = m_nicks.at(index.row());
+
+    switch (role)
+    {
+        case Qt::DisplayRole:
+            return nick->text(index.column());
+        case Qt::DecorationRole:
+            if (index.column() == Nick::NicknameColumn)
+                return nick->icon();
+            break;
+        case Qt::ToolTipRole:
+            // an empty string rather than no value, so a stale tooltip gets hidden
+            return Konversation::removeIrcMarkup(nick->getChannelNick()->tooltip());
+        case AwayRole:
+            return nick->isAway();
+    }
+
+    return QVariant();
+}
+
+Qt::ItemFlags NickListModel::flags(const QModelIndex& index) const
+{
+    if (!index.isValid())
+        return 0;
+
+    return Qt::ItemIsEnabled | Qt::ItemIsSelectable | Qt::ItemIsDropEnabled;
+}
+
+QStringList NickListModel::mimeTypes() const
+{
+    return KUrl::List::mimeDataTypes();
+}
+
+Qt::DropActions NickListModel::supportedDropActions() const
+{
+    return Qt::CopyAction | Qt::MoveAction;
+}
+
+Nick* NickListModel::nickAt(int row) const
+{
+    return m_nicks.value(row);
+}
+
+void NickListModel::insertNick(Nick* nick)
+{
+    if (!m_sortingEnabled)
+    {
+        m_pendingNicks.append(nick);
+        scheduleUpdate();
+
+        return;
+    }
+
+    QList<Nick*>::iterator it = qLowerBound(m_nicks.begin(), m_nicks.end(), nick,
+        NickLessThan(m_sortColumn, m_sortOrder));
+    const int row = it - m_nicks.begin();
+
+    beginInsertRows(QModelIndex(), row, row);
+    m_nicks.insert(row, nick);
+    endInsertRows();
+}
+
+void NickListModel::removeNick(Nick* nick)
+{
+    m_changedNicks.remove(nick);
+
+    if (m_pendingNicks.removeOne(nick))
+        return;
+
+    const int row = m_nicks.indexOf(nick);
+
+    if (row < 0)
+        return;
+
+    beginRemoveRows(QModelIndex(), row, row);
+    m_nicks.removeAt(row);
+    endRemoveRows();
+}
+
+void NickListModel::clear()
+{
+    m_updateTimer->stop();
+    m_pendingNicks.clear();
+    m_changedNicks.clear();
+    m_unsorted = false;
+
+    beginResetModel();
+    m_nicks.clear();
+    endResetModel();
+}
+
+void NickListModel::nickChanged(Nick* nick)
+{
+    m_changedNicks.insert(nick);
+    scheduleUpdate();
+}
+
+void NickListModel::refreshAll()
+{
+    if (!m_nicks.isEmpty())
+        emit dataChanged(index(0, 0), index(m_nicks.count() - 1, columnCount() - 1));
+}
+
+void NickListModel::setSortingEnabled(bool enable)
+{
+    if (m_sortingEnabled == enable)
+        return;
+
+    m_sortingEnabled = enable;
+
+    if (m_sortingEnabled && (m_unsorted || !m_pendingNicks.isEmpty()))
+        resort();
+}
+
+void NickListModel::sort(int column, Qt::SortOrder order)
+{
+    m_sortColumn = column;
+    m_sortOrder = order;
+
+    resort();
+}
+
+void NickListModel::resort()
+{
+    // pending changes are taken care of by the sort
+    m_updateTimer->stop();
+    m_changedNicks.clear();
+
+    appendPendingNicks();
+    sortNicks();
+}
+
+void NickListModel::scheduleUpdate()
+{
+    if (!m_updateTimer->isActive())
+        m_updateTimer->start();
+}
+
+void NickListModel::appendPendingNicks()
+{
+    if (m_pendingNicks.isEmpty())
+        return;
+
+    const int first = m_nicks.count();
+
+    beginInsertRows(QModelIndex(), first, first + m_pendingNicks.count() - 1);
+    m_nicks += m_pendingNicks;
+    m_pendingNicks.clear();
+    endInsertRows();
+
+    m_unsorted = true;
+}
+
+void NickListModel::processUpdates()
+{
+    m_updateTimer->stop();
+
+    appendPendingNicks();
+
+    if (m_changedNicks.isEmpty())
+        return;
+
+    if (m_sortingEnabled && !repositionChangedNicks())
+    {
+        // the layout change repaints all visible rows anyway
+        m_changedNicks.clear();
+
+        return;
+    }
+
+    // Find the rows of all changed nicks in one pass
+    QList<int> rows;
+    const int count = m_nicks.count();
+
+    for (int row = 0; row < count && rows.count() < m_changedNicks.count(); ++row)
+    {
+        if (m_changedNicks.contains(m_nicks.at(row)))
+            rows.append(row);
+    }
+
+    m_changedNicks.clear();
+
+    if (rows.isEmpty())
+        return;
+
+    // Coalesce adjacent rows into ranges
+    QList<QPair<int, int> > ranges;
+    int start = rows.first();
+    int end = start;
+
+    for (int i = 1; i < rows.count(); ++i)
+    {
+        if (rows.at(i) == end + 1)
+        {
+            end = rows.at(i);
+        }
+        else
+        {
+            ranges.append(qMakePair(start, end));
+            start = end = rows.at(i);
+        }
+    }
+
+    ranges.append(qMakePair(start, end));
+
+    const int lastColumn = columnCount() - 1;
+
+    if (ranges.count() > MaxChangedRanges)
+    {
+        emit dataChanged(index(ranges.first().first, 0), index(ranges.last().second, lastColumn));
+
+        return;
+    }
+
+    for (int i = 0; i < ranges.count(); ++i)
+        emit dataChanged(index(ranges.at(i).first, 0), index(ranges.at(i).second, lastColumn));
+}
+
+/// Move changed nicks that are out of order to their sorted position, one
+/// row at a time, so only they get repainted. Falls back to a full sort if
+/// too many moved and returns false then.
+bool NickListModel::repositionChangedNicks()
+{
+    NickLessThan lessThan(m_sortColumn, m_sortOrder);
+    QList<Nick*> misplaced;
+    const int count = m_nicks.count();
+    int seen = 0;
+
+    for (int row = 0; row < count && seen < m_changedNicks.count(); ++row)
+    {
+        Nick* nick = m_nicks.at(row);
+
+        if (!m_changedNicks.contains(nick))
+            continue;
+
+        ++seen;
+
+        if ((row > 0 && lessThan(nick, m_nicks.at(row - 1)))
+            || (row < count - 1 && lessThan(m_nicks.at(row + 1), nick)))
+        {
+            misplaced.append(nick);
+        }
+    }
+
+    if (misplaced.isEmpty())
+        return true;
+
+    if (misplaced.count() > MaxMovedNicks)
+    {
+        sortNicks();
+
+        return false;
+    }
+
+    // Apart from the nicks still to be moved the list is in order
+    QSet<Nick*> unplaced = misplaced.toSet();
+
+    foreach (Nick* nick, misplaced)
+    {
+        unplaced.remove(nick);
+
+        const int from = m_nicks.indexOf(nick);
+        int to = count;
+
+        for (int row = 0; row < count; ++row)
+        {
+            Nick* other = m_nicks.at(row);
+
+            if (other != nick && !unplaced.contains(other) && lessThan(nick, other))
+            {
+                to = row;
+                break;
+            }
+        }
+
+        // already in place relative to the ordered rows
+        if (to == from || to == from + 1)
+            continue;
+
+        beginMoveRows(QModelIndex(), from, from, QModelIndex(), to);
+        m_nicks.move(from, (to > from) ? to - 1 : to);
+        endMoveRows();
+    }
+
+    return true;
+}
+
+void NickListModel::sortNicks()
+{
+    emit layoutAboutToBeChanged();
+
+    // Remember which nick every persistent index (e.g. the selection) points at
+    const QModelIndexList oldIndexes = persistentIndexList();
+    QList<Nick*> persistentNicks;
+
+    foreach (const QModelIndex& oldIndex, oldIndexes)
+        persistentNicks.append(m_nicks.at(oldIndex.row()));
+
+    qStableSort(m_nicks.begin(), m_nicks.end(), NickLessThan(m_sortColumn, m_sortOrder));
+    m_unsorted = false;
+
+    if (!oldIndexes.isEmpty())
+    {
+        QHash<Nick*, int> rowOfNick;
+        rowOfNick.reserve(m_nicks.count());
+
+        for (int row = 0; row < m_nicks.count(); ++row)
+            rowOfNick.insert(m_nicks.at(row), row);
+
+        QModelIndexList newIndexes;
+
+        for (int i = 0; i < oldIndexes.count(); ++i)
+            newIndexes.append(index(rowOfNick.value(persistentNicks.at(i)), oldIndexes.at(i).column()));
+
+        changePersistentIndexList(oldIndexes, newIndexes);
+    }
+
+    emit layoutChanged();
+}
+
+#include "nicklistmodel.moc"
@@ -0,0 +1,95 @@
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+*/
+
+#ifndef NICKLISTMODEL_H
+#define NICKLISTMODEL_H
+
+#include <QAbstractListModel>
+#include <QList>
+#include <QSet>
+#include <QStringList>
+
+
+class QTimer;
+
+class Nick;
+
+/**
+ * Flat model of the nicks in a channel, shown by NickListView.
+ *
+ * Rows only hold a pointer to the channel's Nick; labels, icons and tooltips
+ * are computed in data(), so only rows that are actually painted cost
+ * anything. Nick changes are collected and turned into a few dataChanged()
+ * ranges per update interval. Changed nicks that went out of order are moved
+ * row by row, with a full resort only when many did, and nicks added while
+ * sorting is disabled are appended in one batch.
+ */
+class NickListModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+    public:
+        enum Roles {
+            AwayRole = Qt::UserRole + 1
+        };
+
+        explicit NickListModel(QObject* parent = 0);
+        ~NickListModel();
+
+        int columnCount(const QModelIndex& parent = QModelIndex()) const;
+        int rowCount(const QModelIndex& parent = QModelIndex()) const;
+        QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
+        Qt::ItemFlags flags(const QModelIndex& index) const;
+
+        QStringList mimeTypes() const;
+        Qt::DropActions supportedDropActions() const;
+
+        void sort(int column, Qt::SortOrder order = Qt::AscendingOrder);
+
+        Nick* nickAt(int row) const;
+
+        void insertNick(Nick* nick);
+        void removeNick(Nick* nick);
+        void clear();
+
+        /// Queue a row update for nick, it is repositioned as needed.
+        void nickChanged(Nick* nick);
+        /// Repaint all rows, e.g. after the icon theme changed.
+        void refreshAll();
+
+        /** While sorting is disabled new nicks are appended in batches instead
+         *  of being inserted at their sorted position. Enabling it sorts again.
+         */
+        void setSortingEnabled(bool enable);
+        bool isSortingEnabled() const { return m_sortingEnabled; }
+
+    public slots:
+        /// Sort all rows again. CAUTION: this might be CPU intensive
+        void resort();
+
+    private slots:
+        void processUpdates();
+
+    private:
+        void scheduleUpdate();
+        void appendPendingNicks();
+        bool repositionChangedNicks();
+        void sortNicks();
+
+        QList<Nick*> m_nicks;
+        QList<Nick*> m_pendingNicks;
+        QSet<Nick*> m_changedNicks;
+
+        QTimer* m_updateTimer;
+
+        bool m_sortingEnabled;
+        bool m_unsorted;
+        int m_sortColumn;
+        Qt::SortOrder m_sortOrder;
+};
+
+#endif
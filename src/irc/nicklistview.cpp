@@ -14,13 +14,13 @@
 
 #include "nicklistview.h"
 #include "nick.h"
+#include "nicklistmodel.h"
 #include "application.h"
 #include "images.h"
 #include "irccontextmenus.h"
 
 #include <QHeaderView>
 #include <QDropEvent>
-#include <QToolTip>
 #include <QStyledItemDelegate>
 
 
@@ -30,6 +30,9 @@ class NickItemDelegate : public QStyledItemDelegate
         NickItemDelegate(QObject *parent = 0);
 
         virtual QSize sizeHint(const QStyleOptionViewItem& option, const QModelIndex& index) const;
+
+    protected:
+        virtual void initStyleOption(QStyleOptionViewItem* option, const QModelIndex& index) const;
 };
 
 NickItemDelegate::NickItemDelegate(QObject *parent)
@@ -43,10 +46,23 @@ QSize NickItemDelegate::sizeHint(const QStyleOptionViewItem& option, const QMode
     return QSize(size.width(), qMax(NickListView::getMinimumRowHeight(), size.height()));
 }
 
+void NickItemDelegate::initStyleOption(QStyleOptionViewItem* option, const QModelIndex& index) const
+{
+    QStyledItemDelegate::initStyleOption(option, index);
+
+    // Gray out away nicks in all columns. The custom nick list palette has
+    // no disabled colors of its own, so take the application's.
+    if (index.data(NickListModel::AwayRole).toBool())
+    {
+        option->palette.setBrush(QPalette::Text,
+            qApp->palette(qobject_cast<QWidget*>(parent())).brush(QPalette::Disabled, QPalette::Text));
+    }
+}
+
 int NickListView::s_minimumRowHeight = 0;
 
 
-NickListView::NickListView(QWidget* parent, Channel *chan) : QTreeWidget(parent)
+NickListView::NickListView(QWidget* parent, Channel *chan, NickListModel* model) : QTreeView(parent)
 {
     setWhatsThis();
     channel=chan;
@@ -66,16 +82,14 @@ NickListView::NickListView(QWidget* parent, Channel *chan) : QTreeWidget(parent)
 
     // General layout
     setRootIsDecorated(false); // single level view
-    setColumnCount(2);
+    setItemsExpandable(false);
+    setModel(model);
 
     setSelectionBehavior(QAbstractItemView::SelectRows);
     setSelectionMode(QAbstractItemView::ExtendedSelection);
     setAllColumnsShowFocus(true);
 
-    // These two below must be called after setColumnCount().
-    header()->setSortIndicator(Nick::NicknameColumn, Qt::AscendingOrder);
-    setSortingEnabled(true);
-
+    // The model keeps itself sorted, see NickListModel::insertNick()
     header()->hide();
     header()->setStretchLastSection(false);
 }
@@ -84,6 +98,11 @@ NickListView::~NickListView()
 {
 }
 
+NickListModel* NickListView::nickListModel() const
+{
+    return static_cast<NickListModel*>(model());
+}
+
 int NickListView::getMinimumRowHeight()
 {
     return s_minimumRowHeight;
@@ -95,45 +114,13 @@ void NickListView::updateMinimumRowHeight()
     s_minimumRowHeight = images->getNickIcon(Images::Normal, false).height() + 2;
 }
 
-bool NickListView::event(QEvent *event)
-{
-    if(( event->type() == QEvent::ToolTip ) )
-    {
-        QHelpEvent* helpEvent = static_cast<QHelpEvent*>( event );
-
-        QTreeWidgetItem *item = itemAt(viewport()->mapFromParent(helpEvent->pos()));
-        if( item )
-        {
-            Nick *nick = dynamic_cast<Nick*>( item );
-            if( nick )
-            {
-               QString text =  Konversation::removeIrcMarkup(nick->getChannelNick()->tooltip());
-               if( !text.isEmpty() )
-                       QToolTip::showText( helpEvent->globalPos(), text );
-               else
-                       QToolTip::hideText();
-            }
-
-        }
-        else
-                QToolTip::hideText();
-    }
-    return QTreeWidget::event( event );
-}
-
-// Make this public
-void NickListView::executeDelayedItemsLayout()
-{
-    QTreeWidget::executeDelayedItemsLayout();
-}
-
 void NickListView::setWhatsThis()
 {
     Images* images = Application::instance()->images();
 
     if(!images->getNickIcon( Images::Normal, false).isNull())
     {
-        QTreeWidget::setWhatsThis(i18n("<qt><p>This shows all the people in the channel.  The nick for each person is shown, with a picture showing their status.<br /></p>"
+        QTreeView::setWhatsThis(i18n("<qt><p>This shows all the people in the channel.  The nick for each person is shown, with a picture showing their status.<br /></p>"
             "<table>"
             "<tr><th><img src=\"%1\"/></th><td>This person has administrator privileges.</td></tr>"
             "<tr><th><img src=\"%2\"/></th><td>This person is a channel owner.</td></tr>"
@@ -161,101 +148,40 @@ void NickListView::refresh()
 {
     updateMinimumRowHeight();
 
-    QTreeWidgetItemIterator it(this);
-
-    while (*it)
-    {
-        static_cast<Nick*>(*it)->refresh();
-        ++it;
-    }
+    nickListModel()->refreshAll();
 
     setWhatsThis();
 }
 
-void NickListView::setSortingEnabled(bool enable)
+QList<Nick*> NickListView::selectedNicks() const
 {
-    QTreeWidget::setSortingEnabled(enable);
-    // We want to decouple header and this object with regard to sorting
-    // (for performance reasons). By default there is no way to reenable
-    // sorting without full resort (which is necessary for us) since both
-    // header indicator change and setSortingEnabled(false/true) trigger
-    // full resort of QTreeView. However, after disconnect, it is possible
-    // to use header()->setSortIndicator() for this.
-    // This could probably be done in a better way if nick list was model
-    // based. NOTE: QTreeView::sortByColumn() won't work after this change
-    // if sorting is enabled.
-    if (enable && header()) {
-        disconnect(header(), SIGNAL(sortIndicatorChanged(int,Qt::SortOrder)),
-                this, 0);
-    }
-}
+    QList<int> rows;
 
-void NickListView::fastSetSortingEnabled(bool value)
-{
-    if (value)
+    foreach (const QModelIndex& index, selectionModel()->selectedIndexes())
     {
-        int sortCol = header()->sortIndicatorSection();
-        if (sortCol > -1)
-        {
-            header()->setSortIndicator(-1, header()->sortIndicatorOrder());
-            // since indicator section is -1, this basically sets the flag only
-            // while setSortIndicator() is decoupled from triggerring resort.
-            setSortingEnabled(true);
-            // NOTE:: ResizeToContents mode on sortCol would be performance killer
-            header()->setSortIndicator(sortCol, header()->sortIndicatorOrder());
-        }
-    }
-    else
-    {
-        setSortingEnabled(false);
+        if (index.column() == Nick::NicknameColumn)
+            rows.append(index.row());
     }
-}
 
-void NickListView::sortByColumn(int column, Qt::SortOrder order)
-{
-    if (isSortingEnabled())
-    {
-        // original implementation relies on sortIndicatorChanged signal
-        model()->sort(column, order);
-    }
-    else
-        QTreeWidget::sortByColumn(column, order);
-}
+    qSort(rows);
 
-void NickListView::resort()
-{
-    sortByColumn(header()->sortIndicatorSection(), header()->sortIndicatorOrder());
-}
+    QList<Nick*> nicks;
 
-int NickListView::findLowerBound(const QTreeWidgetItem& item) const
-{
-    int start = 0, end = topLevelItemCount();
-    int mid;
-
-    while (start < end) {
-        mid = start + (end-start)/2;
-        if ((*topLevelItem(mid)) < item)
-            start = mid + 1;
-        else
-            end = mid;
-    }
-    return start;
+    foreach (int row, rows)
+        nicks.append(nickListModel()->nickAt(row));
+
+    return nicks;
 }
 
 void NickListView::contextMenuEvent(QContextMenuEvent* ev)
 {
-    if (selectedItems().count())
+    if (selectionModel()->hasSelection())
     {
         IrcContextMenus::nickMenu(ev->globalPos(), IrcContextMenus::ShowChannelActions,
             channel->getServer(), channel->getSelectedNickList(), channel->getName());
     }
 }
 
-QStringList NickListView::mimeTypes () const
-{
-    return KUrl::List::mimeDataTypes();
-}
-
 bool NickListView::canDecodeMime(QDropEvent const *event) const {
     // Verify if the URL is not irc://
     if (KUrl::List::canDecode(event->mimeData()))
@@ -280,7 +206,7 @@ bool NickListView::canDecodeMime(QDropEvent const *event) const {
 void NickListView::dragEnterEvent(QDragEnterEvent *event)
 {
     if (canDecodeMime(event)) {
-        QTreeWidget::dragEnterEvent(event);
+        QTreeView::dragEnterEvent(event);
         return;
     }
     else
@@ -291,7 +217,7 @@ void NickListView::dragEnterEvent(QDragEnterEvent *event)
 
 void NickListView::dragMoveEvent(QDragMoveEvent *event)
 {
-    QTreeWidget::dragMoveEvent(event);
+    QTreeView::dragMoveEvent(event);
 
     if (!indexAt(event->pos()).isValid())
     {
@@ -300,17 +226,28 @@ void NickListView::dragMoveEvent(QDragMoveEvent *event)
     }
 }
 
-bool NickListView::dropMimeData(QTreeWidgetItem *parent, int index, const QMimeData *data, Qt::DropAction action)
+void NickListView::dropEvent(QDropEvent *event)
 {
-    Q_UNUSED(index);
-    Q_UNUSED(action);
-    Nick* nick = dynamic_cast<Nick*>(parent);
-    if (nick) {
-        const KUrl::List uris = KUrl::List::fromMimeData(data);
+    Nick* nick = 0;
+    const QModelIndex index = indexAt(event->pos());
+
+    if (index.isValid())
+        nick = nickListModel()->nickAt(index.row());
+
+    if (nick)
+    {
+        const KUrl::List uris = KUrl::List::fromMimeData(event->mimeData());
         channel->getServer()->sendURIs(uris, nick->getChannelNick()->getNickname());
-        return true;
+        event->acceptProposedAction();
     }
-    return false;
+    else
+    {
+        event->ignore();
+    }
+
+    stopAutoScroll();
+    setState(NoState);
+    viewport()->update();
 }
 
 #include "nicklistview.moc"
@@ -19,69 +19,42 @@
 #include "images.h"
 #include "common.h"
 
-#include <QTreeWidget>
+#include <QTreeView>
 
 
-class QTimer;
+class NickListModel;
 
 
-class NickListView : public QTreeWidget
+class NickListView : public QTreeView
 {
     Q_OBJECT
 
         public:
-        NickListView(QWidget* parent, Channel *chan);
+        NickListView(QWidget* parent, Channel *chan, NickListModel* model);
         ~NickListView();
 
+        NickListModel* nickListModel() const;
+
         /** Call when the icons have been changed.
          */
         void refresh();
         void setWhatsThis();
 
-        void setSortingEnabled(bool enable); // WARNING: originally non-virtual
-        void sortByColumn(int column, Qt::SortOrder order); // WARNING: originally non-virtual
-        void fastSetSortingEnabled(bool value);
-        int findLowerBound(const QTreeWidgetItem& item) const;
-        void executeDelayedItemsLayout();
+        /// The selected nicks, in the order they are shown
+        QList<Nick*> selectedNicks() const;
 
         static int getMinimumRowHeight();
 
-        // A helper class to disable sorting while in scope
-        class NoSorting
-        {
-            private:
-                NickListView *w;
-                bool enabled;
-            public:
-                NoSorting(NickListView *w) : w(w), enabled(w->isSortingEnabled())
-                {
-                    if (enabled) w->fastSetSortingEnabled(false);
-                };
-                ~NoSorting()
-                {
-                    if (enabled) w->fastSetSortingEnabled(true);
-                }
-        };
-
-    public slots:
-        /** Resort the listview. CAUTION: this might be CPU intensive
-         */
-        void resort();
-
     protected:
-        //! Reimplemented for dynamic tooltips
-        virtual bool event(QEvent* ev);
         virtual void contextMenuEvent(QContextMenuEvent* ev);
 
         // Drag & Drop support
-        virtual QStringList mimeTypes () const;
         bool canDecodeMime(QDropEvent const *event) const;
-        virtual bool dropMimeData(QTreeWidgetItem *parent, int index, const QMimeData *data, Qt::DropAction action);
         virtual void dragEnterEvent(QDragEnterEvent *event);
         virtual void dragMoveEvent(QDragMoveEvent *event);
+        virtual void dropEvent(QDropEvent *event);
 
         Channel *channel;
-        QTimer *m_resortTimer;
 
     private:
         static int s_minimumRowHeight;
@@ -518,7 +518,7 @@ void NicksOnline::updateNotifyList()
   // update notify list
   Preferences::setNotifyList(notifyList);
   // save notify list
-  static_cast<Application*>(kapp)->saveOptions(false);
+  static_cast<Application*>(kapp)->scheduleSaveOptions(false);
 }
 
 /**
@@ -1015,7 +1015,7 @@ void NicksOnline::slotNickInfoChanged(Server* server, const NickInfoPtr nickInfo
 void NicksOnline::slotAddNickname(int serverGroupId, const QString& nickname)
 {
     Preferences::addNotify(serverGroupId, nickname);
-    static_cast<Application*>(kapp)->saveOptions(true);
+    static_cast<Application*>(kapp)->saveServerGroup(serverGroupId);
 }
 
 /**
@@ -134,7 +134,11 @@ namespace Konversation
         QString text = inputLine; // the text we'll send, currently in Unicode
         QStringList finals; // The strings we're going to output
 
-        QString channelCodecName = Preferences::channelEncoding(m_server->getDisplayName(), destination);
+        QString channelCodecName;
+        if (m_server->getServerGroup())
+            channelCodecName = Preferences::channelEncoding(m_server->getServerGroup()->id(), destination);
+        else
+            channelCodecName = Preferences::channelEncoding(m_server->getDisplayName(), destination);
         //Get the codec we're supposed to use. This must not fail. (not verified)
         QTextCodec* codec;
 
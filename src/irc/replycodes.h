@@ -90,6 +90,7 @@
 #define RPL_VERSION            351
 #define RPL_WHOREPLY           352
 #define RPL_NAMREPLY           353
+#define RPL_WHOSPCRPL          354
 #define RPL_LINKS              364
 #define RPL_ENDOFLINKS         365
 #define RPL_ENDOFNAMES         366
@@ -144,11 +145,13 @@
 #define ERR_PASSWDMISMATCH     464
 #define ERR_YOUREBANNEDCREEP   465
 #define ERR_KEYSET             467
+#define ERR_LINKCHANNEL        470
 #define ERR_CHANNELISFULL      471
 #define ERR_UNKNOWNMODE        472
 #define ERR_INVITEONLYCHAN     473
 #define ERR_BANNEDFROMCHAN     474
 #define ERR_BADCHANNELKEY      475
+#define ERR_BADCHANMASK        476
 #define ERR_NOCHANMODES        477
 #define ERR_NOPRIVILEGES       481
 #define ERR_CHANOPRIVSNEEDED   482
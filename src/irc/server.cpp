@@ -36,6 +36,10 @@
 #include "addressbook.h"
 #include "scriptlauncher.h"
 #include "serverison.h"
+#include "whoscheduler.h"
+#include "connectionracer.h"
+#include "connectburst.h"
+#include "keepalive.h"
 #include "notificationhandler.h"
 #include "awaymanager.h"
 #include "ircinput.h"
@@ -84,6 +88,9 @@ Server::Server(QObject* parent, ConnectionSettings& settings) : QObject(parent)
     m_identifyMsg = false;
     m_capRequested = false;
     m_capAnswered = false;
+    m_capNegotiating = false;
+    m_capSaslPending = false;
+    m_capabilities = NoCapabilities;
     m_autoJoin = false;
 
     m_nickIndices.clear();
@@ -91,10 +98,26 @@ Server::Server(QObject* parent, ConnectionSettings& settings) : QObject(parent)
 
     m_nickListModel = new QStringListModel(this);
 
-    m_currentLag = -1;
     m_rawLog = 0;
     m_channelListPanel = 0;
     m_serverISON = 0;
+    m_whoScheduler = new WhoScheduler(this);
+    m_connectionRacer = new ConnectionRacer(this);
+    connect(m_connectionRacer, SIGNAL(attemptStarted(Konversation::ServerSettings,QString)),
+        this, SLOT(connectionAttemptStarted(Konversation::ServerSettings,QString)));
+    connect(m_connectionRacer, SIGNAL(attemptFailed(Konversation::ServerSettings,QString)),
+        this, SLOT(connectionAttemptFailed(Konversation::ServerSettings,QString)));
+    connect(m_connectionRacer, SIGNAL(won(KTcpSocket*,Konversation::ServerSettings)),
+        this, SLOT(connectionRaceWon(KTcpSocket*,Konversation::ServerSettings)));
+    connect(m_connectionRacer, SIGNAL(lost(KTcpSocket*,Konversation::ServerSettings)),
+        this, SLOT(connectionRaceLost(KTcpSocket*,Konversation::ServerSettings)));
+    m_connectBurst = new ConnectBurst(this);
+    m_keepAlive = new KeepAlive(this);
+    connect(m_keepAlive, SIGNAL(lagMeasured(int)), this, SLOT(updateLag(int)));
+    connect(m_keepAlive, SIGNAL(lagTooLong(int)), this, SLOT(updateLongPongLag(int)));
+    connect(m_keepAlive, SIGNAL(timedOut()), this, SLOT(lagTimedOut()));
+    connect(m_keepAlive, SIGNAL(pingSent()), this, SLOT(refreshOwnHostmask()));
+    m_whoxSupported = false;
     m_away = false;
     m_socket = 0;
     m_prevISONList = QStringList();
@@ -235,12 +258,85 @@ void Server::purgeData()
         delete it.value();
     m_unjoinedChannels.clear();
 
+    dropRejoinChannels();
+
     m_queryNicks.clear();
     delete m_serverISON;
     m_serverISON = 0;
 
 }
 
+void Server::keepDataForRejoin()
+{
+    // Whatever was kept over an earlier break and not rejoined since is gone
+    dropRejoinChannels();
+
+    m_rejoinChannels = m_joinedChannels;
+    m_joinedChannels.clear();
+
+    // Hostmasks, real names and away states are provisional until the
+    // WhoScheduler, which prefers nicks without a WHO time stamp, verified them
+    foreach (NickInfoPtr nickInfo, m_allNicks)
+        nickInfo->setWhoTimeStamp(0);
+
+    delete m_serverISON;
+    m_serverISON = 0;
+}
+
+void Server::dropRejoinChannels()
+{
+    foreach (const QString& lcChannelName, m_rejoinChannels.keys())
+        dropRejoinChannel(lcChannelName);
+}
+
+void Server::dropRejoinChannel(const QString& lcChannelName)
+{
+    ChannelNickMap* channelNicks = m_rejoinChannels.take(lcChannelName);
+
+    if (!channelNicks)
+        return;
+
+    Channel* channel = getChannelByName(lcChannelName);
+
+    if (channel)
+        channel->purgeKeptNicks();
+
+    const QStringList nicknames = channelNicks->keys();
+    delete channelNicks;
+
+    foreach (const QString& nickname, nicknames)
+    {
+        if (!isWatchedNick(nickname))
+            deleteNickIfUnlisted(nickname);
+    }
+}
+
+bool Server::isKeptForRejoin(const QString& lcNickname) const
+{
+    ChannelMembershipMap::ConstIterator it;
+
+    for (it = m_rejoinChannels.constBegin(); it != m_rejoinChannels.constEnd(); ++it)
+    {
+        if (it.value()->contains(lcNickname))
+            return true;
+    }
+
+    return false;
+}
+
+void Server::reclaimRejoinChannel(const QString& channelName)
+{
+    const QString lcChannelName = channelName.toLower();
+
+    if (!m_rejoinChannels.contains(lcChannelName))
+        return;
+
+    // The kept members are what the channel's nicklist still refers to
+    delete m_unjoinedChannels.take(lcChannelName);
+    delete m_joinedChannels.take(lcChannelName);
+    m_joinedChannels.insert(lcChannelName, m_rejoinChannels.take(lcChannelName));
+}
+
 //... so called to match the ChatWindow derivatives.
 bool Server::closeYourself(bool askForConfirmation)
 {
@@ -287,7 +383,6 @@ void Server::initTimers()
     m_notifyTimer.setObjectName("notify_timer");
     m_notifyTimer.setSingleShot(true);
     m_incomingTimer.setObjectName("incoming_timer");
-    m_pingSendTimer.setSingleShot(true);
 }
 
 void Server::connectSignals()
@@ -295,8 +390,6 @@ void Server::connectSignals()
     // Timers
     connect(&m_incomingTimer, SIGNAL(timeout()), this, SLOT(processIncomingData()));
     connect(&m_notifyTimer, SIGNAL(timeout()), this, SLOT(notifyTimeout()));
-    connect(&m_pingResponseTimer, SIGNAL(timeout()), this, SLOT(updateLongPongLag()));
-    connect(&m_pingSendTimer, SIGNAL(timeout()), this, SLOT(sendPing()));
 
     // OutputFilter
     connect(getOutputFilter(), SIGNAL(requestDccSend()), this,SLOT(requestDccSend()), Qt::QueuedConnection);
@@ -398,7 +491,7 @@ int Server::getPort()
 
 int Server::getLag()  const
 {
-    return m_currentLag;
+    return m_keepAlive->lag();
 }
 
 bool Server::getAutoJoin()  const
@@ -458,6 +551,8 @@ void Server::connectToIRCServer()
         updateConnectionState(Konversation::SSConnecting);
 
         m_ownIpByUserhost.clear();
+        m_whoxSupported = false;
+        m_connectBurst->reset();
 
         resetQueues();
 
@@ -468,39 +563,38 @@ void Server::connectToIRCServer()
             m_nickListModel->setStringList(getIdentity()->getNicknameList());
         resetNickSelection();
 
-        m_socket = new KTcpSocket();
-        m_socket->setObjectName("serverSocket");
+        if (Preferences::self()->parallelConnect())
+        {
+            if (getIdentity()->getAuthType() == "pemclientcert")
+                m_connectionRacer->setClientCertificate(getIdentity()->getPemClientCertFile().toLocalFile());
+            else
+                m_connectionRacer->setClientCertificate(QString());
 
-        connect(m_socket, SIGNAL(error(KTcpSocket::Error)), SLOT(broken(KTcpSocket::Error)) );
-        connect(m_socket, SIGNAL(readyRead()), SLOT(incoming()));
-        connect(m_socket, SIGNAL(disconnected()), SLOT(closed()));
+            // A proxy has to resolve the names itself
+            m_connectionRacer->start(connectionCandidates(), !Preferences::self()->proxyEnabled());
+        }
+        else
+        {
+            const bool encrypted = getConnectionSettings().server().SSLEnabled()
+                || getIdentity()->getAuthType() == "pemclientcert";
 
-        connect(m_socket, SIGNAL(hostFound()), SLOT (hostFound()));
+            m_socket = new KTcpSocket();
+            initSocket(encrypted);
 
-        getStatusView()->appendServerMessage(i18n("Info"),i18n("Looking for server %1 (port <numid>%2</numid>)...",
-            getConnectionSettings().server().host(),
-            QString::number(getConnectionSettings().server().port())));
+            connect(m_socket, SIGNAL(hostFound()), SLOT (hostFound()));
 
-        // connect() will do a async lookup too
-        if(getConnectionSettings().server().SSLEnabled() || getIdentity()->getAuthType() == "pemclientcert")
-        {
-            connect(m_socket, SIGNAL(encrypted()), SLOT (socketConnected()));
-            connect(m_socket, SIGNAL(sslErrors(QList<KSslError>)), SLOT(sslError(QList<KSslError>)));
+            getStatusView()->appendServerMessage(i18n("Info"),i18n("Looking for server %1 (port <numid>%2</numid>)...",
+                getConnectionSettings().server().host(),
+                QString::number(getConnectionSettings().server().port())));
 
-            if (getIdentity()->getAuthType() == "pemclientcert")
+            // connect() will do a async lookup too
+            if (encrypted)
+                m_socket->connectToHostEncrypted(getConnectionSettings().server().host(), getConnectionSettings().server().port());
+            else
             {
-                m_socket->setLocalCertificate(getIdentity()->getPemClientCertFile().toLocalFile());
-                m_socket->setPrivateKey(getIdentity()->getPemClientCertFile().toLocalFile());
+                connect(m_socket, SIGNAL(connected()), SLOT (socketConnected()));
+                m_socket->connectToHost(getConnectionSettings().server().host(), getConnectionSettings().server().port());
             }
-
-            m_socket->setAdvertisedSslVersion(KTcpSocket::TlsV1);
-
-            m_socket->connectToHostEncrypted(getConnectionSettings().server().host(), getConnectionSettings().server().port());
-        }
-        else
-        {
-            connect(m_socket, SIGNAL(connected()), SLOT (socketConnected()));
-            m_socket->connectToHost(getConnectionSettings().server().host(), getConnectionSettings().server().port());
         }
 
         // set up the connection details
@@ -512,6 +606,104 @@ void Server::connectToIRCServer()
         kDebug() << "connectToIRCServer() called while already connected: This should never happen. (" << (isConnecting() << 1) + isConnected() << ')';
 }
 
+void Server::initSocket(bool encrypted)
+{
+    m_socket->setObjectName("serverSocket");
+
+    connect(m_socket, SIGNAL(error(KTcpSocket::Error)), SLOT(broken(KTcpSocket::Error)) );
+    connect(m_socket, SIGNAL(readyRead()), SLOT(incoming()));
+    connect(m_socket, SIGNAL(disconnected()), SLOT(closed()));
+
+    if (encrypted)
+    {
+        connect(m_socket, SIGNAL(encrypted()), SLOT (socketConnected()));
+        connect(m_socket, SIGNAL(sslErrors(QList<KSslError>)), SLOT(sslError(QList<KSslError>)));
+
+        if (getIdentity()->getAuthType() == "pemclientcert")
+        {
+            m_socket->setLocalCertificate(getIdentity()->getPemClientCertFile().toLocalFile());
+            m_socket->setPrivateKey(getIdentity()->getPemClientCertFile().toLocalFile());
+        }
+
+        m_socket->setAdvertisedSslVersion(KTcpSocket::TlsV1);
+    }
+}
+
+Konversation::ServerList Server::connectionCandidates()
+{
+    Konversation::ServerList servers;
+    servers << getConnectionSettings().server();
+
+    if (getConnectionSettings().serverGroup())
+    {
+        foreach (const Konversation::ServerSettings& server, getConnectionSettings().serverGroup()->serverList())
+        {
+            if (!servers.contains(server))
+                servers << server;
+        }
+    }
+
+    // A client certificate is only sent over an encrypted connection
+    if (getIdentity()->getAuthType() == "pemclientcert")
+    {
+        for (int i = 0; i < servers.count(); ++i)
+            servers[i].setSSLEnabled(true);
+    }
+
+    return servers;
+}
+
+void Server::connectionAttemptStarted(const Konversation::ServerSettings& server, const QString& address)
+{
+    if (address == server.host())
+        getStatusView()->appendServerMessage(i18n("Info"), i18n("Connecting to %1 (port <numid>%2</numid>)...",
+            server.host(), QString::number(server.port())));
+    else
+        getStatusView()->appendServerMessage(i18n("Info"), i18n("Connecting to %1 at %2 (port <numid>%3</numid>)...",
+            server.host(), address, QString::number(server.port())));
+}
+
+void Server::connectionAttemptFailed(const Konversation::ServerSettings& server, const QString& error)
+{
+    getStatusView()->appendServerMessage(i18n("Info"), i18n("Could not connect to %1 (port <numid>%2</numid>): %3.",
+        server.host(), QString::number(server.port()), error));
+}
+
+void Server::connectionRaceWon(KTcpSocket* socket, const Konversation::ServerSettings& server)
+{
+    // Registration only happens on the winner, on several servers of
+    // one network at once our nicks would collide with each other
+    getConnectionSettings().setServer(server);
+
+    m_socket = socket;
+    // the racer already did the handshake of encrypted connections
+    initSocket(false);
+
+    if (!m_socket->sslErrors().isEmpty())
+    {
+        // The errors were only ignored for the handshake, nothing was sent yet
+        QPointer<KTcpSocket> wonSocket = m_socket;
+
+        if (!askIgnoreSslErrors(wonSocket, wonSocket->sslErrors()))
+        {
+            if (wonSocket && wonSocket == m_socket)
+                m_socket->close();
+
+            return;
+        }
+    }
+
+    socketConnected();
+}
+
+void Server::connectionRaceLost(KTcpSocket* socket, const Konversation::ServerSettings& server)
+{
+    getConnectionSettings().setServer(server);
+
+    m_socket = socket;
+    broken(m_socket->error());
+}
+
 void Server::connectToIRCServerIn(uint delay)
 {
     m_delayedConnectTimer->setInterval(delay * 1000);
@@ -579,12 +771,9 @@ bool& isOp,bool& isHalfop,bool& hasVoice)
 
     int modeIndex;
 
-    if (nickname.isEmpty()) return;
-
-    while ((modeIndex = m_serverNickPrefixes.indexOf(nickname[0])) != -1)
+    // With multi-prefix there may be more than one mode character
+    while (!nickname.isEmpty() && (modeIndex = m_serverNickPrefixes.indexOf(nickname.at(0))) != -1)
     {
-        if(nickname.isEmpty())
-            return;
         nickname = nickname.mid(1);
         // cut off the prefix
         bool recognisedMode = false;
@@ -655,11 +844,7 @@ void Server::socketConnected()
     emit sslConnected(this);
     getConnectionSettings().setReconnectCount(0);
 
-    if (getIdentity() && getIdentity()->getAuthType() == "saslplain"
-        && !getIdentity()->getSaslAccount().isEmpty() && !getIdentity()->getAuthPassword().isEmpty())
-    {
-        capInitiateNegotiation();
-    }
+    capInitiateNegotiation();
 
     QStringList ql;
 
@@ -680,14 +865,46 @@ void Server::socketConnected()
     setNickname(getNickname());
 }
 
-void Server::capInitiateNegotiation()
+bool Server::wantsSasl()
 {
-    getStatusView()->appendServerMessage(i18n("Info"),i18n("Negotiating capabilities with server..."));
+    return getIdentity() && getIdentity()->getAuthType() == "saslplain"
+        && !getIdentity()->getSaslAccount().isEmpty() && !getIdentity()->getAuthPassword().isEmpty();
+}
 
-    getStatusView()->appendServerMessage(i18n("Info"),i18n("Requesting SASL capability..."));
-    queue("CAP REQ :sasl", HighPriority);
+Server::Capability Server::capabilityFromName(const QString& name)
+{
+    if (name == "sasl")
+        return SASL;
+    else if (name == "multi-prefix")
+        return MultiPrefix;
+    else if (name == "userhost-in-names")
+        return UserhostInNames;
+    else if (name == "away-notify")
+        return AwayNotify;
+    else if (name == "extended-join")
+        return ExtendedJoin;
+    else if (name == "account-notify")
+        return AccountNotify;
+    else if (name == "cap-notify")
+        return CapNotify;
+
+    return NoCapabilities;
+}
 
+void Server::capInitiateNegotiation()
+{
+    m_capabilities = NoCapabilities;
     m_capRequested = true;
+    m_capAnswered = false;
+    m_capNegotiating = true;
+    m_capSaslPending = false;
+
+    if (wantsSasl())
+        getStatusView()->appendServerMessage(i18n("Info"),i18n("Negotiating capabilities with server..."));
+
+    // Registration is held until CAP END, so nothing else is affected by the
+    // round trip. Servers that don't know CAP just ignore it.
+    queue("CAP LS", HighPriority);
 }
 
 void Server::capReply()
@@ -695,16 +912,92 @@ void Server::capReply()
     m_capAnswered = true;
 }
 
+void Server::capListed(const QStringList& names, bool complete)
+{
+    m_capAnswered = true;
+
+    // Multi-line LS replies are collected until the last line
+    m_capOffered += names;
+
+    if (!complete)
+        return;
+
+    QStringList request;
+
+    foreach (const QString& offer, m_capOffered)
+    {
+        // CAP 3.2 servers may append values, e.g. "sasl=PLAIN,EXTERNAL"
+        const QString name = offer.section('=', 0, 0);
+        const Capability capability = capabilityFromName(name);
+
+        if (capability == NoCapabilities || request.contains(name))
+            continue;
+
+        if (capability == SASL && !wantsSasl())
+            continue;
+
+        request << name;
+    }
+
+    if (wantsSasl())
+    {
+        if (request.contains("sasl"))
+            getStatusView()->appendServerMessage(i18n("Info"),i18n("Requesting SASL capability..."));
+        else
+            getStatusView()->appendServerMessage(i18n("Error"), i18n("SASL capability denied or not supported by server."));
+    }
+
+    m_capOffered.clear();
+
+    if (request.isEmpty())
+        capEndNegotiation();
+    else
+        queue("CAP REQ :" + request.join(" "), HighPriority);
+}
+
+void Server::capAdded(const QStringList& names)
+{
+    // cap-notify: a capability became available after registration
+    QStringList request;
+
+    foreach (const QString& offer, names)
+    {
+        const QString name = offer.section('=', 0, 0);
+        const Capability capability = capabilityFromName(name);
+
+        if (capability != NoCapabilities && capability != SASL && !(m_capabilities & capability))
+            request << name;
+    }
+
+    if (!request.isEmpty())
+        queue("CAP REQ :" + request.join(" "), HighPriority);
+}
+
+void Server::capRemoved(const QString& name)
+{
+    m_capabilities &= ~capabilityFromName(name);
+}
+
 void Server::capEndNegotiation()
 {
-    getStatusView()->appendServerMessage(i18n("Info"),i18n("Closing capabilities negotiation."));
+    if (!m_capNegotiating)
+        return;
+
+    m_capNegotiating = false;
+    m_capSaslPending = false;
+
+    if (wantsSasl())
+        getStatusView()->appendServerMessage(i18n("Info"),i18n("Closing capabilities negotiation."));
 
     queue("CAP END", HighPriority);
 }
 
 void Server::capCheckIgnored()
 {
-    if (m_capRequested && !m_capAnswered)
+    // Registration is complete, anything negotiated from now on comes from cap-notify
+    m_capNegotiating = false;
+
+    if (m_capRequested && !m_capAnswered && wantsSasl())
         getStatusView()->appendServerMessage(i18n("Error"), i18n("Capabilities negotiation failed: Appears not supported by server."));
 }
 
@@ -712,9 +1005,21 @@ void Server::capAcknowledged(const QString& name, Server::CapModifiers modifiers
 {
     m_capAnswered = true;
 
-    if (name == "sasl" && modifiers == Server::NoModifiers)
+    const Capability capability = capabilityFromName(name);
+
+    if (modifiers & Server::DisMod)
+    {
+        m_capabilities &= ~capability;
+
+        return;
+    }
+
+    m_capabilities |= capability;
+
+    if (capability == SASL && modifiers == Server::NoModifiers)
     {
         getStatusView()->appendServerMessage(i18n("Info"), i18n("SASL capability acknowledged by server, attempting SASL PLAIN authentication..."));
+        m_capSaslPending = true;
         sendAuthenticate("PLAIN");
     }
 }
@@ -723,8 +1028,13 @@ void Server::capDenied(const QString& name)
 {
     if (name == "sasl")
         getStatusView()->appendServerMessage(i18n("Error"), i18n("SASL capability denied or not supported by server."));
+}
 
-    capEndNegotiation();
+void Server::capRequestAnswered()
+{
+    // SASL authentication ends the negotiation itself once it is done
+    if (!m_capSaslPending)
+        capEndNegotiation();
 }
 
 void Server::registerWithServices()
@@ -773,12 +1083,22 @@ void Server::broken(KTcpSocket::Error error)
     resetQueues();
 
     m_notifyTimer.stop();
-    m_pingSendTimer.stop();
-    m_pingResponseTimer.stop();
-    m_inputFilter.setLagMeasuring(false);
-    m_currentLag = -1;
+    m_keepAlive->stop();
 
-    purgeData();
+    // Only a connection that was lost, rather than closed, is expected back
+    if (Preferences::self()->warmReconnect() && !m_sslErrorLock
+        && getConnectionState() != Konversation::SSDeliberatelyDisconnected)
+    {
+        foreach (Channel* channel, m_channelList)
+        {
+            if (channel->joined())
+                channel->keepNicksForRejoin();
+        }
+
+        keepDataForRejoin();
+    }
+    else
+        purgeData();
 
     // HACK Only show one nick change dialog at connection time.
     // This hack is a bit nasty as it assumes that the only KDialog
@@ -845,6 +1165,14 @@ void Server::sslError( const QList<KSslError>& errors )
     // else.
     QPointer<KTcpSocket> socket = qobject_cast<KTcpSocket*>(QObject::sender());
 
+    if (askIgnoreSslErrors(socket, errors))
+        socket->ignoreSslErrors();
+}
+
+bool Server::askIgnoreSslErrors(KTcpSocket* sslSocket, const QList<KSslError>& errors)
+{
+    QPointer<KTcpSocket> socket = sslSocket;
+
     m_sslErrorLock = true;
     bool ignoreSslErrors = KIO::SslUi::askIgnoreSslErrors(socket, KIO::SslUi::RecallAndStoreRules);
     m_sslErrorLock = false;
@@ -856,7 +1184,7 @@ void Server::sslError( const QList<KSslError>& errors )
     {
         kDebug() << "Socket was destroyed while waiting for user interaction.";
 
-        return;
+        return false;
     }
 
     // Ask the user if he wants to ignore the errors.
@@ -874,15 +1202,13 @@ void Server::sslError( const QList<KSslError>& errors )
         if (isConnecting())
         {
             // The user has chosen to ignore SSL errors.
-            socket->ignoreSslErrors();
-        }
-        else
-        {
-            // QueuedConnection is vital here, otherwise we're deleting the socket
-            // in a slot connected to one of its signals (connectToIRCServer deletes
-            // any old socket) and crash.
-            QMetaObject::invokeMethod(this, "connectToIRCServer", Qt::QueuedConnection);
+            return true;
         }
+
+        // QueuedConnection is vital here, otherwise we're deleting the socket
+        // in a slot connected to one of its signals (connectToIRCServer deletes
+        // any old socket) and crash.
+        QMetaObject::invokeMethod(this, "connectToIRCServer", Qt::QueuedConnection);
     }
     else
     {
@@ -906,6 +1232,8 @@ void Server::sslError( const QList<KSslError>& errors )
 
         emit sslInitFailure();
     }
+
+    return false;
 }
 
 // Will be called from InputFilter as soon as the Welcome message was received
@@ -917,6 +1245,7 @@ void Server::connectionEstablished(const QString& ownHost)
         QHostInfo::lookupHost(ownHost, this, SLOT(gotOwnResolvedHostByWelcome(QHostInfo)));
 
     updateConnectionState(Konversation::SSConnected);
+    m_connectBurst->registered();
 
     // Make a helper object to build ISON (notify) list and map offline nicks to addressbook.
     // TODO: Give the object a kick to get it started?
@@ -934,7 +1263,7 @@ void Server::connectionEstablished(const QString& ownHost)
     requestUserhost(getNickname());
 
     // Start the PINGPONG match
-    m_pingSendTimer.start(1000 /*1 sec*/);
+    m_keepAlive->start(m_socket);
 
     // Recreate away state if we were set away prior to a reconnect.
     if (m_away)
@@ -1018,6 +1347,8 @@ void Server::quitServer(const QString& quitMessage)
     // a QUIT).
     updateConnectionState(Konversation::SSDeliberatelyDisconnected);
 
+    m_connectionRacer->abort();
+
     if (!m_socket) return;
 
     QString toServer = "QUIT :";
@@ -1131,6 +1462,10 @@ void Server::notifyTimeout()
 
 void Server::autoCommandsAndChannels()
 {
+    // Sent as soon as RPL_ISUPPORT is complete, the end of the MOTD comes later
+    if (!m_connectBurst->start())
+        return;
+
     if (getServerGroup() && !getServerGroup()->connectCommands().isEmpty())
     {
         QString connectCommands = getServerGroup()->connectCommands();
@@ -1151,21 +1486,19 @@ void Server::autoCommandsAndChannels()
         }
     }
 
+    Konversation::ChannelList channels;
+
     if (getAutoJoin())
-    {
-        for ( QStringList::Iterator it = m_autoJoinCommands.begin(); it != m_autoJoinCommands.end(); ++it )
-            queue((*it));
-    }
+        channels = m_autoJoinChannels;
 
     if (!m_connectionSettings.oneShotChannelList().isEmpty())
     {
-        QStringList oneShotJoin = generateJoinCommand(m_connectionSettings.oneShotChannelList());
-        for ( QStringList::Iterator it = oneShotJoin.begin(); it != oneShotJoin.end(); ++it )
-        {
-            queue((*it));
-        }
+        channels += m_connectionSettings.oneShotChannelList();
         m_connectionSettings.clearOneShotChannelList();
     }
+
+    // Queued behind the connect commands, which may identify with services
+    queueList(generateJoinCommand(m_connectBurst->plan(channels)));
 }
 
 /** Create a set of indices into the nickname list of the current identity based on the current nickname.
@@ -1238,6 +1571,8 @@ void Server::incoming()
     //if (len <= 0 && getConnectionSettings().server().SSLEnabled())
     //    return;
 
+    m_keepAlive->dataReceived();
+
     // split buffer to lines
     QList<QByteArray> bufferLines;
     while (m_socket->canReadLine())
@@ -1578,6 +1913,17 @@ bool Server::queue(const QString& line, QueuePriority priority)
     return false;
 }
 
+int Server::sendUnqueued(const QString& line)
+{
+    if (line.isEmpty() || !isSocketConnected())
+        return 0;
+
+    int sizesent = _send_internal(line);
+    emit sentStat(line.length(), sizesent);
+
+    return sizesent;
+}
+
 bool Server::queueList(const QStringList& buffer, QueuePriority priority)
 {
     if (buffer.isEmpty() || !validQueue(priority))
@@ -1838,6 +2184,10 @@ bool Server::isNickOnline(const QString &nickname)
 
 QString Server::getOwnIpByNetworkInterface()
 {
+    // There is no socket while connecting to several servers at once
+    if (!m_socket)
+        return QString();
+
     return m_socket->localAddress().toString();
 }
 
@@ -1929,7 +2279,12 @@ void Server::requestWhois(const QString& nickname)
 void Server::requestWho(const QString& channel)
 {
     m_inputFilter.setAutomaticRequest("WHO", channel, true);
-    queue("WHO "+channel, LowPriority);
+
+    // Ask WHOX capable servers for the account and a token to recognize the replies by
+    if (m_whoxSupported)
+        queue("WHO " + channel + " %tcuhnfar," + QString::number(WhoScheduler::WhoxQueryToken), LowPriority);
+    else
+        queue("WHO "+channel, LowPriority);
 }
 
 void Server::requestUserhost(const QString& nicks)
@@ -2730,6 +3085,7 @@ Channel* Server::joinChannel(const QString& name, const QString& hostmask)
             Konversation::ChannelSettings channelSettings = getServerGroup()->channelByNameFromHistory(name);
             channel->setNotificationsEnabled(channelSettings.enableNotifications());
             getServerGroup()->appendChannelHistory(channelSettings);
+            Application::instance()->saveServerGroup(getServerGroup()->id(), false);
         }
 
         m_channelList.append(channel);
@@ -2739,6 +3095,9 @@ Channel* Server::joinChannel(const QString& name, const QString& hostmask)
         connect(this, SIGNAL(nicknameChanged(QString)), channel, SLOT(setNickname(QString)));
     }
 
+    // Take back the members kept over a reconnect, if any.
+    reclaimRejoinChannel(name);
+
     // Move channel from unjoined (if present) to joined list and add our own nickname to the joined list.
     ChannelNickPtr channelNick = addNickToJoinedChannelsList(name, getNickname());
 
@@ -2763,11 +3122,15 @@ void Server::removeChannel(Channel* channel)
         Konversation::ChannelSettings channelSettings = getServerGroup()->channelByNameFromHistory(channel->getName());
         channelSettings.setNotificationsEnabled(channel->notificationsEnabled());
         getServerGroup()->appendChannelHistory(channelSettings);
+        Application::instance()->saveServerGroup(getServerGroup()->id(), false);
     }
 
     m_channelList.removeOne(channel);
     m_loweredChannelNameHash.remove(channel->getName().toLower());
 
+    // Closed before it was joined again after a reconnect
+    dropRejoinChannel(channel->getName().toLower());
+
     if (!isConnected())
         updateAutoJoin();
 }
@@ -3084,7 +3447,7 @@ bool Server::deleteNickIfUnlisted(const QString &nickname)
     if (!m_queryNicks.contains(lcNickname))
     {
         QStringList nickChannels = getNickChannels(nickname);
-        if (nickChannels.isEmpty())
+        if (nickChannels.isEmpty() && !isKeptForRejoin(lcNickname))
         {
             m_allNicks.remove(lcNickname);
             return true;
@@ -3337,6 +3700,14 @@ Channel* Server::removeNickFromChannel(const QString &channelName, const QString
     return outChannel;
 }
 
+void Server::removeStaleNickFromChannel(const QString &channelName, const QString &nickname)
+{
+    removeChannelNick(channelName, nickname);
+
+    if (!isWatchedNick(nickname))
+        deleteNickIfUnlisted(nickname);
+}
+
 void Server::nickWasKickedFromChannel(const QString &channelName, const QString &nickname, const QString &kicker, const QString &reason)
 {
     Channel* outChannel = getChannelByName(channelName);
@@ -3436,6 +3807,8 @@ void Server::userhost(const QString& nick,const QString& hostmask,bool away,bool
     NickInfoPtr nickInfo = getNickInfo(nick);
     if (nickInfo)
     {
+        nickInfo->setWhoTimeStamp(QDateTime::currentDateTime().toTime_t());
+
         if (nickInfo->isAway() != away)
         {
             nickInfo->setAway(away);
@@ -3521,9 +3894,7 @@ void Server::setTopicAuthor(const QString& channel, const QString& author, QDate
 
 void Server::endOfWho(const QString& target)
 {
-    Channel* channel = getChannelByName(target);
-    if(channel)
-        channel->scheduleAutoWho();
+    m_whoScheduler->endOfWho(target);
 }
 
 void Server::endOfNames(const QString& target)
@@ -3531,6 +3902,8 @@ void Server::endOfNames(const QString& target)
     Channel* channel = getChannelByName(target);
     if(channel)
         channel->endOfNames();
+
+    m_connectBurst->channelDone(target);
 }
 
 bool Server::isNickname(const QString &compare) const
@@ -3658,10 +4031,12 @@ const QString& inputLineText
 void Server::sendToAllChannels(const QString &text)
 {
     // Send a message to all channels we are in
+    QList<ChatWindow*> targets;
+
     foreach (Channel* channel, m_channelList)
-    {
-        channel->sendText(text);
-    }
+        targets.append(channel);
+
+    sendToTargets(targets, text);
 }
 
 void Server::invitation(const QString& nick,const QString& channel)
@@ -3778,6 +4153,8 @@ void Server::updateAutoJoin(Konversation::ChannelList channels)
         }
     }
 
+    m_autoJoinChannels = tmpList;
+
     if (!tmpList.isEmpty())
     {
         setAutoJoinCommands(generateJoinCommand(tmpList));
@@ -3812,8 +4189,11 @@ QStringList Server::generateJoinCommand(const Konversation::ChannelList &tmpList
             uint currentLength = getIdentity()->getCodec()->fromUnicode(channel).length();
             currentLength += getIdentity()->getCodec()->fromUnicode(password).length();
 
+            const int targetLimit = m_connectBurst->joinTargetLimit();
+
             //channels.count() and passwords.count() account for the commas
-            if (length + currentLength + 6 + channels.count() + passwords.count() >= 512) // 6: "JOIN " plus separating space between chans and pws.
+            if (length + currentLength + 6 + channels.count() + passwords.count() >= 512 // 6: "JOIN " plus separating space between chans and pws.
+                || (targetLimit > 0 && channels.count() >= targetLimit))
             {
                 while (!passwords.isEmpty() && passwords.last() == ".") passwords.pop_back();
 
@@ -3886,17 +4266,171 @@ void Server::executeMultiServerCommand(const QString& command, const QString& pa
 
 void Server::sendToAllChannelsAndQueries(const QString& text)
 {
-    // Send a message to all channels we are in
+    QList<ChatWindow*> targets;
+
     foreach (Channel* channel, m_channelList)
+        targets.append(channel);
+
+    foreach (Query* query, m_queryList)
+        targets.append(query);
+
+    sendToTargets(targets, text);
+}
+
+/// Send text to many channels and queries at once. Plain messages and /ME
+/// are parsed and split only once per target encoding and all resulting lines
+/// are queued in one go. Text with any other line is sent to each target on
+/// its own.
+void Server::sendToTargets(const QList<ChatWindow*>& targets, const QString& text)
+{
+    if (targets.isEmpty())
+        return;
+
+    const QString commandChar = Preferences::self()->commandChar();
+    const QStringList lines = text.split(QRegExp("[\r\n]+"), QString::SkipEmptyParts);
+
+    bool batchable = true;
+
+    foreach (const QString& line, lines)
     {
-        channel->sendText(text);
+        batchable = !line.startsWith(commandChar) || line.startsWith(commandChar + commandChar)
+            || line.startsWith(commandChar + "me ", Qt::CaseInsensitive);
+
+        // an alias may expand to anything, possibly depending on the target
+        if (batchable)
+        {
+            QString aliased(line);
+            batchable = !getOutputFilter()->replaceAliases(aliased, targets.first());
+        }
+
+        if (!batchable)
+            break;
     }
 
-    // Send a message to all queries we are in
-    foreach (Query* query, m_queryList)
+    // Targets sharing an encoding get the very same split lines
+    QMap<QString, QList<ChatWindow*> > targetsByCodec;
+
+    foreach (ChatWindow* target, targets)
+    {
+        QString codecName;
+
+        if (getServerGroup())
+            codecName = Preferences::channelEncoding(getServerGroup()->id(), target->getName());
+        else
+            codecName = Preferences::channelEncoding(getDisplayName(), target->getName());
+
+        targetsByCodec[codecName.toLower()].append(target);
+    }
+
+    // The longest name of each group and what its lines parse into
+    QList<ChatWindow*> longestTargets;
+    QList<QList<Konversation::OutputFilterResult> > groupResults;
+
+    for (QMap<QString, QList<ChatWindow*> >::const_iterator group = targetsByCodec.constBegin();
+        batchable && group != targetsByCodec.constEnd(); ++group)
     {
-        query->sendText(text);
+        // The longest name leaves the least room per line, a split fitting it fits all
+        ChatWindow* longest = group.value().first();
+
+        foreach (ChatWindow* target, group.value())
+        {
+            if (target->getName().length() > longest->getName().length())
+                longest = target;
+        }
+
+        const QString linePrefix = "PRIVMSG " + longest->getName() + ' ';
+        QList<Konversation::OutputFilterResult> results;
+
+        foreach (const QString& line, lines)
+        {
+            Konversation::OutputFilterResult result = getOutputFilter()->parse(getNickname(), line, longest->getName(), longest);
+
+            // Only lines that become PRIVMSGs to the target can be sent to the others as well
+            batchable = (result.type == Konversation::Message || result.type == Konversation::Action);
+
+            QStringList sent = result.toServerList;
+
+            if (!result.toServer.isEmpty())
+                sent.append(result.toServer);
+
+            foreach (const QString& serverLine, sent)
+                batchable = batchable && serverLine.startsWith(linePrefix);
+
+            if (!batchable)
+                break;
+
+            results.append(result);
+        }
+
+        longestTargets.append(longest);
+        groupResults.append(results);
+    }
+
+    if (!batchable)
+    {
+        foreach (ChatWindow* target, targets)
+            target->sendText(text);
+
+        return;
+    }
+
+    QStringList toServer;
+    int groupIndex = 0;
+
+    foreach (const QList<ChatWindow*>& group, targetsByCodec)
+    {
+        const QString linePrefix = "PRIVMSG " + longestTargets.at(groupIndex)->getName() + ' ';
+
+        foreach (const Konversation::OutputFilterResult& result, groupResults.at(groupIndex))
+        {
+            QStringList shown = result.outputList;
+            QStringList sent = result.toServerList;
+
+            if (!result.output.isEmpty())
+                shown.append(result.output);
+
+            if (!result.toServer.isEmpty())
+                sent.append(result.toServer);
+
+            foreach (ChatWindow* target, group)
+            {
+                const bool isQuery = (target->getType() == ChatWindow::Query);
+
+                for (int i = 0; i < shown.count(); ++i)
+                {
+                    if (i == 0 && result.type == Konversation::Action)
+                        target->appendAction(getNickname(), shown.at(i));
+                    else if (isQuery)
+                        target->appendQuery(getNickname(), shown.at(i));
+                    else
+                        target->append(getNickname(), shown.at(i));
+                }
+
+                foreach (const QString& serverLine, sent)
+                    toServer.append("PRIVMSG " + target->getName() + ' ' + serverLine.mid(linePrefix.length()));
+            }
+        }
+
+        ++groupIndex;
     }
+
+    queueList(toServer);
+}
+
+int Server::queueMark(QueuePriority priority)
+{
+    if (!validQueue(priority))
+        return 0;
+
+    return m_queues[priority]->linesSent() + m_queues[priority]->pendingMessages();
+}
+
+int Server::queueLinesSent(QueuePriority priority)
+{
+    if (!validQueue(priority))
+        return 0;
+
+    return m_queues[priority]->linesSent();
 }
 
 void Server::requestAway(const QString& reason)
@@ -4056,51 +4590,34 @@ void Server::removeBan(const QString &channel, const QString &ban)
     }
 }
 
-void Server::sendPing()
+void Server::refreshOwnHostmask()
 {
-    //WHO ourselves once a minute in case the irc server has changed our
+    //WHO ourselves now and then in case the irc server has changed our
     //hostmask, such as what happens when a Freenode cloak is activated.
-    //It might be more intelligent to only do this when there is text
-    //in the inputbox. Kinda changes this into a "do minutely"
-    //queue :-)
-    QStringList ql;
-    ql << "PING LAG" + QTime::currentTime().toString("hhmmss");
     getInputFilter()->setAutomaticRequest("WHO", getNickname(), true);
-    ql << "WHO " + getNickname();
-    queueList(ql, HighPriority);
-
-    m_lagTime.start();
-    m_inputFilter.setLagMeasuring(true);
-    m_pingResponseTimer.start(1000 /*1 sec*/);
+    queue("WHO " + getNickname(), LowPriority);
 }
 
-void Server::pongReceived()
+void Server::pongReceived(const QString& cookie)
 {
-    // ignore unrequested PONGs
-    if (m_pingSendTimer.isActive())
-        return;
-
-    m_currentLag = m_lagTime.elapsed();
-    m_inputFilter.setLagMeasuring(false);
-    m_pingResponseTimer.stop();
-
-    emit serverLag(this, m_currentLag);
+    m_keepAlive->pongReceived(cookie);
+}
 
-    // Send another PING in 60 seconds
-    m_pingSendTimer.start(60000 /*60 sec*/);
+void Server::updateLag(int msec)
+{
+    emit serverLag(this, msec);
 }
 
-void Server::updateLongPongLag()
+void Server::updateLongPongLag(int msec)
 {
     if (isSocketConnected())
-    {
-        m_currentLag = m_lagTime.elapsed();
-        emit tooLongLag(this, m_currentLag);
-        // kDebug() << "Current lag: " << currentLag;
+        emit tooLongLag(this, msec);
+}
 
-        if (m_currentLag > (Preferences::self()->maximumLagTime() * 1000))
-            m_socket->close();
-    }
+void Server::lagTimedOut()
+{
+    if (isSocketConnected())
+        m_socket->close();
 }
 
 void Server::updateEncoding()
@@ -4227,6 +4744,12 @@ void Server::startNickInfoChangedTimer()
         m_nickInfoChangedTimer->start();
 }
 
+void Server::flushNickInfoChanges()
+{
+    m_nickInfoChangedTimer->stop();
+    sendNickInfoChangedSignals();
+}
+
 void Server::sendNickInfoChangedSignals()
 {
     emit nickInfoChanged();
@@ -4273,7 +4796,7 @@ void Server::sendChannelNickChangedSignals()
 void Server::involuntaryQuit()
 {
     if((m_connectionState == Konversation::SSConnected || m_connectionState == Konversation::SSConnecting) &&
-       (m_socket->peerAddress() != QHostAddress(QHostAddress::LocalHost) && m_socket->peerAddress() != QHostAddress(QHostAddress::LocalHostIPv6)))
+       (!m_socket || (m_socket->peerAddress() != QHostAddress(QHostAddress::LocalHost) && m_socket->peerAddress() != QHostAddress(QHostAddress::LocalHostIPv6))))
     {
         quitServer();
         updateConnectionState(Konversation::SSInvoluntarilyDisconnected);
@@ -50,6 +50,10 @@ class Identity;
 class RawLog;
 class ChannelListPanel;
 class ServerISON;
+class WhoScheduler;
+class ConnectBurst;
+class KeepAlive;
+class ConnectionRacer;
 class ChatWindow;
 class ViewContainer;
 
@@ -93,6 +97,18 @@ class Server : public QObject
         };
         Q_DECLARE_FLAGS(CapModifiers, CapModifier)
 
+        enum Capability {
+            NoCapabilities = 0x0,
+            SASL = 0x1,
+            MultiPrefix = 0x2,
+            UserhostInNames = 0x4,
+            AwayNotify = 0x8,
+            ExtendedJoin = 0x10,
+            AccountNotify = 0x20,
+            CapNotify = 0x40
+        };
+        Q_DECLARE_FLAGS(Capabilities, Capability)
+
         Server(QObject* parent, ConnectionSettings& settings);
         ~Server();
 
@@ -141,6 +157,8 @@ class Server : public QObject
         Channel* nickJoinsChannel(const QString &channelName, const QString &nickname, const QString &hostmask);
         void renameNick(const QString &nickname,const QString &newNick);
         Channel* removeNickFromChannel(const QString &channelName, const QString &nickname, const QString &reason, bool quit=false);
+        /// Silently forgets a member kept over a reconnect that the channel's NAMES no longer list.
+        void removeStaleNickFromChannel(const QString &channelName, const QString &nickname);
         void nickWasKickedFromChannel(const QString &channelName, const QString &nickname, const QString &kicker, const QString &reason);
         void removeNickFromServer(const QString &nickname, const QString &reason);
 
@@ -197,7 +215,10 @@ class Server : public QObject
         QString parseWildcards(const QString& toParse, const QString& nickname, const QString& channelName, const QString &channelKey, const QStringList &nickList, const QString& inputLineText);
         QString parseWildcards(const QString& toParse, const QString& nickname, const QString& channelName, const QString &channelKey, const QString& nick, const QString& inputLineText);
 
+        /// Sends the connect commands and joins the channels, once per connection.
         void autoCommandsAndChannels();
+        ConnectBurst* getConnectBurst() const { return m_connectBurst; }
+        KeepAlive* getKeepAlive() const { return m_keepAlive; }
 
         void sendURIs(const KUrl::List& uris, const QString& nick);
 
@@ -366,6 +387,14 @@ class Server : public QObject
         void setTopicLength(int topicLength) { m_topicLength = topicLength; }
         int topicLength() const { return m_topicLength; }
 
+        /// Whether the server announced WHOX (extended WHO queries) in ISUPPORT.
+        void setWhoxSupported(bool supported) { m_whoxSupported = supported; }
+        bool isWhoxSupported() const { return m_whoxSupported; }
+
+        /// The IRCv3 capabilities currently enabled on this connection.
+        Capabilities capabilities() const { return m_capabilities; }
+        bool hasCapability(Capability capability) const { return m_capabilities & capability; }
+
         void registerWithServices();
 
         // Blowfish stuff
@@ -471,6 +500,15 @@ class Server : public QObject
         bool queue(const QString& line, QueuePriority priority=StandardPriority);
         //TODO this should be an overload, not a separate name. ambiguous cases need QString() around the cstring
         bool queueList(const QStringList& buffer, QueuePriority priority=StandardPriority);
+        /** Writes line to the socket right away, past the rate limits of the queues.
+         *  Only for the few lines whose timing matters, like our PINGs.
+         */
+        int sendUnqueued(const QString& line);
+        /** Number of lines the queue will have sent once everything in it now
+         *  is gone. Counts restart from zero when the queues are reset.
+         */
+        int queueMark(QueuePriority priority=StandardPriority);
+        int queueLinesSent(QueuePriority priority=StandardPriority);
 
         void setNickname(const QString &newNickname);
         /** This is called when we want to open a new query, or focus an existing one.
@@ -514,14 +552,15 @@ class Server : public QObject
         void showSSLDialog();
         void sendToAllChannels(const QString& text);
         void sendToAllChannelsAndQueries(const QString& text);
+        void sendToTargets(const QList<ChatWindow*>& targets, const QString& text);
 
         void enableIdentifyMsg(bool enabled);
         bool identifyMsgEnabled();
         void addBan(const QString &channel, const QString &ban);
         void removeBan(const QString &channel, const QString &ban);
 
-        /// Called when we received a PONG from the server
-        void pongReceived();
+        /// Called when we received a PONG from the server, with what it echoed
+        void pongReceived(const QString& cookie);
 
         #ifdef HAVE_QCA2
         void initKeyExchange(const QString &receiver);
@@ -531,6 +570,8 @@ class Server : public QObject
 
         /// Start the NickInfo changed timer if it isn't started already
         void startNickInfoChangedTimer();
+        /// Emit the pending nickInfoChanged() signals now instead of on the timer.
+        void flushNickInfoChanges();
         /// Start the ChannelNick changed timer if it isn't started already
         void startChannelNickChangedTimer(const QString& channel);
 
@@ -541,10 +582,14 @@ class Server : public QObject
 
         void capInitiateNegotiation();
         void capReply();
+        void capListed(const QStringList& names, bool complete);
+        void capAdded(const QStringList& names);
+        void capRemoved(const QString& name);
         void capEndNegotiation();
         void capCheckIgnored();
         void capAcknowledged(const QString& name, CapModifiers modifiers);
         void capDenied(const QString& name);
+        void capRequestAnswered();
         void sendAuthenticate(const QString& message);
 
     protected slots:
@@ -552,6 +597,10 @@ class Server : public QObject
         void preShellCommandExited(int exitCode, QProcess::ExitStatus exitStatus);
         void preShellCommandError(QProcess::ProcessError eror);
         void socketConnected();
+        void connectionAttemptStarted(const Konversation::ServerSettings& server, const QString& address);
+        void connectionAttemptFailed(const Konversation::ServerSettings& server, const QString& error);
+        void connectionRaceWon(KTcpSocket* socket, const Konversation::ServerSettings& server);
+        void connectionRaceLost(KTcpSocket* socket, const Konversation::ServerSettings& server);
         void startAwayTimer();
         void incoming();
         void processIncomingData();
@@ -595,10 +644,14 @@ class Server : public QObject
         void gotOwnResolvedHostByWelcome(const QHostInfo& res);
         void gotOwnResolvedHostByUserhost(const QHostInfo& res);
 
-        /// Send a PING to the server so we can meassure the lag
-        void sendPing();
+        /// Passes on a lag measured by KeepAlive
+        void updateLag(int msec);
         /// Updates GUI when the lag gets high
-        void updateLongPongLag();
+        void updateLongPongLag(int msec);
+        /// Closes the socket when the server does not answer anymore
+        void lagTimedOut();
+        /// WHO ourselves along with a PING in case the server changed our hostmask
+        void refreshOwnHostmask();
 
         /// Update the encoding shown in the mainwindow's actions
         void updateEncoding();
@@ -728,6 +781,8 @@ class Server : public QObject
         bool m_autoJoin;
 
         QStringList m_autoJoinCommands;
+        /// The channels m_autoJoinCommands were generated from, for the connect burst.
+        Konversation::ChannelList m_autoJoinChannels;
 
         KTcpSocket* m_socket;
 
@@ -735,7 +790,6 @@ class Server : public QObject
         QTimer m_notifyTimer;
         QStringList m_notifyCache;                  // List of users found with ISON
         int m_checkTime;                            // Time elapsed while waiting for server 303 response
-        int m_currentLag;
 
         QStringList m_inputBuffer;
 
@@ -773,6 +827,25 @@ class Server : public QObject
     private:
         void purgeData();
 
+        /// Hooks m_socket up, and with encryption sets it up for the identity.
+        void initSocket(bool encrypted);
+        /// The servers to race for a connection, the current one first.
+        Konversation::ServerList connectionCandidates();
+        /// Asks the user whether to go on despite certificate errors, true if
+        /// the connection attempt should continue with the socket.
+        bool askIgnoreSslErrors(KTcpSocket* socket, const QList<KSslError>& errors);
+        /// Keeps the members of joined channels over an involuntary disconnect,
+        /// for the channels to take back when they are joined again.
+        void keepDataForRejoin();
+        void dropRejoinChannels();
+        void dropRejoinChannel(const QString& lcChannelName);
+        void reclaimRejoinChannel(const QString& channelName);
+        bool isKeptForRejoin(const QString& lcNickname) const;
+
+        /// Whether the identity is set up for SASL PLAIN authentication.
+        bool wantsSasl();
+        static Capability capabilityFromName(const QString& name);
+
         /// Recovers the filename from the dccArguments list from pos 0 to size-offset-1
         /// joining with a space and cleans the filename using cleanDccFileName.
         /// The filename only needs to be recovered if it contains a space, in case
@@ -797,6 +870,15 @@ class Server : public QObject
         /// Helper object to construct ISON (notify) list and map offline nicks to
         /// addressbook.
         ServerISON* m_serverISON;
+        /// Helper object to keep the hostmasks and away states of channel members current.
+        WhoScheduler* m_whoScheduler;
+        /// Connects to all servers of the group at once, if enabled.
+        ConnectionRacer* m_connectionRacer;
+        /// Plans the JOINs sent after registering and times the connection.
+        ConnectBurst* m_connectBurst;
+        /// Pings the server and measures the lag.
+        KeepAlive* m_keepAlive;
+        bool m_whoxSupported;
         /// All nicks known to this server.  Note this is NOT a list of all nicks on the server.
         /// Any nick appearing in this list is online, but may not necessarily appear in
         /// any of the joined or unjoined channel lists because a WHOIS has not yet been
@@ -809,6 +891,9 @@ class Server : public QObject
         /// Note that this is NOT a list of all channels on the server, just those we are
         /// interested in because of nicks in the Nick Watch List.
         ChannelMembershipMap m_unjoinedChannels;
+        /// Membership lists of channels joined before the connection broke and
+        /// not joined again since.  Their nicks are still in m_allNicks.
+        ChannelMembershipMap m_rejoinChannels;
         /// List of nicks in Queries.
         NickInfoMap m_queryNicks;
 
@@ -826,18 +911,16 @@ class Server : public QObject
         /// Used to lock incomingTimer while processing message.
         bool m_processingIncoming;
 
-        /// Measures the lag between PING and PONG
-        QTime m_lagTime;
-        /// Updates the gui when the lag gets too high
-        QTimer m_pingResponseTimer;
-        /// Wait before sending the next PING
-        QTimer m_pingSendTimer;
-
         /// Previous ISON reply of the server, needed for comparison with the next reply
         QStringList m_prevISONList;
 
         bool m_capRequested;
         bool m_capAnswered;
+        /// True from CAP LS until CAP END, i.e. while registration is held
+        bool m_capNegotiating;
+        bool m_capSaslPending;
+        QStringList m_capOffered;
+        Capabilities m_capabilities;
         QString m_lastAuthenticateCommand;
 
         ConnectionSettings m_connectionSettings;
@@ -861,5 +944,6 @@ class Server : public QObject
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(Server::CapModifiers)
+Q_DECLARE_OPERATORS_FOR_FLAGS(Server::Capabilities)
 
 #endif
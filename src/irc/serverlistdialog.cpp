@@ -173,6 +173,7 @@ namespace Konversation
                         m_selectedServer = dlg->editedServer();
 
                         *serverGroup = *dlg->serverGroupSettings();
+                        Preferences::serverGroupRenamed(serverGroup->id());
 
                         emit serverGroupsChanged(serverGroup); // will call updateServerList
                     }
@@ -188,6 +189,7 @@ namespace Konversation
                         m_selectedServer = ServerSettings("");
 
                         *serverGroup = *dlg->serverGroupSettings();
+                        Preferences::serverGroupRenamed(serverGroup->id());
 
                         emit serverGroupsChanged(serverGroup); // will call updateServerList
                     }
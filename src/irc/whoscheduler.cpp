@@ -0,0 +1,230 @@
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+*/
+
+#include "whoscheduler.h"
+#include "server.h"
+#include "channel.h"
+#include "nick.h"
+#include "application.h"
+#include "inputfilter.h"
+#include "preferences.h"
+
+#include <QDateTime>
+#include <QTimer>
+
+
+// past this many stale members a WHO is cheaper than USERHOST
+static const int MaxUserhostNicks = 5;
+
+WhoScheduler::WhoScheduler(Server* server) : QObject(server), m_server(server)
+{
+    m_pendingWhoSince = 0;
+
+    m_requestTimer = new QTimer(this);
+    connect(m_requestTimer, SIGNAL(timeout()), this, SLOT(sendRequest()));
+    updateSettings();
+
+    connect(m_server, SIGNAL(serverOnline(bool)), this, SLOT(serverOnline(bool)));
+    connect(m_server,
+        SIGNAL(channelMembersChanged(Server*,QString,bool,bool,QString)),
+        this,
+        SLOT(channelMembersChanged(Server*,QString,bool,bool,QString)));
+    connect(m_server,
+        SIGNAL(channelJoinedOrUnjoined(Server*,QString,bool)),
+        this,
+        SLOT(channelJoinedOrUnjoined(Server*,QString,bool)));
+    connect(Application::instance(), SIGNAL(appearanceChanged()), this, SLOT(updateSettings()));
+}
+
+WhoScheduler::~WhoScheduler()
+{
+}
+
+void WhoScheduler::serverOnline(bool online)
+{
+    m_channelRefreshed.clear();
+    m_missingHostmasks.clear();
+    m_pendingWho.clear();
+
+    if (online)
+        m_requestTimer->start();
+    else
+        m_requestTimer->stop();
+}
+
+void WhoScheduler::updateSettings()
+{
+    m_requestTimer->setInterval(60000 / qMax(1, Preferences::self()->autoWhoRequestsPerMinute()));
+}
+
+void WhoScheduler::channelMembersChanged(Server* /* server */, const QString& /* channelName */,
+    bool joined, bool parted, const QString& nickname)
+{
+    // with userhost-in-names every NAMES and JOIN line carries the hostmask
+    if (joined && !parted && !m_server->hasCapability(Server::UserhostInNames))
+        m_missingHostmasks.insert(nickname.toLower());
+}
+
+void WhoScheduler::channelJoinedOrUnjoined(Server* /* server */, const QString& channelName, bool joined)
+{
+    if (!joined)
+        m_channelRefreshed.remove(channelName.toLower());
+}
+
+void WhoScheduler::endOfWho(const QString& target)
+{
+    const QString lcTarget = target.toLower();
+
+    // A manual WHO on a channel refreshes it just as well as ours
+    if (m_server->getChannelByName(target))
+        m_channelRefreshed.insert(lcTarget, QDateTime::currentDateTime().toTime_t());
+
+    if (lcTarget == m_pendingWho)
+        m_pendingWho.clear();
+}
+
+void WhoScheduler::sendRequest()
+{
+    const uint now = QDateTime::currentDateTime().toTime_t();
+
+    if (!m_pendingWho.isEmpty())
+    {
+        // Don't stack requests while a WHO is still queued or being answered.
+        // A server that never ends it must not stall us for good, though.
+        if (now - m_pendingWhoSince < uint(Preferences::self()->autoWhoContinuousInterval()))
+            return;
+
+        m_pendingWho.clear();
+    }
+
+    if (Preferences::self()->autoWhoContinuousEnabled() && requestChannelWho(now))
+        return;
+
+    if (Preferences::self()->autoUserhost())
+        requestUserhosts();
+}
+
+/// Refresh the joined channel that went the longest without it, if it is due.
+/// Returns whether a request was sent.
+bool WhoScheduler::requestChannelWho(uint now)
+{
+    const uint interval = Preferences::self()->autoWhoContinuousInterval();
+    const int nicksLimit = Preferences::self()->autoWhoNicksLimit();
+    // With away-notify the server pushes away changes, so a nick that was
+    // covered once stays current and never needs to be asked for again.
+    const bool pushed = m_server->hasCapability(Server::AwayNotify);
+    InputFilter* inputFilter = m_server->getInputFilter();
+
+    // Looking at more than one channel per tick only happens when members
+    // shared with channels refreshed before turn out to be fresh already.
+    QSet<QString> visited;
+
+    forever
+    {
+        Channel* oldest = 0;
+        uint oldestRefresh = 0;
+
+        foreach (Channel* channel, m_server->getChannelList())
+        {
+            const QString lcName = channel->getName().toLower();
+
+            if (visited.contains(lcName) || !channel->joined() || !channel->initialNamesReceived()
+                || channel->numberOfNicks() > nicksLimit || inputFilter->isWhoRequestUnderProcess(lcName))
+                continue;
+
+            const uint refreshed = m_channelRefreshed.value(lcName);
+
+            if (now - refreshed < interval)
+                continue;
+
+            if (!oldest || refreshed < oldestRefresh)
+            {
+                oldest = channel;
+                oldestRefresh = refreshed;
+            }
+        }
+
+        if (!oldest)
+            return false;
+
+        const QString lcName = oldest->getName().toLower();
+        visited.insert(lcName);
+
+        QStringList staleNicks;
+        bool tooMany = false;
+
+        foreach (Nick* nick, oldest->getNickList())
+        {
+            NickInfoPtr nickInfo = nick->getChannelNick()->getNickInfo();
+
+            const uint timeStamp = nickInfo->getWhoTimeStamp();
+
+            if (!timeStamp || nickInfo->getHostmask().isEmpty() || (!pushed && now - timeStamp >= interval))
+            {
+                if (staleNicks.count() == MaxUserhostNicks)
+                {
+                    tooMany = true;
+                    break;
+                }
+
+                staleNicks << nickInfo->getNickname();
+            }
+        }
+
+        m_channelRefreshed.insert(lcName, now);
+
+        if (tooMany)
+        {
+            m_pendingWho = lcName;
+            m_pendingWhoSince = now;
+            m_server->requestWho(oldest->getName());
+
+            return true;
+        }
+        else if (!staleNicks.isEmpty())
+        {
+            m_server->requestUserhost(staleNicks.join(" "));
+
+            return true;
+        }
+    }
+}
+
+/// Ask for the hostmasks of nicks that joined since the last request.
+/// Returns whether a request was sent.
+bool WhoScheduler::requestUserhosts()
+{
+    if (m_server->hasCapability(Server::UserhostInNames))
+    {
+        m_missingHostmasks.clear();
+
+        return false;
+    }
+
+    QStringList nicks;
+    QSet<QString>::iterator it = m_missingHostmasks.begin();
+
+    while (it != m_missingHostmasks.end() && nicks.count() < MaxUserhostNicks)
+    {
+        NickInfoPtr nickInfo = m_server->getNickInfo(*it);
+
+        // gone again, or covered by a JOIN, WHO or USERHOST reply meanwhile
+        if (nickInfo && nickInfo->getHostmask().isEmpty())
+            nicks << nickInfo->getNickname();
+
+        it = m_missingHostmasks.erase(it);
+    }
+
+    if (nicks.isEmpty())
+        return false;
+
+    m_server->requestUserhost(nicks.join(" "));
+
+    return true;
+}
+
+#include "whoscheduler.moc"
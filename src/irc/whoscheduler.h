@@ -0,0 +1,76 @@
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+*/
+
+#ifndef WHOSCHEDULER_H
+#define WHOSCHEDULER_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+
+
+class QTimer;
+
+class Server;
+
+/**
+ * Keeps hostmasks, real names and away states of the nicks in joined channels
+ * up to date, for all channels of one Server. There is one instance of this
+ * class for each Server object.
+ *
+ * Instead of every channel polling on its own, requests are sent one at a time
+ * at the rate set by Preferences::autoWhoRequestsPerMinute(). Every nick
+ * remembers when a WHO or USERHOST reply last covered it, so members shared
+ * between channels are only asked for once: a channel whose members are all
+ * fresh is skipped, one with only a few stale members gets a USERHOST for
+ * those instead of a full WHO.
+ *
+ * With the userhost-in-names, away-notify and extended-join capabilities the
+ * server sends all of this by itself, so after one WHO per channel for the
+ * members present at join time nothing is polled anymore.
+ */
+class WhoScheduler : public QObject
+{
+    Q_OBJECT
+
+    public:
+        /// Tags our WHOX queries, so their replies can be told from manual ones.
+        static const int WhoxQueryToken = 152;
+
+        explicit WhoScheduler(Server* server);
+        ~WhoScheduler();
+
+        /// Called on RPL_ENDOFWHO, for automatic and manual requests alike.
+        void endOfWho(const QString& target);
+
+    private slots:
+        void serverOnline(bool online);
+        void updateSettings();
+        void channelMembersChanged(Server* server, const QString& channelName, bool joined, bool parted, const QString& nickname);
+        void channelJoinedOrUnjoined(Server* server, const QString& channelName, bool joined);
+        void sendRequest();
+
+    private:
+        bool requestChannelWho(uint now);
+        bool requestUserhosts();
+
+        /// A pointer to the server we are a member of.
+        Server* m_server;
+        QTimer* m_requestTimer;
+
+        /// Lowercase channel name -> when it was last covered, as time_t.
+        QHash<QString, uint> m_channelRefreshed;
+        /// Lowercase nicks seen joining without a hostmask.
+        QSet<QString> m_missingHostmasks;
+
+        /// Lowercase target of the WHO we are waiting for, if any.
+        QString m_pendingWho;
+        uint m_pendingWhoSince;
+};
+
+#endif
@@ -0,0 +1,579 @@
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+*/
+
+#include "logindex.h"
+#include "preferences.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTimer>
+#include <QtConcurrentRun>
+
+#include <KGlobal>
+#include <KLocale>
+#include <KUser>
+
+#include <algorithm>
+
+
+// how long after a log was written its new lines get indexed
+static const int ChangeDelay = 5000;
+
+// files and bytes one worker job reads before its result is merged
+static const int MaxBatchFiles = 16;
+static const qint64 MaxBatchSize = Q_INT64_C(4) * 1024 * 1024;
+
+namespace
+{
+    struct ScanJob
+    {
+        QVector<int> files;
+        QStringList paths;
+        QVector<qint64> starts;
+    };
+
+    /// Lower case words of text, as used for the postings.
+    QStringList words(const QString& text)
+    {
+        QStringList result;
+        const int length = text.length();
+        int start = -1;
+
+        for (int i = 0; i <= length; ++i)
+        {
+            if (i < length && text.at(i).isLetterOrNumber())
+            {
+                if (start < 0)
+                    start = i;
+            }
+            else if (start >= 0)
+            {
+                result.append(text.mid(start, i - start).toLower());
+                start = -1;
+            }
+        }
+
+        return result;
+    }
+
+    /// The nick of a message as written by IRCView, or an empty string.
+    QString nickOf(const QString& text)
+    {
+        if (text.startsWith(QLatin1String("<-> ")))
+            return text.mid(4, text.indexOf(QLatin1String(">\t")) - 4);
+
+        if (text.startsWith('<'))
+        {
+            const int end = text.indexOf(QLatin1String(">\t"));
+
+            return (end > 0) ? text.mid(1, end - 1) : QString();
+        }
+
+        if (text.startsWith(QLatin1String("\t * ")))
+            return text.mid(4).section(' ', 0, 0);
+
+        return QString();
+    }
+
+    /// Split a line written by ChatWindow::logText() into date and text.
+    bool splitLine(const QString& line, QString& date, QString& text)
+    {
+        if (!line.startsWith('['))
+            return false;
+
+        const int dateEnd = line.indexOf(QLatin1String("] ["));
+
+        if (dateEnd < 0)
+            return false;
+
+        const int timeEnd = line.indexOf(QLatin1String("] "), dateEnd + 3);
+
+        if (timeEnd < 0)
+            return false;
+
+        date = line.mid(1, dateEnd - 1);
+        text = line.mid(timeEnd + 2);
+
+        return true;
+    }
+
+    void scanFile(int file, const QString& path, qint64 start, LogScanResult& result,
+        QHash<QString, int>& nickIds, QHash<QString, int>& dateIds)
+    {
+        QFile log(path);
+
+        if (!log.open(QIODevice::ReadOnly) || !log.seek(start))
+            return;
+
+        qint64 offset = start;
+
+        while (!log.atEnd())
+        {
+            const QByteArray raw = log.readLine();
+
+            // still being written, picked up with the next change
+            if (!raw.endsWith('\n'))
+                break;
+
+            const qint64 lineOffset = offset;
+            offset += raw.size();
+
+            QString date;
+            QString text;
+
+            if (!splitLine(QString::fromUtf8(raw.constData(), raw.size() - 1), date, text))
+                continue;
+
+            LogIndexLine line;
+            line.offset = lineOffset;
+            line.file = file;
+
+            const QString nick = nickOf(text);
+
+            if (nick.isEmpty())
+                line.nick = -1;
+            else
+            {
+                QHash<QString, int>::const_iterator it = nickIds.constFind(nick);
+
+                if (it == nickIds.constEnd())
+                {
+                    it = nickIds.insert(nick, result.nicks.count());
+                    result.nicks.append(nick);
+                }
+
+                line.nick = it.value();
+            }
+
+            // dates are resolved when merging, KLocale is not thread-safe
+            QHash<QString, int>::const_iterator it = dateIds.constFind(date);
+
+            if (it == dateIds.constEnd())
+            {
+                it = dateIds.insert(date, result.dates.count());
+                result.dates.append(date);
+            }
+
+            line.day = it.value();
+
+            const int index = result.lines.count();
+            result.lines.append(line);
+
+            foreach (const QString& word, words(text))
+            {
+                QVector<int>& posting = result.postings[word];
+
+                if (posting.isEmpty() || posting.last() != index)
+                    posting.append(index);
+            }
+        }
+
+        result.sizes.insert(file, offset);
+    }
+
+    LogScanResult runScanJob(const ScanJob& job)
+    {
+        LogScanResult result;
+        QHash<QString, int> nickIds;
+        QHash<QString, int> dateIds;
+
+        for (int i = 0; i < job.files.count(); ++i)
+            scanFile(job.files.at(i), job.paths.at(i), job.starts.at(i), result, nickIds, dateIds);
+
+        return result;
+    }
+
+    class HitNewerThan
+    {
+        public:
+            explicit HitNewerThan(const QVector<LogIndexLine>& lines) : m_lines(lines) {}
+
+            bool operator()(int left, int right) const
+            {
+                const int leftDay = m_lines.at(left).day;
+                const int rightDay = m_lines.at(right).day;
+
+                if (leftDay != rightDay)
+                    return leftDay > rightDay;
+
+                return left > right;
+            }
+
+        private:
+            const QVector<LogIndexLine>& m_lines;
+    };
+}
+
+LogIndex::LogIndex(QObject* parent) : QObject(parent)
+{
+    m_started = false;
+
+    m_changeTimer = new QTimer(this);
+    m_changeTimer->setSingleShot(true);
+    m_changeTimer->setInterval(ChangeDelay);
+    connect(m_changeTimer, SIGNAL(timeout()), this, SLOT(updateChangedLogs()));
+
+    connect(&m_scanWatcher, SIGNAL(finished()), this, SLOT(scanFinished()));
+}
+
+LogIndex::~LogIndex()
+{
+    m_scanWatcher.waitForFinished();
+}
+
+QString LogIndex::logPath()
+{
+    return Preferences::self()->logfilePath().pathOrUrl().replace("$HOME", KUser(KUser::UseRealUserID).homeDir());
+}
+
+QString LogIndex::logTarget(const QString& fileName)
+{
+    return QFileInfo(fileName).completeBaseName();
+}
+
+void LogIndex::update()
+{
+    m_started = true;
+
+    QDir logDir(logPath());
+    const QStringList logs = logDir.entryList(QStringList() << "*.log", QDir::Files);
+
+    foreach (const QString& log, logs)
+    {
+        const QString path = logDir.filePath(log);
+        const int id = m_fileIds.value(path, -1);
+
+        if (id < 0 || QFileInfo(path).size() != m_indexedSizes.at(id))
+            queueFile(path);
+    }
+
+    startScan();
+}
+
+bool LogIndex::isUpdating() const
+{
+    return m_scanWatcher.isRunning() || !m_queue.isEmpty();
+}
+
+void LogIndex::logChanged(const QString& fileName)
+{
+    // nobody searched yet, the first search indexes everything anyway
+    if (!m_started)
+        return;
+
+    m_changedLogs.insert(fileName);
+
+    if (!m_changeTimer->isActive())
+        m_changeTimer->start();
+}
+
+void LogIndex::updateChangedLogs()
+{
+    foreach (const QString& fileName, m_changedLogs)
+        queueFile(fileName);
+
+    m_changedLogs.clear();
+
+    startScan();
+}
+
+int LogIndex::fileId(const QString& fileName)
+{
+    QHash<QString, int>::const_iterator it = m_fileIds.constFind(fileName);
+
+    if (it != m_fileIds.constEnd())
+        return it.value();
+
+    const int id = m_files.count();
+
+    m_files.append(fileName);
+    m_fileIds.insert(fileName, id);
+    m_indexedSizes.append(0);
+
+    return id;
+}
+
+void LogIndex::queueFile(const QString& fileName)
+{
+    if (!m_queue.contains(fileName))
+        m_queue.append(fileName);
+}
+
+void LogIndex::startScan()
+{
+    if (m_scanWatcher.isRunning() || m_queue.isEmpty())
+        return;
+
+    ScanJob job;
+    qint64 batchSize = 0;
+
+    while (!m_queue.isEmpty() && job.files.count() < MaxBatchFiles && batchSize < MaxBatchSize)
+    {
+        const QString path = m_queue.takeFirst();
+        const qint64 size = QFileInfo(path).size();
+        int id = fileId(path);
+
+        // Cleared or replaced, its lines are dropped from searches and it
+        // is indexed again under a new id
+        if (size < m_indexedSizes.at(id))
+        {
+            m_files[id].clear();
+            m_fileIds.remove(path);
+            id = fileId(path);
+        }
+
+        const qint64 start = m_indexedSizes.at(id);
+
+        if (size == start)
+            continue;
+
+        job.files.append(id);
+        job.paths.append(path);
+        job.starts.append(start);
+
+        batchSize += size - start;
+    }
+
+    if (job.files.isEmpty())
+    {
+        emit updated();
+
+        return;
+    }
+
+    m_scanWatcher.setFuture(QtConcurrent::run(runScanJob, job));
+}
+
+void LogIndex::scanFinished()
+{
+    const LogScanResult result = m_scanWatcher.result();
+    const int first = m_lines.count();
+
+    QVector<int> nickIds(result.nicks.count());
+
+    for (int i = 0; i < result.nicks.count(); ++i)
+    {
+        const QString& nick = result.nicks.at(i);
+        QHash<QString, int>::const_iterator it = m_nickIds.constFind(nick);
+
+        if (it == m_nickIds.constEnd())
+        {
+            it = m_nickIds.insert(nick, m_nicks.count());
+            m_nicks.append(nick);
+        }
+
+        nickIds[i] = it.value();
+    }
+
+    QVector<int> days(result.dates.count());
+
+    for (int i = 0; i < result.dates.count(); ++i)
+    {
+        const QString& date = result.dates.at(i);
+        QHash<QString, int>::const_iterator it = m_days.constFind(date);
+
+        if (it == m_days.constEnd())
+        {
+            const QDate parsed = KGlobal::locale()->readDate(date);
+            it = m_days.insert(date, parsed.isValid() ? parsed.toJulianDay() : 0);
+        }
+
+        days[i] = it.value();
+    }
+
+    m_lines.reserve(first + result.lines.count());
+
+    foreach (LogIndexLine line, result.lines)
+    {
+        if (line.nick >= 0)
+            line.nick = nickIds.at(line.nick);
+
+        line.day = days.at(line.day);
+        m_lines.append(line);
+    }
+
+    // new lines come after all indexed ones, so the postings stay sorted
+    QHash<QString, QVector<int> >::const_iterator it;
+
+    for (it = result.postings.constBegin(); it != result.postings.constEnd(); ++it)
+    {
+        QVector<int>& posting = m_postings[it.key()];
+        posting.reserve(posting.count() + it.value().count());
+
+        foreach (int index, it.value())
+            posting.append(first + index);
+    }
+
+    QHash<int, qint64>::const_iterator size;
+
+    for (size = result.sizes.constBegin(); size != result.sizes.constEnd(); ++size)
+        m_indexedSizes[size.key()] = size.value();
+
+    emit updated();
+
+    startScan();
+}
+
+/// Lines containing all words, or all lines if there are none.
+QList<int> LogIndex::lineCandidates(const QStringList& words) const
+{
+    QList<int> result;
+
+    if (words.isEmpty())
+    {
+        result.reserve(m_lines.count());
+
+        for (int i = 0; i < m_lines.count(); ++i)
+            result.append(i);
+
+        return result;
+    }
+
+    // Intersect starting with the rarest word, the candidates only shrink
+    QList<const QVector<int>*> postings;
+
+    foreach (const QString& word, words)
+    {
+        QHash<QString, QVector<int> >::const_iterator it = m_postings.constFind(word);
+
+        if (it == m_postings.constEnd())
+            return result;
+
+        int i = 0;
+
+        while (i < postings.count() && postings.at(i)->count() < it.value().count())
+            ++i;
+
+        postings.insert(i, &it.value());
+    }
+
+    QVector<int> candidates = *postings.first();
+
+    for (int i = 1; i < postings.count() && !candidates.isEmpty(); ++i)
+    {
+        const QVector<int>& posting = *postings.at(i);
+        QVector<int> matches;
+        QVector<int>::const_iterator next = posting.constBegin();
+
+        foreach (int index, candidates)
+        {
+            next = qLowerBound(next, posting.constEnd(), index);
+
+            if (next == posting.constEnd())
+                break;
+
+            if (*next == index)
+                matches.append(index);
+        }
+
+        candidates = matches;
+    }
+
+    return candidates.toList();
+}
+
+QList<LogSearchHit> LogIndex::search(const LogSearchQuery& query, int maxHits) const
+{
+    QList<LogSearchHit> hits;
+
+    QStringList queryWords = words(query.text);
+    queryWords.removeDuplicates();
+
+    // the filters match few nicks and files, look them up once
+    QSet<int> nicks;
+
+    if (!query.nick.isEmpty())
+    {
+        for (int i = 0; i < m_nicks.count(); ++i)
+        {
+            if (m_nicks.at(i).contains(query.nick, Qt::CaseInsensitive))
+                nicks.insert(i);
+        }
+
+        if (nicks.isEmpty())
+            return hits;
+    }
+
+    QVector<bool> files(m_files.count());
+
+    for (int i = 0; i < m_files.count(); ++i)
+    {
+        files[i] = !m_files.at(i).isEmpty()
+            && (query.target.isEmpty() || logTarget(m_files.at(i)).contains(query.target, Qt::CaseInsensitive));
+    }
+
+    const int from = query.from.isValid() ? query.from.toJulianDay() : 0;
+    const int to = query.to.isValid() ? query.to.toJulianDay() : 0;
+
+    QVector<int> matches;
+
+    foreach (int index, lineCandidates(queryWords))
+    {
+        const LogIndexLine& line = m_lines.at(index);
+
+        if (!files.at(line.file))
+            continue;
+
+        if (!nicks.isEmpty() && !nicks.contains(line.nick))
+            continue;
+
+        if ((from && line.day < from) || (to && line.day > to))
+            continue;
+
+        matches.append(index);
+    }
+
+    const int count = qMin(maxHits, matches.count());
+    std::partial_sort(matches.begin(), matches.begin() + count, matches.end(), HitNewerThan(m_lines));
+
+    // Read the hit lines back, keeping the files open for other hits in them
+    QHash<int, QFile*> openFiles;
+
+    for (int i = 0; i < count; ++i)
+    {
+        const LogIndexLine& line = m_lines.at(matches.at(i));
+        QFile* file = openFiles.value(line.file);
+
+        if (!file)
+        {
+            file = new QFile(m_files.at(line.file));
+            file->open(QIODevice::ReadOnly);
+            openFiles.insert(line.file, file);
+        }
+
+        if (!file->isOpen() || !file->seek(line.offset))
+            continue;
+
+        QString date;
+        QString text;
+
+        if (!splitLine(QString::fromUtf8(file->readLine()).trimmed(), date, text))
+            continue;
+
+        LogSearchHit hit;
+        hit.fileName = file->fileName();
+        hit.target = logTarget(hit.fileName);
+        hit.offset = line.offset;
+
+        if (line.day)
+            hit.date = QDate::fromJulianDay(line.day);
+
+        if (line.nick >= 0)
+            hit.nick = m_nicks.at(line.nick);
+
+        hit.line = text;
+
+        hits.append(hit);
+    }
+
+    qDeleteAll(openFiles);
+
+    return hits;
+}
+
+#include "logindex.moc"
@@ -0,0 +1,127 @@
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+*/
+
+#ifndef LOGINDEX_H
+#define LOGINDEX_H
+
+#include <QObject>
+#include <QDate>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+
+
+class QTimer;
+
+struct LogIndexLine
+{
+    qint64 offset; ///< of the line in its file
+    qint32 file;
+    qint32 nick; ///< -1 if the line has no nick
+    qint32 day; ///< Julian day, 0 if unknown
+};
+
+/// What a worker found in a batch of log files, with its own nick and date
+/// tables that get mapped onto the index's when merging.
+struct LogScanResult
+{
+    QVector<LogIndexLine> lines;
+    QHash<QString, QVector<int> > postings;
+    QStringList nicks;
+    QStringList dates;
+    /// file -> how far it has been indexed
+    QHash<int, qint64> sizes;
+};
+
+struct LogSearchQuery
+{
+    QString text;
+    QString target; ///< part of the log file name
+    QString nick;
+    QDate from;
+    QDate to;
+};
+
+struct LogSearchHit
+{
+    QString fileName;
+    QString target;
+    qint64 offset;
+    QDate date;
+    QString nick;
+    QString line;
+};
+
+/**
+ * Inverted index over the words of all log files written by
+ * ChatWindow::logText(), for searching all logs at once.
+ *
+ * It is built on a worker thread the first time it is used and kept up to
+ * date afterwards by indexing only what got appended to a log. Logs are read
+ * in batches so each merge into the index is short.
+ */
+class LogIndex : public QObject
+{
+    Q_OBJECT
+
+    public:
+        explicit LogIndex(QObject* parent = 0);
+        ~LogIndex();
+
+        /// The directory logs are written to.
+        static QString logPath();
+        /// The channel or query a log is for, as in "server_#channel".
+        static QString logTarget(const QString& fileName);
+
+        /// Index whatever changed in the log directory.
+        void update();
+        bool isUpdating() const;
+
+        /// A log was appended to, it gets indexed shortly if the index is in use.
+        void logChanged(const QString& fileName);
+
+        /// The newest lines matching all words and filters of query.
+        QList<LogSearchHit> search(const LogSearchQuery& query, int maxHits = 500) const;
+
+        int lineCount() const { return m_lines.count(); }
+
+    signals:
+        /// Emitted after each merged batch and when indexing finished.
+        void updated();
+
+    private slots:
+        void scanFinished();
+        void updateChangedLogs();
+
+    private:
+        int fileId(const QString& fileName);
+        void queueFile(const QString& fileName);
+        void startScan();
+        QList<int> lineCandidates(const QStringList& words) const;
+
+        QStringList m_files; ///< file id -> path, empty for replaced ids
+        QHash<QString, int> m_fileIds;
+        QVector<qint64> m_indexedSizes;
+
+        QStringList m_nicks;
+        QHash<QString, int> m_nickIds;
+        QHash<QString, int> m_days;
+
+        QVector<LogIndexLine> m_lines;
+        /// word -> ascending indexes into m_lines
+        QHash<QString, QVector<int> > m_postings;
+
+        bool m_started;
+        QStringList m_queue;
+        QSet<QString> m_changedLogs;
+        QTimer* m_changeTimer;
+        QFutureWatcher<LogScanResult> m_scanWatcher;
+};
+
+#endif
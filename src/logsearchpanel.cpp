@@ -0,0 +1,176 @@
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+*/
+
+#include "logsearchpanel.h"
+#include "application.h"
+#include "logindex.h"
+#include "mainwindow.h"
+#include "viewcontainer.h"
+
+#include <QCheckBox>
+#include <QDateEdit>
+#include <QHeaderView>
+#include <QLabel>
+#include <QPushButton>
+#include <QTreeWidget>
+
+#include <KDialog>
+#include <KHBox>
+#include <KLineEdit>
+#include <KLocale>
+
+
+// the newest hits shown, enough to narrow the search down from
+static const int MaxHits = 500;
+
+enum HitRoles
+{
+    FileNameRole = Qt::UserRole + 1,
+    OffsetRole
+};
+
+LogSearchPanel::LogSearchPanel(QWidget* parent) : ChatWindow(parent)
+{
+    setName(i18n("Log Search"));
+    setType(ChatWindow::LogSearch);
+
+    setSpacing(0);
+
+    m_logIndex = Application::instance()->getLogIndex();
+    m_searched = false;
+
+    KHBox* queryBox = new KHBox(this);
+    queryBox->setSpacing(KDialog::spacingHint());
+
+    new QLabel(i18n("Search for:"), queryBox);
+    m_queryEdit = new KLineEdit(queryBox);
+    m_queryEdit->setClearButtonShown(true);
+    m_queryEdit->setWhatsThis(i18n("Lines containing all of these words are shown, newest first."));
+    connect(m_queryEdit, SIGNAL(returnPressed()), this, SLOT(search()));
+
+    QPushButton* searchButton = new QPushButton(KIcon("edit-find"), i18n("Search"), queryBox);
+    connect(searchButton, SIGNAL(clicked()), this, SLOT(search()));
+
+    KHBox* filterBox = new KHBox(this);
+    filterBox->setSpacing(KDialog::spacingHint());
+
+    new QLabel(i18n("Channel:"), filterBox);
+    m_targetEdit = new KLineEdit(filterBox);
+    m_targetEdit->setClearButtonShown(true);
+    connect(m_targetEdit, SIGNAL(returnPressed()), this, SLOT(search()));
+
+    new QLabel(i18n("Nick:"), filterBox);
+    m_nickEdit = new KLineEdit(filterBox);
+    m_nickEdit->setClearButtonShown(true);
+    connect(m_nickEdit, SIGNAL(returnPressed()), this, SLOT(search()));
+
+    m_fromCheck = new QCheckBox(i18n("From:"), filterBox);
+    m_fromEdit = new QDateEdit(QDate::currentDate().addMonths(-1), filterBox);
+    m_fromEdit->setCalendarPopup(true);
+    connect(m_fromCheck, SIGNAL(toggled(bool)), this, SLOT(updateDateFilters()));
+
+    m_toCheck = new QCheckBox(i18n("To:"), filterBox);
+    m_toEdit = new QDateEdit(QDate::currentDate(), filterBox);
+    m_toEdit->setCalendarPopup(true);
+    connect(m_toCheck, SIGNAL(toggled(bool)), this, SLOT(updateDateFilters()));
+
+    updateDateFilters();
+
+    m_hitTree = new QTreeWidget(this);
+    m_hitTree->setHeaderLabels(QStringList() << i18n("Date") << i18n("Channel") << i18n("Nick") << i18n("Line"));
+    m_hitTree->setRootIsDecorated(false);
+    m_hitTree->setAllColumnsShowFocus(true);
+    m_hitTree->setUniformRowHeights(true);
+    m_hitTree->header()->setMovable(false);
+    m_hitTree->setWhatsThis(i18n("Double-click a line to open its log file there."));
+    connect(m_hitTree, SIGNAL(itemActivated(QTreeWidgetItem*,int)), this, SLOT(openHit(QTreeWidgetItem*)));
+
+    m_statusLabel = new QLabel(this);
+
+    connect(m_logIndex, SIGNAL(updated()), this, SLOT(indexUpdated()));
+
+    // only indexes what changed since the panel was last open
+    m_logIndex->update();
+    indexUpdated();
+}
+
+LogSearchPanel::~LogSearchPanel()
+{
+}
+
+void LogSearchPanel::childAdjustFocus()
+{
+    m_queryEdit->setFocus();
+}
+
+void LogSearchPanel::updateDateFilters()
+{
+    m_fromEdit->setEnabled(m_fromCheck->isChecked());
+    m_toEdit->setEnabled(m_toCheck->isChecked());
+}
+
+void LogSearchPanel::indexUpdated()
+{
+    if (m_logIndex->isUpdating())
+        m_statusLabel->setText(i18np("Indexing log files, 1 line so far...",
+            "Indexing log files, %1 lines so far...", m_logIndex->lineCount()));
+    else
+        m_statusLabel->setText(i18np("1 line indexed.", "%1 lines indexed.", m_logIndex->lineCount()));
+
+    // show what the new lines add to the last search
+    if (m_searched)
+        search();
+}
+
+void LogSearchPanel::search()
+{
+    LogSearchQuery query;
+    query.text = m_queryEdit->text();
+    query.target = m_targetEdit->text();
+    query.nick = m_nickEdit->text();
+
+    if (m_fromCheck->isChecked())
+        query.from = m_fromEdit->date();
+
+    if (m_toCheck->isChecked())
+        query.to = m_toEdit->date();
+
+    const QList<LogSearchHit> hits = m_logIndex->search(query, MaxHits);
+
+    m_searched = true;
+
+    m_hitTree->setUpdatesEnabled(false);
+    m_hitTree->clear();
+
+    QList<QTreeWidgetItem*> items;
+
+    foreach (const LogSearchHit& hit, hits)
+    {
+        QTreeWidgetItem* item = new QTreeWidgetItem();
+        item->setText(0, KGlobal::locale()->formatDate(hit.date, KLocale::ShortDate));
+        item->setText(1, hit.target);
+        item->setText(2, hit.nick);
+        item->setText(3, hit.line.simplified());
+        item->setData(0, FileNameRole, hit.fileName);
+        item->setData(0, OffsetRole, hit.offset);
+
+        items.append(item);
+    }
+
+    m_hitTree->addTopLevelItems(items);
+    m_hitTree->setUpdatesEnabled(true);
+}
+
+void LogSearchPanel::openHit(QTreeWidgetItem* item)
+{
+    ViewContainer* viewContainer = Application::instance()->getMainWindow()->getViewContainer();
+
+    viewContainer->openLogFile(item->text(1), item->data(0, FileNameRole).toString(),
+        item->data(0, OffsetRole).toLongLong());
+}
+
+#include "logsearchpanel.moc"
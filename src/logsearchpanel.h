@@ -0,0 +1,60 @@
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+*/
+
+#ifndef LOGSEARCHPANEL_H
+#define LOGSEARCHPANEL_H
+
+#include "chatwindow.h"
+
+
+class QCheckBox;
+class QDateEdit;
+class QLabel;
+class QTreeWidget;
+class QTreeWidgetItem;
+
+class KLineEdit;
+
+class LogIndex;
+
+/// Searches all log files at once through the LogIndex and opens a log at
+/// the position of a hit.
+class LogSearchPanel : public ChatWindow
+{
+    Q_OBJECT
+
+    public:
+        explicit LogSearchPanel(QWidget* parent);
+        ~LogSearchPanel();
+
+
+    protected:
+        void childAdjustFocus();
+
+
+    private slots:
+        void search();
+        void indexUpdated();
+        void openHit(QTreeWidgetItem* item);
+        void updateDateFilters();
+
+    private:
+        LogIndex* m_logIndex;
+        bool m_searched;
+
+        KLineEdit* m_queryEdit;
+        KLineEdit* m_targetEdit;
+        KLineEdit* m_nickEdit;
+        QCheckBox* m_fromCheck;
+        QDateEdit* m_fromEdit;
+        QCheckBox* m_toCheck;
+        QDateEdit* m_toEdit;
+        QLabel* m_statusLabel;
+        QTreeWidget* m_hitTree;
+};
+
+#endif
@@ -218,6 +218,14 @@ MainWindow::MainWindow() : KXmlGuiWindow(0)
     connect(action, SIGNAL(triggered()), m_viewContainer, SLOT(addUrlCatcher()));
     actionCollection()->addAction("open_url_catcher", action);
 
+    action=new KToggleAction(this);
+    action->setText(i18n("&Search Logfiles"));
+    action->setIcon(KIcon("edit-find"));
+    action->setShortcut(KShortcut("Ctrl+Shift+O"));
+    action->setHelpText(i18n("Search all logfiles in a new tab"));
+    connect(action, SIGNAL(triggered()), m_viewContainer, SLOT(addLogSearch()));
+    actionCollection()->addAction("open_log_search", action);
+
     if (KAuthorized::authorizeKAction("shell_access"))
     {
         action=new KAction(this);
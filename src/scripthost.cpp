@@ -0,0 +1,183 @@
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+*/
+
+#include "scripthost.h"
+
+#include <QCoreApplication>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QtEndian>
+
+#include <KDebug>
+#include <KProcess>
+
+
+ScriptHost::ScriptHost(const QStringList& command, QObject* parent) : QObject(parent)
+{
+    m_command = command;
+
+    m_server = 0;
+    m_socket = 0;
+    m_process = 0;
+}
+
+ScriptHost::~ScriptHost()
+{
+    // the host exits once its socket is closed
+    if (m_socket)
+        m_socket->disconnectFromServer();
+
+    if (m_process)
+    {
+        m_process->disconnect(this);
+        m_process->waitForFinished(1000);
+    }
+}
+
+bool ScriptHost::run(int connectionId, const QString& target, const QString& path, const QStringList& arguments)
+{
+    if (!m_process && !start())
+        return false;
+
+    sendFrame(QStringList() << "run" << QString::number(connectionId) << target << path << arguments);
+
+    return true;
+}
+
+bool ScriptHost::start()
+{
+    static int hostCount = 0;
+
+    if (!m_server)
+    {
+        m_server = new QLocalServer(this);
+        connect(m_server, SIGNAL(newConnection()), this, SLOT(hostConnected()));
+
+        const QString name = QString("konversation-scripthost-%1-%2")
+            .arg(QCoreApplication::applicationPid()).arg(++hostCount);
+
+        // a crashed instance with our pid might have left it behind
+        QLocalServer::removeServer(name);
+
+        if (!m_server->listen(name))
+        {
+            kDebug() << "cannot listen for the script host:" << m_server->errorString();
+            delete m_server;
+            m_server = 0;
+
+            return false;
+        }
+    }
+
+    m_process = new KProcess(this);
+    m_process->setOutputChannelMode(KProcess::ForwardedChannels);
+    m_process->setProgram(m_command.first(), m_command.mid(1) << m_server->fullServerName());
+    connect(m_process, SIGNAL(finished(int,QProcess::ExitStatus)), this, SLOT(hostFinished()));
+
+    m_process->start();
+
+    if (!m_process->waitForStarted())
+    {
+        kDebug() << "cannot start the script host" << m_command;
+        delete m_process;
+        m_process = 0;
+
+        return false;
+    }
+
+    return true;
+}
+
+void ScriptHost::hostConnected()
+{
+    QLocalSocket* socket = m_server->nextPendingConnection();
+
+    if (m_socket)
+    {
+        // only the host we started may talk to us
+        delete socket;
+
+        return;
+    }
+
+    m_socket = socket;
+    connect(m_socket, SIGNAL(readyRead()), this, SLOT(readFrames()));
+
+    foreach (const QStringList& fields, m_queue)
+        sendFrame(fields);
+
+    m_queue.clear();
+}
+
+void ScriptHost::sendFrame(const QStringList& fields)
+{
+    if (!m_socket)
+    {
+        m_queue << fields;
+
+        return;
+    }
+
+    const QByteArray payload = fields.join(QString(QChar(0))).toUtf8();
+    QByteArray frame(4, 0);
+
+    qToBigEndian<quint32>(payload.size(), reinterpret_cast<uchar*>(frame.data()));
+    frame += payload;
+
+    m_socket->write(frame);
+}
+
+void ScriptHost::readFrames()
+{
+    m_buffer += m_socket->readAll();
+
+    int offset = 0;
+
+    // The calls of a whole script run usually arrive in one read
+    while (m_buffer.size() - offset >= 4)
+    {
+        const quint32 length = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(m_buffer.constData() + offset));
+
+        if (quint32(m_buffer.size() - offset - 4) < length)
+            break;
+
+        const QString payload = QString::fromUtf8(m_buffer.constData() + offset + 4, length);
+        offset += 4 + length;
+
+        emit commandReceived(payload.split(QChar(0)));
+    }
+
+    m_buffer.remove(0, offset);
+}
+
+void ScriptHost::hostFinished()
+{
+    // Scripts the host had been sent are lost, it may have run them partly.
+    // The queued ones it never saw, e.g. as it failed to import, and they
+    // can still be run another way.
+    if (m_socket)
+    {
+        m_socket->deleteLater();
+        m_socket = 0;
+    }
+    else
+    {
+        foreach (const QStringList& fields, m_queue)
+        {
+            if (fields.count() >= 4 && fields.first() == "run")
+                emit runFailed(fields.at(1).toInt(), fields.at(2), fields.at(3), fields.mid(4));
+        }
+    }
+
+    m_process->deleteLater();
+    m_process = 0;
+
+    m_queue.clear();
+    m_buffer.clear();
+}
+
+#include "scripthost.moc"
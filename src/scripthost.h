@@ -0,0 +1,72 @@
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+*/
+
+#ifndef SCRIPTHOST_H
+#define SCRIPTHOST_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QList>
+#include <QStringList>
+
+
+class QLocalServer;
+class QLocalSocket;
+
+class KProcess;
+
+/**
+ * A long-lived process that runs scripts for one interpreter, so launching a
+ * script costs a message instead of a fork/exec and its calls back into
+ * Konversation arrive over a local socket instead of one D-Bus call each.
+ *
+ * Messages in both directions are frames: a 32-bit big-endian payload length
+ * followed by UTF-8 fields separated by NUL characters, the first one naming
+ * the frame type. The host process is started on first use and again after
+ * it exited.
+ */
+class ScriptHost : public QObject
+{
+    Q_OBJECT
+
+    public:
+        /// @param command The program and arguments starting the host; the
+        ///                socket name is appended.
+        explicit ScriptHost(const QStringList& command, QObject* parent = 0);
+        ~ScriptHost();
+
+        /// Returns false if the host could not be started.
+        bool run(int connectionId, const QString& target, const QString& path, const QStringList& arguments);
+
+    signals:
+        /// A frame sent by the host, split into its fields.
+        void commandReceived(const QStringList& fields);
+        /// The host exited before it connected, so a script passed to run() never ran.
+        void runFailed(int connectionId, const QString& target, const QString& path, const QStringList& arguments);
+
+    private slots:
+        void hostConnected();
+        void readFrames();
+        void hostFinished();
+
+    private:
+        bool start();
+        void sendFrame(const QStringList& fields);
+
+        QStringList m_command;
+
+        QLocalServer* m_server;
+        QLocalSocket* m_socket;
+        KProcess* m_process;
+
+        /// Frames written before the host connected, split into their fields.
+        QList<QStringList> m_queue;
+        /// Received data not making up a complete frame yet.
+        QByteArray m_buffer;
+};
+
+#endif
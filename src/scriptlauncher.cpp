@@ -11,10 +11,14 @@
 */
 
 #include "scriptlauncher.h"
+#include "scripthost.h"
 #include "channel.h"
 #include "application.h"
 #include "server.h"
+#include "common.h"
+#include "preferences.h"
 
+#include <QFile>
 #include <QFileInfo>
 
 #include <KProcess>
@@ -49,19 +53,33 @@ void ScriptLauncher::launchScript(int connectionId, const QString& target, const
     QString script(parameterList.takeFirst());
     QString path = scriptPath(script);
 
-    parameterList.prepend(target);
-    parameterList.prepend(QString::number(connectionId));
+    QFileInfo fileInfo(path);
 
+    if (Preferences::self()->scriptHostEnabled() && fileInfo.exists())
+    {
+        ScriptHost* host = scriptHost(path);
+
+        if (host && host->run(connectionId, target, path, parameterList))
+            return;
+    }
+
+    launchDetached(connectionId, target, script, path, parameterList);
+}
+
+void ScriptLauncher::launchDetached(int connectionId, const QString& target, const QString& script,
+    const QString& path, const QStringList& arguments)
+{
     QFileInfo fileInfo(path);
 
+    QStringList parameterList(arguments);
+    parameterList.prepend(target);
+    parameterList.prepend(QString::number(connectionId));
+
+    // PYTHONPATH was set up in the constructor and is inherited
     KProcess proc;
     proc.setWorkingDirectory(fileInfo.path());
     proc.setProgram(path, parameterList);
 
-    QStringList pythonPath = QProcessEnvironment::systemEnvironment().value("PYTHONPATH").split(':', QString::SkipEmptyParts);
-    pythonPath << KGlobal::dirs()->findDirs("data", "konversation/scripting_support/python");
-    proc.setEnv("PYTHONPATH", pythonPath.join(":"));
-
     if (proc.startDetached() == 0)
     {
         if (!fileInfo.exists())
@@ -71,4 +89,79 @@ void ScriptLauncher::launchScript(int connectionId, const QString& target, const
     }
 }
 
+/// Returns the host for the interpreter of the script at path, or 0 if
+/// scripts in its language can't be hosted.
+ScriptHost* ScriptLauncher::scriptHost(const QString& path)
+{
+    if (!m_interpreters.contains(path))
+    {
+        QStringList interpreter;
+        QFile file(path);
+
+        if (file.open(QIODevice::ReadOnly))
+        {
+            const QString firstLine = QString::fromLocal8Bit(file.readLine(256)).trimmed();
+
+            if (firstLine.startsWith(QLatin1String("#!")))
+                interpreter = firstLine.mid(2).split(' ', QString::SkipEmptyParts);
+        }
+
+        m_interpreters.insert(path, interpreter);
+    }
+
+    const QStringList interpreter = m_interpreters.value(path);
+
+    // Only Python has a host so far, see konversation/host.py
+    if (interpreter.isEmpty() || !interpreter.last().section('/', -1).startsWith(QLatin1String("python")))
+        return 0;
+
+    const QString key = interpreter.join(" ");
+    ScriptHost* host = m_hosts.value(key);
+
+    if (!host)
+    {
+        host = new ScriptHost(QStringList(interpreter) << "-m" << "konversation.host", this);
+        connect(host, SIGNAL(commandReceived(QStringList)), this, SLOT(hostCommand(QStringList)));
+        connect(host, SIGNAL(runFailed(int,QString,QString,QStringList)),
+            this, SLOT(hostRunFailed(int,QString,QString,QStringList)));
+        m_hosts.insert(key, host);
+    }
+
+    return host;
+}
+
+void ScriptLauncher::hostCommand(const QStringList& fields)
+{
+    const QString& type = fields.first();
+
+    // Same checks as the D-Bus calls the scripts would make otherwise
+    if (type == "say" && fields.count() == 4)
+    {
+        QString target(Konversation::sterilizeUnicode(fields.at(2)));
+        QString command(Konversation::sterilizeUnicode(fields.at(3)));
+
+        if (fields.at(1).isEmpty() || target.isEmpty() || command.isEmpty())
+            return;
+
+        command.replace('\n',"\\n");
+        command.replace('\r',"\\r");
+        target.remove('\n');
+        target.remove('\r');
+
+        emit scriptSay(fields.at(1), target, command);
+    }
+    else if (type == "info" && fields.count() == 2)
+        emit scriptInfo(Konversation::sterilizeUnicode(fields.at(1)));
+    else if (type == "error" && fields.count() == 2)
+        emit scriptInfo(i18n("Error: %1", Konversation::sterilizeUnicode(fields.at(1))));
+    else
+        kDebug() << "unknown script host command" << fields;
+}
+
+void ScriptLauncher::hostRunFailed(int connectionId, const QString& target, const QString& path, const QStringList& arguments)
+{
+    // the host could not start up, run the script on its own as without one
+    launchDetached(connectionId, target, QFileInfo(path).fileName(), path, arguments);
+}
+
 #include "scriptlauncher.moc"
@@ -11,11 +11,14 @@
 */
 
 #include <QObject>
+#include <QHash>
+#include <QStringList>
 
 #ifndef SCRIPTLAUNCHER_H
 #define SCRIPTLAUNCHER_H
 
 
+class ScriptHost;
 
 class ScriptLauncher : public QObject
 {
@@ -31,7 +34,25 @@ class ScriptLauncher : public QObject
         void scriptNotFound(const QString& name);
         void scriptExecutionError(const QString& name);
 
+        /// Calls made by scripts run in a script host, see DBus for their meaning.
+        void scriptSay(const QString& connection, const QString& target, const QString& command);
+        void scriptInfo(const QString& string);
+
     public slots:
         void launchScript(int connectionId, const QString& target, const QString& parameter);
+
+    private slots:
+        void hostCommand(const QStringList& fields);
+        void hostRunFailed(int connectionId, const QString& target, const QString& path, const QStringList& arguments);
+
+    private:
+        void launchDetached(int connectionId, const QString& target, const QString& script,
+            const QString& path, const QStringList& arguments);
+        ScriptHost* scriptHost(const QString& path);
+
+        /// Script path -> interpreter command line from its #! line.
+        QHash<QString, QStringList> m_interpreters;
+        /// Interpreter command line -> the host running its scripts.
+        QHash<QString, ScriptHost*> m_hosts;
 };
 #endif
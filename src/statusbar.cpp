@@ -13,6 +13,7 @@
 #include "mainwindow.h"
 #include "viewcontainer.h"
 #include "ssllabel.h"
+#include "keepalive.h"
 
 #include <KStatusBar>
 #include <QLabel>
@@ -152,16 +153,40 @@ namespace Konversation
                 lagString += i18n("Lag: %1 s", msec / 1000);
 
             m_lagLabel->setText(lagString);
+            updateLagToolTip(lagServer);
 
             if (m_lagLabel->isHidden()) m_lagLabel->show();
         }
     }
 
+    void StatusBar::updateLagToolTip(Server* lagServer)
+    {
+        const QList<int> bounds = KeepAlive::histogramBounds();
+        const QList<int> histogram = lagServer->getKeepAlive()->histogram();
+
+        QStringList lines;
+        lines << i18n("Lags measured on %1:", lagServer->getDisplayName());
+
+        for (int i = 0; i < histogram.count(); ++i)
+        {
+            if (!histogram.at(i))
+                continue;
+
+            if (i < bounds.count())
+                lines << i18np("Below %2 ms: once", "Below %2 ms: %1 times", histogram.at(i), bounds.at(i));
+            else
+                lines << i18np("%2 ms or more: once", "%2 ms or more: %1 times", histogram.at(i), bounds.last());
+        }
+
+        m_lagLabel->setToolTip(lines.join("\n"));
+    }
+
     void StatusBar::resetLagLabel(Server* lagServer)
     {
         if (!lagServer || lagServer == m_window->getViewContainer()->getFrontServer())
         {
             m_lagLabel->setText(i18n("Lag: Unknown"));
+            m_lagLabel->setToolTip(QString());
         }
     }
 
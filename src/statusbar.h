@@ -56,6 +56,8 @@ namespace Konversation
             void removeSSLLabel();
 
         private:
+            void updateLagToolTip(Server* lagServer);
+
             MainWindow* m_window;
 
             KSqueezedTextLabel* m_mainLabel;
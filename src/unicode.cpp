@@ -36,37 +36,86 @@
 #define UTF8_6Bytes(c) ( k6BytesLeadByte == ((c) & kLeft7BitsMask))
 #define UTF8_ValidTrialByte(c) ( kTrialByte == ((c) & kLeft2BitsMask))
 
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace Konversation {
 
-bool isUtf8(const QByteArray& text)
+/* Length of the leading run of bytes that are 7-bit ASCII and not ESC.
+   ESC is excluded because ESC '$' / ESC '(' mark ISO-2022-JP, which the
+   Japanese guesser has to see. Such a run is valid UTF-8 and leaves all
+   guesser DFAs in their initial state, so callers can skip it. */
+static int plainAsciiPrefixLength(const unsigned char* data, int len)
 {
-    int i;
-    int j;
-    int clen = 0;
-    int len = text.length();
+    int i = 0;
+
+#if defined(__AVX2__)
+    const __m256i esc32 = _mm256_set1_epi8(0x1B);
 
-    JapaneseCode* jc = new JapaneseCode();
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        int mask = _mm256_movemask_epi8(_mm256_or_si256(chunk, _mm256_cmpeq_epi8(chunk, esc32)));
 
-    JapaneseCode::Type result = jc->guess_jp(text, len);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i esc16 = _mm_set1_epi8(0x1B);
 
-    switch(result)
+    for (; i + 16 <= len; i += 16)
     {
-        case JapaneseCode::K_SJIS:
-        case JapaneseCode::K_JIS:
-            delete jc;
-            return false;
-        default:
-            delete jc;
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(chunk, _mm_cmpeq_epi8(chunk, esc16)));
+
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#else
+    const quint64 ones = Q_UINT64_C(0x0101010101010101);
+    const quint64 highBits = Q_UINT64_C(0x8080808080808080);
+
+    for (; i + 8 <= len; i += 8)
+    {
+        quint64 word;
+        memcpy(&word, data + i, sizeof(word));
+
+        quint64 esc = word ^ (ones * 0x1B);
+
+        /* high bit set anywhere, or a zero byte (i.e. ESC) in esc */
+        if ((word & highBits) || ((esc - ones) & ~esc & highBits))
             break;
     }
+#endif
+
+    while (i < len && data[i] < 0x80 && data[i] != 0x1B)
+        ++i;
+
+    return i;
+}
+
+/* Validates UTF-8 the way Mozilla's IsUTF8 does, including the legacy 5 and 6
+   byte forms. */
+static bool isValidUtf8(const unsigned char* data, int len)
+{
+    int i;
+    int j;
+    int clen = 0;
 
     for(i=0; i < len; i += clen)
     {
-        if(UTF8_1Byte(text[i]))
+        if(UTF8_1Byte(data[i]))
         {
             clen = 1;
+            continue;
         }
-        else if(UTF8_2Bytes(text[i]))
+        else if(UTF8_2Bytes(data[i]))
         {
             clen = 2;
 
@@ -75,10 +124,10 @@ bool isUtf8(const QByteArray& text)
                 return false;
 
             /* 0000 0000 - 0000 007F : should encode in less bytes */
-            if(0 ==  (text[i] & 0x1E ))
+            if(0 ==  (data[i] & 0x1E ))
                 return false;
         }
-        else if(UTF8_3Bytes(text[i]))
+        else if(UTF8_3Bytes(data[i]))
         {
             clen = 3;
 
@@ -88,14 +137,14 @@ bool isUtf8(const QByteArray& text)
 
             /* a single Surrogate should not show in 3 bytes UTF8, instead, the pair should be intepreted
                as one single UCS4 char and encoded UTF8 in 4 bytes */
-            if((QChar(0xED) == text[i] ) && (0xA0 == (text[i+1] & 0xA0 ) ))
+            if((0xED == data[i] ) && (0xA0 == (data[i+1] & 0xA0 ) ))
                 return false;
 
             /* 0000 0000 - 0000 07FF : should encode in less bytes */
-            if((0 ==  (text[i] & 0x0F )) && (0 ==  (text[i+1] & 0x20 ) ))
+            if((0 ==  (data[i] & 0x0F )) && (0 ==  (data[i+1] & 0x20 ) ))
                 return false;
         }
-        else if(UTF8_4Bytes(text[i]))
+        else if(UTF8_4Bytes(data[i]))
         {
             clen = 4;
 
@@ -104,10 +153,10 @@ bool isUtf8(const QByteArray& text)
                 return false;
 
             /* 0000 0000 - 0000 FFFF : should encode in less bytes */
-            if((0 ==  (text[i] & 0x07 )) && (0 ==  (text[i+1] & 0x30 )) )
+            if((0 ==  (data[i] & 0x07 )) && (0 ==  (data[i+1] & 0x30 )) )
                 return false;
         }
-        else if(UTF8_5Bytes(text[i]))
+        else if(UTF8_5Bytes(data[i]))
         {
             clen = 5;
 
@@ -116,10 +165,10 @@ bool isUtf8(const QByteArray& text)
                 return false;
 
             /* 0000 0000 - 001F FFFF : should encode in less bytes */
-            if((0 ==  (text[i] & 0x03 )) && (0 ==  (text[i+1] & 0x38 )) )
+            if((0 ==  (data[i] & 0x03 )) && (0 ==  (data[i+1] & 0x38 )) )
                 return false;
         }
-        else if(UTF8_6Bytes(text[i]))
+        else if(UTF8_6Bytes(data[i]))
         {
             clen = 6;
 
@@ -128,7 +177,7 @@ bool isUtf8(const QByteArray& text)
                 return false;
 
             /* 0000 0000 - 03FF FFFF : should encode in less bytes */
-            if((0 ==  (text[i] & 0x01 )) && (0 ==  (text[i+1] & 0x3E )) )
+            if((0 ==  (data[i] & 0x01 )) && (0 ==  (data[i+1] & 0x3E )) )
                 return false;
         }
         else
@@ -138,11 +187,90 @@ bool isUtf8(const QByteArray& text)
 
         for(j = 1; j<clen ;++j)
         {
-            if(! UTF8_ValidTrialByte(text[i+j]))  /* Trail bytes invalid */
+            if(! UTF8_ValidTrialByte(data[i+j]))  /* Trail bytes invalid */
                 return false;
         }
+
+        /* skip any ASCII run that follows the multibyte sequence in bulk */
+        i += clen;
+        clen = plainAsciiPrefixLength(data + i, len - i);
     }
     return true;
 }
 
+/* Index of the first UTF-16 code unit at or after from that sterilizeUnicode()
+   may have to fix up: a surrogate (D800-DFFF), one of the BMP noncharacters
+   FDD0-FDEF, or FFFE/FFFF. Returns len if there is none. */
+static int findUnicodeFixupCandidate(const ushort* data, int from, int len)
+{
+    int i = from;
+
+#if defined(__SSE2__)
+    const __m128i surrogateBase = _mm_set1_epi16(short(0xD800));
+    const __m128i surrogateSpan = _mm_set1_epi16(0x07FF);
+    const __m128i nonCharBase = _mm_set1_epi16(short(0xFDD0));
+    const __m128i nonCharSpan = _mm_set1_epi16(0x001F);
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i allOnes = _mm_set1_epi16(-1);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; i + 8 <= len; i += 8)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+
+        /* x - base <= span, unsigned, via saturating subtraction */
+        __m128i surrogate = _mm_cmpeq_epi16(_mm_subs_epu16(_mm_sub_epi16(chunk, surrogateBase), surrogateSpan), zero);
+        __m128i nonChar = _mm_cmpeq_epi16(_mm_subs_epu16(_mm_sub_epi16(chunk, nonCharBase), nonCharSpan), zero);
+        /* FFFE and FFFF saturate to FFFF when incremented */
+        __m128i planeEnd = _mm_cmpeq_epi16(_mm_adds_epu16(chunk, one), allOnes);
+
+        int mask = _mm_movemask_epi8(_mm_or_si128(surrogate, _mm_or_si128(nonChar, planeEnd)));
+
+        if (mask)
+            return i + (__builtin_ctz(mask) >> 1);
+    }
+#endif
+
+    for (; i < len; ++i)
+    {
+        ushort c = data[i];
+
+        if ((c >= 0xD800 && c <= 0xDFFF) || (c >= 0xFDD0 && c <= 0xFDEF) || c >= 0xFFFE)
+            return i;
+    }
+
+    return len;
+}
+
+bool isUtf8(const QByteArray& text)
+{
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(text.constData());
+    int len = text.length();
+
+    /* Plain ASCII is by far the most common case on IRC */
+    int asciiLength = plainAsciiPrefixLength(data, len);
+
+    if (asciiLength == len)
+        return true;
+
+    data += asciiLength;
+    len -= asciiLength;
+
+    if (!isValidUtf8(data, len))
+        return false;
+
+    /* Valid UTF-8 can still be Shift-JIS or ISO-2022-JP. The ASCII prefix
+       doesn't change the guesser's state, so start it where it matters. */
+    JapaneseCode jc;
+
+    switch(jc.guess_jp(reinterpret_cast<const char*>(data), len))
+    {
+        case JapaneseCode::K_SJIS:
+        case JapaneseCode::K_JIS:
+            return false;
+        default:
+            return true;
+    }
+}
+
 }
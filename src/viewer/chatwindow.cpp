@@ -18,6 +18,7 @@
 #include "server.h"
 #include "application.h"
 #include "logfilereader.h"
+#include "logindex.h"
 #include "viewcontainer.h"
 
 #include <QDateTime>
@@ -478,17 +479,15 @@ void ChatWindow::logText(const QString& text)
                 firstLog=false;
             }
 
-            QDateTime dateTime = QDateTime::currentDateTime();
-            QString logLine(QString("[%1] [%2] %3\n").arg(KGlobal::locale()->formatDate(dateTime.date(), KLocale::LongDate)).
-                arg(KGlobal::locale()->formatTime(dateTime.time(), true)).arg(text));
-
-            logStream << logLine;
+            logStream << Konversation::logTimeStamp() << ' ' << text << '\n';
 
             // detach stream from file
             logStream.setDevice(0);
 
             // close file
             logfile.close();
+
+            Application::instance()->getLogIndex()->logChanged(logfile.fileName());
         }
         else kWarning() << "open(QIODevice::Append) for " << logfile.fileName() << " failed!";
     }
@@ -47,7 +47,8 @@ class ChatWindow : public KVBox
             Konsole,
             UrlCatcher,
             NicksOnline,
-            LogFileReader
+            LogFileReader,
+            LogSearch
         };
 
         /** Clean up and close this tab.  Return false if you want to cancel the close. */
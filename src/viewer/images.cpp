@@ -14,6 +14,7 @@
 #include "common.h"
 #include "application.h"
 
+#include <QHash>
 #include <QIconEngine>
 #include <QPainter>
 
@@ -36,14 +37,22 @@ class LedIconEngine : public QIconEngine
         virtual QPixmap pixmap(const QSize &size, QIcon::Mode mode, QIcon::State state);
 
     private:
+        void render(QPainter *painter, const QRect &rect);
+
         const QColor m_color;
         const bool m_state;
+
+        // rendered once per size, the engine is shared by all copies of its icon
+        QHash<quint64, QPixmap> m_pixmaps;
 };
 
 void LedIconEngine::paint(QPainter *painter, const QRect &rect, QIcon::Mode mode, QIcon::State state)
 {
-    Q_UNUSED(mode);
-    Q_UNUSED(state);
+    painter->drawPixmap(rect.topLeft(), pixmap(rect.size(), mode, state));
+}
+
+void LedIconEngine::render(QPainter *painter, const QRect &rect)
+{
     QColor color;
     QBrush brush;
     QPen pen;
@@ -108,13 +117,25 @@ void LedIconEngine::paint(QPainter *painter, const QRect &rect, QIcon::Mode mode
 
 QPixmap LedIconEngine::pixmap(const QSize &size, QIcon::Mode mode, QIcon::State state)
 {
+    Q_UNUSED(mode);
+    Q_UNUSED(state);
+
+    const quint64 key = (quint64(size.width()) << 32) | quint32(size.height());
+    QHash<quint64, QPixmap>::const_iterator it = m_pixmaps.constFind(key);
+
+    if (it != m_pixmaps.constEnd())
+        return it.value();
+
     QPixmap pix(size);
     {
         pix.fill(Qt::transparent);
         QPainter p(&pix);
         p.setRenderHint(QPainter::Antialiasing);
-        paint(&p, QRect(QPoint(0, 0), size), mode, state);
+        render(&p, QRect(QPoint(0, 0), size));
     }
+
+    m_pixmaps.insert(key, pix);
+
     return pix;
 }
 
@@ -152,24 +173,18 @@ QString Images::getNickIconAwayPath() const
 void Images::initializeLeds()
 {
     m_serverColor = "steelblue";
-    m_systemColor = Preferences::self()->tabNotificationsSystemColor();
-    m_msgsColor = Preferences::self()->tabNotificationsMsgsColor();
-    m_privateColor = Preferences::self()->tabNotificationsPrivateColor();
-    m_eventsColor = Preferences::self()->tabNotificationsEventsColor();
-    m_nickColor = Preferences::self()->tabNotificationsNickColor();
-    m_highlightsColor = Preferences::self()->tabNotificationsHighlightsColor();
-
-    // m_serverLedOn = getLed(m_serverColor,true);
-    m_serverLedOff = getLed(m_serverColor,false);
-    m_systemLedOn = getLed(m_systemColor,true);
-    m_systemLedOff = getLed(m_systemColor,false);
-    m_msgsLedOn = getLed(m_msgsColor,true);
-    m_msgsLedOff = getLed(m_msgsColor,false);
-    m_privateLedOn = getLed(m_privateColor,true);
-    m_privateLedOff = getLed(m_privateColor,false);
-    m_eventsLedOn = getLed(m_eventsColor,true);
-    m_nickLedOn = getLed(m_nickColor,true);
-    m_highlightsLedOn = getLed(m_highlightsColor,true);
+
+    // the LEDs for the configured colors, the cache takes care of changes
+    getServerLed(false);
+    getSystemLed(true);
+    getSystemLed(false);
+    getMsgsLed(true);
+    getMsgsLed(false);
+    getPrivateLed(true);
+    getPrivateLed(false);
+    getEventsLed();
+    getNickLed();
+    getHighlightsLed();
 }
 
 void Images::initializeKimifaceIcons()
@@ -246,93 +261,49 @@ void Images::initializeNickIcons()
 
 QIcon Images::getLed(const QColor& col,bool state)
 {
-    return QIcon(new LedIconEngine(col, state));
+    // color and state packed into one key
+    const quint64 key = (quint64(col.rgba()) << 1) | (state ? 1 : 0);
+    QHash<quint64, QIcon>::const_iterator it = m_leds.constFind(key);
+
+    if (it == m_leds.constEnd())
+        it = m_leds.insert(key, QIcon(new LedIconEngine(col, state)));
+
+    return it.value();
 }
 
 QIcon Images::getServerLed(bool state)
 {
-    if (state)
-        return m_serverLedOn;
-    else
-        return m_serverLedOff;
+    return getLed(m_serverColor, state);
 }
 
 QIcon Images::getSystemLed(bool state)
 {
-    if (Preferences::self()->tabNotificationsSystemColor()!=m_systemColor)
-    {
-        if (state)
-            return getLed(Preferences::self()->tabNotificationsSystemColor(),true);
-        else
-            return getLed(Preferences::self()->tabNotificationsSystemColor(),false);
-    }
-    else
-    {
-        if (state)
-            return m_systemLedOn;
-        else
-            return m_systemLedOff;
-    }
+    return getLed(Preferences::self()->tabNotificationsSystemColor(), state);
 }
 
 QIcon Images::getMsgsLed(bool state)
 {
-    if (Preferences::self()->tabNotificationsMsgsColor()!=m_msgsColor)
-    {
-        if (state)
-            return getLed(Preferences::self()->tabNotificationsMsgsColor(),true);
-        else
-            return getLed(Preferences::self()->tabNotificationsMsgsColor(),false);
-    }
-    else
-    {
-        if (state)
-            return m_msgsLedOn;
-        else
-            return m_msgsLedOff;
-    }
+    return getLed(Preferences::self()->tabNotificationsMsgsColor(), state);
 }
 
 QIcon Images::getPrivateLed(bool state)
 {
-    if (Preferences::self()->tabNotificationsPrivateColor()!=m_privateColor)
-    {
-        if (state)
-            return getLed(Preferences::self()->tabNotificationsPrivateColor(),true);
-        else
-            return getLed(Preferences::self()->tabNotificationsPrivateColor(),false);
-    }
-    else
-    {
-        if (state)
-            return m_privateLedOn;
-        else
-            return m_privateLedOff;
-    }
+    return getLed(Preferences::self()->tabNotificationsPrivateColor(), state);
 }
 
 QIcon Images::getEventsLed()
 {
-    if (Preferences::self()->tabNotificationsEventsColor()!=m_eventsColor)
-        return getLed(Preferences::self()->tabNotificationsEventsColor(),true);
-    else
-        return m_eventsLedOn;
+    return getLed(Preferences::self()->tabNotificationsEventsColor(), true);
 }
 
 QIcon Images::getNickLed()
 {
-    if (Preferences::self()->tabNotificationsNickColor()!=m_nickColor)
-        return getLed(Preferences::self()->tabNotificationsNickColor(),true);
-    else
-        return m_nickLedOn;
+    return getLed(Preferences::self()->tabNotificationsNickColor(), true);
 }
 
 QIcon Images::getHighlightsLed()
 {
-    if (Preferences::self()->tabNotificationsHighlightsColor()!=m_highlightsColor)
-        return getLed(Preferences::self()->tabNotificationsHighlightsColor(),true);
-    else
-        return m_highlightsLedOn;
+    return getLed(Preferences::self()->tabNotificationsHighlightsColor(), true);
 }
 
 #include "images.moc"
@@ -13,6 +13,7 @@
 #ifndef IMAGES_H
 #define IMAGES_H
 
+#include <QHash>
 #include <QIcon>
 #include <QPixmap>
 #include <QObject>
@@ -67,25 +68,10 @@ class Images : public QObject
         void initializeLeds();
         void initializeKimifaceIcons();
 
-        QIcon m_serverLedOn;
-        QIcon m_serverLedOff;
-        QIcon m_systemLedOn;
-        QIcon m_systemLedOff;
-        QIcon m_msgsLedOn;
-        QIcon m_msgsLedOff;
-        QIcon m_privateLedOn;
-        QIcon m_privateLedOff;
-        QIcon m_eventsLedOn;
-        QIcon m_nickLedOn;
-        QIcon m_highlightsLedOn;
+        /// LED icons by color and state, each renders a size only once
+        QHash<quint64, QIcon> m_leds;
 
         QColor m_serverColor;
-        QColor m_systemColor;
-        QColor m_msgsColor;
-        QColor m_privateColor;
-        QColor m_eventsColor;
-        QColor m_nickColor;
-        QColor m_highlightsColor;
 
         QIcon kimproxyAway;
         QIcon kimproxyOnline;
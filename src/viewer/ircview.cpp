@@ -22,16 +22,55 @@
 #include "sound.h"
 #include "emoticons.h"
 #include "notificationhandler.h"
+#include "dbus.h"
 
 #include <QScrollBar>
 #include <QTextBlock>
 #include <QPainter>
 #include <QTextDocumentFragment>
+#include <QTimer>
 
 #include <KStandardShortcut>
+#include <KTemporaryFile>
 
 using namespace Konversation;
 
+// how long a view has to stay hidden before its scrollback is trimmed
+static const int HiddenTrimDelay = 10 * 60 * 1000;
+
+// lines read back from the spill file at a time
+static const int SpillPageSize = 200;
+
+static QDataStream& operator<<(QDataStream& stream, const IRCViewLine& line)
+{
+    stream << line.rtl << quint32(line.runs.count());
+
+    foreach (const IRCViewLine::Run& run, line.runs)
+        stream << run.isHtml << run.text << run.format;
+
+    return stream;
+}
+
+static QDataStream& operator>>(QDataStream& stream, IRCViewLine& line)
+{
+    quint32 count;
+    stream >> line.rtl >> count;
+
+    line.runs.clear();
+
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i)
+    {
+        IRCViewLine::Run run;
+        QTextFormat format;
+
+        stream >> run.isHtml >> run.text >> format;
+        run.format = format.toCharFormat();
+        line.runs.append(run);
+    }
+
+    return stream;
+}
+
 class ScrollBarPin
 {
         QPointer<QScrollBar> m_bar;
@@ -87,6 +126,7 @@ class SelectionPin
 
 IRCView::IRCView(QWidget* parent) : KTextBrowser(parent), m_rememberLine(0), m_lastMarkerLine(0), m_rememberLineDirtyBit(false), markerFormatObject(this)
 {
+    m_spillFile = 0;
     m_mousePressedOnUrl = false;
     m_isOnNick = false;
     m_isOnChannel = false;
@@ -130,6 +170,13 @@ IRCView::IRCView(QWidget* parent) : KTextBrowser(parent), m_rememberLine(0), m_l
     setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
 
     setContextMenuOptions(IrcContextMenus::ShowTitle | IrcContextMenus::ShowFindAction, true);
+
+    m_trimTimer = new QTimer(this);
+    m_trimTimer->setSingleShot(true);
+    m_trimTimer->setInterval(HiddenTrimDelay);
+    connect(m_trimTimer, SIGNAL(timeout()), this, SLOT(trimHiddenView()));
+
+    connect(verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(checkScrolledToTop(int)));
 }
 
 IRCView::~IRCView()
@@ -169,6 +216,8 @@ bool IRCView::search(const QString& pattern, bool caseSensitive, bool wholeWords
     if (pattern.isEmpty())
         return true;
 
+    flushPendingLines();
+
     m_pattern       = pattern;
     m_forward       = forward;
     m_searchFlags = 0;
@@ -184,6 +233,8 @@ bool IRCView::search(const QString& pattern, bool caseSensitive, bool wholeWords
 
 bool IRCView::searchNext(bool reversed)
 {
+    flushPendingLines();
+
     bool fwd = (reversed ? !m_forward : m_forward);
     if (fwd) {
         m_searchFlags &= ~QTextDocument::FindBackward;
@@ -191,7 +242,26 @@ bool IRCView::searchNext(bool reversed)
     else {
         m_searchFlags |= QTextDocument::FindBackward;
     }
-    return find(m_pattern, m_searchFlags);
+
+    bool found = find(m_pattern, m_searchFlags);
+
+    // Look for older matches in the spill file and page in only up to the
+    // newest of them, not all lines while there is none
+    while (!found && !fwd && hasSpilledLines())
+    {
+        int count = spilledLinesToMatch();
+
+        if (!count)
+            break;
+
+        QTextCursor cursor = textCursor();
+        cursor.setPosition(pageIn(count));
+        setTextCursor(cursor);
+
+        found = find(m_pattern, m_searchFlags);
+    }
+
+    return found;
 }
 
 class IrcViewMimeData : public QMimeData
@@ -418,6 +488,8 @@ void IRCView::cullMarkedLine(int where, int rem, int add) //slot
 
 void IRCView::insertMarkerLine() //slot
 {
+    flushPendingLines();
+
     //if the last line is already a marker of any kind, skip out
     if (lastBlockIsLine(BlockIsMarker))
         return;
@@ -462,6 +534,9 @@ void IRCView::appendRememberLine()
     //clear this now, so that doAppend doesn't double insert
     m_rememberLineDirtyBit = false;
 
+    // the line goes after everything appended so far
+    flushPendingLines();
+
     //if the last line is already the remember line, do nothing
     if (lastBlockIsLine(BlockIsRemember))
         return;
@@ -537,6 +612,10 @@ void IRCView::enableParagraphSpacing() {}
 
 void IRCView::updateAppearance()
 {
+    // colors or the time stamp format might have changed
+    m_colorNames.clear();
+    Konversation::resetTimeStamps();
+
     if (Preferences::self()->customTextFont())
         setFont(Preferences::self()->textFont());
     else
@@ -567,89 +646,165 @@ void IRCView::updateAppearance()
 
 // Data insertion
 
+void IRCViewLine::addText(const QString& text, const QTextCharFormat& format)
+{
+    QString added;
+    added.reserve(text.length());
+
+    // Drop the spaces the HTML parser used to: runs of them show as one and
+    // lines never start with one
+    for (int i = 0; i < text.length(); ++i)
+    {
+        QChar c = text.at(i);
+
+        if (c == '\n')
+            continue;
+
+        if (c.isSpace() && c != QChar(QChar::Nbsp) && c != QChar(QChar::ParagraphSeparator))
+        {
+            if (collapseSpace)
+                continue;
+
+            c = ' ';
+            collapseSpace = true;
+        }
+        else
+        {
+            collapseSpace = false;
+        }
+
+        added += c;
+    }
+
+    if (added.isEmpty())
+        return;
+
+    if (!runs.isEmpty() && !runs.last().isHtml && runs.last().format == format)
+    {
+        runs.last().text += added;
+
+        return;
+    }
+
+    Run run;
+    run.text = added;
+    run.format = format;
+    run.isHtml = false;
+    runs.append(run);
+}
+
+void IRCViewLine::addHtml(const QString& html)
+{
+    Run run;
+    run.text = html;
+    run.text.remove('\n');
+    run.isHtml = true;
+    runs.append(run);
+
+    collapseSpace = false;
+}
+
+void IRCViewLine::addLine(const IRCViewLine& other)
+{
+    foreach (const Run& run, other.runs)
+    {
+        if (run.isHtml)
+            addHtml(run.text);
+        else
+            addText(run.text, run.format);
+    }
+}
+
 void IRCView::append(const QString& nick, const QString& message)
 {
-    QString channelColor = Preferences::self()->color(Preferences::ChannelMessage).name();
+    QTextCharFormat format = textFormat(colorName(Preferences::ChannelMessage));
 
     m_tabNotification = Konversation::tnfNormal;
 
-    QString nickLine = createNickLine(nick, channelColor);
+    IRCViewLine text;
+    IRCViewLine line;
+    line.rtl = (filter(text, message, format, nick, true, true, false) == QChar::DirR);
 
-    QChar::Direction dir;
-    QString text(filter(message, channelColor, nick, true, true, false, &dir));
-    QString line;
-    bool rtl = (dir == QChar::DirR);
-
-    if(rtl)
+    if (line.rtl)
     {
-        line = RLE;
-        line += LRE;
-        line += "<font color=\"" + channelColor + "\">" + nickLine +" %1" + PDF + RLM + " %3</font>";
+        line.addText(QString(RLE) + LRE, format);
+        addNick(line, nick, format);
+        line.addText(" ", format);
+        addTimeStamp(line, format);
+        line.addText(QString(PDF) + RLM + ' ', format);
     }
     else
     {
         if (!QApplication::isLeftToRight())
-            line += LRE;
+            line.addText(LRE, format);
 
-        line += "<font color=\"" + channelColor + "\">%1" + nickLine + " %3</font>";
+        addTimeStamp(line, format);
+        addNick(line, nick, format);
+        line.addText(" ", format);
     }
 
-    line = line.arg(timeStamp(), nick, text);
+    line.addLine(text);
 
     emit textToLog(QString("<%1>\t%2").arg(nick, message));
 
-    doAppend(line, rtl);
+    doAppend(line);
 }
 
 void IRCView::appendRaw(const QString& message, bool self)
 {
-    QColor color = self ? Preferences::self()->color(Preferences::ChannelMessage)
-        : Preferences::self()->color(Preferences::ServerMessage);
+    QString color = colorName(self ? Preferences::ChannelMessage : Preferences::ServerMessage);
     m_tabNotification = Konversation::tnfNone;
 
-    QString line = QString(timeStamp() + " <font color=\"" + color.name() + "\">" + message + "</font>");
+    IRCViewLine line;
+    addTimeStamp(line, QTextCharFormat());
+    line.addText(" ", QTextCharFormat());
+    line.addHtml("<font color=\"" + color + "\">" + message + "</font>");
 
-    doAppend(line, false, self);
+    doAppend(line, self);
 }
 
 void IRCView::appendLog(const QString & message)
 {
-    QColor channelColor = Preferences::self()->color(Preferences::ChannelMessage);
+    QString channelColor = colorName(Preferences::ChannelMessage);
     m_tabNotification = Konversation::tnfNone;
 
-    QString line("<font color=\"" + channelColor.name() + "\">" + message + "</font>");
+    IRCViewLine line;
+    line.rtl = !QApplication::isLeftToRight();
+    line.addHtml("<font color=\"" + channelColor + "\">" + message + "</font>");
 
-    doRawAppend(line, !QApplication::isLeftToRight());
+    doRawAppend(line);
 }
 
 void IRCView::appendQuery(const QString& nick, const QString& message, bool inChannel)
 {
-    QString queryColor=Preferences::self()->color(Preferences::QueryMessage).name();
+    QTextCharFormat format = textFormat(colorName(Preferences::QueryMessage));
 
     m_tabNotification = Konversation::tnfPrivate;
 
-    QString nickLine = createNickLine(nick, queryColor, true, inChannel);
-
-    QString line;
-    QChar::Direction dir;
-    QString text(filter(message, queryColor, nick, true, true, false, &dir));
-    bool rtl = (dir == QChar::DirR);
+    IRCViewLine text;
+    IRCViewLine line;
+    line.rtl = (filter(text, message, format, nick, true, true, false) == QChar::DirR);
 
-    if(rtl)
+    if (line.rtl)
     {
-        line = RLE;
-        line += LRE;
-        line += "<font color=\"" + queryColor + "\">" + nickLine + " %1" + PDF + RLM + " %3</font>";
+        line.addText(QString(RLE) + LRE, format);
+        addNick(line, nick, format, true, inChannel);
+        line.addText(" ", format);
+        addTimeStamp(line, format);
+        line.addText(QString(PDF) + RLM + ' ', format);
     }
     else
     {
         if (!QApplication::isLeftToRight())
-            line += LRE;
+            line.addText(LRE, format);
 
-        line += "<font color=\"" + queryColor + "\">%1 " + nickLine + " %3</font>";
+        addTimeStamp(line, format);
+        line.addText(" ", format);
+        addNick(line, nick, format, true, inChannel);
+        line.addText(" ", format);
     }
 
-    line = line.arg(timeStamp(), nick, text);
+    line.addLine(text);
 
     if (inChannel) {
         emit textToLog(QString("<-> %1>\t%2").arg(nick, message));
@@ -657,7 +812,7 @@ void IRCView::appendQuery(const QString& nick, const QString& message, bool inCh
         emit textToLog(QString("<%1>\t%2").arg(nick, message));
     }
 
-    doAppend(line, rtl);
+    doAppend(line);
 }
 
 void IRCView::appendChannelAction(const QString& nick, const QString& message)
@@ -674,56 +829,58 @@ void IRCView::appendQueryAction(const QString& nick, const QString& message)
 
 void IRCView::appendAction(const QString& nick, const QString& message)
 {
-    QString actionColor = Preferences::self()->color(Preferences::ActionMessage).name();
+    QTextCharFormat format = textFormat(colorName(Preferences::ActionMessage));
 
-    QString line;
-
-    QString nickLine = createNickLine(nick, actionColor, false);
+    IRCViewLine line;
 
     if (message.isEmpty())
     {
         if (!QApplication::isLeftToRight())
-            line += LRE;
-
-        line += "<font color=\"" + actionColor + "\">%1 * " + nickLine + "</font>";
+            line.addText(LRE, format);
 
-        line = line.arg(timeStamp(), nick);
+        addTimeStamp(line, format);
+        line.addText(" * ", format);
+        addNick(line, nick, format, false);
 
         emit textToLog(QString("\t * %1").arg(nick));
 
-        doAppend(line, false);
+        doAppend(line);
     }
     else
     {
-        QChar::Direction dir;
-        QString text(filter(message, actionColor, nick, true,true, false, &dir));
-        bool rtl = (dir == QChar::DirR);
+        IRCViewLine text;
+        line.rtl = (filter(text, message, format, nick, true, true, false) == QChar::DirR);
 
-        if (rtl)
+        if (line.rtl)
         {
-            line = RLE;
-            line += LRE;
-            line += "<font color=\"" + actionColor + "\">" + nickLine + " * %1" + PDF + " %3</font>";
+            line.addText(QString(RLE) + LRE, format);
+            addNick(line, nick, format, false);
+            line.addText(" * ", format);
+            addTimeStamp(line, format);
+            line.addText(QString(PDF) + ' ', format);
         }
         else
         {
             if (!QApplication::isLeftToRight())
-                line += LRE;
+                line.addText(LRE, format);
 
-            line += "<font color=\"" + actionColor + "\">%1 * " + nickLine + " %3</font>";
+            addTimeStamp(line, format);
+            line.addText(" * ", format);
+            addNick(line, nick, format, false);
+            line.addText(" ", format);
         }
 
-        line = line.arg(timeStamp(), nick, text);
+        line.addLine(text);
 
         emit textToLog(QString("\t * %1 %2").arg(nick, message));
 
-        doAppend(line, rtl);
+        doAppend(line);
     }
 }
 
 void IRCView::appendServerMessage(const QString& type, const QString& message, bool parseURL)
 {
-    QString serverColor = Preferences::self()->color(Preferences::ServerMessage).name();
+    QString serverColor = colorName(Preferences::ServerMessage);
     m_tabNotification = Konversation::tnfControl;
 
     // Fixed width font option for MOTD
@@ -731,38 +888,49 @@ void IRCView::appendServerMessage(const QString& type, const QString& message, b
     if(Preferences::self()->fixedMOTD() && !m_fontDataBase.isFixedPitch(font().family()))
     {
         if(type == i18n("MOTD"))
-            fixed=" face=\"" + KGlobalSettings::fixedFont().family() + "\"";
+            fixed = KGlobalSettings::fixedFont().family();
     }
 
-    QString line;
-    QChar::Direction dir;
-    QString text(filter(message, serverColor, 0 , true, parseURL, false, &dir));
-    bool rtl = (dir == QChar::DirR);
+    QTextCharFormat format = textFormat(serverColor, false, fixed);
+    QTextCharFormat boldFormat = textFormat(serverColor, true, fixed);
+
+    IRCViewLine text;
+    IRCViewLine line;
+    line.rtl = (filter(text, message, format, QString(), true, parseURL, false) == QChar::DirR);
 
-    if(rtl)
+    if(line.rtl)
     {
-        line = RLE;
-        line += LRE;
-        line += "<font color=\"" + serverColor + "\"" + fixed + "><b>[</b>%2<b>]</b> %1" + PDF + " %3</font>";
+        line.addText(QString(RLE) + LRE, format);
+        line.addText("[", boldFormat);
+        line.addText(type, format);
+        line.addText("]", boldFormat);
+        line.addText(" ", format);
+        addTimeStamp(line, format);
+        line.addText(QString(PDF) + ' ', format);
     }
     else
     {
         if (!QApplication::isLeftToRight())
-            line += LRE;
+            line.addText(LRE, format);
 
-        line += "<font color=\"" + serverColor + "\"" + fixed + ">%1 <b>[</b>%2<b>]</b> %3</font>";
+        addTimeStamp(line, format);
+        line.addText(" ", format);
+        line.addText("[", boldFormat);
+        line.addText(type, format);
+        line.addText("]", boldFormat);
+        line.addText(" ", format);
     }
 
-    line = line.arg(timeStamp(), type, text);
+    line.addLine(text);
 
     emit textToLog(QString("%1\t%2").arg(type, message));
 
-    doAppend(line, rtl);
+    doAppend(line);
 }
 
 void IRCView::appendCommandMessage(const QString& type,const QString& message, bool parseURL, bool self)
 {
-    QString commandColor = Preferences::self()->color(Preferences::CommandMessage).name();
+    QTextCharFormat format = textFormat(colorName(Preferences::CommandMessage));
     QString prefix="***";
     m_tabNotification = Konversation::tnfControl;
 
@@ -776,32 +944,31 @@ void IRCView::appendCommandMessage(const QString& type,const QString& message, b
         prefix="<--";
     }
 
-    prefix=Qt::escape(prefix);
+    IRCViewLine text;
+    IRCViewLine line;
+    line.rtl = (filter(text, message, format, QString(), true, parseURL, self) == QChar::DirR);
 
-    QString line;
-    QChar::Direction dir;
-    QString text(filter(message, commandColor, 0, true, parseURL, self, &dir));
-    bool rtl = (dir == QChar::DirR);
-
-    if(rtl)
+    if(line.rtl)
     {
-        line = RLE;
-        line += LRE;
-        line += "<font color=\"" + commandColor + "\">%2 %1" + PDF + " %3</font>";
+        line.addText(QString(RLE) + LRE, format);
+        line.addText(prefix + ' ', format);
+        addTimeStamp(line, format);
+        line.addText(QString(PDF) + ' ', format);
     }
     else
     {
         if (!QApplication::isLeftToRight())
-            line += LRE;
+            line.addText(LRE, format);
 
-        line += "<font color=\"" + commandColor + "\">%1 %2 %3</font>";
+        addTimeStamp(line, format);
+        line.addText(' ' + prefix + ' ', format);
     }
 
-    line = line.arg(timeStamp(), prefix, text);
+    line.addLine(text);
 
     emit textToLog(QString("%1\t%2").arg(type, message));
 
-    doAppend(line, rtl, self);
+    doAppend(line, self);
 }
 
 void IRCView::appendBacklogMessage(const QString& firstColumn,const QString& rawMessage)
@@ -809,7 +976,7 @@ void IRCView::appendBacklogMessage(const QString& firstColumn,const QString& raw
     QString time;
     QString message = rawMessage;
     QString nick = firstColumn;
-    QString backlogColor = Preferences::self()->color(Preferences::BacklogMessage).name();
+    QTextCharFormat format = textFormat(colorName(Preferences::BacklogMessage));
     m_tabNotification = Konversation::tnfNone;
 
     //The format in Chatwindow::logText is not configurable, so as long as nobody allows square brackets in a date/time format....
@@ -822,35 +989,29 @@ void IRCView::appendBacklogMessage(const QString& firstColumn,const QString& raw
         nick = '|' + nick + '|';
     }
 
-    // Nicks are in "<nick>" format so replace the "<>"
-    nick.replace('<',"&lt;");
-    nick.replace('>',"&gt;");
-
-    QString line;
-    QChar::Direction dir;
-    QString text(filter(message, backlogColor, NULL, false, false, false, &dir));
-    bool rtl = (dir == QChar::DirR);
+    IRCViewLine text;
+    IRCViewLine line;
+    line.rtl = (filter(text, message, format, QString(), false, false, false) == QChar::DirR);
 
-    if(rtl)
+    if(line.rtl)
     {
-        line = RLE;
-        line += LRE;
-        line += "<font color=\"" + backlogColor + "\">%2 %1" + PDF + " %3</font>";
+        line.addText(QString(RLE) + LRE, format);
+        line.addText(nick + ' ' + time + PDF + ' ', format);
     }
     else
     {
         if (!QApplication::isLeftToRight())
-            line += LRE;
+            line.addText(LRE, format);
 
-        line += "<font color=\"" + backlogColor + "\">%1 %2 %3</font>";
+        line.addText(time + ' ' + nick + ' ', format);
     }
 
-    line = line.arg(time, nick, text);
+    line.addLine(text);
 
-    doAppend(line, rtl);
+    doAppend(line);
 }
 
-void IRCView::doAppend(const QString& newLine, bool rtl, bool self)
+void IRCView::doAppend(const IRCViewLine& line, bool self)
 {
     if (m_rememberLineDirtyBit)
         appendRememberLine();
@@ -858,15 +1019,14 @@ void IRCView::doAppend(const QString& newLine, bool rtl, bool self)
     if (!self && m_chatWin)
         m_chatWin->activateTabNotification(m_tabNotification);
 
-    int scrollMax = Preferences::self()->scrollbackMax();
-    if (scrollMax != 0)
-    {
-        //don't remove lines if the user has scrolled up to read old lines
-        bool atBottom = (verticalScrollBar()->value() == verticalScrollBar()->maximum());
-        document()->setMaximumBlockCount(atBottom ? scrollMax : document()->maximumBlockCount() + 1);
-    }
+    doRawAppend(line);
 
-    doRawAppend(newLine, rtl);
+    // Older lines than scrollbackMax go to the spill file, a page at a time
+    // rather than one with every line appended
+    int limit = Preferences::self()->scrollbackMax();
+
+    if (limit > 0 && document()->blockCount() + m_pendingLines.count() >= limit + SpillPageSize)
+        pageOut(limit);
 
     //FIXME: Disable auto-text for DCC Chats since we don't have a server to parse wildcards.
     if (!m_autoTextToSend.isEmpty() && m_server)
@@ -887,53 +1047,323 @@ void IRCView::doAppend(const QString& newLine, bool rtl, bool self)
         emit clearStatusBarTempText();
 }
 
-void IRCView::doRawAppend(const QString& newLine, bool rtl)
+void IRCView::doRawAppend(const IRCViewLine& line)
 {
+    // Hidden views only keep the line, most of them are never looked at
+    if (!isVisible())
+    {
+        m_pendingLines.append(line);
+
+        return;
+    }
+
     SelectionPin selpin(this); // HACK stop selection at end from growing
-    QString line(newLine);
+    ScrollBarPin barpin(verticalScrollBar());
+
+    QTextCursor cursor(document());
+    cursor.beginEditBlock();
+    insertLine(cursor, line);
+    cursor.endEditBlock();
+}
+
+void IRCView::flushPendingLines()
+{
+    if (m_pendingLines.isEmpty())
+        return;
 
-    line.remove('\n');
+    QList<IRCViewLine> lines = m_pendingLines;
+    m_pendingLines.clear();
 
-    KTextBrowser::append(line);
+    SelectionPin selpin(this);
+    ScrollBarPin barpin(verticalScrollBar());
+
+    QTextCursor cursor(document());
+    cursor.beginEditBlock();
 
-    QTextCursor formatCursor(document()->lastBlock());
-    QTextBlockFormat format = formatCursor.blockFormat();
+    foreach (const IRCViewLine& line, lines)
+        insertLine(cursor, line);
 
-    format.setAlignment(rtl ? Qt::AlignRight : Qt::AlignLeft);
-    formatCursor.setBlockFormat(format);
+    cursor.endEditBlock();
 }
 
-QString IRCView::timeStamp()
+void IRCView::insertLine(QTextCursor& cursor, const IRCViewLine& line)
 {
-    if(Preferences::self()->timestamping())
+    cursor.movePosition(QTextCursor::End);
+
+    if (!document()->isEmpty())
+        cursor.insertBlock(textCursor().blockFormat(), textCursor().charFormat());
+
+    insertRuns(cursor, line);
+}
+
+void IRCView::insertRuns(QTextCursor& cursor, const IRCViewLine& line)
+{
+    // Only runs that still carry IRC formatting or links go through the HTML parser
+    foreach (const IRCViewLine::Run& run, line.runs)
+    {
+        if (run.isHtml)
+            cursor.insertHtml(run.text);
+        else
+            cursor.insertText(run.text, run.format);
+    }
+
+    QTextBlockFormat format = cursor.blockFormat();
+    format.setAlignment(line.rtl ? Qt::AlignRight : Qt::AlignLeft);
+    cursor.setBlockFormat(format);
+}
+
+void IRCView::pageOut(int limit)
+{
+    int lines = document()->isEmpty() ? 0 : document()->blockCount();
+    int excess = lines + m_pendingLines.count() - limit;
+
+    if (limit <= 0 || excess <= 0)
+        return;
+
+    bool hidden = !isVisible();
+    QScrollBar* bar = verticalScrollBar();
+    QAbstractTextDocumentLayout* layout = document()->documentLayout();
+
+    // While the user scrolled up, e.g. to lines just paged in, keep them all
+    if (!hidden && bar->value() != bar->maximum())
+        return;
+
+    // Only lines above the visible part may go, so the view stays in place
+    QTextBlock block = document()->firstBlock();
+    int count = 0;
+
+    while (count < excess && count < lines
+        && (hidden || layout->blockBoundingRect(block).bottom() < bar->value()))
+    {
+        // marker and remember lines are not worth keeping
+        if (!dynamic_cast<Burr*>(block.userData()))
+            spillLine(lineFromBlock(block));
+
+        block = block.next();
+        ++count;
+    }
+
+    if (count > 0)
     {
-        QTime time = QTime::currentTime();
-        QString timeColor = Preferences::self()->color(Preferences::Time).name();
-        QString timeFormat = Preferences::self()->timestampFormat();
-        QString timeString;
+        QTextCursor cursor(document());
 
-        if(!Preferences::self()->showDate())
+        if (count < lines)
+            cursor.movePosition(QTextCursor::NextBlock, QTextCursor::KeepAnchor, count);
+        else
+            cursor.movePosition(QTextCursor::End, QTextCursor::KeepAnchor);
+
+        cursor.removeSelectedText();
+
+        if (!hidden)
+            bar->setValue(bar->maximum());
+    }
+
+    // Pending lines are newer than the document's, so they go only after all of those
+    if (count == lines)
+    {
+        for (; count < excess && !m_pendingLines.isEmpty(); ++count)
+            spillLine(m_pendingLines.takeFirst());
+    }
+}
+
+int IRCView::pageIn()
+{
+    return pageIn(SpillPageSize);
+}
+
+int IRCView::pageIn(int count)
+{
+    if (!hasSpilledLines())
+        return 0;
+
+    QScrollBar* bar = verticalScrollBar();
+    int value = bar->value();
+    int maximum = bar->maximum();
+    int length = document()->characterCount();
+
+    QTextCursor cursor(document());
+    cursor.beginEditBlock();
+
+    IRCViewLine line;
+
+    // Newest first, each one becomes the new first block
+    for (int i = 0; i < count && unspillLine(line); ++i)
+    {
+        cursor.movePosition(QTextCursor::Start);
+
+        if (!document()->isEmpty())
         {
-            timeString = QString(QLatin1String("<font color=\"") + timeColor + QLatin1String("\">[%1]</font> ")).arg(time.toString(timeFormat));
+            cursor.insertBlock(cursor.blockFormat(), cursor.charFormat());
+            cursor.movePosition(QTextCursor::Start);
         }
-        else
+
+        insertRuns(cursor, line);
+    }
+
+    cursor.endEditBlock();
+
+    // keep showing the same lines
+    bar->setValue(value + bar->maximum() - maximum);
+
+    return document()->characterCount() - length;
+}
+
+void IRCView::checkScrolledToTop(int value)
+{
+    if (value == verticalScrollBar()->minimum() && hasSpilledLines())
+        QTimer::singleShot(0, this, SLOT(pageIn()));
+}
+
+IRCViewLine IRCView::lineFromBlock(const QTextBlock& block)
+{
+    IRCViewLine line;
+    line.rtl = (block.blockFormat().alignment() & Qt::AlignRight);
+
+    for (QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it)
+    {
+        QTextFragment fragment = it.fragment();
+
+        if (!fragment.isValid())
+            continue;
+
+        IRCViewLine::Run run;
+        run.text = fragment.text();
+        run.format = fragment.charFormat();
+        run.isHtml = false;
+        line.runs.append(run);
+    }
+
+    return line;
+}
+
+bool IRCView::hasSpilledLines() const
+{
+    return m_spillFile && m_spillFile->size() > 0;
+}
+
+void IRCView::spillLine(const IRCViewLine& line)
+{
+    if (!m_spillFile)
+    {
+        m_spillFile = new KTemporaryFile();
+        m_spillFile->setParent(this);
+
+        if (!m_spillFile->open())
         {
-            QDate date = QDate::currentDate();
-            timeString = QString("<font color=\"" +
-                timeColor + "\">[%1 %2]</font> ")
-                    .arg(KGlobal::locale()->formatDate(date, KLocale::ShortDate),
-                         time.toString(timeFormat));
+            kDebug() << "cannot open a scrollback spill file:" << m_spillFile->errorString();
+            delete m_spillFile;
+            m_spillFile = 0;
+
+            return;
         }
+    }
+
+    QByteArray record;
+    QDataStream recordStream(&record, QIODevice::WriteOnly);
+    recordStream << line;
+
+    m_spillFile->seek(m_spillFile->size());
+    m_spillFile->write(record);
+
+    QDataStream stream(m_spillFile);
+    stream << quint32(record.size());
+
+    m_spillFile->flush();
+}
+
+bool IRCView::unspillLine(IRCViewLine& line)
+{
+    if (!hasSpilledLines())
+        return false;
+
+    qint64 end = m_spillFile->size();
+    bool ok = readSpilledLine(end, line);
+    m_spillFile->resize(end);
+
+    return ok;
+}
+
+bool IRCView::readSpilledLine(qint64& end, IRCViewLine& line) const
+{
+    quint32 length;
+
+    m_spillFile->seek(end - sizeof(quint32));
+    QDataStream stream(m_spillFile);
+    stream >> length;
+
+    end -= sizeof(quint32) + length;
+
+    m_spillFile->seek(end);
+    QByteArray record = m_spillFile->read(length);
+
+    QDataStream recordStream(record);
+    recordStream >> line;
+
+    return recordStream.status() == QDataStream::Ok;
+}
+
+int IRCView::spilledLinesToMatch() const
+{
+    if (!hasSpilledLines())
+        return 0;
+
+    QString pattern = QRegExp::escape(m_pattern);
+
+    if (m_searchFlags & QTextDocument::FindWholeWords)
+        pattern = "\\b" + pattern + "\\b";
+
+    QRegExp needle(pattern, (m_searchFlags & QTextDocument::FindCaseSensitively) ? Qt::CaseSensitive : Qt::CaseInsensitive);
+
+    qint64 end = m_spillFile->size();
+    int count = 0;
+    IRCViewLine line;
+
+    // Newest first, as a backward search goes
+    while (end > 0 && readSpilledLine(end, line))
+    {
+        ++count;
+
+        QString text;
 
-        return timeString;
+        foreach (const IRCViewLine::Run& run, line.runs)
+            text += run.isHtml ? QTextDocumentFragment::fromHtml(run.text).toPlainText() : run.text;
+
+        if (needle.indexIn(text) != -1)
+            return count;
     }
 
-    return QString();
+    return 0;
+}
+
+void IRCView::clear()
+{
+    m_pendingLines.clear();
+
+    if (m_spillFile)
+        m_spillFile->resize(0);
+
+    KTextBrowser::clear();
 }
 
-QString IRCView::createNickLine(const QString& nick, const QString& defaultColor, bool encapsulateNick, bool privMsg)
+void IRCView::trimHiddenView()
+{
+    int keep = Preferences::self()->hiddenScrollbackMax();
+
+    if (!isVisible())
+        pageOut(keep);
+}
+
+void IRCView::addTimeStamp(IRCViewLine& line, const QTextCharFormat& format)
+{
+    if(!Preferences::self()->timestamping())
+        return;
+
+    line.addText(Konversation::timeStamp(), textFormat(colorName(Preferences::Time), false, format.fontFamily()));
+    line.addText(" ", format);
+}
+
+void IRCView::addNick(IRCViewLine& line, const QString& nick, const QTextCharFormat& format, bool encapsulateNick, bool privMsg)
 {
-    QString nickLine = "%2";
     QString nickColor;
 
     if (Preferences::self()->useColoredNicks())
@@ -956,23 +1386,62 @@ QString IRCView::createNickLine(const QString& nick, const QString& defaultColor
         }
     }
     else
-        nickColor = defaultColor;
+        nickColor = format.foreground().color().name();
 
-    nickLine = QLatin1String("<font color=\"") + nickColor + QLatin1String("\">") + nickLine + QLatin1String("</font>");
+    bool bold = Preferences::self()->useBoldNicks();
+    QTextCharFormat markFormat = bold ? textFormat(format.foreground().color().name(), true, format.fontFamily()) : format;
+    QTextCharFormat nickFormat = textFormat(nickColor, bold, format.fontFamily());
 
     if (Preferences::self()->useClickableNicks())
-        nickLine = "<a class=\"nick\" href=\"#" + nick + "\">" + nickLine + "</a>";
+    {
+        nickFormat.setAnchor(true);
+        nickFormat.setAnchorHref('#' + nick);
+    }
+
+    if(encapsulateNick)
+        line.addText(QLatin1String("<"), markFormat);
 
     if (privMsg)
-        nickLine.prepend(QLatin1String("-&gt; "));
+        line.addText(QLatin1String("-> "), markFormat);
+
+    line.addText(nick, nickFormat);
 
     if(encapsulateNick)
-        nickLine = QLatin1String("&lt;") + nickLine + QLatin1String("&gt;");
+        line.addText(QLatin1String(">"), markFormat);
+}
+
+QString IRCView::colorName(int color)
+{
+    QHash<int, QString>::const_iterator it = m_colorNames.constFind(color);
 
-    if(Preferences::self()->useBoldNicks())
-        nickLine = QLatin1String("<b>") + nickLine + QLatin1String("</b>");
+    if (it == m_colorNames.constEnd())
+        it = m_colorNames.insert(color, Preferences::self()->color(color).name());
 
-    return nickLine;
+    return it.value();
+}
+
+QTextCharFormat IRCView::textFormat(const QString& color, bool bold, const QString& family)
+{
+    QString key = color + (bold ? QLatin1Char('b') : QLatin1Char(' ')) + family;
+    QHash<QString, QTextCharFormat>::const_iterator it = m_textFormats.constFind(key);
+
+    if (it != m_textFormats.constEnd())
+        return it.value();
+
+    QTextCharFormat format;
+
+    if (!color.isEmpty())
+        format.setForeground(QColor(color));
+
+    if (bold)
+        format.setFontWeight(QFont::Bold);
+
+    if (!family.isEmpty())
+        format.setFontFamily(family);
+
+    m_textFormats.insert(key, format);
+
+    return format;
 }
 
 void IRCView::replaceDecoration(QString& line, char decoration, char replacement)
@@ -987,27 +1456,60 @@ void IRCView::replaceDecoration(QString& line, char decoration, char replacement
     }
 }
 
-QString IRCView::filter(const QString& line, const QString& defaultColor, const QString& whoSent,
-    bool doHighlight, bool parseURL, bool self, QChar::Direction* direction)
+// Counts the letters with a strong direction, the line takes the majority's
+static inline void countDirection(const QChar& dirChar, unsigned int& ltr_chars, unsigned int& rtl_chars)
 {
-    QString filteredLine(line);
-    Application* konvApp = static_cast<Application*>(kapp);
+    if (!(dirChar.isNumber() || dirChar.isSymbol() ||
+        dirChar.isSpace()  || dirChar.isPunct()  ||
+        dirChar.isMark()))
+    {
+        switch(dirChar.direction())
+        {
+            case QChar::DirL:
+            case QChar::DirLRO:
+            case QChar::DirLRE:
+                ltr_chars++;
+                break;
+            case QChar::DirR:
+            case QChar::DirAL:
+            case QChar::DirRLO:
+            case QChar::DirRLE:
+                rtl_chars++;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// all IRC formatting starts with a control character, most lines have none
+static inline bool hasControlChars(const QString& text)
+{
+    const QChar* data = text.unicode();
+
+    for (int i = 0; i < text.length(); ++i)
+    {
+        if (data[i].unicode() < 0x20)
+            return true;
+    }
+
+    return false;
+}
+
+QChar::Direction IRCView::filter(IRCViewLine& line, const QString& message, const QTextCharFormat& format, const QString& whoSent,
+    bool doHighlight, bool parseURL, bool self)
+{
+    QString filteredLine(message);
 
     //Since we can't turn off whitespace simplification withouteliminating text wrapping,
     //  if the line starts with a space turn it into a non-breaking space.
     //    (which magically turns back into a space on copy)
 
-    if (filteredLine[0] == ' ')
+    if (!filteredLine.isEmpty() && filteredLine[0] == ' ')
     {
         filteredLine[0] = '\xA0';
     }
 
-    // TODO: Use QStyleSheet::escape() here
-    // Replace all < with &lt;
-    filteredLine.replace('<', "\x0blt;");
-    // Replace all > with &gt;
-    filteredLine.replace('>', "\x0bgt;");
-
     if (filteredLine.contains('\x07'))
     {
         if (Preferences::self()->beep())
@@ -1018,7 +1520,90 @@ QString IRCView::filter(const QString& line, const QString& defaultColor, const
         filteredLine.remove('\x07');
     }
 
-    filteredLine = ircTextToHtml(filteredLine,  parseURL, defaultColor, whoSent, true, direction);
+    QString highlightColor = checkHighlights(message, whoSent, doHighlight, self);
+
+    // TODO: Use QStyleSheet::escape() here
+    QString escapedLine(filteredLine);
+    // Replace all < with &lt;
+    escapedLine.replace('<', "\x0blt;");
+    // Replace all > with &gt;
+    escapedLine.replace('>', "\x0bgt;");
+
+    // Lines without IRC formatting, links and emoticons are shown as they are
+    bool plain = !hasControlChars(filteredLine);
+
+    if (plain && parseURL)
+        plain = getUrlRanges(escapedLine).isEmpty() && getChannelRanges(escapedLine).isEmpty();
+
+    if (plain)
+    {
+        unsigned int rtl_chars = 0;
+        unsigned int ltr_chars = 0;
+        QChar lastChar;
+
+        // Keep pairs of spaces like ircTextToHtml() does
+        for (int pos = 0; pos < filteredLine.length(); ++pos)
+        {
+            const QChar dirChar = filteredLine.at(pos);
+
+            if (dirChar == ' ' && lastChar == ' ')
+            {
+                filteredLine[pos] = '\xA0';
+                lastChar = '\xA0';
+            }
+            else
+            {
+                lastChar = dirChar;
+            }
+
+            countDirection(dirChar, ltr_chars, rtl_chars);
+        }
+
+        if (Preferences::self()->enableEmotIcons())
+        {
+            QString htmlLine(filteredLine);
+            htmlLine.replace('&', "&amp;");
+            htmlLine.replace('<', "&lt;");
+            htmlLine.replace('>', "&gt;");
+
+            plain = (Konversation::Emoticons::parseEmoticons(htmlLine) == htmlLine);
+        }
+
+        if (plain)
+        {
+            line.addText(filteredLine, highlightColor.isEmpty() ? format
+                : textFormat(highlightColor, false, format.fontFamily()));
+
+            return (rtl_chars > ltr_chars) ? QChar::DirR : QChar::DirL;
+        }
+    }
+
+    QChar::Direction direction;
+    QString defaultColor = format.foreground().color().name();
+    QString htmlLine = ircTextToHtml(escapedLine, parseURL, defaultColor, whoSent, true, &direction);
+
+    // apply found highlight color to line
+    if (!highlightColor.isEmpty())
+    {
+        htmlLine = QLatin1String("<font color=\"") + highlightColor + QLatin1String("\">") + htmlLine +
+            QLatin1String("</font>");
+    }
+
+    htmlLine = Konversation::Emoticons::parseEmoticons(htmlLine);
+
+    QString fontTag = QLatin1String("<font color=\"") + defaultColor + QLatin1Char('"');
+
+    if (!format.fontFamily().isEmpty())
+        fontTag += QLatin1String(" face=\"") + format.fontFamily() + QLatin1Char('"');
+
+    line.addHtml(fontTag + QLatin1Char('>') + htmlLine + QLatin1String("</font>"));
+
+    return direction;
+}
+
+QString IRCView::checkHighlights(const QString& line, const QString& whoSent, bool doHighlight, bool self)
+{
+    Application* konvApp = static_cast<Application*>(kapp);
 
     // Highlight
     QString ownNick;
@@ -1117,23 +1702,18 @@ QString IRCView::filter(const QString& line, const QString& defaultColor, const
             }
         }
 
-        // apply found highlight color to line
         if (!highlightColor.isEmpty())
-        {
-            filteredLine = QLatin1String("<font color=\"") + highlightColor + QLatin1String("\">") + filteredLine +
-                QLatin1String("</font>");
-        }
+            konvApp->eventDBus()->post("highlight", m_server, m_chatWin->getName(), whoSent, line);
+
+        return highlightColor;
     }
     else if (doHighlight && (whoSent == ownNick) && Preferences::self()->highlightOwnLines())
     {
         // highlight own lines
-        filteredLine = QLatin1String("<font color=\"") + Preferences::self()->highlightOwnLinesColor().name() +
-            QLatin1String("\">") + filteredLine + QLatin1String("</font>");
+        return Preferences::self()->highlightOwnLinesColor().name();
     }
 
-    filteredLine = Konversation::Emoticons::parseEmoticons(filteredLine);
-
-    return filteredLine;
+    return QString();
 }
 
 QString IRCView::ircTextToHtml(const QString& text, bool parseURL, const QString& defaultColor,
@@ -1144,7 +1724,7 @@ QString IRCView::ircTextToHtml(const QString& text, bool parseURL, const QString
     QString htmlText(text);
 
     bool allowColors = Preferences::self()->allowColorCodes();
-    QString linkColor = Preferences::self()->color(Preferences::Hyperlink).name();
+    QString linkColor = colorName(Preferences::Hyperlink);
 
     unsigned int rtl_chars = 0;
     unsigned int ltr_chars = 0;
@@ -1549,27 +2129,7 @@ QString IRCView::ircTextToHtml(const QString& text, bool parseURL, const QString
                         lastChar = dirChar;
                     }
 
-                    if (!(dirChar.isNumber() || dirChar.isSymbol() ||
-                        dirChar.isSpace()  || dirChar.isPunct()  ||
-                        dirChar.isMark()))
-                    {
-                        switch(dirChar.direction())
-                        {
-                            case QChar::DirL:
-                            case QChar::DirLRO:
-                            case QChar::DirLRE:
-                                ltr_chars++;
-                                break;
-                            case QChar::DirR:
-                            case QChar::DirAL:
-                            case QChar::DirRLO:
-                            case QChar::DirRLE:
-                                rtl_chars++;
-                                break;
-                            default:
-                                break;
-                        }
-                    }
+                    countDirection(dirChar, ltr_chars, rtl_chars);
                 }
         }
     }
@@ -1935,6 +2495,22 @@ QString IRCView::getColors(const QString& text, int start, QString& _fgColor, QS
     return ret;
 }
 
+void IRCView::showEvent(QShowEvent* event)
+{
+    KTextBrowser::showEvent(event);
+
+    m_trimTimer->stop();
+    flushPendingLines();
+}
+
+void IRCView::hideEvent(QHideEvent* event)
+{
+    KTextBrowser::hideEvent(event);
+
+    if (Preferences::self()->hiddenScrollbackMax() > 0)
+        m_trimTimer->start();
+}
+
 void IRCView::resizeEvent(QResizeEvent *event)
 {
     ScrollBarPin b(verticalScrollBar());
@@ -19,11 +19,17 @@
 
 #include <QAbstractTextDocumentLayout>
 #include <QFontDatabase>
+#include <QHash>
+#include <QTextCharFormat>
 
 #include <KTextBrowser>
 #include <KUrl>
 
 
+class QTimer;
+
+class KTemporaryFile;
+
 class Server;
 class ChatWindow;
 struct Burr;
@@ -57,6 +63,36 @@ struct TextHtmlData
     QString defaultColor;
 };
 
+/// A line about to be appended to the view, as runs of text sharing a
+/// character format. Plain runs are inserted through QTextCursor as they are,
+/// only message text with IRC formatting, links or emoticons is left as HTML.
+struct IRCViewLine
+{
+    struct Run
+    {
+        QString text;
+        QTextCharFormat format;
+        bool isHtml;
+    };
+
+    IRCViewLine()
+        : rtl(false), collapseSpace(true)
+    {
+    }
+
+    /// Adds plain text, dropping spaces the HTML parser would have collapsed.
+    void addText(const QString& text, const QTextCharFormat& format);
+    /// Adds rich text, which is parsed when the line is inserted.
+    void addHtml(const QString& html);
+    /// Adds all runs of another line.
+    void addLine(const IRCViewLine& other);
+
+    QList<Run> runs;
+    bool rtl;
+    /// The last character added was a space, or nothing was added yet.
+    bool collapseSpace;
+};
+
 class IRCView : public KTextBrowser
 {
     Q_OBJECT
@@ -65,7 +101,8 @@ class IRCView : public KTextBrowser
         explicit IRCView(QWidget* parent);
         ~IRCView();
 
-        //void clear();
+        /// Clears the document and the lines kept for it while hidden.
+        void clear();
         //! Some people apparently want the text in the view to be doublespaced :/
         void enableParagraphSpacing();
 
@@ -188,8 +225,17 @@ class IRCView : public KTextBrowser
         //! FIXME why is this protected, and all alone down there?
         void appendAction(const QString& nick, const QString& message);
 
-        /// Appends a new line without any scrollback or notification checks
-        void doRawAppend(const QString& newLine, bool rtl);
+        /// Appends a new line without any scrollback or notification checks.
+        /// While the view is hidden the line is only kept until it is shown.
+        void doRawAppend(const IRCViewLine& line);
+
+        /// Inserts the lines kept while the view was hidden into the document.
+        void flushPendingLines();
+
+        /// Moves the oldest lines to the spill file until at most limit are
+        /// left in memory. Lines on screen or below stay, and nothing moves
+        /// while the view is scrolled up.
+        void pageOut(int limit);
 
     public slots:
         void appendChannelAction(const QString& nick, const QString& message);
@@ -199,7 +245,7 @@ class IRCView : public KTextBrowser
         void appendBacklogMessage(const QString& firstColumn, const QString& message);
 
     protected:
-        void doAppend(const QString& line, bool rtl, bool self=false);
+        void doAppend(const IRCViewLine& line, bool self=false);
 
     public slots:
         /// Emits the doSeach signal.
@@ -225,7 +271,13 @@ class IRCView : public KTextBrowser
     protected:
         void openLink(const QUrl &url);
 
-        QString filter(const QString& line, const QString& defaultColor, const QString& who=QString(), bool doHighlight=true, bool parseURL=true, bool self=false, QChar::Direction* direction = 0);
+        /// Adds message to line in the given format, as plain text if it has no IRC
+        /// formatting, links or emoticons, else as HTML. Returns its direction.
+        QChar::Direction filter(IRCViewLine& line, const QString& message, const QTextCharFormat& format, const QString& who=QString(), bool doHighlight=true, bool parseURL=true, bool self=false);
+
+        /// Runs the highlight actions for a line and returns the color to show it in,
+        /// or an empty string to keep its own.
+        QString checkHighlights(const QString& line, const QString& who, bool doHighlight, bool self);
 
         void replaceDecoration(QString& line, char decoration, char replacement);
 
@@ -285,7 +337,38 @@ class IRCView : public KTextBrowser
         /// if the values are valid
         inline QString getColors(const QString& text, int start, QString& _fgColor, QString& _bgColor, bool* invalidFgVal, bool* invalidBgValue);
 
+    private slots:
+        /// Pages out all but the last lines of a view that stayed hidden for a while.
+        void trimHiddenView();
+
+        /// Pages in older lines once the view is scrolled to the top.
+        void checkScrolledToTop(int value);
+
+        /// Inserts a page of lines from the spill file at the start of the
+        /// document. Returns the length of the inserted text.
+        int pageIn();
+
+    private:
+        /// Like pageIn(), for up to count lines.
+        int pageIn(int count);
+
+        void insertLine(QTextCursor& cursor, const IRCViewLine& line);
+        void insertRuns(QTextCursor& cursor, const IRCViewLine& line);
+
+        static IRCViewLine lineFromBlock(const QTextBlock& block);
+
+        bool hasSpilledLines() const;
+        void spillLine(const IRCViewLine& line);
+        bool unspillLine(IRCViewLine& line);
+        /// Reads the spilled line whose record ends at end, and moves end to its start.
+        bool readSpilledLine(qint64& end, IRCViewLine& line) const;
+        /// How many of the newest spilled lines to page in for the newest one
+        /// matching the search pattern, 0 if none does.
+        int spilledLinesToMatch() const;
+
     protected:
+        virtual void showEvent(QShowEvent* event);
+        virtual void hideEvent(QHideEvent* event);
         virtual void resizeEvent(QResizeEvent *event);
         virtual void mouseReleaseEvent(QMouseEvent* ev);
         virtual void mousePressEvent(QMouseEvent* ev);
@@ -295,14 +378,20 @@ class IRCView : public KTextBrowser
 
         QChar::Direction basicDirection(const QString &string);
 
-        /// Returns a formated timestamp if timestamps are enabled else it returns QString::null
-        QString timeStamp();
+        /// Adds the timestamp followed by a space in format to line, if timestamps are enabled
+        void addTimeStamp(IRCViewLine& line, const QTextCharFormat& format);
 
-        /// Returns a formated nick string
-        //! FIXME formatted in what way?
-        QString createNickLine(const QString& nick, const QString& defaultColor,
+        /// Adds the nick, colored, bold and clickable as configured, to line
+        void addNick(IRCViewLine& line, const QString& nick, const QTextCharFormat& format,
             bool encapsulateNick = true, bool privMsg = false);
 
+        /// Returns the character format for text in color, cached as all lines
+        /// use a handful of them
+        QTextCharFormat textFormat(const QString& color, bool bold = false, const QString& family = QString());
+
+        /// Returns the name of a Preferences color, cached until the appearance changes
+        QString colorName(int color);
+
         //// Search
         QTextDocument::FindFlags m_searchFlags;
         bool m_forward;
@@ -311,6 +400,17 @@ class IRCView : public KTextBrowser
         //used in ::filter
         QColor m_highlightColor;
 
+        QHash<QString, QTextCharFormat> m_textFormats;
+        QHash<int, QString> m_colorNames;
+
+        /// Lines appended while hidden, newer than all of the document's.
+        QList<IRCViewLine> m_pendingLines;
+        QTimer* m_trimTimer;
+
+        /// Lines paged out of the document, the newest at the end. Each record
+        /// is followed by its length so the file can be read back to front.
+        KTemporaryFile* m_spillFile;
+
         QString m_lastStatusText; //last sent status text to the statusbar. Is empty after clearStatusBarTempText()
 
         //used in ::filter
@@ -33,12 +33,13 @@
 #include <KJobUiDelegate>
 
 
-LogfileReader::LogfileReader(QWidget* parent, const QString& log, const QString& caption) : ChatWindow(parent)
+LogfileReader::LogfileReader(QWidget* parent, const QString& log, const QString& caption, qint64 position) : ChatWindow(parent)
 {
     setType(ChatWindow::LogFileReader);
     setName(i18n("Logfile of %1", caption));
 
     fileName = log;
+    hitPosition = position;
 
     setSpacing(0);
 
@@ -117,8 +118,19 @@ void LogfileReader::updateView()
         stream.setCodec(QTextCodec::codecForName("UTF-8"));
         stream.setAutoDetectUnicode(true);
 
+        QString hitLine;
+
+        if(hitPosition >= 0)
+        {
+            // Read the line to show before the stream buffers the file
+            if(file.seek(hitPosition))
+                hitLine = QString::fromUtf8(file.readLine()).section('\t', -1).simplified();
+
+            // Show <pos> bytes around it
+            stream.seek(qMax(Q_INT64_C(0), hitPosition - pos / 2));
+        }
         // Set file pointer to <pos> bytes from the end
-        if(stream.device()->size() > pos)
+        else if(stream.device()->size() > pos)
         {
             stream.device()->seek(stream.device()->size() - pos);
         }
@@ -127,15 +139,20 @@ void LogfileReader::updateView()
         //       first line is just a '\n', so it's ok
         stream.readLine();
         QString str;
+        qint64 read = 0;
 
-        while(!stream.atEnd())
+        while(!stream.atEnd() && (hitPosition < 0 || read < pos))
         {
-            str = Qt::escape(stream.readLine());
-            getTextView()->appendLog(str);
+            str = stream.readLine();
+            read += str.toUtf8().size() + 1;
+            getTextView()->appendLog(Qt::escape(str));
         }
 
         stream.setDevice(0);
         file.close();
+
+        if(!hitLine.isEmpty())
+            getTextView()->search(hitLine, false, false, true, false);
     }
 }
 
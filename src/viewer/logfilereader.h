@@ -29,7 +29,8 @@ class LogfileReader : public ChatWindow
     Q_OBJECT
 
         public:
-        LogfileReader(QWidget* parent, const QString& log, const QString& caption);
+        /// @param position Offset of a line to show instead of the end of the log.
+        LogfileReader(QWidget* parent, const QString& log, const QString& caption, qint64 position = -1);
         ~LogfileReader();
 
         using ChatWindow::closeYourself;
@@ -58,5 +59,6 @@ class LogfileReader : public ChatWindow
         KToolBar* toolBar;
         QSpinBox* sizeSpin;
         QString fileName;
+        qint64 hitPosition;
 };
 #endif
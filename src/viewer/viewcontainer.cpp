@@ -22,6 +22,7 @@
 #include "logfilereader.h"
 #include "konsolepanel.h"
 #include "urlcatcher.h"
+#include "logsearchpanel.h"
 #include "transferpanel.h"
 #include "transfermanager.h"
 #include "chatcontainer.h"
@@ -40,6 +41,7 @@
 
 #include <QSplitter>
 #include <QTabBar>
+#include <QTimer>
 
 #include <KInputDialog>
 #include <KMessageBox>
@@ -53,6 +55,9 @@
 
 using namespace Konversation;
 
+// notifications arriving within one frame cause only one tab update
+static const int NotificationInterval = 16;
+
 TabWidget::TabWidget(QWidget* parent) : KTabWidget(parent)
 {
 }
@@ -68,12 +73,18 @@ ViewContainer::ViewContainer(MainWindow* window):
         , m_vbox(0)
         , m_queueTuner(0)
         , m_urlCatcherPanel(0)
+        , m_logSearchPanel(0)
         , m_nicksOnlinePanel(0)
         , m_insertCharDialog(0)
         , m_queryViewCount(0)
 {
     m_viewSpringLoader = new ViewSpringLoader(this);
 
+    m_notificationTimer = new QTimer(this);
+    m_notificationTimer->setSingleShot(true);
+    m_notificationTimer->setInterval(NotificationInterval);
+    connect(m_notificationTimer, SIGNAL(timeout()), this, SLOT(flushViewNotifications()));
+
     images = Application::instance()->images();
 
     m_viewTreeSplitter = new QSplitter(m_window);
@@ -863,7 +874,11 @@ void ViewContainer::updateViews(const Konversation::ServerGroupSettingsPtr serve
             else if (view==m_tabWidget->currentWidget())
                 unsetViewNotification(view);
             else
-                setViewNotification(view, view->currentTabNotification());
+            {
+                // colors or LEDs might have changed, show it again
+                applyViewNotification(view, view->currentTabNotification());
+                m_shownNotifications.insert(view, view->currentTabNotification());
+            }
         }
     }
 }
@@ -889,12 +904,62 @@ void ViewContainer::setViewNotification(ChatWindow* view, const Konversation::Ta
     if (!view || view == m_tabWidget->currentWidget())
         return;
 
-    if (type < Konversation::tnfControl && !m_activeViewOrderList.contains(view))
+    if (type < Konversation::tnfControl && !m_activeViews.contains(view))
+    {
+        m_activeViews.insert(view);
         m_activeViewOrderList.append(view);
+    }
 
     if (!Preferences::self()->tabNotificationsLeds() && !Preferences::self()->self()->tabNotificationsText())
         return;
 
+    // Lines usually come in bursts, show only the most important
+    // notification of each view once the burst is over
+    QHash<ChatWindow*, Konversation::TabNotifyType>::iterator it = m_pendingNotifications.find(view);
+
+    if (it == m_pendingNotifications.end())
+        m_pendingNotifications.insert(view, type);
+    else if (type < it.value())
+        it.value() = type;
+
+    if (!m_notificationTimer->isActive())
+        m_notificationTimer->start();
+}
+
+void ViewContainer::flushViewNotifications()
+{
+    if (!m_tabWidget)
+    {
+        m_pendingNotifications.clear();
+
+        return;
+    }
+
+    QHash<ChatWindow*, Konversation::TabNotifyType> pending;
+    pending.swap(m_pendingNotifications);
+
+    QHash<ChatWindow*, Konversation::TabNotifyType>::const_iterator it;
+
+    for (it = pending.constBegin(); it != pending.constEnd(); ++it)
+    {
+        ChatWindow* view = it.key();
+
+        if (view == m_tabWidget->currentWidget())
+            continue;
+
+        // nothing changed since the last line in this view
+        QHash<ChatWindow*, Konversation::TabNotifyType>::const_iterator shown = m_shownNotifications.constFind(view);
+
+        if (shown != m_shownNotifications.constEnd() && shown.value() == it.value())
+            continue;
+
+        applyViewNotification(view, it.value());
+        m_shownNotifications.insert(view, it.value());
+    }
+}
+
+void ViewContainer::applyViewNotification(ChatWindow* view, Konversation::TabNotifyType type)
+{
     if (m_viewTree)
     {
         switch (type)
@@ -959,7 +1024,7 @@ void ViewContainer::setViewNotification(ChatWindow* view, const Konversation::Ta
                 }
                 else
                 {
-                    setViewNotification(view,Konversation::tnfNormal);
+                    applyViewNotification(view,Konversation::tnfNormal);
                 }
                 break;
 
@@ -983,7 +1048,7 @@ void ViewContainer::setViewNotification(ChatWindow* view, const Konversation::Ta
                 }
                 else
                 {
-                    setViewNotification(view,Konversation::tnfNormal);
+                    applyViewNotification(view,Konversation::tnfNormal);
                 }
                 break;
 
@@ -1056,7 +1121,7 @@ void ViewContainer::setViewNotification(ChatWindow* view, const Konversation::Ta
                 }
                 else
                 {
-                    setViewNotification(view,Konversation::tnfNormal);
+                    applyViewNotification(view,Konversation::tnfNormal);
                 }
                 break;
 
@@ -1080,7 +1145,7 @@ void ViewContainer::setViewNotification(ChatWindow* view, const Konversation::Ta
                 }
                 else
                 {
-                    setViewNotification(view,Konversation::tnfNormal);
+                    applyViewNotification(view,Konversation::tnfNormal);
                 }
                 break;
 
@@ -1179,7 +1244,16 @@ void ViewContainer::unsetViewNotification(ChatWindow* view)
         m_tabWidget->setTabTextColor(idx, textColor);
     }
 
-    m_activeViewOrderList.removeAll(view);
+    m_pendingNotifications.remove(view);
+    m_shownNotifications.remove(view);
+
+    removeActiveView(view);
+}
+
+void ViewContainer::removeActiveView(ChatWindow* view)
+{
+    if (m_activeViews.remove(view))
+        m_activeViewOrderList.removeOne(view);
 }
 
 void ViewContainer::toggleViewNotifications()
@@ -1663,6 +1737,9 @@ void ViewContainer::closeView(ChatWindow* view)
             case ChatWindow::UrlCatcher:
                 closeUrlCatcher();
                 break;
+            case ChatWindow::LogSearch:
+                closeLogSearch();
+                break;
             case ChatWindow::NicksOnline:
                 closeNicksOnlinePanel();
                 break;
@@ -1700,7 +1777,10 @@ void ViewContainer::cleanupAfterClose(ChatWindow* view)
     }
 
     // Remove the view from the active view list if it's still on it
-    m_activeViewOrderList.removeAll(view);
+    removeActiveView(view);
+
+    m_pendingNotifications.remove(view);
+    m_shownNotifications.remove(view);
 
     if (view->getType() == ChatWindow::Query)
         --m_queryViewCount;
@@ -2187,7 +2267,7 @@ void ViewContainer::openLogFile()
     }
 }
 
-void ViewContainer::openLogFile(const QString& caption, const QString& file)
+void ViewContainer::openLogFile(const QString& caption, const QString& file, qint64 position)
 {
     if (!file.isEmpty())
     {
@@ -2197,7 +2277,7 @@ void ViewContainer::openLogFile(const QString& caption, const QString& file)
         }
         else
         {
-            LogfileReader* logReader = new LogfileReader(m_tabWidget, file, caption);
+            LogfileReader* logReader = new LogfileReader(m_tabWidget, file, caption, position);
             addView(logReader, logReader->getName());
 
             logReader->setServer(0);
@@ -2238,6 +2318,30 @@ void ViewContainer::closeUrlCatcher()
     }
 }
 
+void ViewContainer::addLogSearch()
+{
+    if (m_logSearchPanel == 0)
+    {
+        m_logSearchPanel = new LogSearchPanel(m_tabWidget);
+        addView(m_logSearchPanel, i18n("Log Search"));
+
+        (dynamic_cast<KToggleAction*>(actionCollection()->action("open_log_search")))->setChecked(true);
+    }
+    else
+        closeLogSearch();
+}
+
+void ViewContainer::closeLogSearch()
+{
+    if (m_logSearchPanel)
+    {
+        delete m_logSearchPanel;
+        m_logSearchPanel = 0;
+
+        (dynamic_cast<KToggleAction*>(actionCollection()->action("open_log_search")))->setChecked(false);
+    }
+}
+
 void ViewContainer::toggleDccPanel()
 {
     if (m_dccPanel==0 || !m_dccPanelOpen)
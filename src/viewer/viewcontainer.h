@@ -16,11 +16,15 @@
 #include "common.h"
 #include "server.h"
 
+#include <QHash>
+#include <QSet>
+
 #include <KTabWidget>
 
 
 class QSplitter;
 class QTabBar;
+class QTimer;
 
 class KActionCollection;
 class KVBox;
@@ -31,6 +35,7 @@ class ChatWindow;
 class Server;
 class Images;
 class UrlCatcher;
+class LogSearchPanel;
 class NicksOnline;
 class QueueTuner;
 class ViewSpringLoader;
@@ -146,13 +151,16 @@ class ViewContainer : public QObject
         void insertRememberLines(Server* server);
 
         void openLogFile();
-        void openLogFile(const QString& caption, const QString& file);
+        void openLogFile(const QString& caption, const QString& file, qint64 position = -1);
 
         void addKonsolePanel();
 
         void addUrlCatcher();
         void closeUrlCatcher();
 
+        void addLogSearch();
+        void closeLogSearch();
+
         void toggleDccPanel();
         void addDccPanel();
         void closeDccPanel();
@@ -209,6 +217,7 @@ class ViewContainer : public QObject
     private slots:
         void setupIrcContextMenus();
         void viewSwitched(int newIndex);
+        void flushViewNotifications();
 
     private:
         void setupTabWidget();
@@ -221,6 +230,9 @@ class ViewContainer : public QObject
         void updateViewActions(int index);
         void updateFrontView();
 
+        void applyViewNotification(ChatWindow* view, Konversation::TabNotifyType type);
+        void removeActiveView(ChatWindow* view);
+
         void setFrontServer(Server *);
 
         void initializeSplitterSizes();
@@ -245,6 +257,7 @@ class ViewContainer : public QObject
         QPointer<ChatWindow> m_lastFocusedView;
 
         UrlCatcher* m_urlCatcherPanel;
+        LogSearchPanel* m_logSearchPanel;
         NicksOnline* m_nicksOnlinePanel;
 
         Konversation::DCC::TransferPanel* m_dccPanel;
@@ -255,7 +268,16 @@ class ViewContainer : public QObject
         int m_popupViewIndex;
         int m_queryViewCount;
 
+        /// Views with unseen activity in the order it happened, the set
+        /// answers membership tests for the list.
         QList<ChatWindow*> m_activeViewOrderList;
+        QSet<ChatWindow*> m_activeViews;
+
+        /// Notifications since the last flush, the most important per view
+        QHash<ChatWindow*, Konversation::TabNotifyType> m_pendingNotifications;
+        /// What the tab or tree currently shows for a view
+        QHash<ChatWindow*, Konversation::TabNotifyType> m_shownNotifications;
+        QTimer* m_notificationTimer;
 
         ViewSpringLoader* m_viewSpringLoader;
 };
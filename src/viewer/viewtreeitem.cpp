@@ -184,6 +184,10 @@ QColor ViewTreeItem::getColor() const
 
 void ViewTreeItem::setIcon(const QPixmap& pm)
 {
+    // the LEDs are cached, setting the same one again would only repaint
+    if (pm.cacheKey() == m_oldPixmap.cacheKey())
+        return;
+
     m_oldPixmap = pm;
     if (!m_closeButtonShown) setPixmap(0, pm);
 }